@@ -1,6 +0,0 @@
-#ifndef _CRC_H_
-#define _CRC_H_
-
-u32 crc32c(const u8 *data, bytes len);
-
-#endif
@@ -1,5 +1,5 @@
 #include <kernel.h>
-#include <crc.h>
+#include <crc32c.h>
 #include <http.h>
 #include <lwip.h>
 #include <pagecache.h>
@@ -358,7 +358,7 @@ static void do_metrics_commit(buffer b)
     snappy_chunk_hdr[1] = chunk_len;
     snappy_chunk_hdr[2] = chunk_len >> 8;
     snappy_chunk_hdr[3] = chunk_len >> 16;
-    u32 checksum = crc32c(snappy_chunk_hdr + SNAPPY_CHUNK_HDR_LEN + SNAPPY_CHUNK_CRC_LEN,
+    u32 checksum = crc32c(0, snappy_chunk_hdr + SNAPPY_CHUNK_HDR_LEN + SNAPPY_CHUNK_CRC_LEN,
                           chunk_len - SNAPPY_CHUNK_CRC_LEN);
     u32 *snappy_chunk_crc = (u32 *)(snappy_chunk_hdr + SNAPPY_CHUNK_HDR_LEN);
     *snappy_chunk_crc = ((checksum >> 15) | (checksum << 17)) + 0xa282ead8;
@@ -0,0 +1,131 @@
+/* Network emulator: drops and delays packets received on the loopback interface, so that loss
+ * recovery and congestion control can be exercised without an external network.
+ * Configuration (in the root tuple):
+ *   netem:(loss:<percentage of dropped packets> delay:<milliseconds>)
+ */
+
+#include <kernel.h>
+#include <lwip.h>
+
+//#define NETEM_DEBUG
+#ifdef NETEM_DEBUG
+#define netem_debug(x, ...) do {rprintf("NETEM: " x, ##__VA_ARGS__);} while(0)
+#else
+#define netem_debug(x, ...)
+#endif
+
+typedef struct netem_pkt {
+    struct list l;
+    struct pbuf *p;
+    struct netif *inp;
+    timestamp due;
+} *netem_pkt;
+
+static struct netem {
+    heap h;
+    u64 loss;
+    timestamp delay;
+    struct spinlock lock;
+    struct list queue;
+    struct timer timer;
+    boolean timer_armed;
+    closure_struct(timer_handler, timer_handler);
+    struct pbuf *reinject;  /* delayed packet being passed to the interface */
+    int (*next_filter)(struct pbuf *pbuf, struct netif *input_netif);
+} netem;
+
+/* must be called with lock held */
+static void netem_arm_timer(timestamp t)
+{
+    netem_pkt pkt = struct_from_list(list_get_next(&netem.queue), netem_pkt, l);
+    register_timer(kernel_timers, &netem.timer, CLOCK_ID_MONOTONIC,
+                   (pkt->due > t) ? (pkt->due - t) : 0, false, 0,
+                   (timer_handler)&netem.timer_handler);
+    netem.timer_armed = true;
+}
+
+static int netem_filter(struct pbuf *p, struct netif *inp)
+{
+    if (!netif_is_loopback(inp) || (p == netem.reinject))
+        goto pass;
+    if (netem.loss && (random_u64() % 100 < netem.loss)) {
+        netem_debug("dropping packet %p\n", p);
+        pbuf_free(p);
+        return 0;
+    }
+    if (netem.delay) {
+        netem_pkt pkt = allocate(netem.h, sizeof(*pkt));
+        if (pkt == INVALID_ADDRESS)
+            goto pass;
+        pkt->p = p;
+        pkt->inp = inp;
+        timestamp t = now(CLOCK_ID_MONOTONIC);
+        pkt->due = t + netem.delay;
+        spin_lock(&netem.lock);
+        list_push_back(&netem.queue, &pkt->l);
+        if (!netem.timer_armed)
+            netem_arm_timer(t);
+        spin_unlock(&netem.lock);
+        return 0;
+    }
+  pass:
+    return netem.next_filter ? netem.next_filter(p, inp) : 1;
+}
+
+closure_func_basic(timer_handler, void, netem_timer_func,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    spin_lock(&netem.lock);
+    netem.timer_armed = false;
+    list e;
+    while ((e = list_get_next(&netem.queue))) {
+        netem_pkt pkt = struct_from_list(e, netem_pkt, l);
+        timestamp t = now(CLOCK_ID_MONOTONIC);
+        if (pkt->due > t) {
+            if (!netem.timer_armed)
+                netem_arm_timer(t);
+            break;
+        }
+        list_delete(e);
+        spin_unlock(&netem.lock);
+
+        /* packets are re-injected one at a time, so the filter can recognize them */
+        netem.reinject = pkt->p;
+        if (pkt->inp->input(pkt->p, pkt->inp) != ERR_OK)
+            pbuf_free(pkt->p);
+        netem.reinject = 0;
+        deallocate(netem.h, pkt, sizeof(*pkt));
+        spin_lock(&netem.lock);
+    }
+    spin_unlock(&netem.lock);
+}
+
+int init(status_handler complete)
+{
+    tuple config = get(get_root_tuple(), sym(netem));
+    if (!config)
+        return KLIB_INIT_OK;
+    if (!is_tuple(config)) {
+        rprintf("invalid netem configuration\n");
+        return KLIB_INIT_FAILED;
+    }
+    u64 delay;
+    if (get_u64(config, sym(loss), &netem.loss) && (netem.loss > 100)) {
+        rprintf("netem: invalid loss percentage %ld\n", netem.loss);
+        return KLIB_INIT_FAILED;
+    }
+    if (get_u64(config, sym(delay), &delay))
+        netem.delay = milliseconds(delay);
+    if (!netem.loss && !netem.delay)
+        return KLIB_INIT_OK;
+    netem.h = heap_locked(get_kernel_heaps());
+    spin_lock_init(&netem.lock);
+    list_init(&netem.queue);
+    init_timer(&netem.timer);
+    init_closure_func(&netem.timer_handler, timer_handler, netem_timer_func);
+    netem.next_filter = net_ip_input_filter;
+    net_ip_input_filter = netem_filter;
+    return KLIB_INIT_OK;
+}
@@ -55,6 +55,47 @@
 /* Log compaction is not triggered if the ratio between total entries and
  * obsolete entries is above the constant below. */
 #define TFS_LOG_COMPACT_RATIO   2
+/* Number of log entries written since the last checkpoint that triggers a log compaction, so that
+ * the log contains a recent checkpoint of the directory tree. */
+#define TFS_LOG_CHECKPOINT_ENTRIES  65536
+/* Minimum number of entries in a directory for the directory to be checkpointed in deferred form,
+ * i.e. loaded on first lookup instead of at mount time. */
+#define TFS_DEFERRED_DIR_ENTRIES    16
+/* Maximum amount of file data stored in a compressed extent; a read of any part of a compressed
+ * extent reads and decompresses the whole extent. */
+#define TFS_COMPRESSED_EXTENT_SIZE  (128 * KB)
+/* Number of compressed extents whose decompressed data is kept in memory */
+#define TFS_COMPRESSED_CACHE_EXTENTS    16
+/* Bounds of the storage speculatively preallocated past the end of a file that grows by appending;
+ * within these bounds, the amount of preallocated storage is equal to the file size. */
+#define TFS_PREALLOC_MIN    (64 * KB)
+#define TFS_PREALLOC_MAX    (8 * MB)
+/* Online defragmentation copies file data through a buffer of TFS_DEFRAG_BUFFER_SIZE bytes, and
+ * relocates at most TFS_DEFRAG_JOB_SIZE bytes of a file with each update of the file extents. In
+ * the background, data is relocated at most at TFS_DEFRAG_RATE bytes per second, with a pass over
+ * all files every TFS_DEFRAG_PASS_SECONDS; while foreground I/O exceeds TFS_DEFRAG_IDLE_IO_RATE
+ * bytes per second, the delay between jobs backs off exponentially from TFS_DEFRAG_BACKOFF_MS up to
+ * TFS_DEFRAG_BACKOFF_MAX_SECONDS. */
+#define TFS_DEFRAG_BUFFER_SIZE  (1 * MB)
+#define TFS_DEFRAG_JOB_SIZE     (32 * MB)
+#define TFS_DEFRAG_RATE         (16 * MB)
+#define TFS_DEFRAG_PASS_SECONDS 60
+#define TFS_DEFRAG_IDLE_IO_RATE (1 * MB)
+#define TFS_DEFRAG_BACKOFF_MS   100
+#define TFS_DEFRAG_BACKOFF_MAX_SECONDS  10
+/* Freed storage is discarded in batches issued TFS_DISCARD_DELAY_SECONDS after the first block of
+ * a batch is freed (if online discard is enabled); a trim request discards free storage in rounds
+ * of at most TFS_TRIM_BATCH_SIZE bytes. */
+#define TFS_DISCARD_DELAY_SECONDS   2
+#define TFS_TRIM_BATCH_SIZE         (1 * GB)
+/* Checksums of file data are stored in groups of TFS_CHECKSUM_GROUP_BLOCKS block checksums, each
+ * group being logged as a whole when any of its checksums changes. The background scrub verifies
+ * file data through a buffer of TFS_SCRUB_BUFFER_SIZE bytes, reading at most TFS_SCRUB_RATE bytes
+ * per second, with a pass over all files every TFS_SCRUB_PASS_SECONDS. */
+#define TFS_CHECKSUM_GROUP_BLOCKS   64
+#define TFS_SCRUB_BUFFER_SIZE       (256 * KB)
+#define TFS_SCRUB_RATE              (4 * MB)
+#define TFS_SCRUB_PASS_SECONDS      (60 * 60)
 
 /* Xen stuff */
 #define XENNET_INIT_RX_BUFFERS_FACTOR 4
@@ -71,6 +112,18 @@
 #define LOW_MEMORY_THRESHOLD   (64 * MB)
 #define SG_FRAG_BYTE_THRESHOLD (128*KB)
 #define PAGECACHE_MAX_SG_ENTRIES    8192
+#define PAGECACHE_LRU_BATCH         15  /* per-CPU pending LRU updates */
+#define PAGECACHE_DIRTY_BACKGROUND_PERCENT  10  /* of physical memory: start background writeback */
+#define PAGECACHE_DIRTY_LIMIT_PERCENT       20  /* of physical memory: writers wait for writeback */
+#define PAGECACHE_DIRTY_MAX_PAUSE_MS        200
+#define PAGECACHE_WRITE_BW_DEFAULT  (32 * MB)   /* bytes/s, until writeback bandwidth is measured */
+#define THP_COLLAPSE_PERIOD_SECONDS 10
+#define THP_COLLAPSE_SCAN_RANGES    16  /* 2MB ranges scanned per period */
+#define THP_COLLAPSE_MIN_PAGES      256 /* populated small pages needed to collapse a 2MB range */
+#define THP_COMPACT_BLOCKS          4   /* 2MB physical blocks rebuilt per compaction run */
+#define THP_COMPACT_DEFER_SECONDS   5   /* after a compaction run that rebuilt no blocks */
+#define MMAP_LAZYFREE_MAX_RANGES    4096        /* MADV_FREE ranges kept for deferred freeing */
+#define MMAP_LAZYFREE_SCAN_MAX      (64 * MB)   /* address space scanned per lazyfree cleaner call */
 
 /* don't go below this minimum amount of physical memory when inflating balloon */
 #define BALLOON_MEMORY_MINIMUM (16 * MB)
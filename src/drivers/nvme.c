@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <errno.h>
 #include <pci.h>
 #include <storage.h>
 
@@ -52,6 +53,7 @@
 #define NVME_PHASE_TAG(dw3)     (((dw3) >> 16) & 0x1)
 #define NVME_CMD_ID(dw3)        ((dw3) & 0xFFFF)
 #define NVME_SC_OK  0
+#define NVME_SC_INVALID_OPCODE  0x01
 
 /* Admin command set opcodes */
 #define NVME_OPC_DEL_IOSQ   0x00
@@ -99,6 +101,12 @@
 #define NVME_OPC_RSV_ACQ    0x11
 #define NVME_OPC_RSV_REL    0x15
 
+/* Dataset Management command */
+#define NVME_DSM_AD         (1 << 2)    /* attribute - deallocate */
+#define NVME_DSM_NLB_MAX    U32_MAX     /* number of logical blocks in a range */
+
+#define NVME_WRITE_Z_NLB_MAX    0x10000
+
 #define NVME_ASQ_ORDER  1
 #define NVME_ACQ_ORDER  1
 
@@ -164,12 +172,23 @@ typedef struct nvme_cq {
     boolean phase;
 } *nvme_cq;
 
+/* Dataset Management range */
+struct nvme_dsm_range {
+    u32 cattr;  /* context attributes */
+    u32 nlb;    /* number of logical blocks */
+    u64 slba;   /* starting LBA */
+} __attribute__((packed));
+
 closure_type(nvme_ac_handler, void, struct nvme_cqe *cqe);
 
 declare_closure_struct(3, 3, void, nvme_io,
                        struct nvme *, n, u32, namespace, boolean, write,
                        void *buf, range blocks, status_handler sh);
 
+declare_closure_struct(2, 1, void, nvme_req_handler,
+                       struct nvme *, n, u32, namespace,
+                       storage_req req);
+
 typedef struct nvme {
     heap general, contiguous;
     pci_dev d;
@@ -191,14 +210,15 @@ typedef struct nvme {
     closure_struct(thunk, bh_service);
     closure_struct(nvme_io, r);
     closure_struct(nvme_io, w);
-    closure_struct(storage_simple_req_handler, req_handler);
+    closure_struct(storage_simple_req_handler, rw_handler);
+    closure_struct(nvme_req_handler, req_handler);
     struct spinlock lock;
 } *nvme;
 
 typedef struct nvme_ioreq {
     struct list l;
     u32 namespace;
-    boolean write;
+    u8 opcode;
     void *buf;
     range blocks;
     u64 pending_cmds;
@@ -207,6 +227,7 @@ typedef struct nvme_ioreq {
 } *nvme_ioreq;
 
 typedef struct nvme_iocmd {
+    struct nvme_dsm_range dsm;  /* data of Dataset Management commands */
     struct list l;
     u16 id;
     nvme_ioreq req;
@@ -345,26 +366,47 @@ static void nvme_service_pending(nvme n, boolean allocate)
         }
         new_reqs = true;
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
-        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP |
-                (req->write ? NVME_OPC_WRITE : NVME_OPC_READ);
+        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP | req->opcode;
         sqe->nsid = req->namespace;
-        u64 buf_start = physical_from_virtual(req->buf);
         u64 nlb = range_span(req->blocks);
-        u64 buf_end = buf_start + nlb * SECTOR_SIZE;
-        sqe->dptr.prp1 = buf_start;
-        if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
-            sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
-            if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
-                nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
-                req->buf += nlb * SECTOR_SIZE;
+        switch (req->opcode) {
+        case NVME_OPC_DS_MGMT:
+            nlb = MIN(nlb, NVME_DSM_NLB_MAX);
+            cmd->dsm.cattr = 0;
+            cmd->dsm.nlb = nlb;
+            cmd->dsm.slba = req->blocks.start;
+            sqe->dptr.prp1 = physical_from_virtual(&cmd->dsm);
+            sqe->cdw10 = 0; /* number of ranges, 0's based */
+            sqe->cdw11 = NVME_DSM_AD;
+            sqe->cdw12 = 0;
+            break;
+        case NVME_OPC_WRITE_Z:
+            nlb = MIN(nlb, NVME_WRITE_Z_NLB_MAX);
+            sqe->dptr.prp1 = 0;
+            sqe->cdw10 = req->blocks.start;
+            sqe->cdw11 = req->blocks.start >> 32;
+            sqe->cdw12 = nlb - 1;
+            break;
+        default: {
+            u64 buf_start = physical_from_virtual(req->buf);
+            u64 buf_end = buf_start + nlb * SECTOR_SIZE;
+            sqe->dptr.prp1 = buf_start;
+            if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
+                sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
+                if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
+                    nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
+                    req->buf += nlb * SECTOR_SIZE;
+                }
             }
+            sqe->cdw10 = req->blocks.start;
+            sqe->cdw11 = req->blocks.start >> 32;
+            sqe->cdw12 = nlb - 1;
+        }
         }
         if (nlb == range_span(req->blocks))
             list_delete(l);
-        nvme_debug("request sectors [0x%x, 0x%x), cmd ID 0x%0x",
+        nvme_debug("request opcode 0x%x, sectors [0x%x, 0x%x), cmd ID 0x%0x", req->opcode,
                    req->blocks.start, req->blocks.start + nlb, cmd->id);
-        sqe->cdw10 = req->blocks.start;
-        sqe->cdw12 = nlb - 1;
         cmd->req = req;
         req->pending_cmds++;
         req->blocks.start += nlb;
@@ -374,21 +416,17 @@ static void nvme_service_pending(nvme n, boolean allocate)
         nvme_sq_doorbell(n, NVME_IOQ_IDX, &n->iosq);
 }
 
-define_closure_function(3, 3, void, nvme_io,
-                        nvme, n, u32, namespace, boolean, write,
-                        void *buf, range blocks, status_handler sh)
+static void nvme_submit(nvme n, u32 namespace, u8 opcode, void *buf, range blocks,
+                        status_handler sh)
 {
-    nvme n = bound(n);
-    u32 namespace = bound(namespace);
-    boolean write = bound(write);
-    nvme_debug("[%d] %c %R", namespace, write ? 'w' : 'r', blocks);
+    nvme_debug("[%d] opcode 0x%x %R", namespace, opcode, blocks);
     nvme_ioreq req = nvme_get_ioreq(n);
     if (req == INVALID_ADDRESS) {
         apply(sh, timm("result", "request allocation failed"));
         return;
     }
     req->namespace = namespace;
-    req->write = write;
+    req->opcode = opcode;
     req->buf = buf;
     req->blocks = blocks;
     req->pending_cmds = 0;
@@ -400,6 +438,36 @@ define_closure_function(3, 3, void, nvme_io,
     spin_unlock_irq(&n->lock, irqflags);
 }
 
+define_closure_function(3, 3, void, nvme_io,
+                        nvme, n, u32, namespace, boolean, write,
+                        void *buf, range blocks, status_handler sh)
+{
+    nvme_submit(bound(n), bound(namespace), bound(write) ? NVME_OPC_WRITE : NVME_OPC_READ, buf,
+                blocks, sh);
+}
+
+/* Discard and write zeroes requests are served directly, the others by the simple request
+ * handler. Support for the corresponding commands is optional: a controller that does not
+ * implement them fails the commands with an invalid opcode status. */
+define_closure_function(2, 1, void, nvme_req_handler,
+                        nvme, n, u32, namespace,
+                        storage_req req)
+{
+    nvme n = bound(n);
+    switch (req->op) {
+    case STORAGE_OP_DISCARD:
+        nvme_submit(n, bound(namespace), NVME_OPC_DS_MGMT, 0, req->blocks, req->completion);
+        break;
+    case STORAGE_OP_WRITE_ZEROES:
+        nvme_submit(n, bound(namespace), NVME_OPC_WRITE_Z, 0, req->blocks, req->completion);
+        break;
+    default: {
+        storage_req_handler rw_handler = (storage_req_handler)&n->rw_handler;
+        apply(rw_handler, req);
+    }
+    }
+}
+
 closure_func_basic(thunk, void, nvme_io_irq)
 {
     nvme_debug("%s", func_ss);
@@ -440,8 +508,21 @@ closure_func_basic(thunk, void, nvme_bh_service)
         list_delete(l);
         spin_unlock_irq(&n->lock, irqflags);
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
-        apply(req->sh, (req->sc == NVME_SC_OK) ? STATUS_OK :
-                timm("result", "NVMe status code 0x%x", req->sc));
+        status s;
+        switch (req->sc) {
+        case NVME_SC_OK:
+            s = STATUS_OK;
+            break;
+        case NVME_SC_INVALID_OPCODE:
+            if ((req->opcode == NVME_OPC_DS_MGMT) || (req->opcode == NVME_OPC_WRITE_Z)) {
+                s = storage_unsupported_status();
+                break;
+            }
+            /* fall through */
+        default:
+            s = timm("result", "NVMe status code 0x%x", req->sc);
+        }
+        apply(req->sh, s);
         irqflags = spin_lock_irq(&n->lock);
         list_insert_before(list_begin(&n->free_reqs), l);
     }
@@ -455,10 +536,10 @@ closure_function(4, 0, void, nvme_ns_attach,
     nvme n = bound(n);
     u32 ns_id = bound(ns_id);
     u64 disk_size = bound(disk_size);
-    apply(bound(a),
-          storage_init_req_handler(&n->req_handler, init_closure(&n->r, nvme_io, n, ns_id, false),
-                                   init_closure(&n->w, nvme_io, n, ns_id, true)),
-          disk_size, n->attach_id);
+    storage_init_req_handler(&n->rw_handler, init_closure(&n->r, nvme_io, n, ns_id, false),
+                             init_closure(&n->w, nvme_io, n, ns_id, true));
+    apply(bound(a), init_closure(&n->req_handler, nvme_req_handler, n, ns_id), disk_size,
+          n->attach_id);
     closure_finish();
 }
 
@@ -713,7 +794,8 @@ static boolean nvme_create_iosq(nvme n, storage_attach a)
 
     /* Zero out all submission queue entries, so that when submitting an entry
      * only used fields need to be set. This relies on the fact that all I/O
-     * commands use the same set of fields. */
+     * commands use a subset of the same set of fields, which are set for
+     * each command. */
     zero(n->iosq.ring, U64_FROM_BIT(n->iosq.order) * sizeof(struct nvme_sqe));
 
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
@@ -351,11 +351,14 @@ void filesystem_write_linear(fsfile f, void *src, range q, io_status_handler io_
         return;
     }
     u64 tail_len = length & (block_size - 1);
-    sg_buf sgb = sg_list_tail_add(sg, length - tail_len);
-    sgb->buf = src;
-    sgb->size = length - tail_len;
-    sgb->offset = 0;
-    sgb->refcount = 0;
+    sg_buf sgb;
+    if (length > tail_len) {
+        sgb = sg_list_tail_add(sg, length - tail_len);
+        sgb->buf = src;
+        sgb->size = length - tail_len;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+    }
     void *tail_buf;
     if (tail_len) {
         tail_buf = allocate(fs->h, block_size);
@@ -914,6 +917,7 @@ status filesystem_init(filesystem fs, heap h, u64 size, u64 blocksize, boolean r
 #endif
     fs->get_seals = 0;
     fs->set_seals = 0;
+    fs->trim = 0;
 #ifndef FS_READ_ONLY
     init_refcount(&fs->refcount, 1, init_closure_func(&fs->sync, thunk, fs_sync));
     fs->sync_complete = 0;
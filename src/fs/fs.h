@@ -87,6 +87,7 @@ struct filesystem {
                                        status_handler completion);
     int (*get_seals)(filesystem fs, fsfile fsf, u64 *seals);
     int (*set_seals)(filesystem fs, fsfile fsf, u64 seals);
+    void (*trim)(filesystem fs, range q, u64 minlen, io_status_handler completion);
     void (*destroy_fs)(filesystem fs);
     tuple root;
 #ifdef KERNEL
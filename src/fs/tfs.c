@@ -1,7 +1,10 @@
 #include <errno.h>
 #include <tfs_internal.h>
+#include <lz4.h>
+#include <crc32c.h>
 #ifdef KERNEL
 #include <dma.h>
+#include <management.h>
 #endif
 
 //#define TFS_DEBUG
@@ -24,11 +27,23 @@
 #define tfs_storage_lock(fs)    spin_lock(&(fs)->storage_lock)
 #define tfs_storage_unlock(fs)  spin_unlock(&(fs)->storage_lock)
 
+#define tfs_sync_lock(fs)       spin_lock(&(fs)->sync_lock)
+#define tfs_sync_unlock(fs)     spin_unlock(&(fs)->sync_lock)
+
+#define tfs_cdata_lock(fs)      spin_lock(&(fs)->cdata_lock)
+#define tfs_cdata_unlock(fs)    spin_unlock(&(fs)->cdata_lock)
+
 #else
 
 #define tfs_storage_lock(fs)    ((void)fs)
 #define tfs_storage_unlock(fs)  ((void)fs)
 
+#define tfs_sync_lock(fs)       ((void)fs)
+#define tfs_sync_unlock(fs)     ((void)fs)
+
+#define tfs_cdata_lock(fs)      ((void)fs)
+#define tfs_cdata_unlock(fs)    ((void)fs)
+
 #endif
 
 #define fs_is_tfs(fs)   ((fs)->get_meta == tmpfs_get_meta)
@@ -43,13 +58,29 @@ static tuple tmpfs_get_meta(filesystem fs, inode n)
 
 static s64 tfsfile_get_blocks(fsfile f)
 {
+    tfsfile tf = (tfsfile)f;
     s64 blocks = 0;
-    rangemap_foreach(((tfsfile)f)->extentmap, n) {
+    rangemap_foreach(tf->extentmap, n) {
         blocks += range_span(n->r);
     }
+#ifdef KERNEL
+    tfs fs = (tfs)f->fs;
+    tfs_storage_lock(fs);
+    rangemap_foreach(tf->delalloc, n) {
+        blocks += range_span(n->r);
+    }
+    tfs_storage_unlock(fs);
+#endif
     return blocks;
 }
 
+/* Unlike children(), does not load a deferred directory. */
+static tuple loaded_children(tuple n)
+{
+    tuple c = get_tuple(n, sym(children));
+    return (c && !is_deferred_tuple(c)) ? c : 0;
+}
+
 void fixup_directory(tuple parent, tuple dir);
 
 closure_function(1, 2, boolean, fixup_directory_each,
@@ -61,9 +92,10 @@ closure_function(1, 2, boolean, fixup_directory_each,
     return true;
 }
 
+/* Directory entries in a deferred directory are fixed up when the directory is loaded. */
 void fixup_directory(tuple parent, tuple n)
 {
-    tuple c = children(n);
+    tuple c = loaded_children(n);
     if (c)
         iterate(c, stack_closure(fixup_directory_each, n));
     set(n, sym_this(".."), parent);
@@ -83,6 +115,8 @@ static inline extent allocate_extent(heap h, range file_blocks, range storage_bl
     e->start_block = storage_blocks.start;
     e->allocated = range_span(storage_blocks);
     e->uninited = 0;
+    e->compressed = 0;
+    list_init(&e->checksum_updates);
     return e;
 }
 
@@ -97,20 +131,120 @@ closure_function(2, 1, boolean, tfs_storage_alloc,
     return true;
 }
 
-u64 filesystem_allocate_storage(tfs fs, u64 nblocks)
+/* Looks for a run of free storage blocks, starting from the goal block and wrapping around to the
+ * beginning of the storage space, so that data written together to a file tends to be contiguous
+ * on storage. */
+static u64 tfs_storage_find(tfs fs, u64 nblocks, u64 goal)
+{
+    u64 limit = fs->fs.size >> fs->fs.blocksize_order;
+    u64 start_block;
+    int result = RM_NOMATCH;
+    if (goal < limit)
+        result = rangemap_range_find_gaps(fs->storage, irange(goal, limit),
+                                          stack_closure(tfs_storage_alloc, nblocks, &start_block));
+    if ((result != RM_ABORT) && (goal > 0))
+        result = rangemap_range_find_gaps(fs->storage, irange(0, MIN(goal, limit)),
+                                          stack_closure(tfs_storage_alloc, nblocks, &start_block));
+    return (result == RM_ABORT) ? start_block : INVALID_PHYSICAL;
+}
+
+static boolean tfs_storage_release_locked(tfs fs, range blocks)
+{
+    if (!rangemap_insert_hole(fs->storage, blocks))
+        return false;
+    fs->used_blocks -= range_span(blocks);
+    return true;
+}
+
+#ifdef KERNEL
+/* Online discard: freed storage blocks are collected in a map of pending discards, where adjacent
+ * blocks freed at different times are merged, and are discarded in batches issued
+ * TFS_DISCARD_DELAY_SECONDS after the first block of a batch is freed. Blocks allocated again
+ * before being discarded are removed from the map. */
+static void tfs_discard_schedule_locked(tfs fs)
+{
+    if (fs->discard_scheduled || !rangemap_count(fs->discard_pending))
+        return;
+    fs->discard_scheduled = true;
+    register_timer(kernel_timers, &fs->discard_timer, CLOCK_ID_MONOTONIC_RAW,
+                   seconds(TFS_DISCARD_DELAY_SECONDS), false, 0,
+                   (timer_handler)&fs->discard_timer_expired);
+}
+
+static void tfs_discard_cancel_locked(tfs fs, range blocks)
+{
+    rangemap rm = fs->discard_pending;
+    rmnode n = rangemap_lookup_at_or_next(rm, blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        rmnode next = rangemap_next_node(rm, n);
+        if (!rangemap_insert_hole(rm, range_intersection(n->r, blocks)))
+            rangemap_remove_range(rm, n);   /* a missed discard is harmless */
+        n = next;
+    }
+}
+#endif
+
+static boolean filesystem_free_storage_locked(tfs fs, range blocks)
+{
+    if (!tfs_storage_release_locked(fs, blocks))
+        return false;
+#ifdef KERNEL
+    if (fs->discard && !fs->discard_unsupported &&
+        rangemap_insert_range(fs->discard_pending, blocks))
+        tfs_discard_schedule_locked(fs);
+#endif
+    return true;
+}
+
+/* Speculative preallocation: when a new extent is created for data appended to a file, the storage
+ * that follows the extent is reserved for the file, so that the next appends extend the extent in
+ * place instead of allocating storage that interleaved writers to other files may have taken.
+ * Preallocated storage is not part of any extent in the log; it is tracked in memory only, and is
+ * given back when the file is deallocated or when the filesystem runs out of free storage. */
+
+static void tfsfile_prealloc_release_locked(tfs fs, tfsfile f)
+{
+    if (!range_span(f->prealloc))
+        return;
+    tfs_debug("%s: file %p, prealloc %R\n", func_ss, f, f->prealloc);
+    if (!filesystem_free_storage_locked(fs, f->prealloc))
+        msg_err("failed to free preallocated storage at %R", f->prealloc);
+    fs->prealloc_blocks -= range_span(f->prealloc);
+    f->prealloc = irange(0, 0);
+    list_delete(&f->prealloc_l);
+}
+
+static void tfs_prealloc_reclaim_locked(tfs fs)
+{
+    list_foreach(&fs->prealloc_files, l)
+        tfsfile_prealloc_release_locked(fs, struct_from_list(l, tfsfile, prealloc_l));
+}
+
+static u64 filesystem_allocate_storage_locked(tfs fs, u64 nblocks, u64 goal)
+{
+    u64 start_block = tfs_storage_find(fs, nblocks, goal);
+    if ((start_block == INVALID_PHYSICAL) && fs->prealloc_blocks) {
+        tfs_prealloc_reclaim_locked(fs);
+        start_block = tfs_storage_find(fs, nblocks, goal);
+    }
+    if ((start_block != INVALID_PHYSICAL) &&
+        rangemap_insert_range(fs->storage, irangel(start_block, nblocks))) {
+        fs->used_blocks += nblocks;
+#ifdef KERNEL
+        tfs_discard_cancel_locked(fs, irangel(start_block, nblocks));
+#endif
+        return start_block;
+    }
+    return INVALID_PHYSICAL;
+}
+
+u64 filesystem_allocate_storage(tfs fs, u64 nblocks, u64 goal)
 {
     if (fs->storage) {
         tfs_storage_lock(fs);
-        u64 start_block;
-        int result = rangemap_range_find_gaps(fs->storage,
-                                              irange(0, fs->fs.size >> fs->fs.blocksize_order),
-                                              stack_closure(tfs_storage_alloc,
-                                                            nblocks, &start_block));
-        boolean success = (result == RM_ABORT) &&
-                          rangemap_insert_range(fs->storage, irangel(start_block, nblocks));
+        u64 start_block = filesystem_allocate_storage_locked(fs, nblocks, goal);
         tfs_storage_unlock(fs);
-        if (success)
-            return start_block;
+        return start_block;
     }
     return INVALID_PHYSICAL;
 }
@@ -121,6 +255,12 @@ boolean filesystem_reserve_storage(tfs fs, range blocks)
         tfs_storage_lock(fs);
         boolean success = !rangemap_range_intersects(fs->storage, blocks) &&
                           rangemap_insert_range(fs->storage, blocks);
+        if (success) {
+            fs->used_blocks += range_span(blocks);
+#ifdef KERNEL
+            tfs_discard_cancel_locked(fs, blocks);
+#endif
+        }
         tfs_storage_unlock(fs);
         return success;
     }
@@ -131,14 +271,143 @@ boolean filesystem_free_storage(tfs fs, range blocks)
 {
     if (fs->storage) {
         tfs_storage_lock(fs);
-        boolean success = rangemap_insert_hole(fs->storage, blocks);
+        boolean success = filesystem_free_storage_locked(fs, blocks);
         tfs_storage_unlock(fs);
         return success;
     }
     return true;
 }
 
-void ingest_extent(tfsfile f, symbol off, tuple value)
+#ifndef TFS_READ_ONLY
+
+closure_function(1, 1, boolean, tfs_storage_destroy,
+                 heap, h,
+                 rmnode n)
+{
+    deallocate(bound(h), n, sizeof(*n));
+    return false;
+}
+
+/* Takes up to nblocks blocks from the beginning of the preallocated storage of a file, if it starts
+ * at start_block; returns the number of blocks taken. */
+static u64 tfsfile_take_prealloc(tfs fs, tfsfile f, u64 start_block, u64 nblocks)
+{
+    u64 taken = 0;
+    tfs_storage_lock(fs);
+    if (range_span(f->prealloc) && (f->prealloc.start == start_block)) {
+        taken = MIN(nblocks, range_span(f->prealloc));
+        f->prealloc.start += taken;
+        fs->prealloc_blocks -= taken;
+        if (!range_span(f->prealloc))
+            list_delete(&f->prealloc_l);
+    }
+    tfs_storage_unlock(fs);
+    return taken;
+}
+
+/* Allocates storage for nblocks blocks of data appended to a file, together with extra blocks of
+ * storage preallocated for the file. */
+static u64 tfsfile_allocate_storage(tfs fs, tfsfile f, u64 nblocks, u64 extra, u64 goal)
+{
+    if (!fs->storage)
+        return INVALID_PHYSICAL;
+    tfs_storage_lock(fs);
+    u64 start_block = filesystem_allocate_storage_locked(fs, nblocks + extra, goal);
+    if (start_block != INVALID_PHYSICAL) {
+        tfsfile_prealloc_release_locked(fs, f);
+        f->prealloc = irangel(start_block + nblocks, extra);
+        fs->prealloc_blocks += extra;
+        list_push_back(&fs->prealloc_files, &f->prealloc_l);
+    }
+    tfs_storage_unlock(fs);
+    return start_block;
+}
+
+/* Returns the number of storage blocks available for new data; called with the storage lock
+ * held. */
+static u64 tfs_available_blocks_locked(tfs fs)
+{
+    u64 used = fs->used_blocks - fs->prealloc_blocks + fs->delalloc_blocks;
+    u64 total = fs->fs.size >> fs->fs.blocksize_order;
+    return (total > used) ? total - used : 0;
+}
+
+#ifdef KERNEL
+/* Delayed allocation: a write to the page cache only reserves space for the data being written to
+ * file blocks not backed by storage, and storage is allocated when the data is written back, so
+ * that the extents of a file are sized after the data written back at once instead of after each
+ * write. Reserved file blocks are tracked in the delalloc rangemap of each file. */
+
+closure_function(1, 1, boolean, tfs_delalloc_count,
+                 u64 *, count,
+                 range r)
+{
+    *bound(count) += range_span(r);
+    return true;
+}
+
+closure_function(2, 1, boolean, tfs_delalloc_gap_count,
+                 tfsfile, f, u64 *, count,
+                 range r)
+{
+    rangemap_range_find_gaps(bound(f)->delalloc, r, stack_closure(tfs_delalloc_count, bound(count)));
+    return true;
+}
+
+closure_function(1, 1, boolean, tfs_delalloc_gap_insert,
+                 tfsfile, f,
+                 range r)
+{
+    return rangemap_insert_range(bound(f)->delalloc, r);
+}
+
+/* Called with the filesystem locked. */
+static status tfsfile_delalloc_reserve(tfs fs, tfsfile f, range blocks)
+{
+    status s = STATUS_OK;
+    u64 count = 0;
+    tfs_storage_lock(fs);
+    rangemap_range_find_gaps(f->extentmap, blocks, stack_closure(tfs_delalloc_gap_count, f, &count));
+    if (count > tfs_available_blocks_locked(fs)) {
+        s = timm("result", "no space for delayed allocation");
+        s = timm_append(s, "fsstatus", "%d", -ENOSPC);
+    } else if (count) {
+        /* on failure, the blocks already inserted remain accounted for */
+        fs->delalloc_blocks += count;
+        if (rangemap_range_find_gaps(f->extentmap, blocks,
+                                     stack_closure(tfs_delalloc_gap_insert, f)) == RM_ABORT) {
+            s = timm("result", "failed to reserve blocks");
+            s = timm_append(s, "fsstatus", "%d", -ENOMEM);
+        }
+    }
+    tfs_storage_unlock(fs);
+    tfs_debug("%s: file %p, blocks %R, reserving 0x%lx\n", func_ss, f, blocks, count);
+    return s;
+}
+
+static void tfsfile_delalloc_release_locked(tfs fs, tfsfile f, range blocks)
+{
+    rmnode n = rangemap_lookup_at_or_next(f->delalloc, blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        rmnode next = rangemap_next_node(f->delalloc, n);
+        range i = range_intersection(n->r, blocks);
+        if (range_span(i) && rangemap_insert_hole(f->delalloc, i))
+            fs->delalloc_blocks -= range_span(i);
+        n = next;
+    }
+}
+
+static void tfsfile_delalloc_release(tfs fs, tfsfile f, range blocks)
+{
+    tfs_storage_lock(fs);
+    tfsfile_delalloc_release_locked(fs, f, blocks);
+    tfs_storage_unlock(fs);
+}
+#endif
+
+#endif
+
+void ingest_extent(tfsfile f, symbol off, tuple value, boolean reserve)
 {
     tfs_debug("ingest_extent: f %p, off %b, value %v\n", f, symbol_string(off), value);
     u64 length, file_offset, start_block, allocated;
@@ -152,7 +421,7 @@ void ingest_extent(tfsfile f, symbol off, tuple value)
 
     range storage_blocks = irangel(start_block, allocated);
     tfs fs = tfs_from_file(f);
-    if (!filesystem_reserve_storage(fs, storage_blocks)) {
+    if (reserve && !filesystem_reserve_storage(fs, storage_blocks)) {
         /* soft error... */
         msg_err("unable to reserve storage blocks %R\n", storage_blocks);
     }
@@ -163,31 +432,65 @@ void ingest_extent(tfsfile f, symbol off, tuple value)
     ex->md = value;
     if (get(value, sym(uninited)))
         ex->uninited = INVALID_ADDRESS;
+    if (get(value, sym(compressed)))
+        assert(ingest_parse_int(value, sym(compressed), &ex->compressed));
     assert(rangemap_insert(f->extentmap, &ex->node));
 }
 
-closure_function(1, 2, boolean, tfs_ingest_extent,
-                 tfsfile, f,
+closure_function(2, 2, boolean, tfs_ingest_extent,
+                 tfsfile, f, boolean, reserve,
                  value s, value v)
 {
     assert(is_symbol(s));
-    ingest_extent(bound(f), s, v);
+    ingest_extent(bound(f), s, v, bound(reserve));
     return true;
 }
 
-static boolean enumerate_dir_entries(tfs fs, tuple t);
+/* The attachment of a deferred directory lists the storage ranges (start block and number of
+ * blocks) used by the files in the directory and its subdirectories, so that storage can be
+ * reserved at mount time without loading the directory. */
+static boolean deferred_dir_storage(tuple c, range_handler rh)
+{
+    bytes len;
+    void *attachment = deferred_tuple_attachment(c, &len);
+    if (!attachment)
+        return false;
+    buffer b = alloca_wrap_buffer(attachment, len);
+    while (buffer_length(b) > 0) {
+        u64 start = pop_varint(b);
+        u64 nblocks = pop_varint(b);
+        if (!apply(rh, irangel(start, nblocks)))
+            break;
+    }
+    return true;
+}
 
-closure_function(1, 2, boolean, enumerate_dir_entries_each,
+closure_function(1, 1, boolean, tfs_reserve_range,
                  tfs, fs,
+                 range r)
+{
+    if (!filesystem_reserve_storage(bound(fs), r)) {
+        /* soft error... */
+        msg_err("unable to reserve storage blocks %R\n", r);
+    }
+    return true;
+}
+
+static boolean enumerate_dir_entries(tfs fs, tuple t, boolean reserve);
+
+closure_function(2, 2, boolean, enumerate_dir_entries_each,
+                 tfs, fs, boolean, reserve,
                  value s, value v)
 {
     tfs fs = bound(fs);
     if (is_tuple(v))
-        return enumerate_dir_entries(fs, v);
+        return enumerate_dir_entries(fs, v, bound(reserve));
     return true;
 }
 
-static boolean enumerate_dir_entries(tfs fs, tuple t)
+/* Storage used by files is reserved if the reserve flag is set, which is not the case for the
+ * entries of a deferred directory being loaded, whose storage has been reserved at mount time. */
+static boolean enumerate_dir_entries(tfs fs, tuple t, boolean reserve)
 {
     tuple extents = get_tuple(t, sym(extents));
     if (extents) {
@@ -199,16 +502,51 @@ static boolean enumerate_dir_entries(tfs fs, tuple t)
         u64 len;
         if (filelength && u64_from_value(filelength, &len))
             fsfile_set_length(&f->f, len);
-        return iterate(extents, stack_closure(tfs_ingest_extent, f));
+        return iterate(extents, stack_closure(tfs_ingest_extent, f, reserve));
     }
     table_set(fs->files, t, INVALID_ADDRESS);
-    tuple c = children(t);
-    if (c)
-        return iterate(c, stack_closure(enumerate_dir_entries_each, fs));
+    tuple c = get_tuple(t, sym(children));
+    if (!c)
+        return true;
+    if (is_deferred_tuple(c))
+        return !reserve || deferred_dir_storage(c, stack_closure(tfs_reserve_range, fs));
+    return iterate(c, stack_closure(enumerate_dir_entries_each, fs, reserve));
+}
+
+closure_function(2, 2, boolean, tfs_deferred_entry_loaded,
+                 tfs, fs, tuple, dir,
+                 value s, value v)
+{
+    if (is_tuple(v)) {
+#ifndef TFS_READ_ONLY
+        fixup_directory(bound(dir), v);
+#endif
+        if (!enumerate_dir_entries(bound(fs), v, false))
+            msg_err("failed to enumerate directory entries\n");
+    }
     return true;
 }
 
-void filesystem_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
+/* Called when a deferred directory is loaded. Directories loaded while reading the log are
+ * enumerated (like any other directory) when the log read completes. */
+closure_func_basic(deferred_tuple_handler, boolean, tfs_deferred_loaded,
+                   tuple holder, tuple t, table dictionary)
+{
+    tfs fs = struct_from_closure(tfs, deferred_loaded);
+    tfs_debug("%s: dir %p, children %p\n", func_ss, holder, t);
+    if (log_deferred_loaded(fs->tl, t, dictionary))
+        return true;
+#ifndef TFS_READ_ONLY
+    if (fs->temp_log)
+        log_deferred_loaded(fs->temp_log, t, dictionary);
+#endif
+    iterate(t, stack_closure(tfs_deferred_entry_loaded, fs, holder));
+    return false;
+}
+
+/* Background jobs (defragmentation, scrub) issue their storage requests via tfs_storage_op(),
+ * so that the bytes counted in io_bytes are those of foreground I/O only. */
+static void tfs_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
                            status_handler completion)
 {
     tfs_debug("%s: fs %p, sg %p, sg size %ld, blocks %R, %c\n", func_ss,
@@ -222,6 +560,13 @@ void filesystem_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
     apply(fs->req_handler, &req);
 }
 
+void filesystem_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
+                           status_handler completion)
+{
+    fetch_and_add(&fs->io_bytes, range_span(blocks) << fs->fs.blocksize_order);
+    tfs_storage_op(fs, sg, blocks, write, completion);
+}
+
 closure_function(2, 1, void, zero_blocks_complete,
                  sg_list, sg, status_handler, completion,
                  status s)
@@ -233,11 +578,15 @@ closure_function(2, 1, void, zero_blocks_complete,
     closure_finish();
 }
 
-void zero_blocks(tfs fs, range blocks, merge m)
+static boolean tfs_status_unsupported(status s)
+{
+    s64 fss;
+    return !is_ok(s) && get_s64(s, sym(fsstatus), &fss) && (fss == -EOPNOTSUPP);
+}
+
+static void zero_blocks_write(tfs fs, range blocks, status_handler completion)
 {
     int blocks_per_page = U64_FROM_BIT(fs->page_order - fs->fs.blocksize_order);
-    tfs_debug("%s: fs %p, blocks %R\n", func_ss, fs, blocks);
-    status_handler completion = apply_merge(m);
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         apply(completion, timm("result", "failed to allocate sg list"));
@@ -272,142 +621,627 @@ void zero_blocks(tfs fs, range blocks, merge m)
     apply(fs->req_handler, &req);
 }
 
-closure_function(4, 1, boolean, read_extent,
-                 tfs, fs, sg_list, sg, merge, m, range, blocks,
-                 rmnode node)
+/* Falls back to writing zeroed buffers if the storage does not support write zeroes requests. */
+closure_function(3, 1, void, zero_blocks_offload_complete,
+                 tfs, fs, range, blocks, status_handler, completion,
+                 status s)
 {
     tfs fs = bound(fs);
-    sg_list sg = bound(sg);
-    extent e = (extent)node;
-    range i = range_intersection(bound(blocks), node->r);
-    u64 e_offset = i.start - node->r.start;
-    u64 len = range_span(i);
-    range blocks = irangel(e->start_block + e_offset, len);
-    tfs_debug("%s: e %p, uninited %p, sg %p m %p blocks %R, i %R, len %ld, blocks %R\n",
-              func_ss, e, e->uninited, bound(sg), bound(m), bound(blocks), i, len, blocks);
-    uninited u = e->uninited;
-    if (!u || ((u != INVALID_ADDRESS) && u->initialized))
-        filesystem_storage_op(fs, sg, blocks, false, apply_merge(bound(m)));
-    else
-        sg_zero_fill(sg, range_span(blocks) << fs->fs.blocksize_order);
-    return true;
+    status_handler completion = bound(completion);
+    if (tfs_status_unsupported(s)) {
+        timm_dealloc(s);
+        fs->write_zeroes_unsupported = true;
+        zero_blocks_write(fs, bound(blocks), completion);
+    } else {
+        apply(completion, s);
+    }
+    closure_finish();
 }
 
-closure_function(3, 1, boolean, zero_hole,
-                 tfs, fs, sg_list, sg, range, blocks,
-                 range z)
+static void zero_blocks_storage(tfs fs, range blocks, status_handler completion)
 {
-    range i = range_intersection(bound(blocks), z);
-    u64 length = range_span(i) << bound(fs)->fs.blocksize_order;
-    tfs_debug("%s: i %R, length %ld\n", func_ss, i, length);
-    sg_zero_fill(bound(sg), length);
-    return true;
+    if (!fs->write_zeroes_unsupported) {
+        status_handler sh = closure(fs->fs.h, zero_blocks_offload_complete, fs, blocks,
+                                    completion);
+        if (sh != INVALID_ADDRESS) {
+            struct storage_req req = {
+                .op = STORAGE_OP_WRITE_ZEROES,
+                .blocks = blocks,
+                .completion = sh,
+            };
+            apply(fs->req_handler, &req);
+            return;
+        }
+    }
+    zero_blocks_write(fs, blocks, completion);
 }
 
-BSS_RO_AFTER_INIT io_status_handler ignore_io_status;
-
-/* whole block reads, file length resolved in cache */
-static void tfs_read(fsfile fsf,
-                 sg_list sg, range q, status_handler complete)
+void zero_blocks(tfs fs, range blocks, merge m)
 {
-    tfs fs = (tfs)fsf->fs;
-    tfsfile f = (tfsfile)fsf;
-    merge m = allocate_merge(fs->fs.h, complete);
-    status_handler k = apply_merge(m);
-    tfs_debug("%s: fsfile %p, sg %p, q %R, sh %F\n", func_ss, f, sg, q, complete);
-
-    /* read extent data and zero gaps */
-    q.end = MIN(q.end, fsf->length);
-    range blocks = range_rshift_pad(q, fs->fs.blocksize_order);
-    filesystem_lock(&fs->fs);
-    rangemap_range_lookup_with_gaps(f->extentmap, blocks,
-                                    stack_closure(read_extent, fs, sg, m, blocks),
-                                    stack_closure(zero_hole, fs, sg, blocks));
-    filesystem_unlock(&fs->fs);
-    apply(k, STATUS_OK);
+    tfs_debug("%s: fs %p, blocks %R\n", func_ss, fs, blocks);
+    zero_blocks_storage(fs, blocks, apply_merge(m));
 }
 
-#ifndef TFS_READ_ONLY
-static tuple cleanup_directory(tuple dir);
+/* Checksums of file data.
+ * An extent may store the CRC-32C of each storage block of its data (the compressed data, for
+ * compressed extents) in the checksums attribute of its tuple, where block checksums are grouped in
+ * strings of TFS_CHECKSUM_GROUP_BLOCKS little-endian 32-bit values keyed by the group index, so
+ * that a write only logs the groups it modifies. A zero value means that the checksum of a block is
+ * not known (e.g. the block has been allocated but never written, or is being written), and the
+ * block is not verified. */
+
+/* Copies the checksums of n data blocks of an extent, starting at block index, to sums; returns
+ * whether any of them is known. */
+static boolean tfs_checksums_copy(tuple checksums, u64 index, u64 n, u32 *sums)
+{
+    boolean known = false;
+    for (u64 i = 0; i < n; ) {
+        u64 group = (index + i) / TFS_CHECKSUM_GROUP_BLOCKS;
+        u64 offset = (index + i) % TFS_CHECKSUM_GROUP_BLOCKS;
+        u64 count = MIN(n - i, TFS_CHECKSUM_GROUP_BLOCKS - offset);
+        string s = get_string(checksums, intern_u64(group));
+        if (s && (buffer_length(s) == TFS_CHECKSUM_GROUP_BLOCKS * sizeof(u32))) {
+            u32 *group_sums = buffer_ref(s, 0);
+            for (u64 j = 0; j < count; j++) {
+                sums[i + j] = le32toh(group_sums[offset + j]);
+                if (sums[i + j])
+                    known = true;
+            }
+        } else {
+            zero(sums + i, count * sizeof(u32));
+        }
+        i += count;
+    }
+    return known;
+}
 
-int filesystem_write_tuple(tfs fs, tuple t)
+/* Returns a copy of the checksums of n data blocks of an extent starting at block index, 0 if none
+ * of them is known, or INVALID_ADDRESS on allocation failure; called with the filesystem locked. */
+static u32 *tfs_extent_checksums(tfs fs, extent ex, u64 index, u64 n)
 {
-    if (fs->fs.ro)
-        return -EROFS;
-    if (log_write(fs->tl, t) && (!fs->temp_log || log_write(fs->temp_log, t)))
+    tuple checksums = ex->md ? get_tuple(ex->md, sym(checksums)) : 0;
+    if (!checksums)
         return 0;
-    else
-        return -ENOSPC;
+    u32 *sums = allocate(fs->fs.h, n * sizeof(u32));
+    if ((sums != INVALID_ADDRESS) && !tfs_checksums_copy(checksums, index, n, sums)) {
+        deallocate(fs->fs.h, sums, n * sizeof(u32));
+        sums = 0;
+    }
+    return sums;
 }
 
-int filesystem_write_eav(tfs fs, tuple t, symbol a, value v, boolean cleanup)
+/* Computes the checksums of n blocks of data at the head of sg without consuming it, storing them
+ * in sums or, if verify is true, comparing them with the known checksums in sums. Returns the index
+ * of the first mismatching block, or n. */
+static u64 tfs_sg_checksums(tfs fs, sg_list sg, u64 n, u32 *sums, boolean verify)
 {
-    if (fs->fs.ro)
-        return -EROFS;
-    tuple parent = cleanup ? cleanup_directory(v) : 0;
-    boolean success = log_write_eav(fs->tl, t, a, v);
-    if (success && fs->temp_log) {
-        /* The above log_write_eav() call might have started a TFS log rebuild, in which case the
-         * entire directory tree has been fixed up again and we have to do another cleanup. */
-        if (cleanup)
-            cleanup_directory(v);
-        success = log_write_eav(fs->temp_log, t, a, v);
+    u64 block_size = fs_blocksize(&fs->fs);
+    u64 i = 0;
+    u64 left = block_size;
+    u32 crc = 0;
+    sg_list_foreach(sg, sgb) {
+        void *p = sgb->buf + sgb->offset;
+        u64 len = sg_buf_len(sgb);
+        while ((len > 0) && (i < n)) {
+            u64 l = MIN(len, left);
+            crc = crc32c(crc, p, l);
+            p += l;
+            len -= l;
+            left -= l;
+            if (left == 0) {
+                if (!verify)
+                    sums[i] = crc;
+                else if (sums[i] && (sums[i] != crc))
+                    return i;
+                i++;
+                crc = 0;
+                left = block_size;
+            }
+        }
+        if (i == n)
+            break;
     }
-    if (cleanup)
-        fixup_directory(parent, v);
-    if (success)
-        return 0;
-    else
-        return -ENOSPC;
+    return n;
 }
 
-static int tfs_truncate(filesystem fs, fsfile f, u64 len)
+/* Returns the index of the first of n blocks of data in buf whose checksum does not match its known
+ * checksum in sums, or n. */
+static u64 tfs_buf_verify(tfs fs, void *buf, u64 n, u32 *sums)
 {
-    if (f->md) {
-        value v = value_from_u64(len);
-        if (v == INVALID_ADDRESS)
-            return -ENOMEM;
-        symbol l = sym(filelength);
-        int s = filesystem_write_eav((tfs)fs, f->md, l, v, false);
-        if (s != 0)
-            return s;
-        set(f->md, l, v);
-        f->status |= FSF_DIRTY_DATASYNC;
+    u64 block_size = fs_blocksize(&fs->fs);
+    for (u64 i = 0; i < n; i++, buf += block_size) {
+        if (sums[i] && (crc32c(0, buf, block_size) != sums[i]))
+            return i;
     }
-    return 0;
+    return n;
 }
 
-/* create a new extent in the filesystem
-
-   The life an extent depends on a particular allocation of contiguous
-   storage space. The extent is tied to this allocated area (nominally
-   page size). Only the extent data length and allocation size may be
+static status tfs_checksum_error(tfs fs, u64 block)
+{
+#ifdef KERNEL
+    fetch_and_add(&fs->checksum_errors, 1);
+#else
+    fs->checksum_errors++;
+#endif
+    msg_err("checksum mismatch in file data at storage block 0x%lx\n", block);
+    status s = timm("result", "checksum mismatch at storage block 0x%lx", block);
+    return timm_append(s, "fsstatus", "%d", -EIO);
+}
+
+closure_function(6, 1, void, tfs_read_verify,
+                 tfs, fs, sg_list, sg, sg_list, read_sg, u32 *, sums, range, blocks,
+                 status_handler, completion,
+                 status s)
+{
+    tfs fs = bound(fs);
+    sg_list sg = bound(sg);
+    u32 *sums = bound(sums);
+    range blocks = bound(blocks);
+    u64 n = range_span(blocks);
+    if (is_ok(s)) {
+        u64 i = tfs_sg_checksums(fs, sg, n, sums, true);
+        if (i < n)
+            s = tfs_checksum_error(fs, blocks.start + i);
+    }
+    deallocate_sg_list(bound(read_sg));
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    deallocate(fs->fs.h, sums, n * sizeof(u32));
+    apply(bound(completion), s);
+    closure_finish();
+}
+
+/* Reads n data blocks of an uncompressed extent starting at block index into sg, verifying the
+ * data against the known checksums of the blocks; the data is read into a copy of the sg list, so
+ * that the verification can access it after the storage has consumed the list. Called with the
+ * filesystem locked. */
+static void tfs_read_blocks(tfs fs, extent ex, sg_list sg, u64 index, u64 n,
+                            status_handler completion)
+{
+    range blocks = irangel(ex->start_block + index, n);
+    u32 *sums = tfs_extent_checksums(fs, ex, index, n);
+    if (!sums) {
+        filesystem_storage_op(fs, sg, blocks, false, completion);
+        return;
+    }
+    u64 length = n << fs->fs.blocksize_order;
+    if (sums == INVALID_ADDRESS)
+        goto alloc_fail;
+    sg_list vsg = allocate_sg_list();
+    if (vsg == INVALID_ADDRESS)
+        goto dealloc_sums;
+    sg_list rsg = allocate_sg_list();
+    if (rsg == INVALID_ADDRESS)
+        goto dealloc_vsg;
+    status_handler sh = closure(fs->fs.h, tfs_read_verify, fs, vsg, rsg, sums, blocks, completion);
+    if (sh == INVALID_ADDRESS)
+        goto dealloc_rsg;
+    sg_move(vsg, sg, length);
+    sg_list_foreach(vsg, sgb) {
+        sg_buf rsgb = sg_list_tail_add(rsg, sg_buf_len(sgb));
+        if (rsgb == INVALID_ADDRESS) {
+            apply(sh, timm("result", "failed to allocate sg buf"));
+            return;
+        }
+        rsgb->buf = sgb->buf;
+        rsgb->offset = sgb->offset;
+        rsgb->size = sgb->size;
+        rsgb->refcount = 0;
+    }
+    filesystem_storage_op(fs, rsg, blocks, false, sh);
+    return;
+  dealloc_rsg:
+    deallocate_sg_list(rsg);
+  dealloc_vsg:
+    deallocate_sg_list(vsg);
+  dealloc_sums:
+    deallocate(fs->fs.h, sums, n * sizeof(u32));
+  alloc_fail:
+    sg_consume(sg, length);
+    apply(completion, timm("result", "failed to allocate checksum verification"));
+}
+
+/* Decompressed data of recently read compressed extents, keyed by the extent start block. The
+ * pagecache fills a file one page at a time, so without this cache each page of a compressed extent
+ * would cost a read and a decompression of the whole extent. */
+typedef struct tfs_cdata {
+    struct list l;
+    u64 start_block;
+    void *data;
+    u64 length;
+    struct list readers;    /* waiting for the data to be loaded */
+    boolean loading;
+    boolean stale;          /* extent destroyed while loading */
+} *tfs_cdata;
+
+typedef struct tfs_cdata_reader {
+    struct list l;
+    sg_list sg;
+    range r;
+    status_handler completion;
+} *tfs_cdata_reader;
+
+static void tfs_cdata_free(tfs fs, tfs_cdata cd)
+{
+    deallocate(fs->fs.h, cd->data, cd->length);
+    deallocate(fs->fs.h, cd, sizeof(*cd));
+}
+
+/* called with cdata lock held */
+static tfs_cdata tfs_cdata_lookup(tfs fs, u64 start_block)
+{
+    list_foreach(&fs->cdata_cache, l) {
+        tfs_cdata cd = struct_from_list(l, tfs_cdata, l);
+        if (cd->start_block == start_block)
+            return cd;
+    }
+    return 0;
+}
+
+/* called with cdata lock held */
+static void tfs_cdata_evict(tfs fs)
+{
+    list_foreach_reverse(&fs->cdata_cache, l) {
+        if (fs->cdata_count <= TFS_COMPRESSED_CACHE_EXTENTS)
+            break;
+        tfs_cdata cd = struct_from_list(l, tfs_cdata, l);
+        if (cd->loading)
+            continue;
+        list_delete(l);
+        fs->cdata_count--;
+        tfs_cdata_free(fs, cd);
+    }
+}
+
+closure_function(6, 1, void, tfs_cdata_loaded,
+                 tfs, fs, tfs_cdata, cd, sg_list, sg, void *, buf, u64, compressed, u32 *, sums,
+                 status s)
+{
+    tfs fs = bound(fs);
+    tfs_cdata cd = bound(cd);
+    void *buf = bound(buf);
+    u64 compressed = bound(compressed);
+    u32 *sums = bound(sums);
+    u64 nblocks = pad(compressed, U64_FROM_BIT(fs->fs.blocksize_order)) >> fs->fs.blocksize_order;
+    if (sums) {
+        if (is_ok(s)) {
+            u64 i = tfs_buf_verify(fs, buf, nblocks, sums);
+            if (i < nblocks)
+                s = tfs_checksum_error(fs, cd->start_block + i);
+        }
+        deallocate(fs->fs.h, sums, nblocks * sizeof(u32));
+    }
+    if (is_ok(s)) {
+        s64 len = lz4_decompress(buf, compressed, cd->data, cd->length);
+        if (len < 0)
+            s = timm("result", "failed to decompress extent at block 0x%lx", cd->start_block);
+        else
+            zero(cd->data + len, cd->length - len);
+    }
+    deallocate_sg_list(bound(sg));
+    deallocate(fs->dma, buf, pad(compressed, U64_FROM_BIT(fs->fs.blocksize_order)));
+    struct list readers;
+    tfs_cdata_lock(fs);
+    cd->loading = false;
+    list_move(&readers, &cd->readers);
+    if (is_ok(s)) {
+        list_foreach(&readers, l) {
+            tfs_cdata_reader r = struct_from_list(l, tfs_cdata_reader, l);
+            sg_copy_from_buf(cd->data + r->r.start, r->sg, range_span(r->r));
+        }
+    }
+    boolean release = cd->stale;
+    if (!is_ok(s) && !release) {
+        list_delete(&cd->l);
+        fs->cdata_count--;
+        release = true;
+    }
+    if (!release)
+        tfs_cdata_evict(fs);
+    tfs_cdata_unlock(fs);
+    if (release)
+        tfs_cdata_free(fs, cd);
+    list_foreach(&readers, l) {
+        tfs_cdata_reader r = struct_from_list(l, tfs_cdata_reader, l);
+        list_delete(l);
+        sg_list_release(r->sg);
+        deallocate_sg_list(r->sg);
+        apply(r->completion, s);
+        deallocate(fs->fs.h, r, sizeof(*r));
+    }
+    closure_finish();
+}
+
+/* Allocates a cache entry for a compressed extent, and the sg list and completion for the read of
+ * the compressed data, which is verified against the checksums in sums (if not 0) before being
+ * decompressed; called with cdata lock held. */
+static tfs_cdata tfs_cdata_alloc(tfs fs, u64 start_block, u64 compressed, u64 length, u32 *sums,
+                                 sg_list *read_sg, status_handler *read_sh)
+{
+    heap h = fs->fs.h;
+    tfs_cdata cd = allocate(h, sizeof(*cd));
+    if (cd == INVALID_ADDRESS)
+        return cd;
+    cd->length = length;
+    cd->data = allocate(h, cd->length);
+    if (cd->data == INVALID_ADDRESS)
+        goto dealloc_cd;
+    u64 buf_len = pad(compressed, U64_FROM_BIT(fs->fs.blocksize_order));
+    void *buf = allocate(fs->dma, buf_len);
+    if (buf == INVALID_ADDRESS)
+        goto dealloc_data;
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        goto dealloc_buf;
+    sg_buf sgb = sg_list_tail_add(sg, buf_len);
+    if (sgb == INVALID_ADDRESS)
+        goto dealloc_sg;
+    sgb->buf = buf;
+    sgb->offset = 0;
+    sgb->size = buf_len;
+    sgb->refcount = 0;
+    status_handler sh = closure(h, tfs_cdata_loaded, fs, cd, sg, buf, compressed, sums);
+    if (sh == INVALID_ADDRESS)
+        goto dealloc_sg;
+    cd->start_block = start_block;
+    list_init(&cd->readers);
+    cd->loading = true;
+    cd->stale = false;
+    list_insert_after(&fs->cdata_cache, &cd->l);
+    fs->cdata_count++;
+    *read_sg = sg;
+    *read_sh = sh;
+    return cd;
+  dealloc_sg:
+    deallocate_sg_list(sg);
+  dealloc_buf:
+    deallocate(fs->dma, buf, buf_len);
+  dealloc_data:
+    deallocate(h, cd->data, cd->length);
+  dealloc_cd:
+    deallocate(h, cd, sizeof(*cd));
+    return INVALID_ADDRESS;
+}
+
+/* Fills sg with the decompressed data at byte range r of the compressed extent stored at
+ * start_block; the extent fields and a copy of its checksums (deallocated by this function) are
+ * passed by value so that the caller need not hold the filesystem lock. */
+static void read_compressed_data(tfs fs, u64 start_block, u64 compressed, u64 length, u32 *sums,
+                                 range r, sg_list sg, status_handler completion)
+{
+    tfs_debug("%s: start_block 0x%lx, r %R, sg %p\n", func_ss, start_block, r, sg);
+    heap h = fs->fs.h;
+    u64 nblocks = pad(compressed, U64_FROM_BIT(fs->fs.blocksize_order)) >> fs->fs.blocksize_order;
+    tfs_cdata_lock(fs);
+    tfs_cdata cd = tfs_cdata_lookup(fs, start_block);
+    if (cd && !cd->loading) {
+        list_delete(&cd->l);
+        list_insert_after(&fs->cdata_cache, &cd->l);
+        sg_copy_from_buf(cd->data + r.start, sg, range_span(r));
+        tfs_cdata_unlock(fs);
+        if (sums)
+            deallocate(h, sums, nblocks * sizeof(u32));
+        apply(completion, STATUS_OK);
+        return;
+    }
+    tfs_cdata_reader reader = allocate(h, sizeof(*reader));
+    if (reader == INVALID_ADDRESS)
+        goto alloc_fail;
+    reader->sg = allocate_sg_list();
+    if (reader->sg == INVALID_ADDRESS) {
+        deallocate(h, reader, sizeof(*reader));
+        goto alloc_fail;
+    }
+    sg_list read_sg = 0;
+    status_handler read_sh;
+    if (!cd) {
+        cd = tfs_cdata_alloc(fs, start_block, compressed, length, sums, &read_sg, &read_sh);
+        if (cd == INVALID_ADDRESS) {
+            deallocate_sg_list(reader->sg);
+            deallocate(h, reader, sizeof(*reader));
+            goto alloc_fail;
+        }
+    }
+    sg_move(reader->sg, sg, range_span(r));
+    reader->r = r;
+    reader->completion = completion;
+    list_push_back(&cd->readers, &reader->l);
+    tfs_cdata_unlock(fs);
+    if (read_sg)
+        filesystem_storage_op(fs, read_sg, irangel(start_block, nblocks), false, read_sh);
+    else if (sums)
+        deallocate(h, sums, nblocks * sizeof(u32));
+    return;
+  alloc_fail:
+    tfs_cdata_unlock(fs);
+    if (sums)
+        deallocate(h, sums, nblocks * sizeof(u32));
+    apply(completion, timm("result", "failed to allocate compressed extent read"));
+}
+
+closure_function(4, 1, boolean, read_extent,
+                 tfs, fs, sg_list, sg, merge, m, range, blocks,
+                 rmnode node)
+{
+    tfs fs = bound(fs);
+    sg_list sg = bound(sg);
+    extent e = (extent)node;
+    range i = range_intersection(bound(blocks), node->r);
+    u64 e_offset = i.start - node->r.start;
+    u64 len = range_span(i);
+    range blocks = irangel(e->start_block + e_offset, len);
+    tfs_debug("%s: e %p, uninited %p, sg %p m %p blocks %R, i %R, len %ld, blocks %R\n",
+              func_ss, e, e->uninited, bound(sg), bound(m), bound(blocks), i, len, blocks);
+    uninited u = e->uninited;
+    if (e->compressed) {
+        u64 nblocks = pad(e->compressed, fs_blocksize(&fs->fs)) >> fs->fs.blocksize_order;
+        u32 *sums = tfs_extent_checksums(fs, e, 0, nblocks);
+        if (sums == INVALID_ADDRESS) {
+            sg_consume(sg, len << fs->fs.blocksize_order);
+            apply(apply_merge(bound(m)), timm("result", "failed to allocate checksums"));
+            return true;
+        }
+        read_compressed_data(fs, e->start_block, e->compressed,
+                             range_span(node->r) << fs->fs.blocksize_order, sums,
+                             range_lshift(irangel(e_offset, len), fs->fs.blocksize_order),
+                             sg, apply_merge(bound(m)));
+    } else if (!u || ((u != INVALID_ADDRESS) && u->initialized)) {
+        tfs_read_blocks(fs, e, sg, e_offset, len, apply_merge(bound(m)));
+    } else
+        sg_zero_fill(sg, range_span(blocks) << fs->fs.blocksize_order);
+    return true;
+}
+
+closure_function(3, 1, boolean, zero_hole,
+                 tfs, fs, sg_list, sg, range, blocks,
+                 range z)
+{
+    range i = range_intersection(bound(blocks), z);
+    u64 length = range_span(i) << bound(fs)->fs.blocksize_order;
+    tfs_debug("%s: i %R, length %ld\n", func_ss, i, length);
+    sg_zero_fill(bound(sg), length);
+    return true;
+}
+
+BSS_RO_AFTER_INIT io_status_handler ignore_io_status;
+
+/* whole block reads, file length resolved in cache */
+static void tfs_read(fsfile fsf,
+                 sg_list sg, range q, status_handler complete)
+{
+    tfs fs = (tfs)fsf->fs;
+    tfsfile f = (tfsfile)fsf;
+    merge m = allocate_merge(fs->fs.h, complete);
+    status_handler k = apply_merge(m);
+    tfs_debug("%s: fsfile %p, sg %p, q %R, sh %F\n", func_ss, f, sg, q, complete);
+
+    /* read extent data and zero gaps */
+    q.end = MIN(q.end, fsf->length);
+    range blocks = range_rshift_pad(q, fs->fs.blocksize_order);
+    filesystem_lock(&fs->fs);
+    rangemap_range_lookup_with_gaps(f->extentmap, blocks,
+                                    stack_closure(read_extent, fs, sg, m, blocks),
+                                    stack_closure(zero_hole, fs, sg, blocks));
+    filesystem_unlock(&fs->fs);
+    apply(k, STATUS_OK);
+}
+
+#ifndef TFS_READ_ONLY
+static tuple cleanup_directory(tuple dir);
+
+int filesystem_write_tuple(tfs fs, tuple t)
+{
+    if (fs->fs.ro)
+        return -EROFS;
+    if (log_write(fs->tl, t) && (!fs->temp_log || log_write(fs->temp_log, t)))
+        return 0;
+    else
+        return -ENOSPC;
+}
+
+int filesystem_write_eav(tfs fs, tuple t, symbol a, value v, boolean cleanup)
+{
+    if (fs->fs.ro)
+        return -EROFS;
+    tuple parent = cleanup ? cleanup_directory(v) : 0;
+    boolean success = log_write_eav(fs->tl, t, a, v);
+    if (success && fs->temp_log) {
+        /* The above log_write_eav() call might have started a TFS log rebuild, in which case the
+         * entire directory tree has been fixed up again and we have to do another cleanup. */
+        if (cleanup)
+            cleanup_directory(v);
+        success = log_write_eav(fs->temp_log, t, a, v);
+    }
+    if (cleanup)
+        fixup_directory(parent, v);
+    if (success)
+        return 0;
+    else
+        return -ENOSPC;
+}
+
+static int tfs_truncate(filesystem fs, fsfile f, u64 len)
+{
+#ifdef KERNEL
+    /* dirty data past the new end of the file is discarded from the page cache */
+    if (len < fsfile_get_length(f))
+        tfsfile_delalloc_release((tfs)fs, (tfsfile)f,
+                                 irange(pad(len, fs_blocksize(fs)) >> fs->blocksize_order,
+                                        infinity));
+#endif
+    if (f->md) {
+        value v = value_from_u64(len);
+        if (v == INVALID_ADDRESS)
+            return -ENOMEM;
+        symbol l = sym(filelength);
+        int s = filesystem_write_eav((tfs)fs, f->md, l, v, false);
+        if (s != 0)
+            return s;
+        set(f->md, l, v);
+        f->status |= FSF_DIRTY_DATASYNC;
+    }
+    return 0;
+}
+
+/* Returns the storage block that would make data at the given file block contiguous on storage with
+ * the preceding extent of the file. */
+static u64 tfsfile_alloc_goal(tfsfile f, u64 file_block)
+{
+    extent ex = (extent)rangemap_lookup_max_lte(f->extentmap, file_block);
+    return (ex != INVALID_ADDRESS) ? ex->start_block + ex->allocated : 0;
+}
+
+/* Returns the amount of storage to preallocate for a file when appending to it. */
+static u64 tfsfile_prealloc_size(tfs fs, tfsfile f)
+{
+    rmnode last = rangemap_lookup_max_lte(f->extentmap, infinity);
+    u64 size = (last != INVALID_ADDRESS) ? last->r.end : 0;
+    int order = fs->fs.blocksize_order;
+    return MIN(MAX(size, TFS_PREALLOC_MIN >> order), TFS_PREALLOC_MAX >> order);
+}
+
+/* create a new extent in the filesystem
+
+   The life an extent depends on a particular allocation of contiguous
+   storage space. The extent is tied to this allocated area (nominally
+   page size). Only the extent data length and allocation size may be
    updated; the file offset and block start are immutable. As an
    optimization, adjacent extents on the disk could be joined into
    larger extents with only a meta update.
 
 */
 
-static int create_extent(tfs fs, range blocks, boolean uninited, extent *ex)
+static int create_extent(tfs fs, tfsfile f, range blocks, boolean uninited, boolean prealloc,
+                         extent *ex)
 {
     assert(!fs->fs.ro);
     heap h = fs->fs.h;
-    u64 nblocks = MAX(range_span(blocks), MIN_EXTENT_SIZE >> fs->fs.blocksize_order);
-    nblocks = MIN(range_span(blocks), MAX_EXTENT_SIZE >> fs->fs.blocksize_order);
+    u64 nblocks = MIN(range_span(blocks), MAX_EXTENT_SIZE >> fs->fs.blocksize_order);
 
     tfs_debug("create_extent: blocks %R, uninited %p, nblocks %ld\n", blocks, uninited, nblocks);
     if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
         !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0))
         return -ENOSPC;
 
-    u64 start_block = filesystem_allocate_storage(fs, nblocks);
-    while (start_block == u64_from_pointer(INVALID_ADDRESS)) {
+    /* the preallocated storage of the file is used first, if it follows the preceding extent */
+    u64 goal = tfsfile_alloc_goal(f, blocks.start);
+    u64 start_block = INVALID_PHYSICAL;
+    u64 taken = tfsfile_take_prealloc(fs, f, goal, nblocks);
+    if (taken) {
+        start_block = goal;
+        nblocks = taken;
+    } else if (prealloc) {
+        start_block = tfsfile_allocate_storage(fs, f, nblocks, tfsfile_prealloc_size(fs, f), goal);
+    }
+    if (start_block == INVALID_PHYSICAL)
+        start_block = filesystem_allocate_storage(fs, nblocks, goal);
+    while (start_block == INVALID_PHYSICAL) {
         if (nblocks <= (MIN_EXTENT_ALLOC_SIZE >> fs->fs.blocksize_order))
             break;
         nblocks /= 2;
-        start_block = filesystem_allocate_storage(fs, nblocks);
+        start_block = filesystem_allocate_storage(fs, nblocks, goal);
     }
-    if (start_block == u64_from_pointer(INVALID_ADDRESS))
+    if (start_block == INVALID_PHYSICAL)
         return -ENOSPC;
 
     range storage_blocks = irangel(start_block, nblocks);
@@ -423,16 +1257,79 @@ static int create_extent(tfs fs, range blocks, boolean uninited, extent *ex)
     return 0;
 }
 
+static void tfs_cdata_invalidate(tfs fs, u64 start_block)
+{
+    tfs_cdata_lock(fs);
+    tfs_cdata cd = tfs_cdata_lookup(fs, start_block);
+    if (cd) {
+        list_delete(&cd->l);
+        fs->cdata_count--;
+        if (cd->loading) {
+            cd->stale = true;
+            cd = 0;
+        }
+    }
+    tfs_cdata_unlock(fs);
+    if (cd)
+        tfs_cdata_free(fs, cd);
+}
+
+/* Checksum update of a write in progress (see tfs_checksums_write() below) */
+typedef struct tfs_checksum_update {
+    struct list l;          /* in the list of the extent, unless the extent has been destroyed */
+    tfsfile f;              /* with a reference held */
+    extent ex;
+    u64 index;              /* first data block of the extent */
+    u64 n;
+    boolean failed;         /* the write of the blocks failed */
+    status_handler completion;
+    closure_struct(status_handler, written);
+    u32 sums[];
+} *tfs_checksum_update;
+
+static void tfs_checksum_update_free(tfs fs, tfs_checksum_update u)
+{
+    fsfile_release(&u->f->f);
+    deallocate(fs->fs.h, u, sizeof(*u) + u->n * sizeof(u32));
+}
+
+/* Detaches the checksum updates of the writes in progress to an extent that is being destroyed
+ * or replaced; called with the filesystem locked. */
+static void tfs_extent_detach_updates(extent ex)
+{
+    list_foreach(&ex->checksum_updates, l) {
+        list_delete(l);
+        struct_from_list(l, tfs_checksum_update, l)->ex = 0;
+    }
+}
+
 static void destroy_extent(tfs fs, extent ex)
 {
+    if (ex->compressed)
+        tfs_cdata_invalidate(fs, ex->start_block);
     range q = irangel(ex->start_block, ex->allocated);
     if (!filesystem_free_storage(fs, q))
         msg_err("failed to mark extent at %R as free", q);
     if (ex->uninited && ex->uninited != INVALID_ADDRESS)
         refcount_release(&ex->uninited->refcount);
+    tfs_extent_detach_updates(ex);
     deallocate(fs->fs.h, ex, sizeof(*ex));
 }
 
+static tuple extent_tuple(extent ex)
+{
+    // XXX encode this as an immediate bitstring
+    tuple e = allocate_tuple();
+    set(e, sym(offset), value_from_u64(ex->start_block));
+    set(e, sym(length), value_from_u64(range_span(ex->node.r)));
+    set(e, sym(allocated), value_from_u64(ex->allocated));
+    if (ex->uninited == INVALID_ADDRESS)
+        set(e, sym(uninited), null_value);
+    if (ex->compressed)
+        set(e, sym(compressed), value_from_u64(ex->compressed));
+    return e;
+}
+
 static int add_extent_to_file(tfsfile f, extent ex)
 {
     tuple md = f->f.md;
@@ -450,14 +1347,8 @@ static int add_extent_to_file(tfsfile f, extent ex)
             set(md, a, extents);
         }
 
-        // XXX encode this as an immediate bitstring
-        tuple e = allocate_tuple();
+        tuple e = extent_tuple(ex);
         ex->md = e;
-        set(e, sym(offset), value_from_u64(ex->start_block));
-        set(e, sym(length), value_from_u64(range_span(ex->node.r)));
-        set(e, sym(allocated), value_from_u64(ex->allocated));
-        if (ex->uninited == INVALID_ADDRESS)
-            set(e, sym(uninited), null_value);
         symbol offs = intern_u64(ex->node.r.start);
         int s = filesystem_write_eav(fs, extents, offs, e, false);
         if (s != 0) {
@@ -491,40 +1382,251 @@ static void remove_extent_from_file(tfsfile f, extent ex)
     rangemap_remove_node(f->extentmap, &ex->node);
 }
 
-define_closure_function(2, 1, void, uninited_complete,
-                        uninited, u, status_handler, complete,
-                        status s)
+/* Stores the checksums of n data blocks of an extent starting at block index, taking them from sums
+ * or, if sums is 0, setting them all to fill. The checksums attribute of the extent is created only
+ * if checksums are enabled; called with the filesystem locked. */
+static int tfs_checksums_set(tfsfile f, extent ex, u64 index, u64 n, u32 *sums, u32 fill)
 {
-    uninited u = bound(u);
-    if (!is_ok(s))
-        s = timm_up(s, "result", "failed to convert uninited extent");
-    apply(bound(complete), s);
-
-    u->initialized = true;
-    refcount_release(&u->refcount);
+    tfs fs = tfs_from_file(f);
+    if (!ex->md)
+        return 0;
+    symbol a = sym(checksums);
+    tuple checksums = get_tuple(ex->md, a);
+    boolean created = !checksums;
+    if (created) {
+        if (!fs->checksums)
+            return 0;
+        checksums = allocate_tuple();
+        if (checksums == INVALID_ADDRESS)
+            return -ENOMEM;
+    }
+    u32 group_sums[TFS_CHECKSUM_GROUP_BLOCKS];
+    int fss = 0;
+    for (u64 i = 0; i < n; ) {
+        u64 group = (index + i) / TFS_CHECKSUM_GROUP_BLOCKS;
+        u64 offset = (index + i) % TFS_CHECKSUM_GROUP_BLOCKS;
+        u64 count = MIN(n - i, TFS_CHECKSUM_GROUP_BLOCKS - offset);
+        symbol k = intern_u64(group);
+        string old = get_string(checksums, k);
+        if (old && (buffer_length(old) == sizeof(group_sums)))
+            runtime_memcpy(group_sums, buffer_ref(old, 0), sizeof(group_sums));
+        else
+            zero(group_sums, sizeof(group_sums));
+        for (u64 j = 0; j < count; j++)
+            group_sums[offset + j] = htole32(sums ? sums[i + j] : fill);
+        string s = allocate_string(sizeof(group_sums));
+        if ((s == INVALID_ADDRESS) || !buffer_write(s, group_sums, sizeof(group_sums))) {
+            if (s != INVALID_ADDRESS)
+                deallocate_string(s);
+            fss = -ENOMEM;
+            break;
+        }
+        if (!created) {
+            fss = filesystem_write_eav(fs, checksums, k, s, false);
+            if (fss != 0) {
+                deallocate_string(s);
+                break;
+            }
+        }
+        if (old)
+            deallocate_value(old);
+        set(checksums, k, s);
+        i += count;
+    }
+    if (created) {
+        if (fss == 0)
+            fss = filesystem_write_eav(fs, ex->md, a, checksums, false);
+        if (fss != 0) {
+            destruct_value(checksums, true);
+            return fss;
+        }
+        set(ex->md, a, checksums);
+    }
+    if (fss == 0)
+        f->f.status |= FSF_DIRTY_DATASYNC;
+    return fss;
 }
 
-define_closure_function(2, 0, void, free_uninited,
-                        heap, h, uninited, u)
+/* The checksums of the blocks being written are logged as unknown before the data is written, and
+ * their new values are logged only after the data write has completed and the storage cache has
+ * been flushed, so that neither a crash nor a concurrent read can pair a block with a checksum of
+ * data it does not contain. The checksum updates of writes in progress are linked to their extent
+ * in the order the writes are issued; when an update is applied, the blocks that have been written
+ * again in the meantime are left to the update of the later write. Completed updates are queued and
+ * applied in batches, each batch after its own storage flush. */
+static void tfs_checksums_flush(tfs fs)
 {
-    tfs_debug("%s: %p\n", func_ss, bound(u));
-    deallocate(bound(h), bound(u), sizeof(struct uninited));
+    tfs_sync_lock(fs);
+    vector batch = fs->checksum_batch;
+    fs->checksum_batch = fs->checksum_pending;
+    fs->checksum_pending = batch;
+    tfs_sync_unlock(fs);
+    struct storage_req req = {
+        .op = STORAGE_OP_FLUSH,
+        .blocks = irange(0, 0),
+        .completion = (status_handler)&fs->checksum_flushed,
+    };
+    apply(fs->req_handler, &req);
 }
 
-static uninited allocate_uninited(tfs fs, status_handler sh)
+closure_func_basic(status_handler, void, tfs_checksums_written,
+                   status s)
 {
-    heap h = fs->fs.h;
-    uninited u = allocate(h, sizeof(struct uninited));
-    if (u == INVALID_ADDRESS)
-        return u;
-    u->fs = fs;
-    init_refcount(&u->refcount, 2, init_closure(&u->free, free_uninited, h, u));
-    u->initialized = false;
-    init_closure(&u->complete, uninited_complete, u, sh);
-    return u;
+    tfs_checksum_update u = struct_from_closure(tfs_checksum_update, written);
+    status_handler completion = u->completion;
+    tfsfile f = u->f;
+    tfs fs = tfs_from_file(f);
+    boolean flush = false;
+    /* the update is applied in the context of the flush completion, where the file can be locked;
+     * the checksums of blocks whose write failed remain unknown */
+    u->failed = !is_ok(s);
+    tfs_sync_lock(fs);
+    vector_push(fs->checksum_pending, u);
+    if (!fs->checksum_flushing)
+        flush = fs->checksum_flushing = true;
+    tfs_sync_unlock(fs);
+    apply(completion, s);
+    if (flush)
+        tfs_checksums_flush(fs);
 }
 
-static u64 write_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m)
+closure_func_basic(status_handler, void, tfs_checksums_flushed,
+                   status s)
+{
+    tfs fs = struct_from_closure(tfs, checksum_flushed);
+    tfs_checksum_update u;
+    filesystem_lock(&fs->fs);
+    vector_foreach(fs->checksum_batch, u) {
+        tfsfile f = u->f;
+        extent ex = u->ex;
+        if (ex) {
+            /* the blocks written by later writes in progress are left unknown */
+            for (list l = u->l.next; l != &ex->checksum_updates; l = l->next) {
+                tfs_checksum_update later = struct_from_list(l, tfs_checksum_update, l);
+                range r = range_intersection(irangel(u->index, u->n),
+                                             irangel(later->index, later->n));
+                for (u64 i = r.start; i < r.end; i++)
+                    u->sums[i - u->index] = 0;
+            }
+            list_delete(&u->l);
+            if (is_ok(s) && !u->failed) {
+                int fss = tfs_checksums_set(f, ex, u->index, u->n, u->sums, 0);
+                if (fss != 0)
+                    msg_err("failed to log checksums: %d\n", fss);
+            }
+        }
+        tfs_checksum_update_free(fs, u);
+    }
+    filesystem_unlock(&fs->fs);
+    vector_clear(fs->checksum_batch);
+    if (!is_ok(s))
+        timm_dealloc(s);
+    tfs_sync_lock(fs);
+    boolean next = vector_length(fs->checksum_pending) != 0;
+    if (!next)
+        fs->checksum_flushing = false;
+    tfs_sync_unlock(fs);
+    if (next)
+        tfs_checksums_flush(fs);
+}
+
+/* Logs as unknown the checksums of the blocks of a checksum update, and links the update to its
+ * extent: on success, *sh is replaced with a completion for the write of the blocks, which queues
+ * the update before invoking the original completion. The update is deallocated on failure. */
+static int tfs_checksum_update_start(tfsfile f, extent ex, tfs_checksum_update u,
+                                     status_handler *sh)
+{
+    tfs fs = tfs_from_file(f);
+    int fss = tfs_checksums_set(f, ex, u->index, u->n, 0, 0);
+    if (fss != 0) {
+        deallocate(fs->fs.h, u, sizeof(*u) + u->n * sizeof(u32));
+        return fss;
+    }
+    fsfile_reserve(&f->f);
+    u->f = f;
+    u->ex = ex;
+    u->failed = false;
+    list_push_back(&ex->checksum_updates, &u->l);
+    u->completion = *sh;
+    *sh = init_closure_func(&u->written, status_handler, tfs_checksums_written);
+    return 0;
+}
+
+/* Prepares the update of the checksums of the extent blocks at file blocks r, which are about to be
+ * written with the data at the head of sg, or zeroed if sg is 0. Called with the filesystem
+ * locked. */
+static int tfs_checksums_write(tfsfile f, extent ex, sg_list sg, range r, status_handler *sh)
+{
+    tfs fs = tfs_from_file(f);
+    if (!ex->md || (!fs->checksums && !get(ex->md, sym(checksums))) || !range_span(r))
+        return 0;
+    /* blocks of an uninited extent outside the range being written are zeroed */
+    range q = (sg && (ex->uninited == INVALID_ADDRESS)) ? ex->node.r : r;
+    u64 n = range_span(q);
+    tfs_checksum_update u = allocate(fs->fs.h, sizeof(*u) + n * sizeof(u32));
+    if (u == INVALID_ADDRESS)
+        return -ENOMEM;
+    u->index = q.start - ex->node.r.start;
+    u->n = n;
+    for (u64 i = 0; i < n; i++)
+        u->sums[i] = fs->zero_checksum;
+    if (sg)
+        tfs_sg_checksums(fs, sg, range_span(r), u->sums + (r.start - q.start), false);
+    return tfs_checksum_update_start(f, ex, u, sh);
+}
+
+/* Prepares the checksums of the n data blocks of a new extent, whose data is in buf and is about to
+ * be written. Called with the filesystem locked. */
+static int tfs_checksums_buf(tfsfile f, extent ex, void *buf, u64 n, status_handler *sh)
+{
+    tfs fs = tfs_from_file(f);
+    if (!ex->md || !fs->checksums)
+        return 0;
+    tfs_checksum_update u = allocate(fs->fs.h, sizeof(*u) + n * sizeof(u32));
+    if (u == INVALID_ADDRESS)
+        return -ENOMEM;
+    u->index = 0;
+    u->n = n;
+    u64 block_size = fs_blocksize(&fs->fs);
+    for (u64 i = 0; i < n; i++)
+        u->sums[i] = crc32c(0, buf + (i << fs->fs.blocksize_order), block_size);
+    return tfs_checksum_update_start(f, ex, u, sh);
+}
+
+define_closure_function(2, 1, void, uninited_complete,
+                        uninited, u, status_handler, complete,
+                        status s)
+{
+    uninited u = bound(u);
+    if (!is_ok(s))
+        s = timm_up(s, "result", "failed to convert uninited extent");
+    apply(bound(complete), s);
+
+    u->initialized = true;
+    refcount_release(&u->refcount);
+}
+
+define_closure_function(2, 0, void, free_uninited,
+                        heap, h, uninited, u)
+{
+    tfs_debug("%s: %p\n", func_ss, bound(u));
+    deallocate(bound(h), bound(u), sizeof(struct uninited));
+}
+
+static uninited allocate_uninited(tfs fs, status_handler sh)
+{
+    heap h = fs->fs.h;
+    uninited u = allocate(h, sizeof(struct uninited));
+    if (u == INVALID_ADDRESS)
+        return u;
+    u->fs = fs;
+    init_refcount(&u->refcount, 2, init_closure(&u->free, free_uninited, h, u));
+    u->initialized = false;
+    init_closure(&u->complete, uninited_complete, u, sh);
+    return u;
+}
+
+static u64 write_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m)
 {
     tfs fs = tfs_from_file(f);
     range i = range_intersection(blocks, ex->node.r);
@@ -534,23 +1636,34 @@ static u64 write_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m)
     tfs_debug("   %s: ex %p, uninited %p, sg %p, m %p, blocks %R, write %R\n",
               func_ss, ex, ex->uninited, sg, m, blocks, r);
 
+    status_handler sh = apply_merge(m);
+    int fss = tfs_checksums_write(f, ex, sg, i, &sh);
+    if (fss != 0) {
+        if (sg)
+            sg_consume(sg, range_span(i) << fs->fs.blocksize_order);
+        status s = timm("result", "failed to write checksums");
+        apply(sh, timm_append(s, "fsstatus", "%d", fss));
+        return i.end;
+    }
+
     if (ex->uninited == INVALID_ADDRESS) {
         /* Begin process of normalizing uninited extent */
         if (f->f.md) {
             assert(ex->md);
             symbol a = sym(uninited);
             tfs_debug("%s: log write %p, %p\n", func_ss, ex->md, a);
-            int fss = filesystem_write_eav(fs, ex->md, a, 0, false);
+            fss = filesystem_write_eav(fs, ex->md, a, 0, false);
             if (fss != 0) {
+                if (sg)
+                    sg_consume(sg, range_span(i) << fs->fs.blocksize_order);
                 status s = timm("result", "failed to write log");
-                apply(apply_merge(m), timm_append(s,
-                                           "fsstatus", "%d", fss));
+                apply(sh, timm_append(s, "fsstatus", "%d", fss));
                 return i.end;
             }
             set(ex->md, a, 0);
             f->f.status |= FSF_DIRTY_DATASYNC;
         }
-        ex->uninited = allocate_uninited(fs, apply_merge(m));
+        ex->uninited = allocate_uninited(fs, sh);
         tfs_debug("%s: new uninited %p\n", func_ss, ex->uninited);
         if (ex->uninited == INVALID_ADDRESS)
             goto alloc_fail;
@@ -573,21 +1686,136 @@ static u64 write_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m)
         return i.end;
     }
     if (sg)
-        filesystem_storage_op(fs, sg, r, true, apply_merge(m));
+        filesystem_storage_op(fs, sg, r, true, sh);
     else
-        zero_blocks(fs, r, m);
+        zero_blocks_storage(fs, r, sh);
     return i.end;
   alloc_fail:
-    apply(apply_merge(m), timm("result", "unable to allocate memory for uninited write"));
+    apply(sh, timm("result", "unable to allocate memory for uninited write"));
     return i.end;
 }
 
-static int fill_gap(tfsfile f, sg_list sg, range blocks, merge m, u64 *edge)
+closure_function(5, 1, void, tfs_buf_write_complete,
+                 tfs, fs, sg_list, sg, void *, buf, u64, length, status_handler, completion,
+                 status s)
+{
+    tfs fs = bound(fs);
+    sg_list sg = bound(sg);
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    deallocate(fs->dma, bound(buf), bound(length));
+    apply(bound(completion), s);
+    closure_finish();
+}
+
+/* Writes the contents of a buffer allocated from the DMA heap to storage, deallocating the buffer
+ * when the write completes. */
+static void tfs_buf_write(tfs fs, void *buf, u64 length, range blocks, status_handler completion)
+{
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        goto alloc_fail;
+    sg_buf sgb = sg_list_tail_add(sg, length);
+    if (sgb == INVALID_ADDRESS)
+        goto dealloc_sg;
+    sgb->buf = buf;
+    sgb->offset = 0;
+    sgb->size = length;
+    sgb->refcount = 0;
+    status_handler sh = closure(fs->fs.h, tfs_buf_write_complete, fs, sg, buf, length, completion);
+    if (sh == INVALID_ADDRESS)
+        goto dealloc_sg;
+    filesystem_storage_op(fs, sg, blocks, true, sh);
+    return;
+  dealloc_sg:
+    deallocate_sg_list(sg);
+  alloc_fail:
+    deallocate(fs->dma, buf, length);
+    apply(completion, timm("result", "failed to allocate buffer write"));
+}
+
+/* Writes the data for (part of) a gap to a new extent, which stores the data in compressed form if
+ * that saves at least one block. */
+static int fill_gap_compressed(tfsfile f, sg_list sg, range blocks, merge m, u64 *edge)
+{
+    tfs fs = tfs_from_file(f);
+    heap h = fs->fs.h;
+    int order = fs->fs.blocksize_order;
+    blocks.end = MIN(blocks.end, blocks.start + (TFS_COMPRESSED_EXTENT_SIZE >> order));
+    tfs_debug("   %s: writing new extent blocks %R\n", func_ss, blocks);
+    if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
+        !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0))
+        return -ENOSPC;
+    u64 length = range_span(blocks) << order;
+    int fss = -ENOMEM;
+    void *data = allocate(fs->dma, length);
+    if (data == INVALID_ADDRESS)
+        return fss;
+    void *cdata = allocate(fs->dma, length);
+    if (cdata == INVALID_ADDRESS)
+        goto dealloc_data;
+    void *table = allocate(h, LZ4_HASH_TABLE_SIZE);
+    if (table == INVALID_ADDRESS) {
+        deallocate(fs->dma, cdata, length);
+        goto dealloc_data;
+    }
+    u64 copied = sg_copy_to_buf(data, sg, length);
+    zero(data + copied, length - copied);
+    u64 compressed = lz4_compress(data, length, cdata, length - U64_FROM_BIT(order), table);
+    deallocate(h, table, LZ4_HASH_TABLE_SIZE);
+    u64 nblocks;
+    if (compressed) {
+        deallocate(fs->dma, data, length);
+        data = cdata;
+        nblocks = pad(compressed, U64_FROM_BIT(order)) >> order;
+        zero(data + compressed, (nblocks << order) - compressed);
+    } else {
+        deallocate(fs->dma, cdata, length);
+        nblocks = range_span(blocks);
+    }
+    u64 start_block = filesystem_allocate_storage(fs, nblocks, tfsfile_alloc_goal(f, blocks.start));
+    if (start_block == INVALID_PHYSICAL) {
+        fss = -ENOSPC;
+        goto dealloc_data;
+    }
+    extent ex = allocate_extent(h, blocks, irangel(start_block, nblocks));
+    if (ex == INVALID_ADDRESS) {
+        filesystem_free_storage(fs, irangel(start_block, nblocks));
+        goto dealloc_data;
+    }
+    ex->md = 0;
+    ex->compressed = compressed;
+    fss = add_extent_to_file(f, ex);
+    if (fss != 0) {
+        destroy_extent(fs, ex);
+        goto dealloc_data;
+    }
+    status_handler sh = apply_merge(m);
+    fss = tfs_checksums_buf(f, ex, data, nblocks, &sh);
+    if (fss != 0) {
+        /* the error is reported by the caller */
+        apply(sh, STATUS_OK);
+        remove_extent_from_file(f, ex);
+        destroy_extent(fs, ex);
+        goto dealloc_data;
+    }
+    tfs_buf_write(fs, data, length, irangel(start_block, nblocks), sh);
+    *edge = blocks.end;
+    return 0;
+  dealloc_data:
+    deallocate(fs->dma, data, length);
+    return fss;
+}
+
+static int fill_gap(tfsfile f, sg_list sg, range blocks, merge m, boolean compress,
+                    boolean prealloc, u64 *edge)
 {
+    if (compress && sg)
+        return fill_gap_compressed(f, sg, blocks, m, edge);
     tfs_debug("   %s: writing new extent blocks %R\n", func_ss, blocks);
     extent ex;
     tfs fs = tfs_from_file(f);
-    int fss = create_extent(fs, blocks, m ? false : true, &ex);
+    int fss = create_extent(fs, f, blocks, m ? false : true, prealloc, &ex);
     if (fss != 0)
         return fss;
     blocks = ex->node.r;
@@ -653,11 +1881,21 @@ static int extend(tfsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *
         u64 limit = fs->fs.size >> fs->fs.blocksize_order;
         if (new.end > limit)
             new.end = limit;
-        if (range_span(new) && filesystem_reserve_storage(fs, new)) {
+        u64 taken = tfsfile_take_prealloc(fs, f, new.start, range_span(new));
+        if (taken) {
+            new.end = new.start + taken;
+            int s = update_extent_allocated(f, ex, ex->allocated + taken);
+            if (s == 0) {
+                r.end += taken;
+                free += taken;
+            } else {
+                filesystem_free_storage(fs, new);
+            }
+        } else if (range_span(new) && filesystem_reserve_storage(fs, new)) {
             int s = update_extent_allocated(f, ex, ex->allocated + range_span(new));
             if (s == 0) {
-                r.end = blocks.end;
-                free = r.end - ex->node.r.end;
+                r.end += range_span(new);
+                free += range_span(new);
             } else {
                 filesystem_free_storage(fs, new);
             }
@@ -687,7 +1925,8 @@ static int extend(tfsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *
     return s;
 }
 
-static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merge m)
+static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merge m,
+                                    boolean compress)
 {
     assert(range_span(q) > 0);
     range blocks = range_rshift_pad(q, fs->fs.blocksize_order);
@@ -708,14 +1947,20 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
         next = rangemap_next_node(f->extentmap, prev);
     }
 
+    /* appending data to a file that already has some gets storage preallocated past its end */
+    rmnode last = rangemap_lookup_max_lte(f->extentmap, infinity);
+    boolean prealloc = sg && (last != INVALID_ADDRESS) && (blocks.end > last->r.end);
+
     do {
         tfs_debug("   prev %p, next %p\n", prev, next);
         u64 limit = next == INVALID_ADDRESS ? blocks.end : MIN(blocks.end, next->r.start);
         int fss;
         if (!m || sg) {
             if (blocks.start < limit) {
-                /* try to extend previous node */
-                if (prev != INVALID_ADDRESS && prev->r.end < limit) {
+                /* try to extend previous node; when compressing, new data always goes to new
+                 * extents, and compressed extents are never extended */
+                if (!compress && prev != INVALID_ADDRESS && prev->r.end < limit &&
+                    !((extent)prev)->compressed) {
                     tfs_debug("   extent start 0x%lx, limit 0x%lx\n", blocks.start, limit);
                     fss = extend(f, (extent)prev, sg, irange(blocks.start, limit), m, &blocks.start);
                     if (fss != 0) {
@@ -727,7 +1972,8 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
                 /* fill space */
                 while (blocks.start < limit) {
                     tfs_debug("   fill start 0x%lx, limit 0x%lx\n", blocks.start, limit);
-                    fss = fill_gap(f, sg, irange(blocks.start, limit), m, &blocks.start);
+                    fss = fill_gap(f, sg, irange(blocks.start, limit), m, compress, prealloc,
+                                   &blocks.start);
                     if (fss != 0) {
                         status s = timm("result", "unable to create extent");
                         return timm_append(s, "fsstatus", "%d", fss);
@@ -771,6 +2017,138 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
     return STATUS_OK;
 }
 
+/* Compressed extents cannot be modified in place: a compressed extent that is partially overwritten
+ * (or zeroed) is replaced with uncompressed extents containing its data before the write proceeds,
+ * while a compressed extent that is entirely overwritten is simply removed. */
+static extent prepare_compressed_extents(tfs fs, tfsfile f, range blocks, boolean zero)
+{
+    rmnode n = rangemap_lookup_max_lte(f->extentmap, blocks.start);
+    if (n == INVALID_ADDRESS)
+        n = rangemap_first_node(f->extentmap);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        extent ex = (extent)n;
+        n = rangemap_next_node(f->extentmap, n);
+        if (!ex->compressed || (ex->node.r.end <= blocks.start))
+            continue;
+        if (!range_contains(blocks, ex->node.r))
+            return ex;
+        if (!zero) {
+            remove_extent_from_file(f, ex);
+            destroy_extent(fs, ex);
+        }
+    }
+    return 0;
+}
+
+closure_function(6, 1, void, uncompress_extent_complete,
+                 tfsfile, f, range, r, u64, start_block, void *, buf, sg_list, sg,
+                 status_handler, completion,
+                 status s)
+{
+    tfsfile f = bound(f);
+    tfs fs = tfs_from_file(f);
+    range r = bound(r);
+    u64 start_block = bound(start_block);
+    void *buf = bound(buf);
+    u64 length = range_span(r) << fs->fs.blocksize_order;
+    status_handler completion = bound(completion);
+    deallocate_sg_list(bound(sg));
+    closure_finish();
+    if (!is_ok(s))
+        goto out;
+    filesystem_lock(&fs->fs);
+
+    /* the extent may have been removed while its data was being read */
+    extent ex = (extent)rangemap_lookup(f->extentmap, r.start);
+    if ((ex == INVALID_ADDRESS) || !range_equal(ex->node.r, r) ||
+        (ex->start_block != start_block) || !ex->compressed) {
+        filesystem_unlock(&fs->fs);
+        goto out;
+    }
+    range q = range_lshift(r, fs->fs.blocksize_order);
+    q.end = MIN(q.end, fsfile_get_length(&f->f));
+    remove_extent_from_file(f, ex);
+    destroy_extent(fs, ex);
+    if (range_span(q) == 0) {
+        filesystem_unlock(&fs->fs);
+        goto out;
+    }
+    sg_list sg = allocate_sg_list();
+    sg_buf sgb = (sg != INVALID_ADDRESS) ? sg_list_tail_add(sg, length) : INVALID_ADDRESS;
+    if (sgb == INVALID_ADDRESS) {
+        filesystem_unlock(&fs->fs);
+        if (sg != INVALID_ADDRESS)
+            deallocate_sg_list(sg);
+        s = timm("result", "failed to allocate sg list");
+        goto out;
+    }
+    sgb->buf = buf;
+    sgb->offset = 0;
+    sgb->size = length;
+    sgb->refcount = 0;
+    merge m = allocate_merge(fs->fs.h,
+                             closure(fs->fs.h, tfs_buf_write_complete, fs, sg, buf, length,
+                                     completion));
+    status_handler sh = apply_merge(m);
+    s = extents_range_handler(fs, f, q, sg, m, false);
+    filesystem_unlock(&fs->fs);
+    apply(sh, s);
+    return;
+  out:
+    deallocate(fs->dma, buf, length);
+    apply(completion, s);
+}
+
+/* Rewrites the data of the compressed extent at file block range r to uncompressed extents; called
+ * without locks held, with the extent fields and checksums sampled while the file was locked. */
+static void uncompress_extent(tfs fs, tfsfile f, range r, u64 start_block, u64 compressed,
+                              u32 *sums, status_handler completion)
+{
+    tfs_debug("%s: f %p, r %R, start_block 0x%lx\n", func_ss, f, r, start_block);
+    u64 length = range_span(r) << fs->fs.blocksize_order;
+    void *buf = allocate(fs->dma, length);
+    if (buf == INVALID_ADDRESS)
+        goto alloc_fail;
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        goto dealloc_buf;
+    sg_buf sgb = sg_list_tail_add(sg, length);
+    if (sgb == INVALID_ADDRESS)
+        goto dealloc_sg;
+    sgb->buf = buf;
+    sgb->offset = 0;
+    sgb->size = length;
+    sgb->refcount = 0;
+    status_handler sh = closure(fs->fs.h, uncompress_extent_complete, f, r, start_block, buf, sg,
+                                completion);
+    if (sh == INVALID_ADDRESS)
+        goto dealloc_sg;
+    read_compressed_data(fs, start_block, compressed, length, sums, irange(0, length), sg, sh);
+    return;
+  dealloc_sg:
+    deallocate_sg_list(sg);
+  dealloc_buf:
+    deallocate(fs->dma, buf, length);
+  alloc_fail:
+    if (sums)
+        deallocate(fs->fs.h, sums, (pad(compressed, fs_blocksize(&fs->fs)) >>
+                                    fs->fs.blocksize_order) * sizeof(u32));
+    apply(completion, timm("result", "failed to allocate compressed extent buffer"));
+}
+
+static void tfs_write(fsfile fsf, sg_list sg, range q, status_handler complete);
+
+closure_function(4, 1, void, tfs_write_uncompressed,
+                 fsfile, fsf, sg_list, sg, range, q, status_handler, complete,
+                 status s)
+{
+    if (is_ok(s))
+        tfs_write(bound(fsf), bound(sg), bound(q), bound(complete));
+    else
+        apply(bound(complete), s);
+    closure_finish();
+}
+
 static void tfs_write(fsfile fsf,
                  sg_list sg, range q, status_handler complete)
 {
@@ -785,43 +2163,130 @@ static void tfs_write(fsfile fsf,
         return;
     }
 
+    filesystem_lock(&fs->fs);
+    if (ranges_intersect(f->defrag, range_rshift_pad(q, fs->fs.blocksize_order)))
+        f->defrag_dirty = true;
+    extent cex = prepare_compressed_extents(fs, f, range_rshift_pad(q, fs->fs.blocksize_order),
+                                            sg == 0);
+    if (cex) {
+        range r = cex->node.r;
+        u64 start_block = cex->start_block;
+        u64 compressed = cex->compressed;
+        u32 *sums = tfs_extent_checksums(fs, cex, 0,
+                                         pad(compressed, fs_blocksize(&fs->fs)) >>
+                                         fs->fs.blocksize_order);
+        filesystem_unlock(&fs->fs);
+        if (sums == INVALID_ADDRESS) {
+            apply(complete, timm("result", "failed to allocate checksums"));
+            return;
+        }
+        uncompress_extent(fs, f, r, start_block, compressed, sums,
+                          closure(fs->fs.h, tfs_write_uncompressed, fsf, sg, q, complete));
+        return;
+    }
     merge m = allocate_merge(fs->fs.h, complete);
     status_handler sh = apply_merge(m);
-
-    filesystem_lock(&fs->fs);
-    status s = extents_range_handler(fs, f, q, sg, m);
+    status s = extents_range_handler(fs, f, q, sg, m, fs->compress);
+#ifdef KERNEL
+    tfsfile_delalloc_release(fs, f, range_rshift_pad(q, fs->fs.blocksize_order));
+#endif
     filesystem_unlock(&fs->fs);
     apply(sh, s);
 }
 
+/* Sync requests that complete their data writeback while a log and storage flush is in flight are
+ * queued and then served together by the next flush, so that concurrent fsync() calls share a
+ * single log extension write and a single storage cache flush. */
+static void tfs_sync_start(tfs fs, boolean flush_log)
+{
+    if (flush_log) {
+        filesystem_lock(&fs->fs);
+        log_flush(fs->tl, (status_handler)&fs->sync_log_flushed);
+        filesystem_unlock(&fs->fs);
+        return;
+    }
+    struct storage_req req = {
+        .op = STORAGE_OP_FLUSH,
+        .blocks = irange(0, 0),
+        .completion = (status_handler)&fs->sync_complete,
+    };
+    apply(fs->req_handler, &req);
+}
+
+closure_func_basic(status_handler, void, tfs_sync_log_flushed,
+                   status s)
+{
+    tfs fs = struct_from_closure(tfs, sync_log_flushed);
+    if (!is_ok(s)) {
+        status_handler complete = (status_handler)&fs->sync_complete;
+        apply(complete, s);
+        return;
+    }
+    tfs_sync_start(fs, false);
+}
+
+closure_func_basic(status_handler, void, tfs_sync_complete,
+                   status s)
+{
+    tfs fs = struct_from_closure(tfs, sync_complete);
+    vector batch = fs->sync_batch;
+    u64 batch_size = vector_length(batch);
+    status_handler completion;
+    vector_foreach(batch, completion) {
+#ifdef KERNEL
+        async_apply_status_handler(completion, s);
+#else
+        apply(completion, s);
+#endif
+    }
+    vector_clear(batch);
+    boolean flush_log;
+    tfs_sync_lock(fs);
+    fs->sync_batches[MIN(msb(batch_size), TFS_SYNC_BATCH_ORDERS - 1)]++;
+    boolean next = vector_length(fs->sync_pending) != 0;
+    if (next) {
+        fs->sync_batch = fs->sync_pending;
+        fs->sync_pending = batch;
+        flush_log = fs->sync_flush_log;
+        fs->sync_flush_log = false;
+    } else {
+        fs->syncing = false;
+    }
+    tfs_sync_unlock(fs);
+    if (next)
+        tfs_sync_start(fs, flush_log);
+}
+
 closure_function(3, 1, void, fs_cache_sync_complete,
                  tfs, fs, status_handler, completion, boolean, flush_log,
                  status s)
 {
+    status_handler completion = bound(completion);
     if (!is_ok(s)) {
 #ifdef KERNEL
-        async_apply_status_handler(bound(completion), s);
+        async_apply_status_handler(completion, s);
 #else
-        apply(bound(completion), s);
+        apply(completion, s);
 #endif
         closure_finish();
         return;
     }
-    if (bound(flush_log)) {
-        bound(flush_log) = false;
-        tfs fs = bound(fs);
-        filesystem_lock(&fs->fs);
-        log_flush(fs->tl, (status_handler)closure_self());
-        filesystem_unlock(&fs->fs);
-        return;
-    }
-    struct storage_req req = {
-        .op = STORAGE_OP_FLUSH,
-        .blocks = irange(0, 0),
-        .completion = bound(completion),
-    };
-    apply(bound(fs)->req_handler, &req);
+    tfs fs = bound(fs);
+    boolean flush_log = bound(flush_log);
     closure_finish();
+    boolean start;
+    tfs_sync_lock(fs);
+    start = !fs->syncing;
+    if (start) {
+        fs->syncing = true;
+        vector_push(fs->sync_batch, completion);
+    } else {
+        vector_push(fs->sync_pending, completion);
+        fs->sync_flush_log |= flush_log;
+    }
+    tfs_sync_unlock(fs);
+    if (start)
+        tfs_sync_start(fs, flush_log);
 }
 
 static status_handler tfs_get_sync_handler(filesystem fs, fsfile fsf, boolean datasync,
@@ -836,7 +2301,7 @@ static status_handler tfs_get_sync_handler(filesystem fs, fsfile fsf, boolean da
 }
 
 #ifdef KERNEL
-closure_function(2, 1, status, filesystem_check_or_reserve_extent,
+closure_function(2, 1, status, filesystem_reserve_delalloc,
                  tfs, fs, tfsfile, f,
                  range q)
 {
@@ -848,17 +2313,24 @@ closure_function(2, 1, status, filesystem_check_or_reserve_extent,
         return timm_append(s, "fsstatus", "%d", -EROFS);
     }
     filesystem_lock(&fs->fs);
-    status s = extents_range_handler(fs, f, q, 0, 0);
+    status s = tfsfile_delalloc_reserve(fs, f, range_rshift_pad(q, fs->fs.blocksize_order));
+    if ((s == STATUS_OK) && (fsfile_get_length(&f->f) < q.end)) {
+        int fss = filesystem_truncate_locked(&fs->fs, &f->f, q.end);
+        if (fss != 0) {
+            s = timm("result", "unable to set file length");
+            s = timm_append(s, "fsstatus", "%d", fss);
+        }
+    }
     filesystem_unlock(&fs->fs);
     return s;
 }
 
-static int add_extents(tfs fs, range i, rangemap rm)
+static int add_extents(tfs fs, tfsfile f, range i, rangemap rm)
 {
     extent ex;
     int fss;
     while (range_span(i)) {
-        fss = create_extent(fs, i, true, &ex);
+        fss = create_extent(fs, f, i, true, false, &ex);
         if (fss != 0)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
@@ -930,7 +2402,7 @@ void filesystem_alloc(fsfile f, long offset, long len,
         u64 edge = curr->r.start;
         range i = range_intersection(irange(lastedge, edge), blocks);
         if (range_span(i)) {
-            status = add_extents(tfs, i, new_rm);
+            status = add_extents(tfs, fsf, i, new_rm);
             if (status != 0)
                 goto done;
         }
@@ -941,7 +2413,7 @@ void filesystem_alloc(fsfile f, long offset, long len,
     /* check for a gap between the last node and blocks.end */
     range i = range_intersection(irange(lastedge, blocks.end), blocks);
     if (range_span(i)) {
-        status = add_extents(tfs, i, new_rm);
+        status = add_extents(tfs, fsf, i, new_rm);
         if (status != 0)
             goto done;
     }
@@ -987,7 +2459,7 @@ static tuple cleanup_directory(tuple n)
     tuple parent = table_remove(&n->t, sym(..));
     if (!parent)
         return 0;
-    tuple c = children(n);
+    tuple c = loaded_children(n);
     if (c)
         iterate(c, stack_closure_func(binding_handler, cleanup_directory_each));
     return parent;
@@ -1092,168 +2564,1627 @@ int filesystem_mkentry(filesystem fs, tuple cwd, sstring fp, tuple entry, boolea
         token = runtime_strtok_r(0, delim, &rest);
     }
 
-    filesystem_unlock(fs);
-    return status;
+    filesystem_unlock(fs);
+    return status;
+}
+
+int filesystem_mkdirpath(filesystem fs, tuple cwd, sstring fp,
+        boolean persistent)
+{
+    if (!fs_is_tfs(fs))
+        return -EINVAL;
+    tuple dir = fs_new_entry(fs);
+    /* 'make it a folder' by attaching a children node to the tuple */
+    set(dir, sym(children), allocate_tuple());
+
+    return filesystem_mkentry(fs, cwd, fp, dir, persistent, true);
+}
+
+tfsfile allocate_fsfile(tfs fs, tuple md);
+
+static void deallocate_fsfile(tfs fs, tfsfile f, rmnode_handler extent_destructor)
+{
+    deallocate_rangemap(f->extentmap, extent_destructor);
+    tfs_storage_lock(fs);
+    tfsfile_prealloc_release_locked(fs, f);
+#ifdef KERNEL
+    tfsfile_delalloc_release_locked(fs, f, irange(0, infinity));
+    tfs_storage_unlock(fs);
+    deallocate_rangemap(f->delalloc, stack_closure(tfs_storage_destroy, fs->fs.h));
+    pagecache_deallocate_node(f->f.cache_node);
+#else
+    tfs_storage_unlock(fs);
+#endif
+    deallocate(fs->fs.h, f, sizeof(*f));
+}
+
+closure_function(1, 1, boolean, free_extent,
+                 tfs, fs,
+                 rmnode n)
+{
+    destroy_extent(bound(fs), (extent)n);
+    return true;
+}
+
+static int tfs_create(filesystem fs, tuple parent, string name, tuple md, fsfile *f)
+{
+    tfs tfs = (struct tfs *)fs;
+    tfsfile fsf = 0;
+    int fss;
+    if (!md || is_regular(md)) {
+        if (md)
+            set(md, sym(extents), allocate_tuple());
+        fsf = allocate_fsfile(tfs, md);
+        if (fsf == INVALID_ADDRESS)
+            return -ENOMEM;
+        if (f) {
+            *f = &fsf->f;
+        }
+    }
+    if (parent && name && md) {
+        fss = filesystem_write_eav(tfs, children(parent), intern(name), md, false);
+        if (fsf) {
+            if (fss == 0) {
+                fsfile_reserve(&fsf->f);
+            } else {
+                table_set(tfs->files, md, 0);
+                deallocate_fsfile(tfs, fsf, stack_closure(free_extent, tfs));
+            }
+        }
+    } else {
+        fss = 0;
+    }
+    if ((fss == 0) && !fsf)
+        table_set(tfs->files, md, INVALID_ADDRESS);
+    return fss;
+}
+
+static int tfs_unlink(filesystem fs, tuple parent, string name, tuple md,
+                            boolean *destruct_md)
+{
+    tfs tfs = (struct tfs *)fs;
+    int fss = filesystem_write_eav(tfs, children(parent), intern(name), 0, false);
+    if (fss == 0) {
+        *destruct_md = tfs_file_unlink(tfs, md);
+    }
+    return fss;
+}
+
+static int tfs_rename(filesystem fs, tuple old_parent, string old_name, tuple old_md,
+                            tuple new_parent, string new_name, tuple new_md, boolean exchange,
+                            boolean *destruct_md)
+{
+    int s = fs_check_rename(old_parent, old_md, new_parent, new_md, exchange);
+    if (s != 0)
+        return s;
+    tfs tfs = (struct tfs *)fs;
+    s = filesystem_write_eav(tfs, children(new_parent), intern(new_name), old_md, true);
+    if (s == 0)
+        s = filesystem_write_eav(tfs, children(old_parent), intern(old_name), exchange ? new_md : 0,
+                                 exchange && new_md);
+    if ((s == 0) && !exchange && new_md)
+        *destruct_md = tfs_file_unlink(tfs, new_md);
+    return s;
+}
+
+static u64 tfs_freeblocks(filesystem fs)
+{
+    tfs tfs = (struct tfs *)fs;
+    tfs_storage_lock(tfs);
+    u64 free_blocks = tfs_available_blocks_locked(tfs);
+    tfs_storage_unlock(tfs);
+    return free_blocks;
+}
+
+closure_function(1, 1, boolean, tfs_insert_range,
+                 rangemap, rm,
+                 range r)
+{
+    return rangemap_insert_range(bound(rm), r);
+}
+
+closure_function(1, 2, boolean, tfs_extent_storage,
+                 rangemap, rm,
+                 value s, value v)
+{
+    u64 start_block, allocated;
+    if (!is_tuple(v) || !get_u64(v, sym(offset), &start_block) ||
+        !get_u64(v, sym(allocated), &allocated))
+        return false;
+    return (allocated == 0) || rangemap_insert_range(bound(rm), irangel(start_block, allocated));
+}
+
+/* Collects the storage ranges used by the files in a directory and its subdirectories. */
+closure_function(1, 2, boolean, tfs_dir_storage,
+                 rangemap, rm,
+                 value s, value v)
+{
+    if (!is_tuple(v))
+        return true;
+    rangemap rm = bound(rm);
+    tuple extents = get_tuple(v, sym(extents));
+    if (extents)
+        return iterate(extents, stack_closure(tfs_extent_storage, rm));
+    tuple c = get_tuple(v, sym(children));
+    if (!c)
+        return true;
+    if (is_deferred_tuple(c))
+        return deferred_dir_storage(c, stack_closure(tfs_insert_range, rm));
+    return iterate(c, (binding_handler)closure_self());
+}
+
+/* Large directories are encoded in deferred form in a log checkpoint, with the storage ranges used
+ * by their files as attachment. */
+closure_func_basic(tuple_defer, boolean, tfs_defer,
+                   tuple holder, symbol a, tuple t, buffer attachment)
+{
+    if ((a != sym(children)) || (tuple_count(t) < TFS_DEFERRED_DIR_ENTRIES))
+        return false;
+    tfs fs = struct_from_closure(tfs, defer);
+    rangemap rm = allocate_rangemap(fs->fs.h);
+    if (rm == INVALID_ADDRESS)
+        return false;
+    boolean success = iterate(t, stack_closure(tfs_dir_storage, rm));
+    if (success) {
+        rangemap_foreach(rm, n) {
+            push_varint(attachment, n->r.start);
+            push_varint(attachment, range_span(n->r));
+        }
+    }
+    deallocate_rangemap(rm, stack_closure(tfs_storage_destroy, fs->fs.h));
+    tfs_debug("%s: dir %p, %d entries, deferred %d\n", func_ss, holder, tuple_count(t), success);
+    return success;
+}
+
+/* Called with fs locked; if the log cannot be written, returns false without invoking the
+ * completion handler.
+ * The directory tree is encoded into the new log in memory while the lock is held, so tuple
+ * updates and log flushes wait for the encoding; the new log is then written to storage
+ * asynchronously, concurrently with flushes of the old log. */
+boolean filesystem_log_rebuild(tfs fs, log new_tl, status_handler sh)
+{
+    tfs_debug("%s(%F)\n", func_ss, sh);
+    tuple root = fs->fs.root;
+    cleanup_directory(root);
+    boolean ok = log_write_checkpoint(new_tl, root);
+    fixup_directory(root, root);
+    if (ok) {
+        fs->temp_log = new_tl;
+        log_flush(new_tl, sh);
+    }
+    return ok;
+}
+
+void filesystem_log_rebuild_done(tfs fs, log new_tl)
+{
+    tfs_debug("%s\n", func_ss);
+    fs->tl = new_tl;
+    fs->temp_log = 0;
+}
+
+void filesystem_checkpoint(tfs fs)
+{
+    if (!fs->fs.ro)
+        log_checkpoint(fs->tl);
+}
+
+/* File data written after this call is stored in compressed extents where possible. */
+void filesystem_set_compression(filesystem fs, boolean compress)
+{
+    ((tfs)fs)->compress = compress;
+}
+
+/* Checksums are stored for the data of extents created after this call; extents that already have
+ * checksums keep them up to date regardless of this setting. */
+void filesystem_set_checksums(filesystem fs, boolean checksums)
+{
+    ((tfs)fs)->checksums = checksums;
+}
+
+/* Online defragmentation merges runs of extents that are adjacent in a file into single extents.
+ * If the extents of a run are not contiguous on storage, their data is first copied (without
+ * holding any lock) to newly allocated contiguous storage. The extents of the file are then
+ * replaced by rewriting the extents tuple of the file with a single log entry, so that after a
+ * crash the file has either the old or the new extents. The storage cache is flushed after the
+ * relocated data is written and before the log entry is written, so that the log never references
+ * data that is not persistent; for the same reason, the storage of relocated extents is freed only
+ * after the log has been flushed and the storage cache has been flushed again. A run is not merged
+ * if its extents are modified while its data is being copied. */
+
+typedef struct tfs_defrag_run {
+    range r;                /* file blocks */
+    u64 start_block;        /* storage of the merged extent */
+    u64 allocated;
+    boolean relocate;       /* data is copied to newly allocated storage */
+    boolean stale;          /* extents modified while being copied */
+    vector extents;
+    extent merged;
+} *tfs_defrag_run;
+
+typedef struct tfs_defrag_job {
+    tfs fs;
+    tfsfile f;
+    vector runs;
+    u64 run;                /* index of the run being copied */
+    u64 copied;             /* blocks of the run copied so far */
+    range chunk;            /* file blocks being copied */
+    void *buf;
+    sg_list sg;
+    boolean written;        /* relocated data written since the last storage flush */
+    status_handler completion;
+    closure_struct(status_handler, copy);
+    closure_struct(status_handler, chunk_read);
+    closure_struct(status_handler, data_synced);
+    closure_struct(status_handler, flushed);
+    closure_struct(status_handler, log_synced);
+} *tfs_defrag_job;
+
+static boolean tfs_defrag_eligible(extent ex)
+{
+    return !ex->compressed && !ex->uninited;
+}
+
+/* Returns whether each extent of a run starts on storage where the previous extent ends. */
+static boolean tfs_defrag_contiguous(tfs_defrag_run run)
+{
+    extent prev = 0;
+    extent ex;
+    vector_foreach(run->extents, ex) {
+        if (prev && ((prev->allocated != range_span(prev->node.r)) ||
+                     (ex->start_block != prev->start_block + prev->allocated)))
+            return false;
+        prev = ex;
+    }
+    return true;
+}
+
+/* Returns whether the extents of a run are still the extents of the file in the run range; called
+ * with the filesystem locked. Extents are compared by address, so that extents destroyed after the
+ * run has been set up are never accessed. */
+static boolean tfs_defrag_run_valid(tfsfile f, tfs_defrag_run run)
+{
+    rmnode n = rangemap_lookup(f->extentmap, run->r.start);
+    if ((n == INVALID_ADDRESS) || (n->r.start != run->r.start))
+        return false;
+    u64 end = run->r.start;
+    extent ex;
+    vector_foreach(run->extents, ex) {
+        if ((n != &ex->node) || (n->r.start != end) || !tfs_defrag_eligible(ex))
+            return false;
+        end = n->r.end;
+        n = rangemap_next_node(f->extentmap, n);
+    }
+    return (end == run->r.end);
+}
+
+static void tfs_defrag_run_free(heap h, tfs_defrag_run run)
+{
+    deallocate_vector(run->extents);
+    if (run->merged)
+        deallocate(h, run->merged, sizeof(struct extent));
+    deallocate(h, run, sizeof(*run));
+}
+
+/* Sets up the storage of the merged extent of a run, relocating the run data if the run extents are
+ * not contiguous on storage and the job budget allows it; called with the filesystem locked. */
+static boolean tfs_defrag_run_setup(tfs_defrag_job job, tfs_defrag_run run, u64 *budget)
+{
+    if (vector_length(run->extents) < 2)
+        return false;
+    extent first = vector_get(run->extents, 0);
+    if (tfs_defrag_contiguous(run)) {
+        extent last = vector_peek(run->extents);
+        run->start_block = first->start_block;
+        run->allocated = last->start_block + last->allocated - first->start_block;
+        return true;
+    }
+    u64 nblocks = range_span(run->r);
+    if (nblocks > *budget)
+        return false;
+    run->start_block = filesystem_allocate_storage(job->fs, nblocks,
+                                                   tfsfile_alloc_goal(job->f, run->r.start));
+    if (run->start_block == INVALID_PHYSICAL)
+        return false;
+    run->allocated = nblocks;
+    run->relocate = true;
+    *budget -= nblocks;
+    return true;
+}
+
+/* Adds a run to a job if its extents can be merged, otherwise frees the run. */
+static void tfs_defrag_run_close(tfs_defrag_job job, tfs_defrag_run run, u64 *budget)
+{
+    if (tfs_defrag_run_setup(job, run, budget))
+        vector_push(job->runs, run);
+    else
+        tfs_defrag_run_free(job->fs->fs.h, run);
+}
+
+static tfs_defrag_run tfs_defrag_run_alloc(heap h, extent ex)
+{
+    tfs_defrag_run run = allocate(h, sizeof(*run));
+    if (run == INVALID_ADDRESS)
+        return run;
+    run->extents = allocate_vector(h, 8);
+    if (run->extents == INVALID_ADDRESS) {
+        deallocate(h, run, sizeof(*run));
+        return INVALID_ADDRESS;
+    }
+    vector_push(run->extents, ex);
+    run->r = ex->node.r;
+    run->relocate = run->stale = false;
+    run->merged = 0;
+    return run;
+}
+
+/* Looks for runs of adjacent extents to be merged; called with the filesystem locked. */
+static boolean tfs_defrag_scan(tfs_defrag_job job)
+{
+    tfs fs = job->fs;
+    u64 max_blocks = MAX_EXTENT_SIZE >> fs->fs.blocksize_order;
+    u64 budget = TFS_DEFRAG_JOB_SIZE >> fs->fs.blocksize_order;
+    tfs_defrag_run run = 0;
+    rangemap_foreach(job->f->extentmap, n) {
+        extent ex = (extent)n;
+        if (run && tfs_defrag_eligible(ex) && (run->r.end == n->r.start) &&
+            (range_span(run->r) + range_span(n->r) <= max_blocks)) {
+            vector_push(run->extents, ex);
+            run->r.end = n->r.end;
+            continue;
+        }
+        if (run) {
+            tfs_defrag_run_close(job, run, &budget);
+            run = 0;
+        }
+        if (tfs_defrag_eligible(ex)) {
+            run = tfs_defrag_run_alloc(fs->fs.h, ex);
+            if (run == INVALID_ADDRESS)
+                return false;
+        }
+    }
+    if (run)
+        tfs_defrag_run_close(job, run, &budget);
+    return true;
+}
+
+static void tfs_defrag_job_free(tfs_defrag_job job)
+{
+    tfs fs = job->fs;
+    heap h = fs->fs.h;
+    tfs_defrag_run run;
+    vector_foreach(job->runs, run)
+        tfs_defrag_run_free(h, run);
+    deallocate_vector(job->runs);
+    if (job->buf)
+        deallocate(fs->dma, job->buf, TFS_DEFRAG_BUFFER_SIZE);
+    deallocate(h, job, sizeof(*job));
+}
+
+/* Gives the merged extent of a run the checksums of the run extents; called with the filesystem
+ * locked. */
+static boolean tfs_defrag_run_checksums(tfs fs, tfs_defrag_run run)
+{
+    heap h = fs->fs.h;
+    u64 n = range_span(run->r);
+    u32 *sums = allocate(h, n * sizeof(u32));
+    if (sums == INVALID_ADDRESS)
+        return false;
+    boolean known = false;
+    extent ex;
+    vector_foreach(run->extents, ex) {
+        tuple checksums = ex->md ? get_tuple(ex->md, sym(checksums)) : 0;
+        u32 *ex_sums = sums + (ex->node.r.start - run->r.start);
+        u64 ex_blocks = range_span(ex->node.r);
+        if (checksums && tfs_checksums_copy(checksums, 0, ex_blocks, ex_sums))
+            known = true;
+        else
+            zero(ex_sums, ex_blocks * sizeof(u32));
+    }
+    boolean success = true;
+    if (known) {
+        tuple checksums = allocate_tuple();
+        success = (checksums != INVALID_ADDRESS);
+        u32 group_sums[TFS_CHECKSUM_GROUP_BLOCKS];
+        for (u64 i = 0; success && (i < n); i += TFS_CHECKSUM_GROUP_BLOCKS) {
+            u64 count = MIN(n - i, TFS_CHECKSUM_GROUP_BLOCKS);
+            zero(group_sums, sizeof(group_sums));
+            for (u64 j = 0; j < count; j++)
+                group_sums[j] = htole32(sums[i + j]);
+            string s = allocate_string(sizeof(group_sums));
+            if ((s == INVALID_ADDRESS) || !buffer_write(s, group_sums, sizeof(group_sums))) {
+                if (s != INVALID_ADDRESS)
+                    deallocate_string(s);
+                destruct_value(checksums, true);
+                success = false;
+                break;
+            }
+            set(checksums, intern_u64(i / TFS_CHECKSUM_GROUP_BLOCKS), s);
+        }
+        if (success)
+            set(run->merged->md, sym(checksums), checksums);
+    }
+    deallocate(h, sums, n * sizeof(u32));
+    return success;
+}
+
+closure_function(1, 2, boolean, tfs_defrag_copy_extent,
+                 tuple, extents,
+                 value s, value v)
+{
+    set(bound(extents), s, v);
+    return true;
+}
+
+/* Replaces the extents of the runs that are still valid with the merged extents; on error, or if
+ * the file has been written to in the meantime, no extents are replaced. */
+static void tfs_defrag_commit(tfs_defrag_job job, status s)
+{
+    tfs fs = job->fs;
+    tfsfile f = job->f;
+    heap h = fs->fs.h;
+    int order = fs->fs.blocksize_order;
+    tfs_defrag_run run;
+    filesystem_lock(&fs->fs);
+    tuple md = f->f.md;
+    tuple extents = md ? get_tuple(md, sym(extents)) : 0;
+    boolean valid = is_ok(s) && extents && !f->defrag_dirty;
+    f->defrag = irange(0, 0);
+    tuple new_extents = 0;
+    vector_foreach(job->runs, run) {
+        if (!valid || run->stale || !tfs_defrag_run_valid(f, run) ||
+            (!run->relocate && !tfs_defrag_contiguous(run))) {
+            run->stale = true;
+            continue;
+        }
+        run->merged = allocate_extent(h, run->r, irangel(run->start_block, run->allocated));
+        if (run->merged == INVALID_ADDRESS) {
+            run->merged = 0;
+            run->stale = true;
+            continue;
+        }
+        run->merged->md = extent_tuple(run->merged);
+        if (!tfs_defrag_run_checksums(fs, run)) {
+            destruct_value(run->merged->md, true);
+            deallocate(h, run->merged, sizeof(struct extent));
+            run->merged = 0;
+            run->stale = true;
+            continue;
+        }
+        if (!new_extents) {
+            new_extents = allocate_tuple();
+            iterate(extents, stack_closure(tfs_defrag_copy_extent, new_extents));
+        }
+        extent ex;
+        vector_foreach(run->extents, ex)
+            set(new_extents, intern_u64(ex->node.r.start), 0);
+        set(new_extents, intern_u64(run->r.start), run->merged->md);
+    }
+    if (new_extents) {
+        int fss = filesystem_write_eav(fs, md, sym(extents), new_extents, false);
+        if (fss == 0) {
+            set(md, sym(extents), new_extents);
+            f->f.status |= FSF_DIRTY_DATASYNC;
+        } else {
+            if (is_ok(s)) {
+                s = timm("result", "failed to write log");
+                s = timm_append(s, "fsstatus", "%d", fss);
+            }
+            vector_foreach(job->runs, run) {
+                if (run->merged) {
+                    destruct_value(run->merged->md, true);
+                    run->stale = true;
+                }
+            }
+            destruct_value(new_extents, false);
+            new_extents = 0;
+        }
+    }
+    vector_foreach(job->runs, run) {
+        if (run->stale) {
+            if (run->relocate && !filesystem_free_storage(fs, irangel(run->start_block,
+                                                                      run->allocated)))
+                msg_err("failed to mark relocation storage at 0x%lx as free", run->start_block);
+            vector_clear(run->extents);
+            continue;
+        }
+        fs->defrag_extents += vector_length(run->extents) - 1;
+        extent ex;
+        vector_foreach(run->extents, ex) {
+            rangemap_remove_node(f->extentmap, &ex->node);
+            tfs_extent_detach_updates(ex);
+        }
+        assert(rangemap_insert(f->extentmap, &run->merged->node));
+        if (run->relocate) {
+            fs->defrag_bytes += range_span(run->r) << order;
+            if (rangemap_next_node(f->extentmap, &run->merged->node) == INVALID_ADDRESS) {
+                /* the preallocated storage of the file does not follow its last extent anymore */
+                tfs_storage_lock(fs);
+                tfsfile_prealloc_release_locked(fs, f);
+                tfs_storage_unlock(fs);
+            }
+        } else {
+            /* the merged extent takes over the storage of the extents */
+            vector_foreach(run->extents, ex)
+                deallocate(h, ex, sizeof(*ex));
+            vector_clear(run->extents);
+        }
+        run->merged = 0;
+    }
+    if (!is_ok(s)) {
+        filesystem_unlock(&fs->fs);
+        apply(job->completion, s);
+        tfs_defrag_job_free(job);
+        return;
+    }
+    status_handler flushed = (status_handler)&job->flushed;
+    if (new_extents)
+        log_flush(fs->tl, flushed);
+    filesystem_unlock(&fs->fs);
+    if (!new_extents)
+        apply(flushed, STATUS_OK);
+}
+
+static void tfs_defrag_sync(tfs_defrag_job job, status_handler completion)
+{
+    struct storage_req req = {
+        .op = STORAGE_OP_FLUSH,
+        .blocks = irange(0, 0),
+        .completion = completion,
+    };
+    apply(job->fs->req_handler, &req);
+}
+
+closure_func_basic(status_handler, void, tfs_defrag_data_synced,
+                   status s)
+{
+    tfs_defrag_job job = struct_from_closure(tfs_defrag_job, data_synced);
+    tfs_defrag_commit(job, s);
+}
+
+closure_func_basic(status_handler, void, tfs_defrag_flushed,
+                   status s)
+{
+    tfs_defrag_job job = struct_from_closure(tfs_defrag_job, flushed);
+    if (is_ok(s)) {
+        tfs_defrag_run run;
+        vector_foreach(job->runs, run) {
+            if (vector_length(run->extents)) {
+                /* the new extents must be persistent before the old storage can be reused */
+                tfs_defrag_sync(job, (status_handler)&job->log_synced);
+                return;
+            }
+        }
+    }
+    status_handler log_synced = (status_handler)&job->log_synced;
+    apply(log_synced, s);
+}
+
+/* Releases the storage of relocated extents. */
+closure_func_basic(status_handler, void, tfs_defrag_log_synced,
+                   status s)
+{
+    tfs_defrag_job job = struct_from_closure(tfs_defrag_job, log_synced);
+    tfs fs = job->fs;
+    tfs_defrag_run run;
+    vector_foreach(job->runs, run) {
+        extent ex;
+        vector_foreach(run->extents, ex) {
+            if (is_ok(s))
+                destroy_extent(fs, ex);
+            else
+                /* the log may still reference the storage of the extent */
+                deallocate(fs->fs.h, ex, sizeof(*ex));
+        }
+    }
+    apply(job->completion, s);
+    tfs_defrag_job_free(job);
+}
+
+static sg_list tfs_defrag_sg(tfs_defrag_job job)
+{
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return sg;
+    u64 length = range_span(job->chunk) << job->fs->fs.blocksize_order;
+    sg_buf sgb = sg_list_tail_add(sg, length);
+    if (sgb == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        return INVALID_ADDRESS;
+    }
+    sgb->buf = job->buf;
+    sgb->offset = 0;
+    sgb->size = length;
+    sgb->refcount = 0;
+    return sg;
+}
+
+/* Reads the next chunk of data to be relocated, or commits the job if all data has been copied. */
+closure_func_basic(status_handler, void, tfs_defrag_copy,
+                   status s)
+{
+    tfs_defrag_job job = struct_from_closure(tfs_defrag_job, copy);
+    tfs fs = job->fs;
+    tfsfile f = job->f;
+    int order = fs->fs.blocksize_order;
+    if (job->sg) {
+        deallocate_sg_list(job->sg);
+        job->sg = 0;
+    }
+    if (!is_ok(s))
+        goto commit;
+    if (!job->buf) {
+        job->buf = allocate(fs->dma, TFS_DEFRAG_BUFFER_SIZE);
+        if (job->buf == INVALID_ADDRESS) {
+            job->buf = 0;
+            s = timm("result", "failed to allocate defragmentation buffer");
+            goto commit;
+        }
+    }
+    filesystem_lock(&fs->fs);
+    for (; job->run < vector_length(job->runs); job->run++, job->copied = 0) {
+        tfs_defrag_run run = vector_get(job->runs, job->run);
+        if (!run->relocate || run->stale || (job->copied == range_span(run->r)))
+            continue;
+        if (f->defrag_dirty)
+            break;
+        if (!tfs_defrag_run_valid(f, run)) {
+            run->stale = true;
+            continue;
+        }
+        u64 nblocks = MIN(range_span(run->r) - job->copied, TFS_DEFRAG_BUFFER_SIZE >> order);
+        job->chunk = irangel(run->r.start + job->copied, nblocks);
+        job->sg = tfs_defrag_sg(job);
+        if (job->sg == INVALID_ADDRESS) {
+            job->sg = 0;
+            filesystem_unlock(&fs->fs);
+            s = timm("result", "failed to allocate sg list");
+            goto commit;
+        }
+        merge m = allocate_merge(fs->fs.h, (status_handler)&job->chunk_read);
+        status_handler k = apply_merge(m);
+        extent ex;
+        vector_foreach(run->extents, ex) {
+            range i = range_intersection(ex->node.r, job->chunk);
+            if (range_span(i))
+                tfs_storage_op(fs, job->sg,
+                               irangel(ex->start_block + i.start - ex->node.r.start,
+                                       range_span(i)), false, apply_merge(m));
+        }
+        filesystem_unlock(&fs->fs);
+        apply(k, STATUS_OK);
+        return;
+    }
+    boolean sync = job->written && !f->defrag_dirty;
+    filesystem_unlock(&fs->fs);
+    if (sync) {
+        /* relocated data must be persistent before the log references it */
+        job->written = false;
+        tfs_defrag_sync(job, (status_handler)&job->data_synced);
+        return;
+    }
+  commit:
+    tfs_defrag_commit(job, s);
+}
+
+/* Writes a chunk of data to the relocation storage. */
+closure_func_basic(status_handler, void, tfs_defrag_chunk_read,
+                   status s)
+{
+    tfs_defrag_job job = struct_from_closure(tfs_defrag_job, chunk_read);
+    status_handler copy = (status_handler)&job->copy;
+    deallocate_sg_list(job->sg);
+    job->sg = 0;
+    if (!is_ok(s)) {
+        apply(copy, s);
+        return;
+    }
+    job->sg = tfs_defrag_sg(job);
+    if (job->sg == INVALID_ADDRESS) {
+        job->sg = 0;
+        apply(copy, timm("result", "failed to allocate sg list"));
+        return;
+    }
+    tfs_defrag_run run = vector_get(job->runs, job->run);
+    range blocks = irangel(run->start_block + job->chunk.start - run->r.start,
+                           range_span(job->chunk));
+    job->copied += range_span(job->chunk);
+    job->written = true;
+    tfs_storage_op(job->fs, job->sg, blocks, true, copy);
+}
+
+/* Defragments (part of) a file: the completion is invoked when the merged extents of the file have
+ * been written to the log. The caller must hold a reference to the file. */
+void filesystem_defrag(fsfile f, status_handler completion)
+{
+    tfs fs = (tfs)f->fs;
+    tfsfile tf = (tfsfile)f;
+    heap h = fs->fs.h;
+    if (fs->fs.ro) {
+        status s = timm("result", "read-only filesystem");
+        apply(completion, timm_append(s, "fsstatus", "%d", -EROFS));
+        return;
+    }
+    tfs_defrag_job job = allocate(h, sizeof(*job));
+    if (job == INVALID_ADDRESS)
+        goto alloc_fail;
+    job->runs = allocate_vector(h, 8);
+    if (job->runs == INVALID_ADDRESS) {
+        deallocate(h, job, sizeof(*job));
+        goto alloc_fail;
+    }
+    job->fs = fs;
+    job->f = tf;
+    job->run = job->copied = 0;
+    job->buf = 0;
+    job->sg = 0;
+    job->written = false;
+    job->completion = completion;
+    init_closure_func(&job->copy, status_handler, tfs_defrag_copy);
+    init_closure_func(&job->chunk_read, status_handler, tfs_defrag_chunk_read);
+    init_closure_func(&job->data_synced, status_handler, tfs_defrag_data_synced);
+    init_closure_func(&job->flushed, status_handler, tfs_defrag_flushed);
+    init_closure_func(&job->log_synced, status_handler, tfs_defrag_log_synced);
+    filesystem_lock(&fs->fs);
+    boolean scanned = !f->md || !range_empty(tf->defrag) || tfs_defrag_scan(job);
+    tfs_defrag_run first = vector_length(job->runs) ? vector_get(job->runs, 0) : 0;
+    if (first) {
+        tf->defrag = irange(first->r.start, ((tfs_defrag_run)vector_peek(job->runs))->r.end);
+        tf->defrag_dirty = false;
+    }
+    filesystem_unlock(&fs->fs);
+    if (!first) {
+        tfs_defrag_job_free(job);
+        apply(completion, scanned ? STATUS_OK : timm("result", "out of memory"));
+        return;
+    }
+    tfs_debug("%s: file %p, %d runs in %R\n", func_ss, tf, vector_length(job->runs), tf->defrag);
+    status_handler copy = (status_handler)&job->copy;
+#ifdef KERNEL
+    /* data being written back is copied only after it has reached storage */
+    pagecache_node_finish_pending_writes(f->cache_node, copy);
+#else
+    apply(copy, STATUS_OK);
+#endif
+    return;
+  alloc_fail:
+    apply(completion, timm("result", "out of memory"));
+}
+
+/* Storage blocks to be discarded are reserved in the storage map, so that they cannot be allocated
+ * again while the discard requests are in flight, and the log is flushed and the storage cache is
+ * flushed before the requests are issued, so that the metadata updates that freed the blocks are
+ * persistent before the old data is gone. A trim (FITRIM) request discards free storage in rounds of at most TFS_TRIM_BATCH_SIZE
+ * bytes, so that it does not hold large amounts of free space unavailable for allocation. */
+typedef struct tfs_discard_job {
+    tfs fs;
+    rangemap blocks;        /* storage blocks reserved for discarding */
+    u64 nblocks;
+    range trim;             /* storage blocks left to be trimmed */
+    u64 minlen;             /* minimum length of free storage to be trimmed, in blocks */
+    u64 discarded;          /* blocks */
+    io_status_handler completion;
+    closure_struct(status_handler, flushed);
+    closure_struct(status_handler, synced);
+    closure_struct(status_handler, done);
+} *tfs_discard_job;
+
+static void tfs_discard_job_free(tfs_discard_job job)
+{
+    heap h = job->fs->fs.h;
+    deallocate_rangemap(job->blocks, stack_closure(tfs_storage_destroy, h));
+    deallocate(h, job, sizeof(*job));
+}
+
+static void tfs_discard_finish(tfs_discard_job job, status s)
+{
+    io_status_handler completion = job->completion;
+    bytes discarded = job->discarded << job->fs->fs.blocksize_order;
+    tfs_discard_job_free(job);
+    apply(completion, s, discarded);
+}
+
+/* Reserves the blocks in the job map; called with the storage lock held. */
+static void tfs_discard_reserve_locked(tfs_discard_job job)
+{
+    tfs fs = job->fs;
+    rmnode n = rangemap_first_node(job->blocks);
+    while (n != INVALID_ADDRESS) {
+        rmnode next = rangemap_next_node(job->blocks, n);
+        if (rangemap_insert_range(fs->storage, n->r)) {
+            fs->used_blocks += range_span(n->r);
+            job->nblocks += range_span(n->r);
+        } else {
+            rangemap_remove_range(job->blocks, n);
+        }
+        n = next;
+    }
+}
+
+static void tfs_discard_start(tfs_discard_job job)
+{
+    tfs fs = job->fs;
+    tfs_debug("%s: %ld blocks in %ld ranges\n", func_ss, job->nblocks,
+              rangemap_count(job->blocks));
+    if (!job->nblocks) {
+        status_handler synced = (status_handler)&job->synced;
+        apply(synced, STATUS_OK);
+        return;
+    }
+    filesystem_lock(&fs->fs);
+    log_flush(fs->tl, (status_handler)&job->flushed);
+    filesystem_unlock(&fs->fs);
+}
+
+closure_func_basic(status_handler, void, tfs_discard_flushed,
+                   status s)
+{
+    tfs_discard_job job = struct_from_field(closure_self(), tfs_discard_job, flushed);
+    if (!is_ok(s)) {
+        status_handler done = (status_handler)&job->done;
+        apply(done, s);
+        return;
+    }
+    struct storage_req req = {
+        .op = STORAGE_OP_FLUSH,
+        .blocks = irange(0, 0),
+        .completion = (status_handler)&job->synced,
+    };
+    apply(job->fs->req_handler, &req);
+}
+
+closure_func_basic(status_handler, void, tfs_discard_synced,
+                   status s)
+{
+    tfs_discard_job job = struct_from_field(closure_self(), tfs_discard_job, synced);
+    status_handler done = (status_handler)&job->done;
+    if (!is_ok(s)) {
+        apply(done, s);
+        return;
+    }
+    merge m = allocate_merge(job->fs->fs.h, done);
+    status_handler sh = apply_merge(m);
+    rangemap_foreach(job->blocks, n) {
+        struct storage_req req = {
+            .op = STORAGE_OP_DISCARD,
+            .blocks = n->r,
+            .completion = apply_merge(m),
+        };
+        apply(job->fs->req_handler, &req);
+    }
+    apply(sh, STATUS_OK);
+}
+
+closure_function(3, 1, boolean, tfs_trim_gap,
+                 tfs_discard_job, job, u64 *, budget, u64 *, end,
+                 range r)
+{
+    tfs_discard_job job = bound(job);
+    u64 *budget = bound(budget);
+    if (range_span(r) < job->minlen)
+        return true;
+    r.end = r.start + MIN(range_span(r), *budget);
+    if (!rangemap_insert_range(job->blocks, r))
+        return false;
+    *bound(end) = r.end;
+    *budget -= range_span(r);
+    return (*budget > 0);
+}
+
+/* Reserves the next round of free storage to be trimmed. */
+static void tfs_trim_next(tfs_discard_job job)
+{
+    tfs fs = job->fs;
+    u64 budget = TFS_TRIM_BATCH_SIZE >> fs->fs.blocksize_order;
+    u64 end = job->trim.start;
+    tfs_storage_lock(fs);
+    int result = rangemap_range_find_gaps(fs->storage, job->trim,
+                                          stack_closure(tfs_trim_gap, job, &budget, &end));
+    job->trim.start = (result == RM_ABORT) ? end : job->trim.end;
+    tfs_discard_reserve_locked(job);
+    tfs_storage_unlock(fs);
+    if (!job->nblocks && !range_empty(job->trim))
+        tfs_discard_finish(job, timm("result", "out of memory"));
+    else
+        tfs_discard_start(job);
+}
+
+closure_func_basic(status_handler, void, tfs_discard_done,
+                   status s)
+{
+    tfs_discard_job job = struct_from_field(closure_self(), tfs_discard_job, done);
+    tfs fs = job->fs;
+    tfs_storage_lock(fs);
+    u64 requests = 0;
+    rmnode n;
+    while ((n = rangemap_first_node(job->blocks)) != INVALID_ADDRESS) {
+        if (!tfs_storage_release_locked(fs, n->r))
+            msg_err("failed to release storage at %R", n->r);
+        rangemap_remove_range(job->blocks, n);
+        requests++;
+    }
+    if (is_ok(s)) {
+        fs->discard_requests += requests;
+        fs->discard_bytes += job->nblocks << fs->fs.blocksize_order;
+        job->discarded += job->nblocks;
+    } else if (tfs_status_unsupported(s)) {
+        fs->discard_unsupported = true;
+    }
+    tfs_storage_unlock(fs);
+    job->nblocks = 0;
+    if (is_ok(s) && !range_empty(job->trim))
+        tfs_trim_next(job);
+    else
+        tfs_discard_finish(job, s);
+}
+
+static tfs_discard_job tfs_discard_job_alloc(tfs fs, io_status_handler completion)
+{
+    heap h = fs->fs.h;
+    tfs_discard_job job = allocate(h, sizeof(*job));
+    if (job == INVALID_ADDRESS)
+        return job;
+    job->blocks = allocate_rangemap(h);
+    if (job->blocks == INVALID_ADDRESS) {
+        deallocate(h, job, sizeof(*job));
+        return INVALID_ADDRESS;
+    }
+    job->fs = fs;
+    job->nblocks = 0;
+    job->trim = irange(0, 0);
+    job->minlen = 1;
+    job->discarded = 0;
+    job->completion = completion;
+    init_closure_func(&job->flushed, status_handler, tfs_discard_flushed);
+    init_closure_func(&job->synced, status_handler, tfs_discard_synced);
+    init_closure_func(&job->done, status_handler, tfs_discard_done);
+    return job;
+}
+
+/* Discards the free storage in a byte range of the filesystem that is made of contiguous runs of
+ * at least minlen bytes, and reports the number of bytes discarded. */
+static void tfs_trim(filesystem fs, range q, u64 minlen, io_status_handler completion)
+{
+    tfs tfs = (struct tfs *)fs;
+    if (tfs->discard_unsupported) {
+        apply(completion, storage_unsupported_status(), 0);
+        return;
+    }
+    tfs_discard_job job = tfs_discard_job_alloc(tfs, completion);
+    if (job == INVALID_ADDRESS) {
+        status s = timm("result", "out of memory");
+        apply(completion, timm_append(s, "fsstatus", "%d", -ENOMEM), 0);
+        return;
+    }
+    int order = fs->blocksize_order;
+    u64 limit = fs->size >> order;
+    job->trim = irange(MIN(range_rshift_pad(q, order).start, limit), MIN(q.end >> order, limit));
+    if (job->trim.end < job->trim.start)
+        job->trim.end = job->trim.start;
+    job->minlen = MAX((minlen + MASK(order)) >> order, 1);
+    tfs_debug("%s: blocks %R, minlen %ld\n", func_ss, job->trim, job->minlen);
+    tfs_trim_next(job);
+}
+
+closure_func_basic(status_handler, void, tfsfile_sync_complete,
+                   status s)
+{
+    if (!is_ok(s)) {
+        msg_err("failed to purge page cache node: %v\n", s);
+        timm_dealloc(s);
+    }
+    tfsfile f = (tfsfile)struct_from_closure(fsfile, sync_complete);
+    tfs fs = tfs_from_file(f);
+    deallocate_fsfile(fs, f, stack_closure(free_extent, fs));
+}
+
+closure_function(1, 0, void, free_extents,
+                 fsfile, f)
+{
+    fsfile f = bound(f);
+    status_handler sh = init_closure_func(&f->sync_complete, status_handler, tfsfile_sync_complete);
+#ifdef KERNEL
+    pagecache_purge_node(f->cache_node, sh);
+#else
+    apply(sh, STATUS_OK);
+#endif
+}
+
+#ifdef KERNEL
+closure_function(2, 0, value, tfs_get_sync_batches,
+                 tfs, fs, tuple, t)
+{
+    tfs fs = bound(fs);
+    tuple t = bound(t);
+    u64 counts[TFS_SYNC_BATCH_ORDERS];
+    tfs_sync_lock(fs);
+    runtime_memcpy(counts, fs->sync_batches, sizeof(counts));
+    tfs_sync_unlock(fs);
+    for (int order = 0; order < TFS_SYNC_BATCH_ORDERS; order++) {
+        symbol s = intern_u64(U64_FROM_BIT(order));
+        set(t, s, value_rewrite_u64(get(t, s), counts[order]));
+    }
+    return t;
+}
+
+/* Background defragmentation processes the files loaded at the start of each pass one at a time,
+ * until defragmenting a file does not merge any more extents; the delay before the next job is the
+ * time needed to relocate the data of the previous job at TFS_DEFRAG_RATE. While foreground I/O
+ * exceeds TFS_DEFRAG_IDLE_IO_RATE, the delay is at least TFS_DEFRAG_BACKOFF_MS, doubled after each
+ * busy job up to TFS_DEFRAG_BACKOFF_MAX_SECONDS. Files with data waiting for storage allocation in
+ * the page cache are skipped, as their extents are about to change. */
+
+static void tfs_defrag_schedule(tfs fs, timestamp delay)
+{
+    register_timer(kernel_timers, &fs->defrag_timer, CLOCK_ID_MONOTONIC_RAW, delay, false, 0,
+                   (timer_handler)&fs->defrag_timer_expired);
+}
+
+closure_func_basic(timer_handler, void, tfs_defrag_timer_expired,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    tfs fs = struct_from_closure(tfs, defrag_timer_expired);
+    async_apply((thunk)&fs->defrag_step);
+}
+
+closure_function(3, 1, void, tfs_defrag_done,
+                 tfs, fs, u64, extents, u64, bytes,
+                 status s)
+{
+    tfs fs = bound(fs);
+    if (!is_ok(s)) {
+        msg_err("defragmentation failed: %v\n", s);
+        timm_dealloc(s);
+    }
+    filesystem_lock(&fs->fs);
+    tfsfile f = fs->defrag_file;
+    if (is_ok(s) && (fs->defrag_extents != bound(extents)) && fs->defrag)
+        f = 0;
+    else
+        fs->defrag_file = 0;
+    timestamp delay = seconds(fs->defrag_bytes - bound(bytes)) / TFS_DEFRAG_RATE;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    u64 io = fs->io_bytes - fs->defrag_io_bytes;
+    timestamp elapsed = t - fs->defrag_io_time;
+    fs->defrag_io_bytes += io;
+    fs->defrag_io_time = t;
+    if (io > TFS_DEFRAG_IDLE_IO_RATE * (elapsed / milliseconds(1)) / THOUSAND) {
+        timestamp backoff = milliseconds(TFS_DEFRAG_BACKOFF_MS) << fs->defrag_backoff;
+        if (backoff < seconds(TFS_DEFRAG_BACKOFF_MAX_SECONDS))
+            fs->defrag_backoff++;
+        else
+            backoff = seconds(TFS_DEFRAG_BACKOFF_MAX_SECONDS);
+        delay = MAX(delay, backoff);
+    } else {
+        fs->defrag_backoff = 0;
+    }
+    tfs_defrag_schedule(fs, delay);
+    filesystem_unlock(&fs->fs);
+    if (f)
+        fsfile_release(&f->f);
+    closure_finish();
+}
+
+static boolean tfsfile_delalloc_pending(tfs fs, tfsfile f)
+{
+    tfs_storage_lock(fs);
+    boolean pending = (rangemap_count(f->delalloc) != 0);
+    tfs_storage_unlock(fs);
+    return pending;
 }
 
-int filesystem_mkdirpath(filesystem fs, tuple cwd, sstring fp,
-        boolean persistent)
+closure_func_basic(thunk, void, tfs_defrag_step)
 {
-    if (!fs_is_tfs(fs))
-        return -EINVAL;
-    tuple dir = fs_new_entry(fs);
-    /* 'make it a folder' by attaching a children node to the tuple */
-    set(dir, sym(children), allocate_tuple());
+    tfs fs = struct_from_closure(tfs, defrag_step);
+    filesystem_lock(&fs->fs);
+    if (!fs->defrag) {
+        fs->defrag_running = false;
+        vector_clear(fs->defrag_files);
+        filesystem_unlock(&fs->fs);
+        return;
+    }
+    tfsfile f = fs->defrag_file;
+    if (!f && (vector_length(fs->defrag_files) == 0)) {
+        table_foreach(fs->files, md, v) {
+            if (v != INVALID_ADDRESS)
+                vector_push(fs->defrag_files, md);
+        }
+    }
+    while (!f && (vector_length(fs->defrag_files) > 0)) {
+        f = table_find(fs->files, vector_pop(fs->defrag_files));
+        if ((f == INVALID_ADDRESS) || (f && tfsfile_delalloc_pending(fs, f)))
+            f = 0;
+    }
+    status_handler sh = 0;
+    if (f) {
+        sh = closure(fs->fs.h, tfs_defrag_done, fs, fs->defrag_extents, fs->defrag_bytes);
+        if (sh == INVALID_ADDRESS)
+            sh = 0;
+        else if (!fs->defrag_file)
+            fsfile_reserve(&f->f);
+    }
+    if (sh) {
+        fs->defrag_file = f;
+    } else {
+        /* end of pass */
+        f = fs->defrag_file;
+        fs->defrag_file = 0;
+        vector_clear(fs->defrag_files);
+        tfs_defrag_schedule(fs, seconds(TFS_DEFRAG_PASS_SECONDS));
+    }
+    filesystem_unlock(&fs->fs);
+    if (sh)
+        filesystem_defrag(&f->f, sh);
+    else if (f)
+        fsfile_release(&f->f);
+}
 
-    return filesystem_mkentry(fs, cwd, fp, dir, persistent, true);
+closure_function(1, 1, boolean, tfs_set_defrag,
+                 tfs, fs,
+                 value v)
+{
+    tfs fs = bound(fs);
+    u64 enable;
+    if (!u64_from_value(v, &enable))
+        return false;
+    filesystem_lock(&fs->fs);
+    fs->defrag = (enable != 0);
+    if (fs->defrag && !fs->defrag_running) {
+        fs->defrag_running = true;
+        fs->defrag_io_bytes = fs->io_bytes;
+        fs->defrag_io_time = now(CLOCK_ID_MONOTONIC_RAW);
+        fs->defrag_backoff = 0;
+        tfs_defrag_schedule(fs, 0);
+    }
+    filesystem_unlock(&fs->fs);
+    return true;
 }
 
-tfsfile allocate_fsfile(tfs fs, tuple md);
+closure_function(2, 0, value, tfs_get_defrag_stats,
+                 tfs, fs, tuple, t)
+{
+    tfs fs = bound(fs);
+    tuple t = bound(t);
+    filesystem_lock(&fs->fs);
+    u64 extents = fs->defrag_extents;
+    u64 bytes = fs->defrag_bytes;
+    filesystem_unlock(&fs->fs);
+    symbol s = sym(extents);
+    set(t, s, value_rewrite_u64(get(t, s), extents));
+    s = sym(bytes);
+    set(t, s, value_rewrite_u64(get(t, s), bytes));
+    return t;
+}
 
-static void deallocate_fsfile(tfs fs, tfsfile f, rmnode_handler extent_destructor)
+closure_func_basic(timer_handler, void, tfs_discard_timer_expired,
+                   u64 expiry, u64 overruns)
 {
-    deallocate_rangemap(f->extentmap, extent_destructor);
-#ifdef KERNEL
-    pagecache_deallocate_node(f->f.cache_node);
-#endif
-    deallocate(fs->fs.h, f, sizeof(*f));
+    if (overruns == timer_disabled)
+        return;
+    tfs fs = struct_from_closure(tfs, discard_timer_expired);
+    async_apply((thunk)&fs->discard_batch);
 }
 
-closure_function(1, 1, boolean, free_extent,
-                 tfs, fs,
-                 rmnode n)
+/* Issues the pending discards; the next batch is scheduled when this one completes. */
+closure_func_basic(thunk, void, tfs_discard_batch)
 {
-    destroy_extent(bound(fs), (extent)n);
-    return true;
+    tfs fs = struct_from_closure(tfs, discard_batch);
+    rangemap pending = allocate_rangemap(fs->fs.h);
+    tfs_discard_job job = (pending != INVALID_ADDRESS) ?
+                          tfs_discard_job_alloc(fs, (io_status_handler)&fs->discard_complete) :
+                          INVALID_ADDRESS;
+    tfs_storage_lock(fs);
+    if (job == INVALID_ADDRESS) {
+        fs->discard_scheduled = false;
+        tfs_discard_schedule_locked(fs);
+        tfs_storage_unlock(fs);
+        if (pending != INVALID_ADDRESS)
+            deallocate_rangemap(pending, stack_closure(tfs_storage_destroy, fs->fs.h));
+        return;
+    }
+    deallocate_rangemap(job->blocks, stack_closure(tfs_storage_destroy, fs->fs.h));
+    job->blocks = fs->discard_pending;
+    fs->discard_pending = pending;
+    tfs_discard_reserve_locked(job);
+    tfs_storage_unlock(fs);
+    tfs_discard_start(job);
 }
 
-static int tfs_create(filesystem fs, tuple parent, string name, tuple md, fsfile *f)
+closure_func_basic(io_status_handler, void, tfs_discard_complete,
+                   status s, bytes len)
 {
-    tfs tfs = (struct tfs *)fs;
-    tfsfile fsf = 0;
-    int fss;
-    if (!md || is_regular(md)) {
-        if (md)
-            set(md, sym(extents), allocate_tuple());
-        fsf = allocate_fsfile(tfs, md);
-        if (fsf == INVALID_ADDRESS)
-            return -ENOMEM;
-        if (f) {
-            *f = &fsf->f;
-        }
+    tfs fs = struct_from_closure(tfs, discard_complete);
+    tfs_debug("%s: %ld bytes, status %v\n", func_ss, len, s);
+    if (!is_ok(s)) {
+        if (!tfs_status_unsupported(s))
+            msg_err("failed to discard storage: %v\n", s);
+        timm_dealloc(s);
     }
-    if (parent && name && md) {
-        fss = filesystem_write_eav(tfs, children(parent), intern(name), md, false);
-        if (fsf) {
-            if (fss == 0) {
-                fsfile_reserve(&fsf->f);
-            } else {
-                table_set(tfs->files, md, 0);
-                deallocate_fsfile(tfs, fsf, stack_closure(free_extent, tfs));
-            }
-        }
+    tfs_storage_lock(fs);
+    fs->discard_scheduled = false;
+    if (fs->discard_unsupported) {
+        rmnode n;
+        while ((n = rangemap_first_node(fs->discard_pending)) != INVALID_ADDRESS)
+            rangemap_remove_range(fs->discard_pending, n);
     } else {
-        fss = 0;
+        tfs_discard_schedule_locked(fs);
     }
-    if ((fss == 0) && !fsf)
-        table_set(tfs->files, md, INVALID_ADDRESS);
-    return fss;
+    tfs_storage_unlock(fs);
 }
 
-static int tfs_unlink(filesystem fs, tuple parent, string name, tuple md,
-                            boolean *destruct_md)
+closure_function(1, 1, boolean, tfs_set_discard,
+                 tfs, fs,
+                 value v)
 {
-    tfs tfs = (struct tfs *)fs;
-    int fss = filesystem_write_eav(tfs, children(parent), intern(name), 0, false);
-    if (fss == 0) {
-        *destruct_md = tfs_file_unlink(tfs, md);
-    }
-    return fss;
+    tfs fs = bound(fs);
+    u64 enable;
+    if (!u64_from_value(v, &enable))
+        return false;
+    tfs_storage_lock(fs);
+    fs->discard = (enable != 0);
+    tfs_storage_unlock(fs);
+    return true;
 }
 
-static int tfs_rename(filesystem fs, tuple old_parent, string old_name, tuple old_md,
-                            tuple new_parent, string new_name, tuple new_md, boolean exchange,
-                            boolean *destruct_md)
+closure_function(2, 0, value, tfs_get_discard_stats,
+                 tfs, fs, tuple, t)
 {
-    int s = fs_check_rename(old_parent, old_md, new_parent, new_md, exchange);
-    if (s != 0)
-        return s;
-    tfs tfs = (struct tfs *)fs;
-    s = filesystem_write_eav(tfs, children(new_parent), intern(new_name), old_md, true);
-    if (s == 0)
-        s = filesystem_write_eav(tfs, children(old_parent), intern(old_name), exchange ? new_md : 0,
-                                 exchange && new_md);
-    if ((s == 0) && !exchange && new_md)
-        *destruct_md = tfs_file_unlink(tfs, new_md);
-    return s;
+    tfs fs = bound(fs);
+    tuple t = bound(t);
+    tfs_storage_lock(fs);
+    u64 requests = fs->discard_requests;
+    u64 bytes = fs->discard_bytes;
+    tfs_storage_unlock(fs);
+    symbol s = sym(requests);
+    set(t, s, value_rewrite_u64(get(t, s), requests));
+    s = sym(bytes);
+    set(t, s, value_rewrite_u64(get(t, s), bytes));
+    return t;
 }
 
-closure_function(1, 1, boolean, tfs_storage_freeblocks,
-                 u64 *, free_blocks,
-                 range r)
+#endif
+
+/* The background scrub verifies the data of the extents that have checksums, reading it in chunks
+ * of at most TFS_SCRUB_BUFFER_SIZE bytes and processing the files loaded at the start of each pass
+ * one at a time; the delay before reading the next chunk is the time needed to read the previous
+ * chunk at TFS_SCRUB_RATE. A chunk that fails verification may have been rewritten while being
+ * read, so it is read again (with its current checksums) before mismatches are reported. */
+
+#ifdef KERNEL
+static void tfs_scrub_schedule(tfs fs, timestamp delay)
 {
-    *bound(free_blocks) += range_span(r);
-    return true;
- }
+    register_timer(kernel_timers, &fs->scrub_timer, CLOCK_ID_MONOTONIC_RAW, delay, false, 0,
+                   (timer_handler)&fs->scrub_timer_expired);
+}
 
-static u64 tfs_freeblocks(filesystem fs)
+closure_func_basic(timer_handler, void, tfs_scrub_timer_expired,
+                   u64 expiry, u64 overruns)
 {
-    u64 free_blocks = 0;
-    range q = irangel(0, fs->size >> fs->blocksize_order);
-    tfs tfs = (struct tfs *)fs;
-    tfs_storage_lock(tfs);
-    rangemap_range_find_gaps(tfs->storage, q, stack_closure(tfs_storage_freeblocks, &free_blocks));
-    tfs_storage_unlock(tfs);
-    return free_blocks;
+    if (overruns == timer_disabled)
+        return;
+    tfs fs = struct_from_closure(tfs, scrub_timer_expired);
+    async_apply((thunk)&fs->scrub_step);
+}
+#else
+/* Without timers, the scrub runs without delays and stops at the end of a pass. */
+static void tfs_scrub_schedule(tfs fs, timestamp delay)
+{
+    if (delay >= seconds(TFS_SCRUB_PASS_SECONDS))
+        fs->scrub = false;
+    thunk step = (thunk)&fs->scrub_step;
+    apply(step);
 }
+#endif
 
-void filesystem_log_rebuild(tfs fs, log new_tl, status_handler sh)
+/* Looks for the next chunk of data with known checksums in the file being scrubbed, copying the
+ * checksums of the chunk; returns false at the end of the file. Called with the fs lock held. */
+static boolean tfs_scrub_chunk(tfs fs)
 {
-    tfs_debug("%s(%F)\n", func_ss, sh);
-    tuple root = fs->fs.root;
-    cleanup_directory(root);
-    boolean ok = log_write(new_tl, root);
-    fixup_directory(root, root);
-    if (ok) {
-        fs->temp_log = new_tl;
-        log_flush(new_tl, sh);
-    } else {
-        filesystem_unlock(&fs->fs);
-        apply(sh, timm("result", "failed to write log"));
-        filesystem_lock(&fs->fs);
+    tfsfile f = fs->scrub_file;
+    int order = fs->fs.blocksize_order;
+    boolean found = false;
+    rmnode n = rangemap_lookup_max_lte(f->extentmap, fs->scrub_next);
+    if ((n == INVALID_ADDRESS) || (n->r.start != fs->scrub_next)) {
+        /* the extent being scrubbed has been removed */
+        n = (n == INVALID_ADDRESS) ? rangemap_first_node(f->extentmap) :
+                                     rangemap_next_node(f->extentmap, n);
+        fs->scrub_index = 0;
+    }
+    for (; n != INVALID_ADDRESS; n = rangemap_next_node(f->extentmap, n)) {
+        extent ex = (extent)n;
+        if (fs->scrub_next != n->r.start) {
+            fs->scrub_next = n->r.start;
+            fs->scrub_index = 0;
+        }
+        tuple checksums = ex->md ? get_tuple(ex->md, sym(checksums)) : 0;
+        if (!checksums || (ex->uninited == INVALID_ADDRESS))
+            continue;
+        u64 nblocks = ex->compressed ? pad(ex->compressed, fs_blocksize(&fs->fs)) >> order :
+                                       range_span(n->r);
+        for (; fs->scrub_index < nblocks; fs->scrub_index += fs->scrub_count) {
+            fs->scrub_count = MIN(nblocks - fs->scrub_index, TFS_SCRUB_BUFFER_SIZE >> order);
+            if (tfs_checksums_copy(checksums, fs->scrub_index, fs->scrub_count, fs->scrub_sums)) {
+                u64 block = ex->start_block + fs->scrub_index;
+                if (block != fs->scrub_block) {
+                    fs->scrub_block = block;
+                    fs->scrub_retry = false;
+                }
+                found = true;
+                break;
+            }
+        }
+        if (found)
+            break;
     }
+    return found;
 }
 
-void filesystem_log_rebuild_done(tfs fs, log new_tl)
+closure_func_basic(thunk, void, tfs_scrub_step)
 {
-    tfs_debug("%s\n", func_ss);
-    fs->tl = new_tl;
-    fs->temp_log = 0;
+    tfs fs = struct_from_closure(tfs, scrub_step);
+    heap h = fs->fs.h;
+    int order = fs->fs.blocksize_order;
+    tfsfile release = 0;
+    boolean read = false;
+    filesystem_lock(&fs->fs);
+    if (!fs->scrub) {
+        fs->scrub_running = false;
+        vector_clear(fs->scrub_files);
+        release = fs->scrub_file;
+        fs->scrub_file = 0;
+        if (fs->scrub_buf) {
+            deallocate(fs->dma, fs->scrub_buf, TFS_SCRUB_BUFFER_SIZE);
+            deallocate(h, fs->scrub_sums, (TFS_SCRUB_BUFFER_SIZE >> order) * sizeof(u32));
+            fs->scrub_buf = 0;
+        }
+        goto out;
+    }
+    if (!fs->scrub_buf) {
+        fs->scrub_buf = allocate(fs->dma, TFS_SCRUB_BUFFER_SIZE);
+        if (fs->scrub_buf == INVALID_ADDRESS) {
+            fs->scrub_buf = 0;
+            goto alloc_fail;
+        }
+        fs->scrub_sums = allocate(h, (TFS_SCRUB_BUFFER_SIZE >> order) * sizeof(u32));
+        if (fs->scrub_sums == INVALID_ADDRESS) {
+            deallocate(fs->dma, fs->scrub_buf, TFS_SCRUB_BUFFER_SIZE);
+            fs->scrub_buf = 0;
+            goto alloc_fail;
+        }
+    }
+    if (!fs->scrub_file) {
+        if (vector_length(fs->scrub_files) == 0) {
+            table_foreach(fs->files, md, v) {
+                if (v != INVALID_ADDRESS)
+                    vector_push(fs->scrub_files, md);
+            }
+        }
+        tfsfile f = 0;
+        while (!f && (vector_length(fs->scrub_files) > 0)) {
+            f = table_find(fs->files, vector_pop(fs->scrub_files));
+            if (f == INVALID_ADDRESS)
+                f = 0;
+        }
+        if (!f) {
+            fs->scrub_passes++;
+            tfs_scrub_schedule(fs, seconds(TFS_SCRUB_PASS_SECONDS));
+            goto out;
+        }
+        fsfile_reserve(&f->f);
+        fs->scrub_file = f;
+        fs->scrub_next = fs->scrub_index = 0;
+        fs->scrub_block = INVALID_PHYSICAL;
+        fs->scrub_retry = false;
+    }
+    if (tfs_scrub_chunk(fs)) {
+        read = true;
+    } else {
+        release = fs->scrub_file;
+        fs->scrub_file = 0;
+        if (vector_length(fs->scrub_files) == 0) {
+            /* end of pass */
+            fs->scrub_passes++;
+            tfs_scrub_schedule(fs, seconds(TFS_SCRUB_PASS_SECONDS));
+        } else {
+            tfs_scrub_schedule(fs, 0);
+        }
+    }
+  out:
+    filesystem_unlock(&fs->fs);
+    if (release)
+        fsfile_release(&release->f);
+    if (read) {
+        u64 length = fs->scrub_count << order;
+        status_handler sh = (status_handler)&fs->scrub_read_done;
+        fs->scrub_sg = allocate_sg_list();
+        if (fs->scrub_sg == INVALID_ADDRESS) {
+            fs->scrub_sg = 0;
+            apply(sh, timm("result", "failed to allocate sg list"));
+            return;
+        }
+        sg_buf sgb = sg_list_tail_add(fs->scrub_sg, length);
+        if (sgb == INVALID_ADDRESS) {
+            apply(sh, timm("result", "failed to allocate sg buf"));
+            return;
+        }
+        sgb->buf = fs->scrub_buf;
+        sgb->offset = 0;
+        sgb->size = length;
+        sgb->refcount = 0;
+        tfs_storage_op(fs, fs->scrub_sg, irangel(fs->scrub_block, fs->scrub_count), false, sh);
+    }
+    return;
+  alloc_fail:
+    msg_err("failed to allocate scrub buffer\n");
+    tfs_scrub_schedule(fs, seconds(TFS_SCRUB_PASS_SECONDS));
+    filesystem_unlock(&fs->fs);
 }
 
-closure_func_basic(status_handler, void, tfsfile_sync_complete,
+closure_func_basic(status_handler, void, tfs_scrub_read_done,
                    status s)
 {
-    if (!is_ok(s)) {
-        msg_err("failed to purge page cache node: %v\n", s);
+    tfs fs = struct_from_closure(tfs, scrub_read_done);
+    int order = fs->fs.blocksize_order;
+    u64 n = fs->scrub_count;
+    if (fs->scrub_sg) {
+        deallocate_sg_list(fs->scrub_sg);
+        fs->scrub_sg = 0;
+    }
+    u64 mismatches = 0;
+    u64 first = n;
+    if (is_ok(s)) {
+        for (u64 i = tfs_buf_verify(fs, fs->scrub_buf, n, fs->scrub_sums); i < n;
+             i += 1 + tfs_buf_verify(fs, fs->scrub_buf + ((i + 1) << order), n - i - 1,
+                                     fs->scrub_sums + i + 1)) {
+            if (!mismatches++)
+                first = i;
+        }
+    } else {
+        msg_err("failed to read storage blocks at 0x%lx for scrub: %v\n", fs->scrub_block, s);
         timm_dealloc(s);
     }
-    tfsfile f = (tfsfile)struct_from_closure(fsfile, sync_complete);
-    tfs fs = tfs_from_file(f);
-    deallocate_fsfile(fs, f, stack_closure(free_extent, fs));
+    filesystem_lock(&fs->fs);
+    fs->scrub_bytes += n << order;
+    if (mismatches && !fs->scrub_retry) {
+        fs->scrub_retry = true;
+    } else {
+        if (mismatches) {
+            tfsfile f = fs->scrub_file;
+            fs->scrub_errors += mismatches;
+            msg_err("scrub: %ld checksum mismatches in inode %ld, extent at file offset 0x%lx, "
+                    "first at storage block 0x%lx\n", mismatches, fs->fs.get_inode(&fs->fs, f->f.md),
+                    fs->scrub_next << order, fs->scrub_block + first);
+        }
+        fs->scrub_retry = false;
+        fs->scrub_index += n;
+    }
+    tfs_scrub_schedule(fs, seconds(n << order) / TFS_SCRUB_RATE);
+    filesystem_unlock(&fs->fs);
 }
 
-closure_function(1, 0, void, free_extents,
-                 fsfile, f)
-{
-    fsfile f = bound(f);
-    status_handler sh = init_closure_func(&f->sync_complete, status_handler, tfsfile_sync_complete);
 #ifdef KERNEL
-    pagecache_purge_node(f->cache_node, sh);
-#else
-    apply(sh, STATUS_OK);
-#endif
+closure_function(1, 1, boolean, tfs_set_scrub,
+                 tfs, fs,
+                 value v)
+{
+    tfs fs = bound(fs);
+    u64 enable;
+    if (!u64_from_value(v, &enable))
+        return false;
+    filesystem_lock(&fs->fs);
+    fs->scrub = (enable != 0);
+    if (fs->scrub && !fs->scrub_running) {
+        fs->scrub_running = true;
+        tfs_scrub_schedule(fs, 0);
+    }
+    filesystem_unlock(&fs->fs);
+    return true;
+}
+
+closure_function(1, 1, boolean, tfs_set_checksums,
+                 tfs, fs,
+                 value v)
+{
+    tfs fs = bound(fs);
+    u64 enable;
+    if (!u64_from_value(v, &enable))
+        return false;
+    filesystem_lock(&fs->fs);
+    fs->checksums = (enable != 0);
+    filesystem_unlock(&fs->fs);
+    return true;
+}
+
+closure_function(2, 0, value, tfs_get_checksum_stats,
+                 tfs, fs, tuple, t)
+{
+    tfs fs = bound(fs);
+    tuple t = bound(t);
+    filesystem_lock(&fs->fs);
+    u64 scrub_bytes = fs->scrub_bytes;
+    u64 scrub_errors = fs->scrub_errors;
+    u64 scrub_passes = fs->scrub_passes;
+    filesystem_unlock(&fs->fs);
+    symbol s = sym(read_errors);
+    set(t, s, value_rewrite_u64(get(t, s), fs->checksum_errors));
+    s = sym(scrub_errors);
+    set(t, s, value_rewrite_u64(get(t, s), scrub_errors));
+    s = sym(scrub_bytes);
+    set(t, s, value_rewrite_u64(get(t, s), scrub_bytes));
+    s = sym(scrub_passes);
+    set(t, s, value_rewrite_u64(get(t, s), scrub_passes));
+    return t;
+}
+
+value filesystem_management(filesystem fs)
+{
+    tfs tfs = (struct tfs *)fs;
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    tuple_notifier n = tuple_notifier_wrap(t, false);
+    assert(n != INVALID_ADDRESS);
+
+    /* histogram of sync batches, keyed by the minimum number of requests served by a batch */
+    tuple sb = allocate_tuple();
+    assert(sb != INVALID_ADDRESS);
+    for (int order = 0; order < TFS_SYNC_BATCH_ORDERS; order++)
+        set(sb, intern_u64(U64_FROM_BIT(order)), value_from_u64(0));
+    symbol s = sym(sync_batches);
+    set(t, s, sb);
+    tuple_notifier_register_get_notify(n, s, closure(fs->h, tfs_get_sync_batches, tfs, sb));
+
+    /* background defragmentation, enabled by setting the defrag attribute to 1 */
+    s = sym(defrag);
+    set(t, s, value_from_u64(0));
+    tuple_notifier_register_set_notify(n, s, closure(fs->h, tfs_set_defrag, tfs));
+
+    /* extents removed and bytes relocated by defragmentation */
+    tuple ds = allocate_tuple();
+    assert(ds != INVALID_ADDRESS);
+    set(ds, sym(extents), value_from_u64(0));
+    set(ds, sym(bytes), value_from_u64(0));
+    s = sym(defrag_stats);
+    set(t, s, ds);
+    tuple_notifier_register_get_notify(n, s, closure(fs->h, tfs_get_defrag_stats, tfs, ds));
+
+    /* online discard of freed storage, enabled by setting the discard attribute to 1 */
+    s = sym(discard);
+    set(t, s, value_from_u64(0));
+    tuple_notifier_register_set_notify(n, s, closure(fs->h, tfs_set_discard, tfs));
+
+    /* discard requests completed and bytes discarded, online or via FITRIM */
+    tuple dcs = allocate_tuple();
+    assert(dcs != INVALID_ADDRESS);
+    set(dcs, sym(requests), value_from_u64(0));
+    set(dcs, sym(bytes), value_from_u64(0));
+    s = sym(discard_stats);
+    set(t, s, dcs);
+    tuple_notifier_register_get_notify(n, s, closure(fs->h, tfs_get_discard_stats, tfs, dcs));
+
+    /* checksums of the data of new extents, stored if the checksums attribute is set to 1 */
+    s = sym(checksums);
+    set(t, s, value_from_u64(tfs->checksums));
+    tuple_notifier_register_set_notify(n, s, closure(fs->h, tfs_set_checksums, tfs));
+
+    /* background scrub of file data with checksums, enabled by setting the scrub attribute to 1 */
+    s = sym(scrub);
+    set(t, s, value_from_u64(0));
+    tuple_notifier_register_set_notify(n, s, closure(fs->h, tfs_set_scrub, tfs));
+
+    /* checksum mismatches found by reads and by the scrub, and scrub progress */
+    tuple cs = allocate_tuple();
+    assert(cs != INVALID_ADDRESS);
+    set(cs, sym(read_errors), value_from_u64(0));
+    set(cs, sym(scrub_errors), value_from_u64(0));
+    set(cs, sym(scrub_bytes), value_from_u64(0));
+    set(cs, sym(scrub_passes), value_from_u64(0));
+    s = sym(checksum_stats);
+    set(t, s, cs);
+    tuple_notifier_register_get_notify(n, s, closure(fs->h, tfs_get_checksum_stats, tfs, cs));
+    return n;
 }
+#endif
 
 #endif /* !TFS_READ_ONLY */
 
@@ -1266,7 +4197,7 @@ tfsfile allocate_fsfile(tfs fs, tuple md)
     fsfile fsf = &f->f;
 #ifdef KERNEL
     pagecache_node_reserve fs_reserve =
-        closure(h, filesystem_check_or_reserve_extent, fs, f);
+        closure(h, filesystem_reserve_delalloc, fs, f);
 #endif
     thunk fs_free =
 #ifndef TFS_READ_ONLY
@@ -1289,6 +4220,13 @@ tfsfile allocate_fsfile(tfs fs, tuple md)
         return INVALID_ADDRESS;
     }
     f->extentmap = allocate_rangemap(h);
+#ifdef KERNEL
+    f->delalloc = allocate_rangemap(h);
+    assert(f->delalloc != INVALID_ADDRESS);
+#endif
+    f->prealloc = irange(0, 0);
+    f->defrag = irange(0, 0);
+    f->defrag_dirty = false;
     fsf->get_blocks = tfsfile_get_blocks;
     if (md)
         table_set(fs->files, md, f);
@@ -1310,7 +4248,7 @@ closure_function(2, 1, void, log_complete,
     tfs fs = bound(fs);
     if (is_ok(s)) {
         tuple root = fs->fs.root;
-        if (enumerate_dir_entries(fs, root)) {
+        if (enumerate_dir_entries(fs, root, true)) {
 #ifndef TFS_READ_ONLY
             fixup_directory(root, root);
 #endif
@@ -1340,18 +4278,26 @@ void filesystem_get_uuid(filesystem fs, u8 *uuid)
 
 boolean filesystem_reserve_log_space(tfs fs, u64 *next_offset, u64 *offset, u64 size)
 {
+    if (!fs->storage)
+        return false;
     if (size == 0)
         size = filesystem_log_blocks(fs);
+    boolean success = true;
+    tfs_storage_lock(fs);
     if (*next_offset == INVALID_PHYSICAL) {
-        *next_offset = filesystem_allocate_storage(fs, size);
-        if (*next_offset == INVALID_PHYSICAL)
-            return false;
+        *next_offset = filesystem_allocate_storage_locked(fs, size, 0);
+        if (*next_offset == INVALID_PHYSICAL) {
+            success = false;
+            goto out;
+        }
     }
     if (offset) {
         *offset = *next_offset;
-        *next_offset = filesystem_allocate_storage(fs, size);
+        *next_offset = filesystem_allocate_storage_locked(fs, size, 0);
     }
-    return true;
+  out:
+    tfs_storage_unlock(fs);
+    return success;
 }
 
 static int tfs_get_fsfile(filesystem fs, tuple n, fsfile *f)
@@ -1394,21 +4340,87 @@ void create_filesystem(heap h,
     fs->fs.truncate = tfs_truncate;
     fs->fs.get_freeblocks = tfs_freeblocks;
     fs->fs.get_sync_handler = tfs_get_sync_handler;
+    fs->fs.trim = tfs_trim;
     fs->fs.destroy_fs = destroy_filesystem;
     fs->storage = allocate_rangemap(h);
     assert(fs->storage != INVALID_ADDRESS);
 #ifdef KERNEL
     spin_lock_init(&fs->storage_lock);
+    spin_lock_init(&fs->sync_lock);
     fs->page_order = pagecache_get_page_order();
     fs->zero_page = pagecache_get_zero_page();
 #else
-    fs->page_order = PAGESIZE;
+    fs->page_order = PAGELOG;
     fs->zero_page = allocate_zero(h, PAGESIZE);
 #endif
     fs->temp_log = 0;
+    fs->sync_pending = allocate_vector(h, 8);
+    assert(fs->sync_pending != INVALID_ADDRESS);
+    fs->sync_batch = allocate_vector(h, 8);
+    assert(fs->sync_batch != INVALID_ADDRESS);
+    fs->sync_flush_log = false;
+    fs->syncing = false;
+    fs->compress = false;
+    fs->checksums = false;
+    fs->zero_checksum = crc32c(0, fs->zero_page, blocksize);
+    fs->checksum_pending = allocate_vector(h, 8);
+    assert(fs->checksum_pending != INVALID_ADDRESS);
+    fs->checksum_batch = allocate_vector(h, 8);
+    assert(fs->checksum_batch != INVALID_ADDRESS);
+    fs->checksum_flushing = false;
+    init_closure_func(&fs->checksum_flushed, status_handler, tfs_checksums_flushed);
+    zero(fs->sync_batches, sizeof(fs->sync_batches));
+    init_closure_func(&fs->sync_log_flushed, status_handler, tfs_sync_log_flushed);
+    init_closure_func(&fs->sync_complete, status_handler, tfs_sync_complete);
+    init_closure_func(&fs->defer, tuple_defer, tfs_defer);
+    fs->io_bytes = 0;
+    fs->defrag_extents = fs->defrag_bytes = 0;
+#ifdef KERNEL
+    fs->defrag = fs->defrag_running = false;
+    fs->defrag_files = allocate_vector(h, 8);
+    assert(fs->defrag_files != INVALID_ADDRESS);
+    fs->defrag_file = 0;
+    fs->defrag_io_bytes = 0;
+    fs->defrag_io_time = 0;
+    fs->defrag_backoff = 0;
+    init_timer(&fs->defrag_timer);
+    init_closure_func(&fs->defrag_timer_expired, timer_handler, tfs_defrag_timer_expired);
+    init_closure_func(&fs->defrag_step, thunk, tfs_defrag_step);
+#endif
+    fs->discard_unsupported = fs->write_zeroes_unsupported = false;
+    fs->discard_requests = fs->discard_bytes = 0;
+#ifdef KERNEL
+    fs->discard = fs->discard_scheduled = false;
+    fs->discard_pending = allocate_rangemap(h);
+    assert(fs->discard_pending != INVALID_ADDRESS);
+    init_timer(&fs->discard_timer);
+    init_closure_func(&fs->discard_timer_expired, timer_handler, tfs_discard_timer_expired);
+    init_closure_func(&fs->discard_batch, thunk, tfs_discard_batch);
+    init_closure_func(&fs->discard_complete, io_status_handler, tfs_discard_complete);
+    init_timer(&fs->scrub_timer);
+    init_closure_func(&fs->scrub_timer_expired, timer_handler, tfs_scrub_timer_expired);
+#endif
+    fs->scrub = fs->scrub_running = false;
+    fs->scrub_files = allocate_vector(h, 8);
+    assert(fs->scrub_files != INVALID_ADDRESS);
+    fs->scrub_file = 0;
+    fs->scrub_buf = 0;
+    fs->scrub_sg = 0;
+    fs->scrub_bytes = fs->scrub_errors = fs->scrub_passes = 0;
+    init_closure_func(&fs->scrub_step, thunk, tfs_scrub_step);
+    init_closure_func(&fs->scrub_read_done, status_handler, tfs_scrub_read_done);
 #else
     fs->storage = 0;
 #endif
+    init_closure_func(&fs->deferred_loaded, deferred_tuple_handler, tfs_deferred_loaded);
+#ifdef KERNEL
+    spin_lock_init(&fs->cdata_lock);
+#endif
+    list_init(&fs->cdata_cache);
+    fs->cdata_count = 0;
+    fs->checksum_errors = 0;
+    fs->used_blocks = fs->delalloc_blocks = fs->prealloc_blocks = 0;
+    list_init(&fs->prealloc_files);
     if (!sstring_is_null(label)) {
         int label_len = label.len;
         if (label_len >= sizeof(fs->label))
@@ -1436,20 +4448,25 @@ closure_function(1, 1, boolean, dealloc_extent_node,
     return true;
 }
 
-closure_function(1, 1, boolean, tfs_storage_destroy,
-                 heap, h,
-                 rmnode n)
-{
-    deallocate(bound(h), n, sizeof(*n));
-    return false;
-}
-
 /* If the filesystem is not read-only, this function can only be called after flushing any pending
  * writes. */
 void destroy_filesystem(filesystem fs)
 {
     tfs_debug("%s %p\n", func_ss, fs);
     tfs tfs = (struct tfs *)fs;
+#ifdef KERNEL
+    remove_timer(kernel_timers, &tfs->defrag_timer, 0);
+    deallocate_vector(tfs->defrag_files);
+    remove_timer(kernel_timers, &tfs->discard_timer, 0);
+    deallocate_rangemap(tfs->discard_pending, stack_closure(tfs_storage_destroy, fs->h));
+    remove_timer(kernel_timers, &tfs->scrub_timer, 0);
+#endif
+    deallocate_vector(tfs->scrub_files);
+    if (tfs->scrub_buf) {
+        deallocate(tfs->dma, tfs->scrub_buf, TFS_SCRUB_BUFFER_SIZE);
+        deallocate(fs->h, tfs->scrub_sums,
+                   (TFS_SCRUB_BUFFER_SIZE >> fs->blocksize_order) * sizeof(u32));
+    }
     log_destroy(tfs->tl);
     table_foreach(tfs->files, k, v) {
         fs_notify_release(k, true);
@@ -1461,6 +4478,12 @@ void destroy_filesystem(filesystem fs)
     filesystem_deinit(fs);
     deallocate_table(tfs->files);
     deallocate_rangemap(tfs->storage, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_vector(tfs->sync_pending);
+    deallocate_vector(tfs->sync_batch);
+    deallocate_vector(tfs->checksum_pending);
+    deallocate_vector(tfs->checksum_batch);
+    list_foreach(&tfs->cdata_cache, l)
+        tfs_cdata_free(tfs, struct_from_list(l, tfs_cdata, l));
     deallocate(fs->h, fs, sizeof(*fs));
 }
 
@@ -27,6 +27,13 @@ tfsfile allocate_fsfile(tfs fs, tuple md);
 
 int filesystem_write_tuple(tfs fs, tuple t);
 int filesystem_write_eav(tfs fs, tuple t, symbol a, value v, boolean cleanup);
+void filesystem_checkpoint(tfs fs);
+void filesystem_set_compression(filesystem fs, boolean compress);
+void filesystem_set_checksums(filesystem fs, boolean checksums);
+void filesystem_defrag(fsfile f, status_handler completion);
+#ifdef KERNEL
+value filesystem_management(filesystem fs);
+#endif
 
 int filesystem_mkentry(filesystem fs, tuple cwd, sstring fp, tuple entry,
     boolean persistent, boolean recursive);
@@ -7,7 +7,9 @@
 #include <storage.h>
 #include <tfs.h>
 
-#define TFS_VERSION 0x00000005
+#define TFS_VERSION 0x00000006
+
+#define TFS_SYNC_BATCH_ORDERS   8
 
 typedef struct log *log;
 
@@ -16,6 +18,8 @@ typedef struct tfs {
     rangemap storage;
 #ifdef KERNEL
     struct spinlock storage_lock;
+    struct spinlock sync_lock;
+    struct spinlock cdata_lock;
 #endif
     int alignment_order;        /* in blocks */
     int page_order;
@@ -29,11 +33,90 @@ typedef struct tfs {
     log temp_log;
     u64 next_extend_log_offset;
     u64 next_new_log_offset;
+    vector sync_pending;        /* sync completions waiting for the next flush */
+    vector sync_batch;          /* sync completions served by the flush in flight */
+    boolean sync_flush_log;
+    boolean syncing;
+    u64 sync_batches[TFS_SYNC_BATCH_ORDERS];    /* histogram of batch sizes, by power of 2 */
+    u64 used_blocks;            /* protected by the storage lock, as the 2 fields below */
+    u64 delalloc_blocks;        /* reserved for dirty file data not yet written to storage */
+    u64 prealloc_blocks;        /* speculatively preallocated past the end of files */
+    struct list prealloc_files; /* files with preallocated storage */
+    boolean compress;           /* store new file data in compressed extents */
+    struct list cdata_cache;    /* decompressed data of compressed extents, most recent first */
+    u64 cdata_count;
+    u64 defrag_extents;         /* extents removed by defragmentation, under the fs lock */
+    u64 defrag_bytes;           /* file data relocated by defragmentation */
+    word io_bytes;              /* foreground I/O issued to storage */
+#ifdef KERNEL
+    boolean defrag;             /* background defragmentation enabled */
+    boolean defrag_running;
+    vector defrag_files;        /* metadata of the files left in the current pass */
+    tfsfile defrag_file;        /* file being defragmented, with a reference held */
+    u64 defrag_io_bytes;        /* value of io_bytes at the end of the previous job */
+    timestamp defrag_io_time;
+    u8 defrag_backoff;          /* order of the delay between jobs under foreground I/O */
+    struct timer defrag_timer;
+    closure_struct(timer_handler, defrag_timer_expired);
+    closure_struct(thunk, defrag_step);
+#endif
+    boolean discard_unsupported;        /* storage does not support discard requests */
+    boolean write_zeroes_unsupported;   /* storage does not support write zeroes requests */
+    u64 discard_requests;       /* discard requests completed, under the storage lock */
+    u64 discard_bytes;          /* storage discarded */
+#ifdef KERNEL
+    boolean discard;            /* online discard of freed storage enabled */
+    boolean discard_scheduled;  /* pending discards are waiting for the timer or in flight */
+    rangemap discard_pending;   /* freed storage blocks to be discarded, under the storage lock */
+    struct timer discard_timer;
+    closure_struct(timer_handler, discard_timer_expired);
+    closure_struct(thunk, discard_batch);
+    closure_struct(io_status_handler, discard_complete);
+#endif
+    boolean checksums;          /* store checksums of the data of new extents */
+    u32 zero_checksum;          /* checksum of a block of zeroes */
+    u64 checksum_errors;        /* checksum mismatches found when reading file data */
+    vector checksum_pending;    /* checksum updates of completed writes, under the sync lock */
+    vector checksum_batch;      /* checksum updates served by the flush in flight */
+    boolean checksum_flushing;
+    closure_struct(status_handler, checksum_flushed);
+    boolean scrub;              /* background scrub enabled */
+    boolean scrub_running;
+    boolean scrub_retry;        /* the chunk being read failed verification once already */
+    vector scrub_files;         /* metadata of the files left in the current pass */
+    tfsfile scrub_file;         /* file being scrubbed, with a reference held */
+    u64 scrub_next;             /* file block of the extent being scrubbed */
+    u64 scrub_index;            /* index of the next data block to be scrubbed in the extent */
+    u64 scrub_block;            /* storage block of the chunk being read */
+    u64 scrub_count;            /* blocks in the chunk being read */
+    void *scrub_buf;
+    u32 *scrub_sums;            /* known checksums of the chunk being read */
+    sg_list scrub_sg;
+    u64 scrub_bytes;            /* under the fs lock, as the 3 fields below */
+    u64 scrub_errors;
+    u64 scrub_passes;
+    closure_struct(thunk, scrub_step);
+    closure_struct(status_handler, scrub_read_done);
+#ifdef KERNEL
+    struct timer scrub_timer;
+    closure_struct(timer_handler, scrub_timer_expired);
+#endif
+    closure_struct(status_handler, sync_log_flushed);
+    closure_struct(status_handler, sync_complete);
+    closure_struct(tuple_defer, defer);
+    closure_struct(deferred_tuple_handler, deferred_loaded);
 } *tfs;
 
 typedef struct tfsfile {
     struct fsfile f;    /* must be first */
     rangemap extentmap;
+#ifdef KERNEL
+    rangemap delalloc;  /* file blocks with space reserved for dirty data, under the storage lock */
+#endif
+    range prealloc;     /* storage blocks preallocated past the last extent, under the storage lock */
+    struct list prealloc_l;
+    range defrag;       /* file blocks being relocated by defragmentation */
+    boolean defrag_dirty;   /* written to while being relocated */
 } *tfsfile;
 
 declare_closure_struct(2, 0, void, free_uninited,
@@ -58,22 +141,27 @@ typedef struct extent {
     u64 allocated;
     tuple md;                   /* shortcut to extent meta */
     uninited uninited;
+    u64 compressed;             /* length in bytes of LZ4-compressed data, 0 if not compressed */
+    struct list checksum_updates;   /* of the writes in progress to the extent */
 } *extent;
 
-void ingest_extent(tfsfile f, symbol foff, tuple value);
+void ingest_extent(tfsfile f, symbol foff, tuple value, boolean reserve);
 
 log log_create(heap h, tfs fs, boolean initialize, status_handler sh);
 boolean log_write(log tl, tuple t);
 boolean log_write_eav(log tl, tuple e, symbol a, value v);
+boolean log_write_checkpoint(log tl, tuple root);
+boolean log_deferred_loaded(log tl, tuple t, table dictionary);
 void log_flush(log tl, status_handler completion);
+void log_checkpoint(log tl);
 void log_destroy(log tl);
-u64 filesystem_allocate_storage(tfs fs, u64 nblocks);
+u64 filesystem_allocate_storage(tfs fs, u64 nblocks, u64 goal);
 boolean filesystem_reserve_storage(tfs fs, range storage_blocks);
 boolean filesystem_free_storage(tfs fs, range storage_blocks);
 void filesystem_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
                            status_handler completion);
 
-void filesystem_log_rebuild(tfs fs, log new_tl, status_handler sh);
+boolean filesystem_log_rebuild(tfs fs, log new_tl, status_handler sh);
 void filesystem_log_rebuild_done(tfs fs, log new_tl);
 
 boolean filesystem_reserve_log_space(tfs fs, u64 *next_offset, u64 *offset, u64 size);
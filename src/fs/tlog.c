@@ -78,7 +78,9 @@ struct log {
     heap h;
     tfs fs;
     table dictionary;
+    struct tuple_deferral deferral;
     u64 total_entries, obsolete_entries;
+    u64 checkpoint_entries;         /* total entries after the directory tree checkpoint */
     rangemap extensions;
     log_ext current;
     buffer tuple_staging;
@@ -86,17 +88,23 @@ struct log {
     u64 tuple_bytes_remain;
 
     struct timer flush_timer;
-    vector flush_completions;
+    vector flush_completions;       /* waiting for the next flush */
+    vector flushing_completions;    /* waiting for the flush in progress */
     boolean dirty;
     boolean flushing;
+    boolean flush_requested;
+    boolean compact_pending;
+    boolean checkpoint_requested;
     enum {
         TLOG_STATE_INIT,
         TLOG_STATE_LINKED,
-        TLOG_STATE_COMPACTING,
+        TLOG_STATE_COMPACTING,  /* new log being written, this log is still flushed */
+        TLOG_STATE_SWITCHING,   /* flushes are deferred until the new log replaces this log */
         TLOG_STATE_FAILED,      /* unrecoverable log failure */
     } state;
     struct refcount refcount;
     closure_struct(thunk, free);
+    closure_struct(thunk, compact);
 };
 
 define_closure_function(3, 3, void, log_storage_op,
@@ -200,21 +208,35 @@ static log log_new(heap h, tfs fs)
     tl->tuple_staging = allocate_buffer(h, PAGESIZE /* arbitrary */);
     if (tl->tuple_staging == INVALID_ADDRESS)
         goto fail_dealloc_dict;
+    tl->deferral.h = h;
+    tl->deferral.locations = allocate_table(h, identity_key, pointer_equal);
+    if (tl->deferral.locations == INVALID_ADDRESS)
+        goto fail_dealloc_staging;
+    tl->deferral.defer = 0;
+    tl->deferral.dictionaries = 0;
+    tl->deferral.loaded = (deferred_tuple_handler)&fs->deferred_loaded;
     tl->encoding_lengths = allocate_vector(h, 512);
     if (tl->encoding_lengths == INVALID_ADDRESS)
-        goto fail_dealloc_staging;
+        goto fail_dealloc_locations;
     tl->tuple_bytes_remain = 0;
     tl->dirty = false;
     tl->flushing = false;
+    tl->flush_requested = false;
+    tl->compact_pending = false;
+    tl->checkpoint_requested = false;
     init_timer(&tl->flush_timer);
     tl->flush_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
     if (tl->flush_completions == INVALID_ADDRESS)
         goto fail_dealloc_encoding_lengths;
+    tl->flushing_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
+    if (tl->flushing_completions == INVALID_ADDRESS)
+        goto fail_dealloc_completions;
     tl->total_entries = tl->obsolete_entries = 0;
+    tl->checkpoint_entries = 0;
 #ifndef TLOG_READ_ONLY
     tl->extensions = allocate_rangemap(h);
     if (tl->extensions == INVALID_ADDRESS) {
-        goto fail_dealloc_completions;
+        goto fail_dealloc_flushing_completions;
     }
     init_refcount(&tl->refcount, 1, init_closure_func(&tl->free, thunk, log_free));
 #endif
@@ -224,13 +246,17 @@ static log log_new(heap h, tfs fs)
 #ifndef TLOG_READ_ONLY
         deallocate_rangemap(tl->extensions, stack_closure(log_dealloc_ext_node, tl));
 #endif
-        goto fail_dealloc_completions;
+        goto fail_dealloc_flushing_completions;
     }
     return tl;
+  fail_dealloc_flushing_completions:
+    deallocate_vector(tl->flushing_completions);
   fail_dealloc_completions:
     deallocate_vector(tl->flush_completions);
   fail_dealloc_encoding_lengths:
     deallocate_vector(tl->encoding_lengths);
+  fail_dealloc_locations:
+    deallocate_table(tl->deferral.locations);
   fail_dealloc_staging:
     deallocate_buffer(tl->tuple_staging);
   fail_dealloc_dict:
@@ -264,10 +290,12 @@ closure_function(4, 1, void, flush_log_extension_complete,
     log_ext ext = bound(ext);
     tlog_debug("%s: status %v\n", func_ss, s);
     deallocate_sg_list(bound(sg));
-    apply(bound(complete), s);
+
+    /* the extension is released before invoking the completion, which may destroy the log */
     refcount_release(&ext->refcount);
     if (bound(release))
         close_log_extension(ext);
+    apply(bound(complete), s);
     closure_finish();
 }
 
@@ -444,34 +472,70 @@ static inline boolean log_write_internal(log tl, merge m)
     return true;
 }
 
-static void run_flush_completions(log tl, status s)
+/* Completions may add other completions to the vector while it is being iterated. */
+static void run_flush_completions(vector completions, status s)
 {
-    if (tl->flush_completions) {
-        status_handler sh;
-        vector_foreach(tl->flush_completions, sh)
+    for (int i = 0; i < vector_length(completions); i++) {
+        status_handler sh = vector_get(completions, i);
 #ifdef KERNEL
-            async_apply_status_handler(sh, s);
+        async_apply_status_handler(sh, s);
 #else
-            apply(sh, s);
+        apply(sh, s);
 #endif
-        vector_clear(tl->flush_completions);
     }
+    vector_clear(completions);
 }
 
 closure_function(1, 1, void, log_flush_complete,
                  log, tl,
                  status s)
 {
-    /* would need to move these to runqueue if a flush is ever invoked from a tfs op */
-    tlog_lock(bound(tl));
-    bound(tl)->dirty = false;
-    run_flush_completions(bound(tl), s);
-    bound(tl)->flushing = false;
-    tlog_unlock(bound(tl));
-    refcount_release(&bound(tl)->refcount);
+    log tl = bound(tl);
+    tlog_lock(tl);
+    run_flush_completions(tl->flushing_completions, s);
+    tl->flushing = false;
+
+    /* start the next flush if it has been requested while this one was in progress */
+    if (tl->flush_requested && (tl->state != TLOG_STATE_SWITCHING)) {
+        tl->flush_requested = false;
+        log_flush(tl, 0);
+    }
+    tlog_unlock(tl);
+    refcount_release(&tl->refcount);
+    closure_finish();
+}
+
+/* Called when the new log has been written in its entirety: the old log stops being flushed, and
+ * any tuple updates done since the start of compaction (which have been written to both logs) are
+ * flushed to the new log before the new log is linked in place of the old one. */
+closure_function(3, 1, void, log_switch_begin,
+                 log, old_tl, log, new_tl, status_handler, link,
+                 status s)
+{
+    tlog_debug("%s: status %v\n", func_ss, s);
+    status_handler link = bound(link);
+    if (!is_ok(s)) {
+        apply(link, s);
+        closure_finish();
+        return;
+    }
+    log old_tl = bound(old_tl);
+    log new_tl = bound(new_tl);
+    tfs fs = old_tl->fs;
+    filesystem_lock(&fs->fs);
+    old_tl->state = TLOG_STATE_SWITCHING;
+    new_tl->dirty = true;   /* the link must be written after any tuple updates */
+    log_flush(new_tl, link);
+    filesystem_unlock(&fs->fs);
     closure_finish();
 }
 
+/* Returns whether a value is referenced by the log, either directly or within a deferred tuple. */
+static boolean log_references(log tl, value v)
+{
+    return table_find(tl->dictionary, v) || table_find(tl->deferral.locations, v);
+}
+
 closure_function(2, 1, void, log_switch_complete,
                  log, old_tl, log, new_tl,
                  status s)
@@ -491,21 +555,38 @@ closure_function(2, 1, void, log_switch_complete,
     }
     to_be_used->state = TLOG_STATE_LINKED;
     filesystem_log_rebuild_done(fs, to_be_used);
-    if (is_ok(s))
+    if (is_ok(s)) {
         table_foreach(old_tl->dictionary, k, v) {
             (void)v;
-            if (is_composite(k) && !table_find(new_tl->dictionary, k)) {
+            if (is_composite(k) && !log_references(new_tl, k)) {
                 tlog_debug("  destroying value %p\n", __func__, k);
                 destruct_value(k, false);
             }
         }
+        table_foreach(old_tl->deferral.locations, k, v) {
+            (void)v;
+            if (!table_find(old_tl->dictionary, k) && !log_references(new_tl, k)) {
+                tlog_debug("  destroying deferred value %p\n", __func__, k);
+                destruct_value(k, false);
+            }
+        }
+    }
     rangemap_foreach(to_be_destroyed->extensions, ext) {
         tlog_debug("  deallocating extension at %R\n", __func__, ext->r);
         if (!filesystem_free_storage(fs, ext->r))
             msg_err("failed to mark to_be_destroyed log at %R as free", ext->r);
     }
 
-    run_flush_completions(old_tl, s);
+    /* Flushes requested while switching are completed by flushing the log being used, which
+     * contains all tuple updates. */
+    if (to_be_used == new_tl) {
+        status_handler sh;
+        vector_foreach(old_tl->flush_completions, sh)
+            vector_push(new_tl->flush_completions, sh);
+        vector_clear(old_tl->flush_completions);
+    }
+    to_be_used->dirty = true;
+    log_flush(to_be_used, 0);
     filesystem_unlock(&fs->fs);
 
     refcount_release(&to_be_destroyed->refcount);
@@ -513,26 +594,128 @@ closure_function(2, 1, void, log_switch_complete,
     closure_finish();
 }
 
+static boolean log_compaction_needed(log tl)
+{
+    return tl->checkpoint_requested ||
+           (tl->total_entries - tl->checkpoint_entries >= TFS_LOG_CHECKPOINT_ENTRIES) ||
+           ((tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
+            (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries));
+}
+
+/* Log compaction rewrites the entire directory tree; it runs in a separate context from the flush
+ * that detected the need for it. The filesystem lock is held only while the tree is encoded into
+ * the new log: writing the new log to storage is overlapped with flushes of the old log (see
+ * log_switch_begin()). */
+closure_func_basic(thunk, void, log_compact)
+{
+    log tl = struct_from_closure(log, compact);
+    tfs fs = tl->fs;
+    status_handler rebuild_complete = 0;
+    boolean rebuilt = false;
+    filesystem_lock(&fs->fs);
+    tl->compact_pending = false;
+    if ((tl->state == TLOG_STATE_LINKED) && log_compaction_needed(tl)) {
+        tlog_debug("%ld obsolete entries out of %ld, starting log compaction\n",
+            tl->obsolete_entries, tl->total_entries);
+        tl->checkpoint_requested = false;
+        log new_tl = log_new(fs->fs.h, fs);
+        if (new_tl == INVALID_ADDRESS)
+            goto out;
+        log_ext new_ext = log_ext_new(new_tl);
+        if (new_ext == INVALID_ADDRESS)
+            goto fail_log_destroy;
+        status_handler switch_complete = closure(new_tl->h, log_switch_complete,
+            tl, new_tl);
+        if (switch_complete == INVALID_ADDRESS)
+            goto fail_log_ext_close;
+        status_handler link = closure(tl->h, log_extend_link,
+            new_tl->current, new_ext->sectors, switch_complete);
+        if (link == INVALID_ADDRESS)
+            goto fail_log_dealloc_closure;
+        rebuild_complete = closure(tl->h, log_switch_begin, tl, new_tl, link);
+        if (rebuild_complete == INVALID_ADDRESS)
+            goto fail_log_dealloc_link;
+        log_extension_init(new_tl->current);
+        log_extension_init(new_ext);
+        new_tl->current = new_ext;
+        tl->state = TLOG_STATE_COMPACTING;
+        new_tl->state = TLOG_STATE_INIT;
+        rebuilt = filesystem_log_rebuild(fs, new_tl, rebuild_complete);
+        goto out;
+  fail_log_dealloc_link:
+        deallocate_closure(link);
+  fail_log_dealloc_closure:
+        rebuild_complete = 0;
+        deallocate_closure(switch_complete);
+  fail_log_ext_close:
+        close_log_extension(new_ext);
+        if (!filesystem_free_storage(fs, new_ext->sectors))
+            msg_err("failed to mark new_ext at %R as free", new_ext->sectors);
+  fail_log_destroy:
+        log_destroy(new_tl);
+    }
+  out:
+    filesystem_unlock(&fs->fs);
+    if (rebuild_complete && !rebuilt)
+        apply(rebuild_complete, timm("result", "failed to write log"));
+    refcount_release(&tl->refcount);
+}
+
+/* Called with fs locked. */
+static void log_compact_schedule(log tl)
+{
+    if ((tl->state != TLOG_STATE_LINKED) || tl->compact_pending)
+        return;
+    tl->compact_pending = true;
+    refcount_reserve(&tl->refcount);
+    thunk t = init_closure_func(&tl->compact, thunk, log_compact);
+#ifdef KERNEL
+    async_apply(t);
+#else
+    apply(t);
+#endif
+}
+
+/* Called with fs locked.
+ * A completion is invoked after all tuple updates done before the call have been written to
+ * storage: if there are no pending updates, the completion waits for any flush in progress;
+ * otherwise, it waits for the next flush, which starts right away unless another flush is in
+ * progress, in which case it starts when the current flush completes. */
 void log_flush(log tl, status_handler completion)
 {
     tlog_debug("%s: log %p, completion %p, dirty %d\n", func_ss, tl, completion, tl->dirty);
-    if (!tl->dirty && (tl->state != TLOG_STATE_COMPACTING)) {
+    if (tl->state == TLOG_STATE_SWITCHING) {
         if (completion)
+            vector_push(tl->flush_completions, completion);
+        return;
+    }
+    if (!tl->dirty) {
+        if (completion) {
+            if (tl->flushing)
+                vector_push(tl->flushing_completions, completion);
+            else
 #ifdef KERNEL
-            async_apply_status_handler(completion, STATUS_OK);
+                async_apply_status_handler(completion, STATUS_OK);
 #else
-            apply(completion, STATUS_OK);
+                apply(completion, STATUS_OK);
 #endif
+        }
         return;
     }
     if (completion)
         vector_push(tl->flush_completions, completion);
-    if (tl->flushing || (tl->state == TLOG_STATE_COMPACTING))
+    if (tl->flushing) {
+        tl->flush_requested = true;
         return;
+    }
 #ifdef KERNEL
     remove_timer(kernel_timers, &tl->flush_timer, 0);
 #endif
     tl->flushing = true;
+    tl->dirty = false;
+    vector completions = tl->flushing_completions;
+    tl->flushing_completions = tl->flush_completions;
+    tl->flush_completions = completions;
     refcount_reserve(&tl->refcount);
     merge m = allocate_merge(tl->h, closure(tl->h, log_flush_complete, tl));
     status_handler sh = apply_merge(m);
@@ -547,41 +730,18 @@ void log_flush(log tl, status_handler completion)
     flush_log_extension(tl->current, false, sh);
     tlog_lock(tl);
 
-    if ((tl->state == TLOG_STATE_LINKED) && (tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
-        (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries)) {
-        tlog_debug("%ld obsolete entries out of %ld, starting log compaction\n",
-            tl->obsolete_entries, tl->total_entries);
-        tfs fs = tl->fs;
-        log new_tl = log_new(fs->fs.h, fs);
-        if (new_tl == INVALID_ADDRESS)
-            return;
-        log_ext new_ext = log_ext_new(new_tl);
-        if (new_ext == INVALID_ADDRESS)
-            goto fail_log_destroy;
-        status_handler switch_complete = closure(new_tl->h, log_switch_complete,
-            tl, new_tl);
-        if (switch_complete == INVALID_ADDRESS)
-            goto fail_log_ext_close;
-        status_handler rebuild_complete = closure(tl->h, log_extend_link,
-            new_tl->current, new_ext->sectors, switch_complete);
-        if (rebuild_complete == INVALID_ADDRESS)
-            goto fail_log_dealloc_closure;
-        log_extension_init(new_tl->current);
-        log_extension_init(new_ext);
-        new_tl->current = new_ext;
-        tl->state = TLOG_STATE_COMPACTING;
-        new_tl->state = TLOG_STATE_INIT;
-        filesystem_log_rebuild(fs, new_tl, rebuild_complete);
-        return;
-  fail_log_dealloc_closure:
-        deallocate_closure(switch_complete);
-  fail_log_ext_close:
-        close_log_extension(new_ext);
-        if (!filesystem_free_storage(fs, new_ext->sectors))
-            msg_err("failed to mark new_ext at %R as free", new_ext->sectors);
-  fail_log_destroy:
-        log_destroy(new_tl);
-    }
+    if (log_compaction_needed(tl))
+        log_compact_schedule(tl);
+}
+
+/* Rewrites the log as a checkpoint of the directory tree, regardless of the number of log entries
+ * written since the last checkpoint. */
+void log_checkpoint(log tl)
+{
+    tlog_lock(tl);
+    tl->checkpoint_requested = true;
+    log_compact_schedule(tl);
+    tlog_unlock(tl);
 }
 
 #ifdef KERNEL
@@ -628,7 +788,7 @@ boolean log_write_eav(log tl, tuple e, symbol a, value v)
     u64 len = buffer_length(tl->tuple_staging);
     if ((tl->state == TLOG_STATE_FAILED) || len >= TFS_LOG_MAX_TUPLE_STAGING_BYTES)
         return false;
-    encode_eav(tl->tuple_staging, tl->dictionary, e, a, v, &tl->obsolete_entries);
+    encode_eav(tl->tuple_staging, tl->dictionary, e, a, v, &tl->obsolete_entries, &tl->deferral);
     tl->total_entries++;
     len = buffer_length(tl->tuple_staging) - len;
     vector_push(tl->encoding_lengths, (void *)len);
@@ -636,27 +796,63 @@ boolean log_write_eav(log tl, tuple e, symbol a, value v)
     return (tl->state != TLOG_STATE_FAILED);
 }
 
-boolean log_write(log tl, tuple t)
+static boolean log_write_tuple(log tl, tuple t, tuple_defer defer)
 {
     tlog_debug("log_write: tl %p, t %p\n", tl, t);
     u64 len = buffer_length(tl->tuple_staging);
     if ((tl->state == TLOG_STATE_FAILED) || len >= TFS_LOG_MAX_TUPLE_STAGING_BYTES)
         return false;
-    encode_tuple(tl->tuple_staging, tl->dictionary, t, &tl->total_entries);
+    tl->deferral.defer = defer;
+    encode_tuple(tl->tuple_staging, tl->dictionary, t, &tl->total_entries, &tl->deferral);
+    tl->deferral.defer = 0;
     len = buffer_length(tl->tuple_staging) - len;
     vector_push(tl->encoding_lengths, (void *)len);
     log_set_dirty(tl);
     return (tl->state != TLOG_STATE_FAILED);
 }
 
+boolean log_write(log tl, tuple t)
+{
+    return log_write_tuple(tl, t, 0);
+}
+
+/* Writes the directory tree to a new log: directories selected by the filesystem are encoded in
+ * deferred form, so that their contents are only loaded when first accessed after a mount. */
+boolean log_write_checkpoint(log tl, tuple root)
+{
+    boolean success = log_write_tuple(tl, root, (tuple_defer)&tl->fs->defer);
+    tl->checkpoint_entries = tl->total_entries;
+    return success;
+}
+
 #endif /* !TLOG_READ_ONLY */
 
+/* Called when a deferred tuple is loaded; returns true if the dictionary of the tuple contents is
+ * retained by the log. */
+boolean log_deferred_loaded(log tl, tuple t, table dictionary)
+{
+    if (tl->deferral.dictionaries) {
+        /* log being read: the dictionary is needed to decode references to tuples within t */
+        table_set(tl->deferral.dictionaries, t, dictionary);
+        return true;
+    }
+#ifndef TLOG_READ_ONLY
+    if (!tl->fs->fs.ro && log_references(tl, t))
+        deferral_record_locations(&tl->deferral, t, dictionary);
+#endif
+    return false;
+}
+
 static boolean log_parse_tuple(log tl, buffer b, boolean old_encoding)
 {
     tuple dv = decode_value(tl->h, tl->dictionary, b, &tl->total_entries,
-                            &tl->obsolete_entries, old_encoding);
+                            &tl->obsolete_entries, old_encoding, &tl->deferral);
     if (!is_tuple(dv))
         return false;
+
+    /* the first tuple in a log is the directory tree written when the log was created */
+    if (!tl->checkpoint_entries)
+        tl->checkpoint_entries = tl->total_entries;
     return true;
 }
 
@@ -684,7 +880,7 @@ static status log_hdr_parse(log_ext ext, buffer b, boolean first_ext,
 #endif
         if (ext)
             ext->old_encoding = true;
-    } else if (version == TFS_VERSION) {
+    } else if ((version == TFS_VERSION) || (version == 0x5)) {
         if (ext)
             ext->old_encoding = false;
     } else {
@@ -702,6 +898,19 @@ static status log_hdr_parse(log_ext ext, buffer b, boolean first_ext,
 
 static void log_read(log tl, status_handler sh);
 
+static void log_dictionaries_release(log tl)
+{
+    table dictionaries = tl->deferral.dictionaries;
+    if (!dictionaries)
+        return;
+    table_foreach(dictionaries, t, d) {
+        (void)t;
+        deallocate_table(d);
+    }
+    deallocate_table(dictionaries);
+    tl->deferral.dictionaries = 0;
+}
+
 closure_function(4, 1, void, log_read_complete,
                  log_ext, ext, sg_list, sg, u64, length, status_handler, sh,
                  status read_status)
@@ -842,10 +1051,15 @@ closure_function(4, 1, void, log_read_complete,
         }
         deallocate_table(tl->dictionary);
         tl->dictionary = newdict;
+#ifndef TLOG_READ_ONLY
+        table_foreach(tl->deferral.dictionaries, t, d)
+            deferral_record_locations(&tl->deferral, t, d);
+#endif
     }
 
   out_apply_status:
     tlog_debug("log_read_complete exit with status %v\n", s);
+    log_dictionaries_release(tl);
     buffer_clear(tl->tuple_staging);
     apply(sh, s);
   out:
@@ -893,6 +1107,15 @@ log log_create(heap h, tfs fs, boolean initialize, status_handler sh)
     log tl = log_new(h, fs);
     if (tl == INVALID_ADDRESS)
         return tl;
+    if (!initialize) {
+        /* dictionaries of the deferred tuples loaded while reading the log */
+        tl->deferral.dictionaries = allocate_table(h, identity_key, pointer_equal);
+        if (tl->deferral.dictionaries == INVALID_ADDRESS) {
+            tl->deferral.dictionaries = 0;
+            log_destroy(tl);
+            return INVALID_ADDRESS;
+        }
+    }
     tl->state = TLOG_STATE_LINKED;
     fs->tl = tl;
     if (initialize) {
@@ -937,6 +1160,7 @@ void log_destroy(log tl)
     remove_timer(kernel_timers, &tl->flush_timer, 0);
 #endif
     deallocate_vector(tl->flush_completions);
+    deallocate_vector(tl->flushing_completions);
 #ifndef TLOG_READ_ONLY
     deallocate_rangemap(tl->extensions, stack_closure(log_dealloc_ext_node,
         tl));
@@ -945,5 +1169,11 @@ void log_destroy(log tl)
     deallocate_buffer(tl->tuple_staging);
     close_log_extension(tl->current);
     deallocate_table(tl->dictionary);
+    table_foreach(tl->deferral.locations, v, l) {
+        (void)v;
+        deallocate(tl->h, l, sizeof(struct deferred_location));
+    }
+    deallocate_table(tl->deferral.locations);
+    log_dictionaries_release(tl);
     deallocate(tl->h, tl, sizeof(*tl));
 }
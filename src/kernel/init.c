@@ -457,6 +457,25 @@ boolean mm_register_mem_cleaner(mem_cleaner cleaner)
     return true;
 }
 
+/* Must not be called from a memory cleaner. */
+boolean mm_unregister_mem_cleaner(mem_cleaner cleaner)
+{
+    mm_cleaner mmc = 0;
+    spin_lock(&mm_lock);
+    list_foreach(&mm_cleaners, e) {
+        if (struct_from_list(e, mm_cleaner, l)->cleaner == cleaner) {
+            mmc = struct_from_list(e, mm_cleaner, l);
+            list_delete(e);
+            break;
+        }
+    }
+    spin_unlock(&mm_lock);
+    if (!mmc)
+        return false;
+    deallocate(heap_locked(init_heaps), mmc, sizeof(*mmc));
+    return true;
+}
+
 closure_function(1, 1, void, mm_service_sync,
                  context, ctx,
                  status s)
@@ -480,6 +499,9 @@ void mm_service(boolean flush)
     mm_debug("%s: total %ld, alloc %ld, free %ld\n", func_ss,
              heap_total(phys), heap_allocated(phys), free);
     if (free < threshold) {
+        /* a synchronous cleanup stalls the current context */
+        if (flush)
+            psi_stall_begin(PSI_MEM);
         u64 clean_bytes = threshold - free;
         u64 cleaned = mm_clean(clean_bytes);
         if (cleaned > 0)
@@ -493,6 +515,8 @@ void mm_service(boolean flush)
                 context_suspend();
             }
         }
+        if (flush)
+            psi_stall_end(PSI_MEM);
     }
 }
 
@@ -657,7 +681,11 @@ void kernel_runtime_init(kernel_heaps kh)
     dma_init(kh);
     list_init(&mm_cleaners);
     spin_lock_init(&mm_lock);
-    init_pagecache(locked, (heap)kh->pages, PAGESIZE);
+    /* large pagecache pages are not used on low-memory machines */
+    heap pagecache_large = lowmem ? 0 : reserve_heap_wrapper(misc, (heap)heap_page_backed(kh),
+                                                            PAGEHEAP_MEMORY_RESERVE);
+    assert(pagecache_large != INVALID_ADDRESS);
+    init_pagecache(locked, (heap)kh->pages, pagecache_large, PAGESIZE);
     mem_cleaner pc_cleaner = closure_func(misc, mem_cleaner, mm_pagecache_cleaner);
     assert(pc_cleaner != INVALID_ADDRESS);
     assert(mm_register_mem_cleaner(pc_cleaner));
@@ -681,6 +709,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     init_debug("init_scheduler");
     init_scheduler(locked);
+    init_pressure(locked);
 
     /* platform detection and early init */
     init_debug("probing for hypervisor platform");
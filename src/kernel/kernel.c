@@ -190,6 +190,10 @@ cpuinfo init_cpuinfo(heap backed, int cpu)
     ci->cpu_queue = allocate_queue(backed, CPU_QUEUE_SIZE);
     assert(ci->cpu_queue != INVALID_ADDRESS);
     ci->last_timer_update = 0;
+    ci->busy_poll_until = 0;
+    ci->pagecache_epoch = 0;
+    spin_lock_init(&ci->pagecache_lru.lock);
+    ci->pagecache_lru.count = 0;
     ci->targeted_irqs = 0;
     ci->mcs_prev = 0;
     ci->mcs_next = 0;
@@ -238,6 +238,14 @@ static inline void spin_wunlock(rw_spinlock l) {
 #endif
 #endif
 
+/* pressure stall information */
+typedef enum {
+    PSI_IO,
+    PSI_MEM,
+    PSI_CPU,
+    PSI_NR_RESOURCES
+} psi_resource;
+
 #ifdef KERNEL
 typedef struct sched_queue {
     pqueue q;
@@ -255,8 +263,19 @@ struct cpuinfo {
     queue cpu_queue;
     struct sched_queue thread_queue;
     timestamp last_timer_update;
+    timestamp busy_poll_until;
     int targeted_irqs;
     u64 inval_gen; /* Generation number for invalidates */
+    u64 pagecache_epoch; /* pagecache epoch of lock-free lookup in progress, 0 if none */
+    struct {
+        struct spinlock lock;
+        u32 count;
+        void *pages[PAGECACHE_LRU_BATCH];
+    } pagecache_lru;    /* cache hits pending update of the pagecache LRU lists */
+    struct {
+        u32 running;
+        s32 stalled[PSI_NR_RESOURCES];  /* a stall may end on a different CPU than it began on */
+    } psi;              /* pressure stall state, only written by this CPU */
 
     cpuinfo mcs_prev;
     cpuinfo mcs_next;
@@ -430,6 +449,7 @@ extern queue runqueue;
 extern queue async_queue_1;
 extern timerqueue kernel_timers;
 extern thunk timer_interrupt_handler;
+extern thunk runloop_busy_poll_handler;
 
 closure_type(clock_timer, void, timestamp t);
 
@@ -819,6 +839,17 @@ static inline u64 phys_from_linear_backed_virt(u64 virt)
 }
 
 void unmap_and_free_phys(u64 virtual, u64 length);
+u64 unmap_and_free_clean_phys(u64 virtual, u64 length);
+void clean_mapped_pages(u64 vaddr, u64 length);
+boolean collapse_pages(u64 vaddr, void *dest, pageflags flags, u64 *phys_pages);
+
+typedef struct page_migration {
+    u64 vaddr;
+    u64 phys;   /* in: destination page; out: source page (if entry is non-zero) */
+    pte entry;
+} *page_migration;
+
+void migrate_pages(page_migration pm, int count);
 void page_free_phys(u64 phys);
 
 #if !defined(BOOT)
@@ -834,6 +865,7 @@ void configure_timer(timestamp rate, thunk t);
 
 void kernel_sleep();
 void kernel_delay(timestamp delta);
+void runloop_busy_poll(timestamp duration);
 timestamp kern_now(clock_id id);    /* klibs must use this instead of now() */
 
 void init_clock(void);
@@ -868,6 +900,14 @@ void mm_service(boolean flush);
 
 closure_type(mem_cleaner, u64, u64 clean_bytes);
 boolean mm_register_mem_cleaner(mem_cleaner cleaner);
+boolean mm_unregister_mem_cleaner(mem_cleaner cleaner);
+
+void init_pressure(heap h);
+void psi_stall_begin(psi_resource r);
+void psi_stall_end(psi_resource r);
+void psi_thread_running(boolean running);
+void psi_print(buffer b, psi_resource r);
+value psi_management(heap h);
 
 kernel_heaps get_kernel_heaps(void);
 
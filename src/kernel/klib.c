@@ -346,7 +346,7 @@ void init_klib(kernel_heaps kh, void *fs, tuple config_root, status_handler comp
     klib_loaded = allocate_vector(h, 4);
     assert(klib_loaded != INVALID_ADDRESS);
 
-    tuple c = get_tuple(klib_md, sym(children));
+    tuple c = children(klib_md);
     if (!c)
         goto done;
     klib_root = get_tuple(c, sym(klib));
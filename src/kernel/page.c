@@ -34,6 +34,7 @@ static struct {
     range pagevirt;
     u64 physbase;
     u64 levelmask;              /* bitmap of levels allowed to map */
+    u64 free_tables;            /* physical address of first released table page, 0 if none */
 } pagemem;
 
 #ifndef physical_from_virtual
@@ -71,6 +72,13 @@ void *allocate_table_page(u64 *phys)
     return p;
 #else
     page_init_debug("allocate_table_page:");
+    if (pagemem.free_tables) {
+        *phys = pagemem.free_tables;
+        u64 *p = pointer_from_pteaddr(*phys);
+        pagemem.free_tables = p[0];
+        zero(p, PAGESIZE);
+        return p;
+    }
     if (range_span(pagemem.current_phys) == 0) {
         page_init_debug(" [new alloc, pa: ");
         u64 pa = allocate_u64(pagemem.pageheap, PAGEMEM_ALLOC_SIZE);
@@ -207,7 +215,8 @@ boolean validate_virtual_writable(void * base, u64 length)
                          stack_closure_func(entry_handler, validate_entry_writable));
 }
 
-static pte pte_split(pteptr entry, range gap)
+/* Splits a large page mapping into small page mappings, leaving the pages in gap unmapped. */
+pte pte_split(pteptr entry, range gap)
 {
     u64 new_page_phys;
     u64 *new_page = allocate_table_page(&new_page_phys);
@@ -607,6 +616,196 @@ void unmap_and_free_phys(u64 virtual, u64 length)
                              stack_closure(page_dealloc, (heap)heap_page_backed(get_kernel_heaps())));
 }
 
+/* called with lock held */
+closure_function(3, 3, boolean, unmap_clean_page,
+                 range, q, flush_entry, fe, u64 *, freed,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (!pte_is_present(old_entry) || !pte_is_mapping(level, old_entry) || pte_is_dirty(old_entry))
+        return true;
+    u64 map_len = pte_map_size(level, old_entry);
+    if (!range_contains(bound(q), irangel(vaddr, map_len)))
+        return true;
+    /* The entry is cleared atomically, so that the page is not freed if a concurrent write has
+     * just set the dirty bit. */
+    if (!compare_and_swap_64((u64 *)entry, old_entry, 0))
+        return true;
+    page_invalidate(bound(fe), vaddr);
+    deallocate_u64((heap)heap_page_backed(get_kernel_heaps()),
+                   pagemem.pagevirt.start + page_from_pte(old_entry), map_len);
+    *bound(freed) += map_len;
+    return true;
+}
+
+/* Unmaps and frees the pages in the given range that have not been written to since they were
+ * last cleaned; returns the number of bytes freed. */
+u64 unmap_and_free_clean_phys(u64 virtual, u64 length)
+{
+    u64 freed = 0;
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(virtual, length, stack_closure(unmap_clean_page, irangel(virtual, length), fe,
+                                                 &freed));
+    page_invalidate_sync(fe);
+    return freed;
+}
+
+/* called with lock held */
+closure_function(1, 3, boolean, clean_page,
+                 flush_entry, fe,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (pte_is_present(old_entry) && pte_is_mapping(level, old_entry) && pte_is_dirty(old_entry)) {
+        pt_pte_clean(entry);
+        page_invalidate(bound(fe), vaddr);
+    }
+    return true;
+}
+
+void clean_mapped_pages(u64 vaddr, u64 length)
+{
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(vaddr, length, stack_closure(clean_page, fe));
+    page_invalidate_sync(fe);
+}
+
+/* called with lock held */
+closure_function(3, 3, boolean, collapse_clear_pte,
+                 u64, start, pteptr *, table_entry, u64 *, phys_pages,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (level < PT_PTE_LEVEL - 1)
+        return true;
+    if (level == PT_PTE_LEVEL - 1) {
+        /* nothing to collapse if not mapped with a page table */
+        if (!pte_is_present(old_entry) || pte_is_mapping(level, old_entry))
+            return false;
+        *bound(table_entry) = entry;
+        return true;
+    }
+    if (pte_is_present(old_entry)) {
+        bound(phys_pages)[(vaddr - bound(start)) >> PAGELOG] = page_from_pte(old_entry);
+        pte_set(entry, 0);
+    }
+    return true;
+}
+
+/* Replaces the small page mappings of the 2MB range at vaddr with a single large page mapping of
+ * the page-backed memory at dest, into which the contents of the small pages are copied (holes
+ * are zero-filled); the small pages and their page table are then freed. phys_pages is scratch
+ * space for one entry per small page. The caller must ensure that the small page mappings are not
+ * altered concurrently. Returns false if the range is not mapped with a page table. */
+boolean collapse_pages(u64 vaddr, void *dest, pageflags flags, u64 *phys_pages)
+{
+    assert(!(vaddr & MASK(PAGELOG_2M)));
+    assert(pt_level_shift(PT_PTE_LEVEL - 1) == PAGELOG_2M);
+    u64 count = PAGESIZE_2M >> PAGELOG;
+    pteptr table_entry = 0;
+    zero(phys_pages, count * sizeof(u64));
+
+    /* unmap the small pages before copying them, so that the copy cannot miss any write */
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(vaddr, PAGESIZE_2M,
+                  stack_closure(collapse_clear_pte, vaddr, &table_entry, phys_pages));
+    for (u64 i = 0; i < count; i++)
+        if (phys_pages[i])
+            page_invalidate(fe, vaddr + (i << PAGELOG));
+    page_invalidate_sync(fe);
+    if (!table_entry)
+        return false;
+    for (u64 i = 0; i < count; i++) {
+        void *p = dest + (i << PAGELOG);
+        if (phys_pages[i])
+            runtime_memcpy(p, pointer_from_u64(pagemem.pagevirt.start + phys_pages[i]), PAGESIZE);
+        else
+            zero(p, PAGESIZE);
+    }
+    write_barrier();
+
+    u64 table_phys;
+    {
+        pagetable_lock();
+        table_phys = page_from_pte(pte_from_pteptr(table_entry));
+        pte_set(table_entry, block_pte(physical_from_virtual(dest), flags.w));
+        pagetable_unlock();
+    }
+    fe = get_page_flush_entry();
+    page_invalidate(fe, vaddr);
+    page_invalidate_sync(fe);
+
+    /* the page table cannot be referenced anymore after the invalidation */
+    {
+        pagetable_lock();
+        *pointer_from_pteaddr(table_phys) = pagemem.free_tables;
+        pagemem.free_tables = table_phys;
+        pagetable_unlock();
+    }
+    heap pageheap = (heap)heap_page_backed(get_kernel_heaps());
+    for (u64 i = 0; i < count; i++)
+        if (phys_pages[i])
+            deallocate_u64(pageheap, pagemem.pagevirt.start + phys_pages[i], PAGESIZE);
+    return true;
+}
+
+/* called with lock held */
+closure_function(1, 3, boolean, migrate_clear_pte,
+                 page_migration, pm,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (!pte_is_present(old_entry) || !pte_is_mapping(level, old_entry))
+        return true;
+    if (level == PT_PTE_LEVEL) {
+        bound(pm)->entry = old_entry;
+        pte_set(entry, 0);
+    }
+    return false;
+}
+
+/* called with lock held */
+closure_function(1, 3, boolean, migrate_set_pte,
+                 page_migration, pm,
+                 int level, u64 vaddr, pteptr entry)
+{
+    if (level == PT_PTE_LEVEL) {
+        page_migration pm = bound(pm);
+        pte_set(entry, page_pte(pm->phys, flags_from_pte(pm->entry)));
+        pm->phys = page_from_pte(pm->entry);
+    }
+    return true;
+}
+
+/* Moves the contents of the small pages mapped at the given virtual addresses to new physical
+ * pages, retaining the mapping flags (including the accessed and dirty state). The pages are
+ * unmapped while being copied, so that no write can be lost. Entries whose virtual address is not
+ * mapped with a small page are left with a zero pte value. The caller must ensure that the
+ * mappings are not altered concurrently. */
+void migrate_pages(page_migration pm, int count)
+{
+    flush_entry fe = get_page_flush_entry();
+    for (int i = 0; i < count; i++) {
+        pm[i].entry = 0;
+        traverse_ptes(pm[i].vaddr, PAGESIZE, stack_closure(migrate_clear_pte, &pm[i]));
+        if (pm[i].entry)
+            page_invalidate(fe, pm[i].vaddr);
+    }
+    page_invalidate_sync(fe);
+    for (int i = 0; i < count; i++) {
+        if (!pm[i].entry)
+            continue;
+        runtime_memcpy(pointer_from_pteaddr(pm[i].phys),
+                       pointer_from_pteaddr(page_from_pte(pm[i].entry)), PAGESIZE);
+    }
+    write_barrier();
+    for (int i = 0; i < count; i++) {
+        /* the old mappings are not present, thus no invalidation is needed */
+        if (pm[i].entry)
+            traverse_ptes(pm[i].vaddr, PAGESIZE, stack_closure(migrate_set_pte, &pm[i]));
+    }
+}
+
 void page_free_phys(u64 phys)
 {
     u64 virt = pagemem.pagevirt.start + phys;
@@ -64,4 +64,5 @@ void dump_page_tables(u64 vaddr, u64 length);
 
 /* internal use */
 void *allocate_table_page(u64 *phys);
+pte pte_split(pteptr entry, range gap);
 void page_set_allowed_levels(u64 levelmask);
@@ -1,5 +1,4 @@
 /* TODO:
-   - keep refault stats
    - interface to physical free page list / shootdown epochs
 
    - would be nice to propagate a priority alone with requests to
@@ -41,6 +40,20 @@ static inline u64 page_offset(pagecache_page pp)
     return pp->state_offset & MASK(PAGECACHE_PAGESTATE_SHIFT);
 }
 
+/* Returns true if the page contents are valid and the page is not being evicted. */
+static inline boolean page_is_filled(pagecache_page pp)
+{
+    switch (page_state(pp)) {
+    case PAGECACHE_PAGESTATE_NEW:
+    case PAGECACHE_PAGESTATE_ACTIVE:
+    case PAGECACHE_PAGESTATE_DIRTY:
+    case PAGECACHE_PAGESTATE_WRITING:
+        return !pp->evicted;
+    default:
+        return false;
+    }
+}
+
 static inline range byte_range_from_page(pagecache pc, pagecache_page pp)
 {
     return range_lshift(irangel(page_offset(pp), 1), pc->page_order);
@@ -116,8 +129,49 @@ static inline void pagecache_unlock_node(pagecache_node pn)
     spin_unlock(&pn->pages_lock);
 }
 
+/* Lock-free page lookups are done within an epoch section, which must not block. A page removed
+ * from its node (or a page tree node emptied by the removal) is retired with the current epoch, and
+ * is freed only after all CPUs have left the sections entered at or before that epoch. */
+static inline u64 pagecache_epoch_enter(pagecache pc)
+{
+    u64 flags = irq_disable_save();
+    current_cpu()->pagecache_epoch = pc->epoch;
+    memory_barrier();
+    return flags;
+}
+
+static inline void pagecache_epoch_exit(u64 flags)
+{
+    memory_barrier();
+    current_cpu()->pagecache_epoch = 0;
+    irq_restore(flags);
+}
+
+static inline void pagecache_page_ref(pagecache_page pp)
+{
+    fetch_and_add_32(&pp->refcount, 1);
+}
+
+/* Takes a reference to a page found with a lock-free lookup; fails if the page is unreferenced
+ * (i.e. its memory has been or is being freed). */
+static boolean pagecache_page_ref_speculative(pagecache_page pp)
+{
+    u32 refcount = pp->refcount;
+    while (refcount) {
+        if (compare_and_swap_32(&pp->refcount, refcount, refcount + 1))
+            return true;
+        refcount = pp->refcount;
+    }
+    return false;
+}
+
 closure_type(pp_handler, boolean, pagecache_page pp);
 
+static inline boolean page_state_is_dirty(int state)
+{
+    return (state == PAGECACHE_PAGESTATE_DIRTY) || (state == PAGECACHE_PAGESTATE_WRITING);
+}
+
 static inline void change_page_state_locked(pagecache pc, pagecache_page pp, int state)
 {
     int old_state = page_state(pp);
@@ -165,8 +219,14 @@ static inline void change_page_state_locked(pagecache pc, pagecache_page pp, int
         }
         break;
     case PAGECACHE_PAGESTATE_ACTIVE:
-        assert(old_state == PAGECACHE_PAGESTATE_NEW);
-        pagelist_move(&pc->active, &pc->new, pp);
+        if (old_state == PAGECACHE_PAGESTATE_NEW) {
+            pagelist_move(&pc->active, &pc->new, pp);
+        } else {
+            /* refault of a working set page */
+            assert(old_state == PAGECACHE_PAGESTATE_READING ||
+                   old_state == PAGECACHE_PAGESTATE_ALLOC);
+            pagelist_enqueue(&pc->active, pp);
+        }
         break;
     case PAGECACHE_PAGESTATE_DIRTY:
         if (old_state == PAGECACHE_PAGESTATE_NEW) {
@@ -182,6 +242,13 @@ static inline void change_page_state_locked(pagecache pc, pagecache_page pp, int
     default:
         halt("%s: bad state %d, old %d\n", func_ss, state, old_state);
     }
+    boolean was_dirty = page_state_is_dirty(old_state);
+    if (page_state_is_dirty(state)) {
+        if (!was_dirty)
+            pc->dirty_pages++;
+    } else if (was_dirty) {
+        pc->dirty_pages--;
+    }
 
     pp->state_offset = (pp->state_offset & MASK(PAGECACHE_PAGESTATE_SHIFT)) |
         ((u64)state << PAGECACHE_PAGESTATE_SHIFT);
@@ -217,15 +284,54 @@ static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
     if (pp->kvirt == INVALID_ADDRESS) {
         return false;
     }
-    assert(pp->refcount++ == 0);
+    assert(fetch_and_add_32(&pp->refcount, 1) == 0);
     pp->write_count = 0;
+    if (pp->evicted) {
+        /* Refault: if the page would have stayed in memory with an active list as large as the
+         * number of pages evicted after it, it belongs to the working set. */
+        u64 distance = pc->evictions - pp->eviction_stamp;
+        pp->refault_active = (distance <= pc->active.pages);
+        pagecache_debug("   refault distance %ld, active %ld\n", distance, pc->active.pages);
+    }
     pp->phys = physical_from_virtual(pp->kvirt);
     fetch_and_add(&pc->total_pages, 1);
     change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ALLOC);
+    pp->accessed = false;
     pp->evicted = false;
     return true;
 }
 
+/* State of a page whose contents have just been read in: a page refaulting while part of the
+ * working set goes directly to the active list. */
+static int page_filled_state(pagecache_page pp)
+{
+    if (pp->refault_active) {
+        pp->refault_active = false;
+        return PAGECACHE_PAGESTATE_ACTIVE;
+    }
+    return PAGECACHE_PAGESTATE_NEW;
+}
+
+/* Cache hit: a new page is promoted to the active list on its second access, so that pages
+ * accessed only once (e.g. by a sequential scan) do not push the working set out of the cache. */
+static void page_mark_accessed_locked(pagecache pc, pagecache_page pp)
+{
+    switch (page_state(pp)) {
+    case PAGECACHE_PAGESTATE_NEW:
+        if (pp->accessed) {
+            pp->accessed = false;
+            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+        } else {
+            pp->accessed = true;
+        }
+        break;
+    case PAGECACHE_PAGESTATE_ACTIVE:
+        /* move to bottom of active list */
+        pagelist_touch(&pc->active, pp);
+        break;
+    }
+}
+
 static sg_buf pagecache_add_sgb(pagecache_page pp, sg_list sg, u64 size)
 {
     sg_buf sgb = sg_list_tail_add(sg, size);
@@ -258,13 +364,8 @@ static boolean touch_page_locked(pagecache_node pn, pagecache_page pp, merge m)
         change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_READING);
         return false;
     case PAGECACHE_PAGESTATE_ACTIVE:
-        /* move to bottom of active list */
-        list_delete(&pp->l);
-        list_insert_before(&pc->active.l, &pp->l);
-        break;
     case PAGECACHE_PAGESTATE_NEW:
-        /* cache hit -> active */
-        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+        page_mark_accessed_locked(pc, pp);
         break;
     }
     return true;
@@ -283,7 +384,7 @@ closure_function(3, 1, void, pagecache_read_page_complete,
         msg_err("error reading page 0x%lx: %v\n", page_offset(pp) << pc->page_order, s);
     }
     pagecache_lock_state(pc);
-    change_page_state_locked(bound(pc), pp, PAGECACHE_PAGESTATE_NEW);
+    change_page_state_locked(bound(pc), pp, page_filled_state(pp));
     pagecache_page_queue_completions_locked(pc, pp, s);
     pagecache_unlock_state(pc);
     timm_dealloc(s);
@@ -292,6 +393,8 @@ closure_function(3, 1, void, pagecache_read_page_complete,
     closure_finish();
 }
 
+static boolean pagecache_page_touch(pagecache pc, pagecache_page pp, boolean access);
+
 /* The page refcount is incremented (unless the page is not filled and either a read request is not
  * ongoing, or the merge argument is null). */
 static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page pp, merge m)
@@ -300,13 +403,17 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
     pagecache pc = pv->pc;
     range r;
 
+    if (pagecache_page_touch(pc, pp, true)) {
+        pagecache_page_ref(pp);
+        return true;
+    }
     pagecache_lock_state(pc);
     pagecache_debug("%s: pn %p, pp %p, m %p, state %d\n", func_ss, pn, pp, m, page_state(pp));
     switch (page_state(pp)) {
     case PAGECACHE_PAGESTATE_READING:
         if (m) {
             enqueue_page_completion_statelocked(pc, pp, apply_merge(m));
-            pp->refcount++;
+            pagecache_page_ref(pp);
         }
         pagecache_unlock_state(pc);
         return false;
@@ -327,9 +434,9 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
                 change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_READING);
             } else {
                 zero(pp->kvirt, cache_pagesize(pc));
-                change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
+                change_page_state_locked(pc, pp, page_filled_state(pp));
             }
-            pp->refcount++;
+            pagecache_page_ref(pp);
         }
         pagecache_unlock_state(pc);
 
@@ -350,13 +457,8 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
         }
         return false;
     case PAGECACHE_PAGESTATE_ACTIVE:
-        /* move to bottom of active list */
-        list_delete(&pp->l);
-        list_insert_before(&pc->active.l, &pp->l);
-        break;
     case PAGECACHE_PAGESTATE_NEW:
-        /* cache hit -> active */
-        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+        page_mark_accessed_locked(pc, pp);
         break;
     case PAGECACHE_PAGESTATE_WRITING:
     case PAGECACHE_PAGESTATE_DIRTY:
@@ -364,7 +466,7 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
     default:
         halt("%s: invalid state %d\n", func_ss, page_state(pp));
     }
-    pp->refcount++;
+    pagecache_page_ref(pp);
     pagecache_unlock_state(pc);
     return true;
 }
@@ -378,24 +480,72 @@ static void pagecache_page_delete_locked(pagecache pc, pagecache_page pp)
     if (!pagecache_trylock_node(pn))
         return;
 
-    rbtree_remove_node(&pn->pages, &pp->rbnode);
+    assert(radix_tree_remove(&pn->pages, page_offset(pp)) == pp);
     pagecache_unlock_node(pn);
     pagelist_remove(&pc->free, pp);
-    deallocate(pc->pp_heap, pp, sizeof(*pp));
+    pp->retire_epoch = fetch_and_add(&pc->epoch, 1);
+    list_push_back(&pc->retired, &pp->l);
+}
+
+/* An emptied page tree node is retired through a page descriptor that records the node; if no
+ * descriptor can be allocated, the node is left in its tree. */
+closure_func_basic(radix_retire_handler, boolean, pagecache_retire_tree_node,
+                   radix_node n)
+{
+    pagecache pc = struct_from_closure(pagecache, retire_tree_node);
+    pagecache_page pp = allocate(pc->pp_heap, sizeof(struct pagecache_page));
+    if (pp == INVALID_ADDRESS)
+        return false;
+    pp->node = 0;
+    pp->kvirt = n;
+    pp->retire_epoch = fetch_and_add(&pc->epoch, 1);
+    list_push_back(&pc->retired, &pp->l);
+    return true;
+}
+
+/* Frees retired pages and page tree nodes that cannot be referenced by lock-free lookups
+ * anymore. */
+static void pagecache_reclaim_retired_locked(pagecache pc)
+{
+    if (list_empty(&pc->retired))
+        return;
+    u64 min_epoch = infinity;
+    cpuinfo ci;
+    vector_foreach(cpuinfos, ci) {
+        u64 epoch = ci->pagecache_epoch;
+        if (epoch && (epoch < min_epoch))
+            min_epoch = epoch;
+    }
+    list_foreach(&pc->retired, l) {
+        pagecache_page pp = struct_from_list(l, pagecache_page, l);
+        if (pp->retire_epoch >= min_epoch)
+            break;  /* the list is sorted by retire epoch */
+        list_delete(l);
+        if (!pp->node)
+            deallocate(pc->h, pp->kvirt, sizeof(struct radix_node));
+        deallocate(pc->pp_heap, pp, sizeof(*pp));
+    }
 }
 
 static void pagecache_page_release_locked(pagecache pc, pagecache_page pp, boolean full_delete)
 {
-    if (--pp->refcount > 0)
+    if (fetch_and_add_32(&pp->refcount, -1) > 1)
         return;
     pagecache_debug("%s: pp %p state %d\n", func_ss, pp, page_state(pp));
     assert(pp->write_count == 0);
     assert(pp->read_refcount.c == 0);
 
     change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_FREE);
-    deallocate(pc->contiguous, pp->kvirt, cache_pagesize(pc));
+    /* a page of a large page block is freed individually, and is reallocated as a small page */
+    deallocate(pp->large ? pc->large : pc->contiguous, pp->kvirt, cache_pagesize(pc));
     pp->kvirt = INVALID_ADDRESS;
-    pp->phys = INVALID_PHYSICAL;
+    pp->large = false;
+    if (pp->evicted) {
+        /* the page remains in the node as a shadow entry, to detect refaults */
+        pp->eviction_stamp = pc->evictions++;
+    } else {
+        pp->phys = INVALID_PHYSICAL;
+    }
     u64 pre = fetch_and_add(&pc->total_pages, -1);
     assert(pre > 0);
     pagecache_debug("%s: total pages now %ld\n", func_ss, pre - 1);
@@ -403,6 +553,79 @@ static void pagecache_page_release_locked(pagecache pc, pagecache_page pp, boole
         pagecache_page_delete_locked(pc, pp);
 }
 
+/* Releases a page reference without taking the state lock, unless it is the last reference. */
+static void pagecache_page_release(pagecache pc, pagecache_page pp)
+{
+    u32 refcount = pp->refcount;
+    while (refcount > 1) {
+        if (compare_and_swap_32(&pp->refcount, refcount, refcount - 1))
+            return;
+        refcount = pp->refcount;
+    }
+    pagecache_lock_state(pc);
+    pagecache_page_release_locked(pc, pp, false);
+    pagecache_unlock_state(pc);
+}
+
+/* Cache hits update the LRU lists in batches: each CPU queues hit pages (holding a reference to
+ * each of them), and applies the pending updates with a single acquisition of the state lock when
+ * its batch is full or when the batches are drained. */
+static void pagecache_lru_flush_batch(pagecache pc, cpuinfo ci)
+{
+    if (ci->pagecache_lru.count == 0)
+        return;
+    pagecache_lock_state(pc);
+    for (u32 i = 0; i < ci->pagecache_lru.count; i++) {
+        pagecache_page pp = ci->pagecache_lru.pages[i];
+        if (!pp->evicted)
+            page_mark_accessed_locked(pc, pp);
+        pagecache_page_release_locked(pc, pp, false);
+    }
+    pagecache_unlock_state(pc);
+    ci->pagecache_lru.count = 0;
+}
+
+static void pagecache_lru_add(pagecache pc, pagecache_page pp)
+{
+    cpuinfo ci = current_cpu();
+    spin_lock(&ci->pagecache_lru.lock);
+    ci->pagecache_lru.pages[ci->pagecache_lru.count++] = pp;
+    if (ci->pagecache_lru.count == PAGECACHE_LRU_BATCH)
+        pagecache_lru_flush_batch(pc, ci);
+    spin_unlock(&ci->pagecache_lru.lock);
+}
+
+/* must not be called with the state lock held */
+static void pagecache_lru_drain(pagecache pc)
+{
+    cpuinfo ci;
+    vector_foreach(cpuinfos, ci) {
+        if (ci->pagecache_lru.count == 0)
+            continue;
+        spin_lock(&ci->pagecache_lru.lock);
+        pagecache_lru_flush_batch(pc, ci);
+        spin_unlock(&ci->pagecache_lru.lock);
+    }
+}
+
+/* Cache hit without the state lock: returns true if the page is filled, in which case its LRU
+ * update (if the hit counts as an access) is queued in the per-CPU batch. Must not be called with
+ * the state lock held. */
+static boolean pagecache_page_touch(pagecache pc, pagecache_page pp, boolean access)
+{
+    if (!pagecache_page_ref_speculative(pp))
+        return false;
+    if (page_is_filled(pp)) {
+        if (access)
+            pagecache_lru_add(pc, pp);  /* the batch takes over the page reference */
+        else
+            pagecache_page_release(pc, pp);
+        return true;
+    }
+    pagecache_page_release(pc, pp);
+    return false;
+}
+
 closure_func_basic(thunk, void, pagecache_page_read_release)
 {
     pagecache pc = global_pagecache;
@@ -412,38 +635,48 @@ closure_func_basic(thunk, void, pagecache_page_read_release)
     pagecache_unlock_state(pc);
 }
 
-static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
+static pagecache_page insert_page_nodelocked(pagecache_node pn, u64 offset, void *kvirt,
+                                             boolean large)
 {
-    /* allocate - later we can look at blocks of pages at a time */
     pagecache pc = pn->pv->pc;
-    u64 pagesize = U64_FROM_BIT(pc->page_order);
-    void *p = allocate(pc->contiguous, pagesize);
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-
     pagecache_page pp = allocate(pc->pp_heap, sizeof(struct pagecache_page));
     if (pp == INVALID_ADDRESS)
-        goto fail_dealloc_contiguous;
+        return pp;
 
-    init_rbnode(&pp->rbnode);
     pp->refcount = 1;
     init_refcount(&pp->read_refcount, 0,
                   init_closure_func(&pp->read_release, thunk, pagecache_page_read_release));
     assert((offset >> PAGECACHE_PAGESTATE_SHIFT) == 0);
     pp->state_offset = ((u64)PAGECACHE_PAGESTATE_ALLOC << PAGECACHE_PAGESTATE_SHIFT) | offset;
     pp->write_count = 0;
-    pp->kvirt = p;
+    pp->kvirt = kvirt;
     pp->node = pn;
     pp->l.next = pp->l.prev = 0;
+    pp->accessed = false;
     pp->evicted = false;
-    pp->phys = physical_from_virtual(p);
+    pp->refault_active = false;
+    pp->large = large;
+    pp->phys = physical_from_virtual(kvirt);
     list_init(&pp->bh_completions);
-    assert(rbtree_insert_node(&pn->pages, &pp->rbnode));
+    if (!radix_tree_insert(&pn->pages, offset, pp)) {
+        deallocate(pc->pp_heap, pp, sizeof(*pp));
+        return INVALID_ADDRESS;
+    }
     fetch_and_add(&pc->total_pages, 1); /* decrement happens without cache lock */
     return pp;
-  fail_dealloc_contiguous:
-    deallocate(pc->contiguous, p, pagesize);
-    return INVALID_ADDRESS;
+}
+
+static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
+{
+    pagecache pc = pn->pv->pc;
+    u64 pagesize = U64_FROM_BIT(pc->page_order);
+    void *p = allocate(pc->contiguous, pagesize);
+    if (p == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    pagecache_page pp = insert_page_nodelocked(pn, offset, p, false);
+    if (pp == INVALID_ADDRESS)
+        deallocate(pc->contiguous, p, pagesize);
+    return pp;
 }
 
 static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages)
@@ -456,6 +689,12 @@ static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages)
         pagecache_page pp = struct_from_list(l, pagecache_page, l);
         if (pp->evicted)
             continue;
+        if (pp->accessed) {
+            /* referenced since last scan: give the page a second chance */
+            pp->accessed = false;
+            pagelist_touch(pl, pp);
+            continue;
+        }
         assert(pp->refcount != 0);
         pagecache_debug("%s: list %s, release pp %p - %R, state %d, count %ld\n", func_ss,
                         pl == &pc->new ? ss("new") : ss("active"), pp, byte_range_from_page(pc, pp),
@@ -463,11 +702,23 @@ static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages)
         pp->evicted = true;
         if (pp->refcount == 1)
             evicted++;
-        pagecache_page_release_locked(pc, pp, true);
+        pagecache_page_release_locked(pc, pp, false);
     }
     return evicted;
 }
 
+/* Freed pages are kept in their node as shadow entries (to detect refaults) up to the number of
+ * resident pages; the oldest shadow entries beyond that are deleted. */
+static void pagecache_trim_shadows_locked(pagecache pc)
+{
+    s64 excess = (s64)pc->free.pages - (s64)pc->total_pages;
+    list_foreach(&pc->free.l, l) {
+        if (excess-- <= 0)
+            break;
+        pagecache_page_delete_locked(pc, struct_from_list(l, pagecache_page, l));
+    }
+}
+
 static void balance_page_lists_locked(pagecache pc)
 {
     /* balance active and new lists */
@@ -482,6 +733,10 @@ static void balance_page_lists_locked(pagecache pc)
            just cull unreferenced buffers in LRU fashion until active
            pages are equivalent to new...loosely inspired by linux
            approach. */
+        if (pp->accessed) {
+            pp->accessed = false;
+            continue;
+        }
         if (pp->refcount == 1) {
             pagecache_debug("   pp %R -> new\n", byte_range_from_page(pc, pp));
             change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
@@ -492,9 +747,7 @@ static void balance_page_lists_locked(pagecache pc)
 
 static pagecache_page page_lookup_nodelocked(pagecache_node pn, u64 n)
 {
-    struct pagecache_page k;
-    k.state_offset = n;
-    return (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
+    return radix_tree_lookup(&pn->pages, n);
 }
 
 static pagecache_page page_lookup_or_alloc_nodelocked(pagecache_node pn, u64 n)
@@ -505,6 +758,35 @@ static pagecache_page page_lookup_or_alloc_nodelocked(pagecache_node pn, u64 n)
     return pp;
 }
 
+static inline u64 large_page_count(pagecache pc)
+{
+    return U64_FROM_BIT(PAGELOG_2M - pc->page_order);
+}
+
+/* Allocates the pages of the large page starting at page number pi from a single 2MB block, if
+ * none of them is in the node yet; pages that cannot be allocated this way are left to the caller
+ * to be allocated individually. */
+static void allocate_large_page_nodelocked(pagecache_node pn, u64 pi)
+{
+    pagecache pc = pn->pv->pc;
+    u64 count = large_page_count(pc);
+    for (u64 i = 0; i < count; i++) {
+        if (page_lookup_nodelocked(pn, pi + i) != INVALID_ADDRESS)
+            return;
+    }
+    void *p = allocate(pc->large, PAGESIZE_2M);
+    if (p == INVALID_ADDRESS)
+        return;
+    pagecache_debug("%s: pn %p, pi 0x%lx, block %p\n", func_ss, pn, pi, p);
+    for (u64 i = 0; i < count; i++) {
+        void *kvirt = p + (i << pc->page_order);
+        if (insert_page_nodelocked(pn, pi + i, kvirt, true) == INVALID_ADDRESS) {
+            deallocate(pc->large, kvirt, (count - i) << pc->page_order);
+            return;
+        }
+    }
+}
+
 static pagecache_page touch_or_fill_page_by_num_nodelocked(pagecache_node pn, u64 n, merge m)
 {
     pagecache_page pp = page_lookup_or_alloc_nodelocked(pn, n);
@@ -540,7 +822,7 @@ static void pagecache_nodelocked_traverse(pagecache_node pn, range pages,
         apply(handler, pp);
         if (++pages.start == pages.end)
             break;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_lookup_nodelocked(pn, pages.start);
     }
     pagecache_unlock_state(global_pagecache);
 }
@@ -624,7 +906,7 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
         pagecache_unlock_state(pc);
         offset = 0;
         bound(pi)++;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_lookup_nodelocked(pn, bound(pi));
     } while (bound(pi) < end);
     if ((bound(pi) == end) && !pagecache_set_dirty(pn, r))
         s = timm("result", "failed to add dirty range");
@@ -651,21 +933,12 @@ closure_function(4, 1, void, pagecache_write_sg_next,
     closure_finish();
 }
 
-closure_function(1, 3, void, pagecache_write_sg,
-                 pagecache_node, pn,
-                 sg_list sg, range q, status_handler completion)
-{
-    pagecache_node pn = bound(pn);
-    pagecache_volume pv = pn->pv;
-    pagecache pc = pv->pc;
-    pagecache_debug("%s: node %p, q %R, sg %p, completion %F, from %p\n", func_ss,
-                    pn, q, sg, completion, __builtin_return_address(0));
-
-    if (range_span(q) == 0) {
-        apply(completion, STATUS_OK);
-        return;
-    }
+static void pagecache_start_writeback(pagecache pc);
 
+static void pagecache_write_sg_internal(pagecache_node pn, sg_list sg, range q,
+                                        status_handler completion, context ctx)
+{
+    pagecache pc = pn->pv->pc;
     u64 start_offset = q.start & MASK(pc->page_order);
     u64 end_offset = q.end & MASK(pc->page_order);
     range r = range_rshift(q, pc->page_order);
@@ -678,9 +951,6 @@ closure_function(1, 3, void, pagecache_write_sg,
         }
     }
 
-    context ctx;
-    ctx = get_current_context(current_cpu());
-
     /* prepare pages for writing */
     status_handler finish = closure(pc->h, pagecache_write_sg_finish, pn, q,
                                     q.start >> pc->page_order, sg, completion, ctx);
@@ -739,7 +1009,7 @@ closure_function(1, 3, void, pagecache_write_sg,
             err_msg = ss("failed to re-allocate pagecache page");
             break;
         }
-        pp->refcount++;
+        pagecache_page_ref(pp);
         if (page_state(pp) == PAGECACHE_PAGESTATE_READING)
             enqueue_page_completion_statelocked(pc, pp, apply_merge(m));
         pagecache_unlock_state(pc);
@@ -763,7 +1033,7 @@ closure_function(1, 3, void, pagecache_write_sg,
         if (start_offset > 0) {
             /* Write pages processed so far, then process remaining pages. */
             status_handler write_next = closure_from_context(ctx, pagecache_write_sg_next,
-                                                             (sg_io)closure_self(), sg,
+                                                             pn->cache_write, sg,
                                                              irange(q.start + start_offset, q.end),
                                                              completion);
             if (write_next != INVALID_ADDRESS) {
@@ -777,6 +1047,83 @@ closure_function(1, 3, void, pagecache_write_sg,
     apply(sh, sstring_is_null(err_msg) ? STATUS_OK : timm_sstring(ss("result"), err_msg));
 }
 
+/* Returns how long a write of the given length should be delayed so that, as the amount of dirty
+ * pages grows from the background threshold to the limit, writers are increasingly paced to the
+ * writeback bandwidth of the volume. */
+static timestamp pagecache_write_pause(pagecache_volume pv, u64 length)
+{
+    pagecache pc = pv->pc;
+    u64 dirty = pc->dirty_pages;
+    if (dirty <= pc->dirty_background)
+        return 0;
+    timestamp max_pause = milliseconds(PAGECACHE_DIRTY_MAX_PAUSE_MS);
+    if (dirty >= pc->dirty_limit)
+        return max_pause;
+    u64 bw = pv->write_bw ? pv->write_bw : PAGECACHE_WRITE_BW_DEFAULT;
+    u64 usecs = length * MILLION / bw * (dirty - pc->dirty_background) /
+                (pc->dirty_limit - pc->dirty_background);
+    return MIN(microseconds(usecs), max_pause);
+}
+
+closure_func_basic(timer_handler, void, pagecache_throttled_write_resume,
+                   u64 expiry, u64 overruns)
+{
+    pagecache_throttled_write tw = struct_from_field(closure_self(), pagecache_throttled_write,
+                                                     resume);
+    pagecache_node pn = tw->pn;
+    pagecache pc = pn->pv->pc;
+    if ((overruns != timer_disabled) && (pc->dirty_pages >= pc->dirty_limit)) {
+        /* keep waiting for writeback to bring dirty pages below the limit */
+        pagecache_start_writeback(pc);
+        register_timer(kernel_timers, &tw->t, CLOCK_ID_MONOTONIC,
+                       milliseconds(PAGECACHE_DIRTY_MAX_PAUSE_MS), false, 0,
+                       (timer_handler)&tw->resume);
+        return;
+    }
+    pagecache_write_sg_internal(pn, tw->sg, tw->q, tw->completion, tw->ctx);
+    deallocate(pc->h, tw, sizeof(*tw));
+}
+
+closure_function(1, 3, void, pagecache_write_sg,
+                 pagecache_node, pn,
+                 sg_list sg, range q, status_handler completion)
+{
+    pagecache_node pn = bound(pn);
+    pagecache_volume pv = pn->pv;
+    pagecache pc = pv->pc;
+    pagecache_debug("%s: node %p, q %R, sg %p, completion %F, from %p\n", func_ss,
+                    pn, q, sg, completion, __builtin_return_address(0));
+
+    if (range_span(q) == 0) {
+        apply(completion, STATUS_OK);
+        return;
+    }
+
+    context ctx = get_current_context(current_cpu());
+    if (sg && (pc->dirty_pages > pc->dirty_background)) {
+        pagecache_start_writeback(pc);
+        timestamp pause = pagecache_write_pause(pv, range_span(q));
+        if (pause) {
+            pagecache_throttled_write tw = allocate(pc->h, sizeof(*tw));
+            if (tw != INVALID_ADDRESS) {
+                pagecache_debug("   throttling write for %T (%ld dirty pages)\n", pause,
+                                pc->dirty_pages);
+                tw->pn = pn;
+                tw->sg = sg;
+                tw->q = q;
+                tw->completion = completion;
+                tw->ctx = ctx;
+                init_timer(&tw->t);
+                register_timer(kernel_timers, &tw->t, CLOCK_ID_MONOTONIC, pause, false, 0,
+                               init_closure_func(&tw->resume, timer_handler,
+                                                 pagecache_throttled_write_resume));
+                return;
+            }
+        }
+    }
+    pagecache_write_sg_internal(pn, sg, q, completion, ctx);
+}
+
 /* evict pages from new and active lists, then rebalance */
 static u64 evict_pages_locked(pagecache pc, u64 pages)
 {
@@ -787,6 +1134,7 @@ static u64 evict_pages_locked(pagecache pc, u64 pages)
            active list. */
         evicted += evict_from_list_locked(pc, &pc->active, pages - evicted);
     }
+    pagecache_trim_shadows_locked(pc);
     return evicted;
 }
 
@@ -795,6 +1143,7 @@ static void pagecache_delete_pages_locked(pagecache pc)
     list_foreach(&pc->free.l, l) {
         pagecache_page_delete_locked(pc, struct_from_list(l, pagecache_page, l));
     }
+    pagecache_reclaim_retired_locked(pc);
 }
 
 u64 pagecache_drain(u64 drain_bytes)
@@ -802,6 +1151,8 @@ u64 pagecache_drain(u64 drain_bytes)
     pagecache pc = global_pagecache;
     u64 pages = pad(drain_bytes, cache_pagesize(pc)) >> pc->page_order;
 
+    /* release the references held by pending LRU updates, so that pages can be evicted */
+    pagecache_lru_drain(pc);
     pagecache_lock_state(pc);
     u64 drained = evict_pages_locked(pc, pages) * cache_pagesize(pc);
     balance_page_lists_locked(pc);
@@ -868,10 +1219,12 @@ closure_function(5, 1, void, pagecache_commit_complete,
         if (is_ok(s) || (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY))
             pagecache_page_release_locked(pc, pp, false);
 
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_lookup_nodelocked(pn, page_offset(pp) + 1);
     } while (--page_count > 0);
     pagecache_unlock_state(pc);
-    if (!is_ok(s))
+    if (is_ok(s))
+        fetch_and_add(&pn->pv->writeback_bytes, range_span(r));
+    else
         pagecache_set_dirty(pn, r);
     pagecache_unlock_node(pn);
     deallocate_sg_list(sg);
@@ -989,13 +1342,13 @@ define_closure_function(3, 1, void, pagecache_commit_dirty_ranges,
             /* Reserve the page, unless it is in DIRTY state (in which case it has been reserved
              * when switching to DIRTY state). */
             if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY)
-                pp->refcount++;
+                pagecache_page_ref(pp);
             change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_WRITING);
             pp->write_count++;
             pagecache_unlock_state(pc);
             page_count++;
             start += len;
-            pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+            pp = page_lookup_nodelocked(pn, start >> pc->page_order);
             if (committing >= PAGECACHE_MAX_SG_ENTRIES && start < r.end) {
                 r.end = start;
                 break;
@@ -1068,31 +1421,62 @@ static void pagecache_commit_dirty_node(pagecache_node pn, status_handler comple
         apply(complete, timm_oom);
 }
 
+static void pagecache_commit_dirty_volume(pagecache_volume pv)
+{
+    pagecache_node pn = 0;
+    do {
+        pagecache_lock_volume(pv);
+        list l = list_get_next(&pv->dirty_nodes);
+        pagecache_unlock_volume(pv);
+        if (l) {
+            pn = struct_from_list(l, pagecache_node, l);
+            pagecache_commit_dirty_node(pn, 0);
+        } else {
+            pn = 0;
+        }
+    } while (pn);
+}
+
 static void pagecache_commit_dirty_pages(pagecache pc)
 {
     pagecache_debug("%s\n", func_ss);
 
     pagecache_lock(pc);
-    list_foreach(&pc->volumes, l) {
-        pagecache_volume pv = struct_from_list(l, pagecache_volume, l);
-        pagecache_node pn = 0;
-        do {
-            pagecache_lock_volume(pv);
-            list l = list_get_next(&pv->dirty_nodes);
-            pagecache_unlock_volume(pv);
-            if (l) {
-                pn = struct_from_list(l, pagecache_node, l);
-                pagecache_commit_dirty_node(pn, 0);
-            } else {
-                pn = 0;
-            }
-        } while (pn);
+    list_foreach(&pc->volumes, l)
+        pagecache_commit_dirty_volume(struct_from_list(l, pagecache_volume, l));
+    pagecache_unlock(pc);
+}
+
+/* Starts writeback of the dirty nodes of a volume, unless writeback is already in progress for
+ * the volume: a slow volume does not hold back writeback of the others. Called with the pagecache
+ * lock held. */
+static void pagecache_volume_writeback(pagecache_volume pv)
+{
+    pagecache_lock_volume(pv);
+    boolean busy = pv->writeback_in_progress;
+    if (!busy) {
+        pv->writeback_in_progress = true;
+        pv->writeback_start = now(CLOCK_ID_MONOTONIC);
+        pv->writeback_bytes = 0;
     }
+    pagecache_unlock_volume(pv);
+    if (busy)
+        return;
+    pagecache_commit_dirty_volume(pv);
+    pagecache_finish_pending_writes(pv->pc, pv, 0, (status_handler)&pv->writeback_complete);
+}
+
+static void pagecache_start_writeback(pagecache pc)
+{
+    pagecache_lock(pc);
+    list_foreach(&pc->volumes, l)
+        pagecache_volume_writeback(struct_from_list(l, pagecache_volume, l));
     pagecache_unlock(pc);
 }
 
 static void pagecache_scan(pagecache pc)
 {
+    pagecache_lru_drain(pc);
     pagecache_scan_shared_mappings(pc);
     pagecache_commit_dirty_pages(pc);
 }
@@ -1135,7 +1519,7 @@ closure_function(1, 1, boolean, purge_range_handler,
             refcount_release(&pn->refcount);
         }
         node_offset += page_size;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_lookup_nodelocked(pn, node_offset >> page_order);
     } while (node_offset < n->r.end);
     rangemap_remove_range(&pn->dirty, n);
     return true;
@@ -1188,7 +1572,7 @@ void pagecache_node_unref(pagecache_node pn)
 closure_func_basic(pp_handler, boolean, pagecache_pin_handler,
                    pagecache_page pp)
 {
-    pp->refcount++;
+    pagecache_page_ref(pp);
     return true;
 }
 
@@ -1209,6 +1593,24 @@ void pagecache_node_unpin(pagecache_node pn, range pages)
     pagecache_node_traverse(pn, pages, stack_closure_func(pp_handler, pagecache_unpin_handler));
 }
 
+closure_func_basic(pp_handler, boolean, pagecache_deactivate_handler,
+                   pagecache_page pp)
+{
+    if (pp == INVALID_ADDRESS)
+        return true;
+    pp->accessed = false;
+    if (page_state(pp) == PAGECACHE_PAGESTATE_ACTIVE)
+        change_page_state_locked(global_pagecache, pp, PAGECACHE_PAGESTATE_NEW);
+    return true;
+}
+
+/* Moves cached pages out of the active list, so that they are among the first to be evicted. */
+void pagecache_node_deactivate(pagecache_node pn, range q /* bytes */)
+{
+    pagecache_node_traverse(pn, range_rshift_pad(q, pn->pv->pc->page_order),
+                            stack_closure_func(pp_handler, pagecache_deactivate_handler));
+}
+
 closure_function(5, 1, void, pagecache_node_fetch_complete,
                  pagecache, pc, pagecache_page, first_page, u64, page_count, sg_list, sg, status_handler, complete,
                  status s)
@@ -1221,10 +1623,10 @@ closure_function(5, 1, void, pagecache_node_fetch_complete,
     pagecache_lock_state(pc);
     while (page_count-- > 0) {
         change_page_state_locked(pc, pp,
-            is_ok(s) ? PAGECACHE_PAGESTATE_NEW : PAGECACHE_PAGESTATE_ALLOC);
+            is_ok(s) ? page_filled_state(pp) : PAGECACHE_PAGESTATE_ALLOC);
         pagecache_page_queue_completions_locked(pc, pp, s);
         pagecache_page_release_locked(pc, pp, false);
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_lookup_nodelocked(pp->node, page_offset(pp) + 1);
     }
     pagecache_unlock_state(pc);
     sg_list_release(sg);
@@ -1248,47 +1650,56 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
     pagecache pc = pn->pv->pc;
     merge m = allocate_merge(pc->h, completion);
     status_handler sh = apply_merge(m);
-    struct pagecache_page k;
     if (q.end > pn->length)
         q.end = pn->length;
     u64 read_limit = pad(pn->length, U64_FROM_BIT(pn->pv->block_order));
-    k.state_offset = q.start >> pc->page_order;
+    u64 start = q.start >> pc->page_order;
     u64 end = (q.end + MASK(pc->page_order)) >> pc->page_order;
-    end = MIN(end, k.state_offset + PAGECACHE_MAX_SG_ENTRIES);
+    end = MIN(end, start + PAGECACHE_MAX_SG_ENTRIES);
     boolean mem_cleaned = false;
   begin:
     pagecache_lock_node(pn);
-    pagecache_page pp = (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
     sg_list read_sg = 0;
     range read_r;
     sg_buf sgb = 0;
     sstring err_msg = sstring_null();
     status_handler fetch_complete = 0;
-    pagecache_lock_state(pc);
+    u64 large_count = pc->large ? large_page_count(pc) : 0;
     u64 pi;
-    for (pi = k.state_offset; pi < end; pi++) {
-        if (pp == INVALID_ADDRESS || page_offset(pp) > pi) {
+    for (pi = start; pi < end; pi++) {
+        /* pages spanning a whole aligned large page within the file are allocated together */
+        if (large_count && !(pi & (large_count - 1)) && (pi + large_count <= end))
+            allocate_large_page_nodelocked(pn, pi);
+        pagecache_page pp = page_lookup_nodelocked(pn, pi);
+        if (pp == INVALID_ADDRESS) {
             pp = allocate_page_nodelocked(pn, pi);
             if (pp == INVALID_ADDRESS) {
                 err_msg = ss("failed to allocate pagecache_page");
                 break;
             }
         }
-        if (touch_page_locked(pn, pp, m)) {
+        /* a read starting in the middle of a page is likely the continuation of a previous read
+         * from the same page, and does not count as a new access */
+        boolean cached = pagecache_page_touch(pc, pp, (pi << pc->page_order) >= q.start);
+        if (!cached) {
+            pagecache_lock_state(pc);
+            cached = touch_page_locked(pn, pp, m);
+            boolean freed = !cached && (page_state(pp) == PAGECACHE_PAGESTATE_FREE);
+            pagecache_unlock_state(pc);
+            if (freed) {
+                err_msg = ss("failed to re-allocate page");
+                break;
+            }
+        }
+        if (cached) {
             /* This page does not need to be fetched: fetch pages accumulated so far in read_sg. */
             if (read_sg) {
-                pagecache_unlock_state(pc);
                 pagecache_node_fetch_sg(pc, pn, read_r, read_sg, fetch_complete);
-                pagecache_lock_state(pc);
                 read_sg = 0;
                 sgb = 0;
             }
         } else {
             /* This page needs to be fetched: add it to read_sg. */
-            if (page_state(pp) == PAGECACHE_PAGESTATE_FREE) {
-                err_msg = ss("failed to re-allocate page");
-                break;
-            }
             if (!read_sg) {
                 read_sg = allocate_sg_list();
                 if (read_sg == INVALID_ADDRESS) {
@@ -1324,29 +1735,26 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
                     break;
                 }
             }
-            pp->refcount++;
+            pagecache_page_ref(pp);
             read_r.end += read_size;
         }
         if (ph && !apply(ph, pp)) {
             err_msg = ss("page fetch handler error");
             break;
         }
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
     }
-    pagecache_unlock_state(pc);
     pagecache_unlock_node(pn);
     if (read_sg)
         pagecache_node_fetch_sg(pc, pn, read_r, read_sg, fetch_complete);
     if (!sstring_is_null(err_msg)) {
-        if (!mem_cleaned || (pi != k.state_offset)) {
-            pagecache_debug("   trying to free memory (r %R, pi 0x%lx)\n",
-                            irange(k.state_offset, end), pi);
+        if (!mem_cleaned || (pi != start)) {
+            pagecache_debug("   trying to free memory (r %R, pi 0x%lx)\n", irange(start, end), pi);
             mm_service(true);
             mem_cleaned = true;
-            k.state_offset = pi;
+            start = pi;
             goto begin;
         }
-        if (k.state_offset == q.start >> pc->page_order) {  /* no pages could be fetched */
+        if (start == q.start >> pc->page_order) {  /* no pages could be fetched */
             apply(sh, timm_sstring(ss("result"), err_msg));
             return;
         }
@@ -1359,7 +1767,7 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
 closure_func_basic(pp_handler, boolean, pagecache_read_pp_handler,
                  pagecache_page pp)
 {
-    pp->refcount++;
+    pagecache_page_ref(pp);
     return true;
 }
 
@@ -1382,14 +1790,12 @@ closure_function(4, 1, void, pagecache_read_sg_finish,
             s = timm("result", "invalid user memory");
             s = timm_append(s, "fsstatus", "%d", -EFAULT);
         }
-        struct pagecache_page k;
         int page_order = pc->page_order;
         u64 page_size = U64_FROM_BIT(page_order);
-        k.state_offset = q.start >> page_order;
         u64 offset = q.start & MASK(page_order);
         pagecache_lock_node(pn);
         pagecache_lock_state(pc);
-        pagecache_page pp = (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
+        pagecache_page pp = page_lookup_nodelocked(pn, q.start >> page_order);
         while (pp != INVALID_ADDRESS) {
             u32 copy_len = MIN(page_size - offset, range_span(q));
             if (is_ok(s))
@@ -1400,7 +1806,7 @@ closure_function(4, 1, void, pagecache_read_sg_finish,
                 break;
             }
             offset = 0;
-            pagecache_page next = (pagecache_page)rbnode_get_next((rbnode)pp);
+            pagecache_page next = page_lookup_nodelocked(pn, page_offset(pp) + 1);
             pagecache_page_release_locked(pc, pp, false);
             pp = next;
         }
@@ -1413,6 +1819,62 @@ closure_function(4, 1, void, pagecache_read_sg_finish,
     closure_finish();
 }
 
+#define PAGECACHE_READ_BATCH    16
+
+/* Copies cached data to the sg list without taking the node lock: pages are looked up and pinned
+ * within an epoch section, then data is copied (and pages are unpinned) outside of the section.
+ * Stops at the first page that is not filled, and returns the number of bytes copied. */
+static u64 pagecache_read_cached(pagecache_node pn, range q, sg_list sg)
+{
+    pagecache pc = pn->pv->pc;
+    int page_order = pc->page_order;
+    pagecache_page pages[PAGECACHE_READ_BATCH];
+    u64 copied = 0;
+    boolean miss = false;
+    while (!miss && (q.start < q.end)) {
+        u64 pi = q.start >> page_order;
+        u64 end = MIN((q.end + MASK(page_order)) >> page_order, pi + PAGECACHE_READ_BATCH);
+        int count = 0;
+        pagecache_page unfilled = 0;
+        u64 flags = pagecache_epoch_enter(pc);
+        for (; pi < end; pi++) {
+            pagecache_page pp = radix_tree_lookup(&pn->pages, pi);
+            if ((pp == INVALID_ADDRESS) || !pagecache_page_ref_speculative(pp)) {
+                miss = true;
+                break;
+            }
+            if (!page_is_filled(pp)) {
+                unfilled = pp;
+                miss = true;
+                break;
+            }
+            pages[count++] = pp;
+        }
+        pagecache_epoch_exit(flags);
+        if (unfilled)
+            pagecache_page_release(pc, unfilled);
+        read_barrier();     /* page contents are read after the page state */
+        for (int i = 0; i < count; i++) {
+            pagecache_page pp = pages[i];
+            u64 offset = q.start & MASK(page_order);
+            u64 len = MIN(cache_pagesize(pc) - offset, range_span(q));
+            sg_copy_from_buf(pp->kvirt + offset, sg, len);
+            q.start += len;
+            copied += len;
+            if (offset) {
+                /* continuation of a previous read from this page: not a new access */
+                pagecache_page_release(pc, pp);
+            } else if (pp->accessed && (page_state(pp) == PAGECACHE_PAGESTATE_NEW)) {
+                pagecache_lru_add(pc, pp);  /* second access: queue promotion to active */
+            } else {
+                pp->accessed = true;
+                pagecache_page_release(pc, pp);
+            }
+        }
+    }
+    return copied;
+}
+
 closure_function(1, 3, void, pagecache_read_sg,
                  pagecache_node, pn,
                  sg_list sg, range q, status_handler completion)
@@ -1425,6 +1887,22 @@ closure_function(1, 3, void, pagecache_read_sg,
         apply(completion, STATUS_OK);
         return;
     }
+
+    /* try to serve the read from cached pages first */
+    context user_ctx = context_from_closure(completion);
+    context ctx = get_current_context(current_cpu());
+    if (ctx != user_ctx)
+        use_fault_handler(user_ctx->fault_handler);
+    u64 copied = 0;
+    if (sg_fault_in(sg, range_span(q)))
+        copied = pagecache_read_cached(pn, q, sg);
+    if (ctx != user_ctx)
+        clear_fault_handler();
+    if (copied == range_span(q)) {
+        apply(completion, STATUS_OK);
+        return;
+    }
+    q.start += copied;
     status_handler read_sg_finish = closure(pc->h, pagecache_read_sg_finish, pn, q, sg, completion);
     if (read_sg_finish != INVALID_ADDRESS) {
         pagecache_node_fetch_internal(pn, q,
@@ -1437,6 +1915,174 @@ closure_function(1, 3, void, pagecache_read_sg,
 }
 
 
+closure_function(3, 1, void, pagecache_refresh_page_complete,
+                 pagecache, pc, pagecache_page, pp, sg_list, sg,
+                 status s)
+{
+    pagecache pc = bound(pc);
+    pagecache_page pp = bound(pp);
+    if (!is_ok(s)) {
+        msg_err("error refreshing page 0x%lx: %v\n", page_offset(pp) << pc->page_order, s);
+        timm_dealloc(s);
+    }
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    pagecache_page_release(pc, pp);
+    closure_finish();
+}
+
+/* Invalidates the cached pages overlapping a byte range of a node whose contents on disk have been
+ * overwritten by a direct write: clean pages that are not in use are dropped from the cache, while
+ * clean pages in use (e.g. mapped in user space) are read again from disk. */
+static void pagecache_node_invalidate_range(pagecache_node pn, range q)
+{
+    pagecache pc = pn->pv->pc;
+    pagecache_debug("%s: node %p, q %R\n", func_ss, pn, q);
+    range pages = range_rshift_pad(q, pc->page_order);
+    range limit = irangel(0, pad(pn->length, U64_FROM_BIT(pn->pv->block_order)));
+    pagecache_lock_node(pn);
+    for (u64 pi = pages.start; pi < pages.end; pi++) {
+        pagecache_page pp = page_lookup_nodelocked(pn, pi);
+        if (pp == INVALID_ADDRESS)
+            continue;
+        pagecache_lock_state(pc);
+        int state = page_state(pp);
+        if (((state != PAGECACHE_PAGESTATE_NEW) && (state != PAGECACHE_PAGESTATE_ACTIVE)) ||
+            pp->evicted) {
+            pagecache_unlock_state(pc);
+            continue;
+        }
+        if (pp->refcount == 1) {
+            pagecache_page_release_locked(pc, pp, false);
+            pagecache_unlock_state(pc);
+            continue;
+        }
+        pagecache_page_ref(pp);
+        pagecache_unlock_state(pc);
+        range r = range_intersection(byte_range_from_page(pc, pp), limit);
+        if (range_span(r) == 0) {
+            pagecache_page_release(pc, pp);
+            continue;
+        }
+        sg_list sg = allocate_sg_list();
+        status_handler sh;
+        if ((sg == INVALID_ADDRESS) || (pagecache_add_sgb(pp, sg, range_span(r)) == INVALID_ADDRESS) ||
+            ((sh = closure(pc->h, pagecache_refresh_page_complete, pc, pp, sg)) == INVALID_ADDRESS)) {
+            msg_err("failed to refresh page 0x%lx\n", r.start);
+            if (sg != INVALID_ADDRESS)
+                deallocate_sg_list(sg);
+            pagecache_page_release(pc, pp);
+            continue;
+        }
+        apply(pn->fs_read, sg, r, sh);
+    }
+    pagecache_unlock_node(pn);
+}
+
+/* Direct I/O: data is transferred between the request buffers and the filesystem without going
+ * through the cache. Dirty cached data is written back before issuing a direct request, so that
+ * direct reads see it and later writebacks don't overwrite directly written data. */
+closure_function(5, 1, void, pagecache_direct_io,
+                 pagecache_node, pn, sg_list, sg, range, q, boolean, write, status_handler, complete,
+                 status s)
+{
+    pagecache_node pn = bound(pn);
+    sg_list sg = bound(sg);
+    pagecache_debug("%s: node %p, q %R, %s, status %v\n", func_ss, pn, bound(q),
+                    sg ? ss("writeback done") : ss("I/O done"), s);
+    pagecache pc = pn->pv->pc;
+    if (sg && is_ok(s)) {
+        pagecache_lock_state(pc);
+        if (pc->direct_io_blocked) {
+            /* resumed with a successful status when direct I/O is unblocked */
+            page_completion c = allocate(pc->completions, sizeof(*c));
+            assert(c != INVALID_ADDRESS);
+            c->sh = (status_handler)closure_self();
+            list_push_back(&pc->direct_io_waiters, &c->l);
+            pagecache_unlock_state(pc);
+            return;
+        }
+        pc->direct_io_pending++;
+        pagecache_unlock_state(pc);
+        bound(sg) = 0;
+        apply(bound(write) ? pn->fs_write : pn->fs_read, sg, bound(q),
+              (status_handler)closure_self());
+        return;
+    }
+    if (!sg) {
+        pagecache_lock_state(pc);
+        pc->direct_io_pending--;
+        pagecache_unlock_state(pc);
+    }
+    if (!sg && bound(write) && is_ok(s))
+        pagecache_node_invalidate_range(pn, bound(q));
+    apply(bound(complete), s);
+    closure_finish();
+}
+
+static void pagecache_direct_io_begin(pagecache_node pn, sg_list sg, range q, boolean write,
+                                      status_handler completion)
+{
+    pagecache_debug("%s: node %p, q %R, sg %p, write %d\n", func_ss, pn, q, sg, write);
+    status_handler sh = closure(pn->pv->pc->h, pagecache_direct_io, pn, sg, q, write, completion);
+    if (sh == INVALID_ADDRESS) {
+        status s = timm("result", "out of memory");
+        apply(completion, timm_append(s, "fsstatus", "%d", -ENOMEM));
+        return;
+    }
+    pagecache_lock_node(pn);
+    boolean writeback = !list_empty(&pn->ops) || (rangemap_count(pn->shared_maps) != 0) ||
+                        rangemap_range_intersects(&pn->dirty, q);
+    pagecache_unlock_node(pn);
+    if (writeback)
+        pagecache_sync_node(pn, sh);
+    else
+        apply(sh, STATUS_OK);
+}
+
+/* Prevents new direct I/O requests from being issued, so that user memory can be moved to
+ * different physical pages; fails if any request is in flight. Requests issued while direct I/O is
+ * blocked are queued and resumed when it is unblocked. */
+boolean pagecache_block_direct_io(void)
+{
+    pagecache pc = global_pagecache;
+    pagecache_lock_state(pc);
+    boolean blocked = !pc->direct_io_pending;
+    if (blocked)
+        pc->direct_io_blocked = true;
+    pagecache_unlock_state(pc);
+    return blocked;
+}
+
+void pagecache_unblock_direct_io(void)
+{
+    pagecache pc = global_pagecache;
+    pagecache_lock_state(pc);
+    pc->direct_io_blocked = false;
+    list_foreach(&pc->direct_io_waiters, l) {
+        page_completion c = struct_from_list(l, page_completion, l);
+        async_apply_status_handler(c->sh, STATUS_OK);
+        list_delete(l);
+        deallocate(pc->completions, c, sizeof(*c));
+    }
+    pagecache_unlock_state(pc);
+}
+
+closure_function(1, 3, void, pagecache_direct_read,
+                 pagecache_node, pn,
+                 sg_list sg, range q, status_handler completion)
+{
+    pagecache_direct_io_begin(bound(pn), sg, q, false, completion);
+}
+
+closure_function(1, 3, void, pagecache_direct_write,
+                 pagecache_node, pn,
+                 sg_list sg, range q, status_handler completion)
+{
+    pagecache_direct_io_begin(bound(pn), sg, q, true, completion);
+}
+
+
 closure_function(3, 3, boolean, pagecache_check_dirty_page,
                  pagecache, pc, pagecache_shared_map, sm, flush_entry, fe,
                  int level, u64 vaddr, pteptr entry)
@@ -1447,19 +2093,22 @@ closure_function(3, 3, boolean, pagecache_check_dirty_page,
     if (pte_is_present(old_entry) &&
         pte_is_mapping(level, old_entry) &&
         pte_is_dirty(old_entry)) {
-        range r = irangel(sm->node_offset + (vaddr - sm->n.r.start), cache_pagesize(pc));
-        u64 pi = r.start >> pc->page_order;
-        pagecache_debug("   dirty: vaddr 0x%lx, pi 0x%lx\n", vaddr, pi);
+        range r = irangel(sm->node_offset + (vaddr - sm->n.r.start),
+                          pte_map_size(level, old_entry));
+        range pages = range_rshift(r, pc->page_order);
+        pagecache_debug("   dirty: vaddr 0x%lx, pages %R\n", vaddr, pages);
         pt_pte_clean(entry);
         page_invalidate(bound(fe), vaddr);
         pagecache_node pn = sm->pn;
         pagecache_lock_node(pn);
-        pagecache_page pp = page_lookup_nodelocked(pn, pi);
-        assert(pp != INVALID_ADDRESS);
         pagecache_lock_state(pc);
-        if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY) {
-            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_DIRTY);
-            pp->refcount++;
+        for (u64 pi = pages.start; pi < pages.end; pi++) {
+            pagecache_page pp = page_lookup_nodelocked(pn, pi);
+            assert(pp != INVALID_ADDRESS);
+            if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY) {
+                change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_DIRTY);
+                pagecache_page_ref(pp);
+            }
         }
         pagecache_unlock_state(pc);
         pagecache_set_dirty(pn, r);
@@ -1502,18 +2151,38 @@ closure_func_basic(timer_handler, void, pagecache_scan_timer,
                    u64 expiry, u64 overruns)
 {
     pagecache pc = struct_from_closure(pagecache, do_scan_timer);
-    if ((overruns != timer_disabled) && !pc->writeback_in_progress) {
-        pagecache_scan(pc);
-        pc->writeback_in_progress = true;
-        pagecache_finish_pending_writes(pc, 0, 0, (status_handler)&pc->writeback_complete);
-    }
+    if (overruns == timer_disabled)
+        return;
+    pagecache_lock_state(pc);
+    pagecache_reclaim_retired_locked(pc);
+    pagecache_unlock_state(pc);
+    pagecache_lru_drain(pc);
+    pagecache_scan_shared_mappings(pc);
+    pagecache_start_writeback(pc);
 }
 
 closure_func_basic(status_handler, void, pagecache_writeback_complete,
                    status s)
 {
-    pagecache pc = struct_from_field(closure_self(), pagecache, writeback_complete);
-    pc->writeback_in_progress = false;
+    pagecache_volume pv = struct_from_field(closure_self(), pagecache_volume, writeback_complete);
+    u64 usecs = usec_from_timestamp(now(CLOCK_ID_MONOTONIC) - pv->writeback_start);
+    pagecache_lock_volume(pv);
+    u64 bytes = pv->writeback_bytes;
+
+    /* small writebacks are dominated by latency and would underestimate the bandwidth */
+    if ((bytes >= MB) && usecs) {
+        u64 bw = bytes * MILLION / usecs;
+        pv->write_bw = pv->write_bw ? (3 * pv->write_bw + bw) / 4 : bw;
+        pagecache_debug("%s: pv %p, %ld bytes in %ld us, bandwidth %ld\n", func_ss, pv, bytes,
+                        usecs, pv->write_bw);
+    }
+    pv->writeback_in_progress = false;
+    boolean dealloc = pv->deallocating;
+    pagecache_unlock_volume(pv);
+    if (!is_ok(s))
+        timm_dealloc(s);
+    if (dealloc)
+        deallocate(pv->pc->h, pv, sizeof(*pv));
 }
 
 void pagecache_node_add_shared_map(pagecache_node pn, range q /* bytes */, u64 node_offset)
@@ -1639,8 +2308,8 @@ closure_function(2, 1, boolean, pagecache_fetch_pp_handler,
     sgb->offset = 0;
     sgb->refcount = &pp->read_refcount;
     if (fetch_and_add(&pp->read_refcount.c, 1) == 0)
-        pp->refcount++;
-    pp->refcount++;
+        pagecache_page_ref(pp);
+    pagecache_page_ref(pp);
     return true;
 }
 
@@ -1705,6 +2374,43 @@ void *pagecache_get_page_if_filled(pagecache_node pn, u64 node_offset)
     return kvirt;
 }
 
+/* Looks up a large page (i.e. a 2MB-aligned set of pages allocated from a single physically
+ * contiguous block) whose pages are all filled, and takes a reference to each of its pages. */
+void *pagecache_get_large_page_if_filled(pagecache_node pn, u64 node_offset)
+{
+    pagecache pc = pn->pv->pc;
+    if (!pc->large || (node_offset & MASK(PAGELOG_2M)))
+        return INVALID_ADDRESS;
+    u64 start = node_offset >> pc->page_order;
+    u64 count = large_page_count(pc);
+    void *kvirt = INVALID_ADDRESS;
+    u64 i;
+    pagecache_lock_node(pn);
+    for (i = 0; i < count; i++) {
+        pagecache_page pp = page_lookup_nodelocked(pn, start + i);
+        if ((pp == INVALID_ADDRESS) || !pp->large || !pagecache_page_touch(pc, pp, true))
+            break;
+        pagecache_page_ref(pp);
+        if (i == 0) {
+            kvirt = pp->kvirt;
+            if (pp->large && !(pp->phys & MASK(PAGELOG_2M)))
+                continue;
+        } else if (pp->large && (pp->kvirt == kvirt + (i << pc->page_order))) {
+            continue;
+        }
+        pagecache_page_release(pc, pp);
+        break;
+    }
+    pagecache_debug("%s: pn %p, node_offset 0x%lx, %ld pages\n", func_ss, pn, node_offset, i);
+    if (i < count) {
+        while (i-- > 0)
+            pagecache_page_release(pc, page_lookup_nodelocked(pn, start + i));
+        kvirt = INVALID_ADDRESS;
+    }
+    pagecache_unlock_node(pn);
+    return kvirt;
+}
+
 void pagecache_release_page(pagecache_node pn, u64 node_offset)
 {
     pagecache pc = pn->pv->pc;
@@ -1720,60 +2426,74 @@ void pagecache_release_page(pagecache_node pn, u64 node_offset)
 }
 
 closure_function(4, 3, boolean, pagecache_unmap_page_nodelocked,
-                 pagecache_node, pn, u64, vaddr_base, u64, node_offset, flush_entry, fe,
+                 pagecache_node, pn, range, v, u64, node_offset, flush_entry, fe,
                  int level, u64 vaddr, pteptr entry)
 {
     pte old_entry = pte_from_pteptr(entry);
     if (pte_is_present(old_entry) &&
         pte_is_mapping(level, old_entry)) {
-        u64 pi = (bound(node_offset) + (vaddr - bound(vaddr_base))) >> PAGELOG;
-        pagecache_debug("   vaddr 0x%lx, pi 0x%lx\n", vaddr, pi);
-        pte_set(entry, 0);
+        /* a large page may be only partially unmapped */
+        range v = bound(v);
+        range m = irangel(vaddr, pte_map_size(level, old_entry));
+        range r = range_intersection(m, v);
+        u64 pi = (bound(node_offset) + (r.start - v.start)) >> PAGELOG;
+        pagecache_debug("   vaddr 0x%lx, pi 0x%lx, span 0x%lx\n", vaddr, pi, range_span(r));
+        if (range_equal(r, m)) {
+            pte_set(entry, 0);
+        } else {
+            range gap = irange((r.start - vaddr) >> PAGELOG, (r.end - vaddr) >> PAGELOG);
+            if (pte_split(entry, gap) == INVALID_PHYSICAL)
+                return false;
+        }
         page_invalidate(bound(fe), vaddr);
-        pagecache_page pp = page_lookup_nodelocked(bound(pn), pi);
-        assert(pp != INVALID_ADDRESS);
-        u64 phys = page_from_pte(old_entry);
+        u64 phys = page_from_pte(old_entry) + (r.start - vaddr);
         pagecache pc = bound(pn)->pv->pc;
-        if (phys == pp->phys) {
-            /* shared or cow */
-            assert(pp->refcount >= 1);
-            pagecache_lock_state(pc);
-            pagecache_page_release_locked(pc, pp, false);
-            pagecache_unlock_state(pc);
-        } else {
-            /* private copy: free physical page */
-            page_free_phys(phys);
+        for (; r.start < r.end; r.start += PAGESIZE, phys += PAGESIZE, pi++) {
+            pagecache_page pp = page_lookup_nodelocked(bound(pn), pi);
+            assert(pp != INVALID_ADDRESS);
+            if (phys == pp->phys) {
+                /* shared or cow */
+                assert(pp->refcount >= 1);
+                pagecache_lock_state(pc);
+                pagecache_page_release_locked(pc, pp, false);
+                pagecache_unlock_state(pc);
+            } else {
+                /* private copy: free physical page */
+                page_free_phys(phys);
+            }
         }
     }
     return true;
 }
 
-void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node_offset)
+static void pagecache_node_unmap(pagecache_node pn, range v, u64 node_offset, boolean close)
 {
-    pagecache_debug("%s: pn %p, v %R, node_offset 0x%lx\n", func_ss, pn, v, node_offset);
     flush_entry fe = get_page_flush_entry();
-    pagecache_node_close_shared_pages(pn, v, fe);
+    if (close)
+        pagecache_node_close_shared_pages(pn, v, fe);
+    else
+        /* dirty pages of shared mappings are committed before their PTEs are removed */
+        rangemap_range_lookup(pn->shared_maps, v,
+                              stack_closure(scan_shared_pages_intersection, pn->pv->pc, fe));
     pagecache_lock_node(pn);
     traverse_ptes(v.start, range_span(v), stack_closure(pagecache_unmap_page_nodelocked, pn,
-                                                        v.start, node_offset, fe));
+                                                        v, node_offset, fe));
     pagecache_unlock_node(pn);
     page_invalidate_sync(fe);
 }
 
-closure_func_basic(rbnode_handler, boolean, pagecache_page_print_key,
-                   rbnode n)
+void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node_offset)
 {
-    pagecache pc = struct_from_closure(pagecache, page_print_key);
-    rprintf(" 0x%lx", page_offset((pagecache_page)n) << cache_pagesize(pc));
-    return true;
+    pagecache_debug("%s: pn %p, v %R, node_offset 0x%lx\n", func_ss, pn, v, node_offset);
+    pagecache_node_unmap(pn, v, node_offset, true);
 }
 
-closure_func_basic(rb_key_compare, int, pagecache_page_compare,
-                   rbnode a, rbnode b)
+/* Unlike pagecache_node_unmap_pages(), keeps the shared mappings at v registered, so that pages
+ * faulted in again are tracked (e.g. for MADV_DONTNEED on a mapping that stays in place). */
+void pagecache_node_release_mapped_pages(pagecache_node pn, range v /* bytes */, u64 node_offset)
 {
-    u64 oa = page_offset((pagecache_page)a);
-    u64 ob = page_offset((pagecache_page)b);
-    return oa == ob ? 0 : (oa < ob ? -1 : 1);
+    pagecache_debug("%s: pn %p, v %R, node_offset 0x%lx\n", func_ss, pn, v, node_offset);
+    pagecache_node_unmap(pn, v, node_offset, false);
 }
 
 void pagecache_set_node_length(pagecache_node pn, u64 length)
@@ -1786,12 +2506,12 @@ u64 pagecache_get_node_length(pagecache_node pn)
     return pn->length;
 }
 
-closure_function(1, 1, boolean, pagecache_page_release,
+closure_function(1, 2, boolean, pagecache_page_destruct,
                  pagecache, pc,
-                 rbnode n)
+                 u64 pi, void *p)
 {
     pagecache pc = bound(pc);
-    pagecache_page pp = struct_from_list(n, pagecache_page, rbnode);
+    pagecache_page pp = p;
     pagecache_lock_state(pc);
     if (!pp->evicted)
         pagecache_page_release_locked(pc, pp, false);
@@ -1822,8 +2542,11 @@ closure_func_basic(thunk, void, pagecache_node_free)
     if (pn->fs_reserve)
         deallocate_closure(pn->fs_reserve);
     deallocate_closure(pn->cache_write);
+    deallocate_closure(pn->direct_read);
+    deallocate_closure(pn->direct_write);
     pagecache pc = pn->pv->pc;
-    destruct_rbtree(&pn->pages, stack_closure(pagecache_page_release, pc));
+    pagecache_lru_drain(pc);    /* pending LRU updates may hold page references */
+    destruct_radix_tree(&pn->pages, stack_closure(pagecache_page_destruct, pc));
     deallocate_rangemap(pn->shared_maps, stack_closure_func(rmnode_handler, pagecache_node_assert));
     deallocate(pc->h, pn, sizeof(*pn));
 }
@@ -1851,6 +2574,16 @@ sg_io pagecache_node_get_writer(pagecache_node pn)
     return pn->cache_write;
 }
 
+sg_io pagecache_node_get_direct_reader(pagecache_node pn)
+{
+    return pn->direct_read;
+}
+
+sg_io pagecache_node_get_direct_writer(pagecache_node pn)
+{
+    return pn->direct_write;
+}
+
 pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io fs_write, pagecache_node_reserve fs_reserve)
 {
     heap h = pv->pc->h;
@@ -1866,11 +2599,12 @@ pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io
     spin_lock_init(&pn->pages_lock);
     list_init_member(&pn->l);
     init_rangemap(&pn->dirty, h);
-    init_rbtree(&pn->pages, (rb_key_compare)&pv->pc->page_compare,
-                (rbnode_handler)&pv->pc->page_print_key);
+    init_radix_tree(&pn->pages, h, (radix_retire_handler)&pv->pc->retire_tree_node);
     pn->length = 0;
     pn->cache_read = closure(h, pagecache_read_sg, pn);
     pn->cache_write = closure(h, pagecache_write_sg, pn);
+    pn->direct_read = closure(h, pagecache_direct_read, pn);
+    pn->direct_write = closure(h, pagecache_direct_write, pn);
     pn->fs_read = fs_read;
     pn->fs_write = fs_write;
     pn->fs_reserve = fs_reserve;
@@ -1908,6 +2642,10 @@ pagecache_volume pagecache_allocate_volume(u64 length, int block_order)
     pagecache_unlock(pc);
     list_init(&pv->dirty_nodes);
     spin_lock_init(&pv->lock);
+    pv->writeback_in_progress = false;
+    pv->deallocating = false;
+    pv->write_bw = 0;
+    init_closure_func(&pv->writeback_complete, status_handler, pagecache_writeback_complete);
     if (!timer_is_active(&pc->scan_timer)) {
         timestamp t = seconds(PAGECACHE_SCAN_PERIOD_SECONDS);
         register_timer(kernel_timers, &pc->scan_timer, CLOCK_ID_MONOTONIC, t, false, t,
@@ -1923,7 +2661,13 @@ void pagecache_dealloc_volume(pagecache_volume pv)
     pagecache_lock(pv->pc);
     list_delete(&pv->l);
     pagecache_unlock(pv->pc);
-    deallocate(pv->pc->h, pv, sizeof(*pv));
+    pagecache_lock_volume(pv);
+    boolean busy = pv->writeback_in_progress;
+    if (busy)
+        pv->deallocating = true;
+    pagecache_unlock_volume(pv);
+    if (!busy)
+        deallocate(pv->pc->h, pv, sizeof(*pv));
 }
 
 static inline void page_list_init(struct pagelist *pl)
@@ -1932,7 +2676,7 @@ static inline void page_list_init(struct pagelist *pl)
     pl->pages = 0;
 }
 
-void init_pagecache(heap general, heap contiguous, u64 pagesize)
+void init_pagecache(heap general, heap contiguous, heap large, u64 pagesize)
 {
     pagecache pc = allocate(general, sizeof(struct pagecache));
     assert (pc != INVALID_ADDRESS);
@@ -1942,6 +2686,7 @@ void init_pagecache(heap general, heap contiguous, u64 pagesize)
     assert(pagesize == U64_FROM_BIT(pc->page_order));
     pc->h = general;
     pc->contiguous = contiguous;
+    pc->large = large;
     heap dma = heap_dma();
     pc->zero_page = allocate_zero(dma, pagesize);
     assert(pc->zero_page != INVALID_ADDRESS);
@@ -1960,12 +2705,20 @@ void init_pagecache(heap general, heap contiguous, u64 pagesize)
     page_list_init(&pc->writing);
     list_init(&pc->volumes);
     list_init(&pc->shared_maps);
-    init_closure_func(&pc->page_compare, rb_key_compare, pagecache_page_compare);
-    init_closure_func(&pc->page_print_key, rbnode_handler, pagecache_page_print_key);
+    pc->epoch = 1;
+    list_init(&pc->retired);
+    init_closure_func(&pc->retire_tree_node, radix_retire_handler, pagecache_retire_tree_node);
+    pc->evictions = 0;
+    pc->direct_io_pending = 0;
+    pc->direct_io_blocked = false;
+    list_init(&pc->direct_io_waiters);
+
+    u64 memory_pages = heap_total((heap)heap_physical(get_kernel_heaps())) >> pc->page_order;
+    pc->dirty_pages = 0;
+    pc->dirty_background = memory_pages * PAGECACHE_DIRTY_BACKGROUND_PERCENT / 100;
+    pc->dirty_limit = memory_pages * PAGECACHE_DIRTY_LIMIT_PERCENT / 100;
 
-    pc->writeback_in_progress = false;
     init_timer(&pc->scan_timer);
     init_closure_func(&pc->do_scan_timer, timer_handler, pagecache_scan_timer);
-    init_closure_func(&pc->writeback_complete, status_handler, pagecache_writeback_complete);
     global_pagecache = pc;
 }
@@ -19,6 +19,7 @@ void pagecache_node_unref(pagecache_node pn);
 
 void pagecache_nodelocked_pin(pagecache_node pn, range pages);
 void pagecache_node_unpin(pagecache_node pn, range pages);
+void pagecache_node_deactivate(pagecache_node pn, range q /* bytes */);
 
 void pagecache_sync_volume(pagecache_volume pv, status_handler complete);
 
@@ -38,6 +39,12 @@ sg_io pagecache_node_get_reader(pagecache_node pn);
 
 sg_io pagecache_node_get_writer(pagecache_node pn);
 
+sg_io pagecache_node_get_direct_reader(pagecache_node pn);
+
+sg_io pagecache_node_get_direct_writer(pagecache_node pn);
+boolean pagecache_block_direct_io(void);
+void pagecache_unblock_direct_io(void);
+
 void pagecache_node_add_shared_map(pagecache_node pn , range v /* bytes */, u64 node_offset);
 
 void pagecache_node_close_shared_pages(pagecache_node pn, range q /* bytes */, flush_entry fe);
@@ -51,11 +58,13 @@ void pagecache_node_fetch_pages(pagecache_node pn, range r /* bytes */, sg_list
 
 void pagecache_get_page(pagecache_node pn, u64 node_offset, pagecache_page_handler handler);
 void *pagecache_get_page_if_filled(pagecache_node pn, u64 node_offset);
+void *pagecache_get_large_page_if_filled(pagecache_node pn, u64 node_offset);
 void pagecache_release_page(pagecache_node pn, u64 node_offset);
 
 void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node_offset);
+void pagecache_node_release_mapped_pages(pagecache_node pn, range v /* bytes */, u64 node_offset);
 
 pagecache_volume pagecache_allocate_volume(u64 length, int block_order);
 void pagecache_dealloc_volume(pagecache_volume pv);
 
-void init_pagecache(heap general, heap contiguous, u64 pagesize);
+void init_pagecache(heap general, heap contiguous, heap large, u64 pagesize);
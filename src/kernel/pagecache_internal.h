@@ -16,12 +16,13 @@ typedef struct pagecache {
     int page_order;
     heap h;
     heap contiguous;
+    heap large;                 /* 2MB physically contiguous blocks for large pages (optional) */
     heap completions;
     heap pp_heap;
 
     void *zero_page;            /* for zero-fill dma */
 
-    /* state_lock covers list access, page state changes and
+    /* state_lock covers list access (including the retired list), page state changes and
        alterations to page completion vecs */
 #ifdef KERNEL
     struct spinlock state_lock;
@@ -34,12 +35,30 @@ typedef struct pagecache {
     struct list volumes;
     struct list shared_maps;
 
-    boolean writeback_in_progress;
+    /* pages removed from their node, and emptied nodes of page trees, are retired and freed only
+       when no lock-free lookup can still be referencing them (see
+       pagecache_reclaim_retired_locked()) */
+    word epoch;
+    struct list retired;
+    closure_struct(radix_retire_handler, retire_tree_node);
+
+    u64 evictions;              /* pages evicted so far, used to compute refault distances */
+
+    /* pages in DIRTY or WRITING state, and thresholds (in pages) above which background writeback
+       is started and writers are throttled */
+    u64 dirty_pages;
+    u64 dirty_background;
+    u64 dirty_limit;
+
+    /* direct I/O requests in flight (which transfer data to and from user memory by DMA), whether
+       issuing new requests is temporarily blocked, and requests waiting to be issued (covered by
+       state_lock) */
+    word direct_io_pending;
+    boolean direct_io_blocked;
+    struct list direct_io_waiters;
+
     struct timer scan_timer;
     closure_struct(timer_handler, do_scan_timer);
-    closure_struct(status_handler, writeback_complete);
-    closure_struct(rb_key_compare, page_compare);
-    closure_struct(rbnode_handler, page_print_key);
 } *pagecache;
 
 typedef struct pagecache_volume {
@@ -49,18 +68,26 @@ typedef struct pagecache_volume {
     struct list dirty_nodes;    /* head of pagecache_nodes */
     u64 length;                 /* end of volume */
     int block_order;
+
+    /* writeback runs independently for each volume; its throughput is used to pace writers */
+    boolean writeback_in_progress;
+    boolean deallocating;       /* free volume on writeback completion */
+    timestamp writeback_start;
+    u64 writeback_bytes;
+    u64 write_bw;               /* bytes per second, 0 if not measured yet */
+    closure_struct(status_handler, writeback_complete);
 } *pagecache_volume;
 
 typedef struct pagecache_node {
     struct list l;              /* volume-wide node list */
     pagecache_volume pv;
 
-    /* pages_lock covers traversal, insertions and removals - consider
-       changing to a rw lock or semaphore */
+    /* pages_lock serializes insertions and removals; lookups in the
+       pages tree (indexed by page number) may be done without it */
 #ifdef KERNEL
     struct spinlock pages_lock;
 #endif
-    struct rbtree pages;
+    struct radix_tree pages;
     rangemap shared_maps;       /* shared mappings associated with this node */
     struct rangemap dirty;
     struct list ops;
@@ -68,6 +95,8 @@ typedef struct pagecache_node {
 
     sg_io cache_read;
     sg_io cache_write;
+    sg_io direct_read;          /* cache-bypassing I/O (O_DIRECT) */
+    sg_io direct_write;
     sg_io fs_read;
     sg_io fs_write;
     pagecache_node_reserve fs_reserve;
@@ -76,6 +105,17 @@ typedef struct pagecache_node {
     struct refcount refcount;   /* count dirty pages before freeing node */
 } *pagecache_node;
 
+/* write request delayed by dirty page throttling */
+typedef struct pagecache_throttled_write {
+    pagecache_node pn;
+    sg_list sg;
+    range q;
+    status_handler completion;
+    context ctx;
+    struct timer t;
+    closure_struct(timer_handler, resume);
+} *pagecache_throttled_write;
+
 struct pagecache_node_op_common {
     struct list l;
     enum {
@@ -106,7 +146,7 @@ typedef struct pagecache_shared_map {
 
 #define PAGECACHE_PAGESTATE_SHIFT   61
 
-#define PAGECACHE_PAGESTATE_FREE    0 /* evicted, yet remains in search tree and retains refault data */
+#define PAGECACHE_PAGESTATE_FREE    0 /* evicted, yet remains in page tree and retains refault data */
 #define PAGECACHE_PAGESTATE_EVICTED 1 /* evicted, awaiting release by user (not on list) */
 #define PAGECACHE_PAGESTATE_ALLOC   2 /* allocated, request not issued (not on list) */
 #define PAGECACHE_PAGESTATE_READING 3 /* block reads issued (not on list) */
@@ -118,19 +158,25 @@ typedef struct pagecache_shared_map {
 typedef struct pagecache_page *pagecache_page;
 
 struct pagecache_page {
-    struct rbnode rbnode;
-    struct refcount read_refcount;  /* 24 */
-    u64 state_offset;           /* 40 - state and offset in pages */
-    void *kvirt;                /* 48 */
-    int write_count;            /* 56 */
-    int refcount;               /* 60 */
+    struct refcount read_refcount;  /* 0 */
+    u64 state_offset;           /* 16 - state and offset in pages */
+    void *kvirt;                /* 24 */
+    int write_count;            /* 32 */
+    u32 refcount;               /* 36 - modified atomically, can be taken without locks */
+    pagecache_node node;        /* 40 - null for the retire record of a page tree node (kvirt) */
+    boolean accessed;           /* 48 - accessed since last promotion or LRU scan */
+    boolean evicted;
+    boolean refault_active;     /* refaulted while in the working set: activate when filled */
+    boolean large;              /* kvirt is part of a large page block allocated from pc->large */
     /* end of first cacheline */
 
-    pagecache_node node;
     struct list l;
-    u64 phys;                   /* physical address */
+    union {
+        u64 phys;               /* physical address */
+        u64 eviction_stamp;     /* value of pagecache evictions when the page was evicted */
+        u64 retire_epoch;       /* epoch at which the page was removed from the page tree */
+    };
     struct list bh_completions; /* default for non-kernel use */
 
     closure_struct(thunk, read_release);
-    boolean evicted;
 };
@@ -0,0 +1,252 @@
+#include <kernel.h>
+#include <management.h>
+
+/* Pressure stall information (PSI).
+ * For each resource, the "some" state is the time during which at least one thread is stalled
+ * waiting for the resource, and the "full" state is the time during which at least one thread is
+ * stalled and no CPU is running a thread, i.e. no productive work is being done. Running averages
+ * over 10, 60 and 300 seconds are updated every PSI_AVG_PERIOD_SECONDS, with the same fixed-point
+ * exponential decay used for the load average.
+ * Each CPU keeps track of whether it is running a thread and of the stalls that began and ended on
+ * it, without touching shared state; the per-CPU state is aggregated into the global state under
+ * the PSI lock only when a CPU change may alter the global state, and whenever averages are
+ * updated. */
+
+#define PSI_AVG_PERIOD_SECONDS  2
+
+#define PSI_FSHIFT      11
+#define PSI_FIXED_1     (1 << PSI_FSHIFT)
+#define PSI_INT(x)      ((x) >> PSI_FSHIFT)
+#define PSI_FRAC(x)     PSI_INT(((x) & (PSI_FIXED_1 - 1)) * 100)
+
+#define PSI_NR_AVGS     3
+
+/* 1 / exp(PSI_AVG_PERIOD_SECONDS / window) in fixed point, for 10, 60 and 300 second windows */
+static const u64 psi_avg_exp[PSI_NR_AVGS] = { 1677, 1981, 2034 };
+
+static const sstring psi_resource_names[PSI_NR_RESOURCES] = {
+    ss_static_init("io"),
+    ss_static_init("memory"),
+    ss_static_init("cpu"),
+};
+
+typedef struct psi_state {
+    timestamp total;
+    timestamp start;    /* 0 if not in this state */
+    timestamp avg_total;
+    u64 avg[PSI_NR_AVGS];
+} *psi_state;
+
+static struct {
+    struct spinlock lock;
+    struct psi_state some[PSI_NR_RESOURCES];
+    struct psi_state full[PSI_NR_RESOURCES];
+    timestamp avg_time;
+    struct timer avg_timer;
+    closure_struct(timer_handler, avg_update);
+} psi;
+
+static void psi_state_update(psi_state s, boolean active, timestamp here)
+{
+    if (s->start && !active) {
+        s->total += here - s->start;
+        s->start = 0;
+    } else if (!s->start && active) {
+        s->start = here;
+    }
+}
+
+static boolean psi_stalled(psi_resource r)
+{
+    s64 stalled = 0;
+    cpuinfo ci;
+    vector_foreach(cpuinfos, ci)
+        stalled += ci->psi.stalled[r];
+    return (stalled > 0);
+}
+
+static boolean psi_running(void)
+{
+    cpuinfo ci;
+    vector_foreach(cpuinfos, ci)
+        if (ci->psi.running)
+            return true;
+    return false;
+}
+
+static void psi_update_locked(timestamp here)
+{
+    if (here == 0)
+        here = 1;
+    boolean running = psi_running();
+    for (int r = 0; r < PSI_NR_RESOURCES; r++) {
+        boolean some = psi_stalled(r);
+        psi_state_update(&psi.some[r], some, here);
+        psi_state_update(&psi.full[r], some && !running, here);
+    }
+}
+
+static void psi_update(void)
+{
+    u64 flags = spin_lock_irq(&psi.lock);
+    psi_update_locked(now(CLOCK_ID_MONOTONIC_RAW));
+    spin_unlock_irq(&psi.lock, flags);
+}
+
+static void psi_cpu_stalled(psi_resource r, s32 delta)
+{
+    u64 flags = irq_disable_save();
+    current_cpu()->psi.stalled[r] += delta;
+    irq_restore(flags);
+    memory_barrier();
+}
+
+/* The global state is only updated when the first stall begins or the last stall ends. */
+void psi_stall_begin(psi_resource r)
+{
+    psi_cpu_stalled(r, 1);
+    if (!psi.some[r].start)
+        psi_update();
+}
+
+void psi_stall_end(psi_resource r)
+{
+    psi_cpu_stalled(r, -1);
+    if (psi.some[r].start && !psi_stalled(r))
+        psi_update();
+}
+
+/* Called when a CPU starts or stops running a thread; the global state only needs to be updated
+ * when some thread is stalled and either the last running CPU stops, or a CPU starts running while
+ * no productive work is being done. */
+void psi_thread_running(boolean running)
+{
+    u64 flags = irq_disable_save();
+    current_cpu()->psi.running += running ? 1 : -1;
+    irq_restore(flags);
+    memory_barrier();
+    boolean update = false;
+    for (int r = 0; r < PSI_NR_RESOURCES; r++) {
+        if (running ? psi.full[r].start : psi.some[r].start) {
+            update = true;
+            break;
+        }
+    }
+    if (update && (running || !psi_running()))
+        psi_update();
+}
+
+static timestamp psi_state_total(psi_state s, timestamp here)
+{
+    return s->total + (s->start ? here - s->start : 0);
+}
+
+static void psi_state_avg(psi_state s, timestamp here, timestamp period)
+{
+    timestamp total = psi_state_total(s, here);
+    timestamp delta = MIN(total - s->avg_total, period);
+    s->avg_total = total;
+    u64 pct = (delta * 100 * PSI_FIXED_1) / period;
+    for (int i = 0; i < PSI_NR_AVGS; i++)
+        s->avg[i] = (s->avg[i] * psi_avg_exp[i] + pct * (PSI_FIXED_1 - psi_avg_exp[i])) >>
+                    PSI_FSHIFT;
+}
+
+closure_func_basic(timer_handler, void, psi_avg_update,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    u64 flags = spin_lock_irq(&psi.lock);
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    psi_update_locked(here);
+    timestamp period = here - psi.avg_time;
+    if (period > 0) {
+        for (int r = 0; r < PSI_NR_RESOURCES; r++) {
+            psi_state_avg(&psi.some[r], here, period);
+            psi_state_avg(&psi.full[r], here, period);
+        }
+        psi.avg_time = here;
+    }
+    spin_unlock_irq(&psi.lock, flags);
+}
+
+static void psi_print_state(buffer b, sstring name, psi_state s, timestamp here)
+{
+    bprintf(b, "%s", name);
+    bprintf(b, " avg10=%d.%02d avg60=%d.%02d avg300=%d.%02d total=%ld\n",
+            PSI_INT(s->avg[0]), PSI_FRAC(s->avg[0]), PSI_INT(s->avg[1]), PSI_FRAC(s->avg[1]),
+            PSI_INT(s->avg[2]), PSI_FRAC(s->avg[2]), usec_from_timestamp(psi_state_total(s, here)));
+}
+
+/* Prints the pressure stall information for a resource in the format of /proc/pressure/ files. */
+void psi_print(buffer b, psi_resource r)
+{
+    u64 flags = spin_lock_irq(&psi.lock);
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    struct psi_state some = psi.some[r];
+    struct psi_state full = psi.full[r];
+    spin_unlock_irq(&psi.lock, flags);
+    psi_print_state(b, ss("some"), &some, here);
+    psi_print_state(b, ss("full"), &full, here);
+}
+
+closure_function(2, 0, value, psi_get_state,
+                 psi_state, s, tuple, t)
+{
+    psi_state s = bound(s);
+    tuple t = bound(t);
+    u64 flags = spin_lock_irq(&psi.lock);
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    struct psi_state state = *s;
+    spin_unlock_irq(&psi.lock, flags);
+    symbol avg_syms[PSI_NR_AVGS] = { sym(avg10), sym(avg60), sym(avg300) };
+    for (int i = 0; i < PSI_NR_AVGS; i++) {
+        buffer b = get(t, avg_syms[i]);
+        buffer_clear(b);
+        bprintf(b, "%d.%02d", PSI_INT(state.avg[i]), PSI_FRAC(state.avg[i]));
+    }
+    symbol total = sym(total);
+    set(t, total, value_rewrite_u64(get(t, total), usec_from_timestamp(psi_state_total(&state,
+                                                                                       here))));
+    return t;
+}
+
+static void psi_register_state(heap h, tuple_notifier n, tuple parent, sstring name, psi_state s)
+{
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    set(t, sym(avg10), wrap_string_cstring("0.00"));
+    set(t, sym(avg60), wrap_string_cstring("0.00"));
+    set(t, sym(avg300), wrap_string_cstring("0.00"));
+    set(t, sym(total), value_from_u64(0));
+    symbol k = sym_sstring(name);
+    set(parent, k, t);
+    tuple_notifier_register_get_notify(n, k, closure(h, psi_get_state, s, t));
+}
+
+value psi_management(heap h)
+{
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    for (int r = 0; r < PSI_NR_RESOURCES; r++) {
+        tuple rt = allocate_tuple();
+        assert(rt != INVALID_ADDRESS);
+        tuple_notifier n = tuple_notifier_wrap(rt, false);
+        assert(n != INVALID_ADDRESS);
+        psi_register_state(h, n, rt, ss("some"), &psi.some[r]);
+        psi_register_state(h, n, rt, ss("full"), &psi.full[r]);
+        set(t, sym_sstring(psi_resource_names[r]), n);
+    }
+    return t;
+}
+
+void init_pressure(heap h)
+{
+    spin_lock_init(&psi.lock);
+    psi.avg_time = now(CLOCK_ID_MONOTONIC_RAW);
+    init_timer(&psi.avg_timer);
+    timestamp t = seconds(PSI_AVG_PERIOD_SECONDS);
+    register_timer(kernel_timers, &psi.avg_timer, CLOCK_ID_MONOTONIC, t, false, t,
+                   init_closure_func(&psi.avg_update, timer_handler, psi_avg_update));
+}
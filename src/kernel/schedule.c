@@ -27,6 +27,7 @@ BSS_RO_AFTER_INIT bitmap idle_cpu_mask;
 
 BSS_RO_AFTER_INIT timerqueue kernel_timers;
 BSS_RO_AFTER_INIT thunk timer_interrupt_handler;
+BSS_RO_AFTER_INIT thunk runloop_busy_poll_handler;
 
 NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
 {
@@ -178,6 +179,18 @@ static inline void service_async_1(queue q)
     }
 }
 
+/* Instead of sleeping when idle, keep the current CPU polling for incoming events (via the
+ * registered busy poll handler) for the given duration. */
+void runloop_busy_poll(timestamp duration)
+{
+    if (!runloop_busy_poll_handler)
+        return;
+    cpuinfo ci = current_cpu();
+    timestamp until = now(CLOCK_ID_MONOTONIC_RAW) + duration;
+    if (until > ci->busy_poll_until)
+        ci->busy_poll_until = until;
+}
+
 NOTRACE void __attribute__((noreturn)) runloop_internal(void)
 {
     cpuinfo ci = current_cpu();
@@ -274,6 +287,12 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
         (!(shutting_down & SHUTDOWN_ONGOING) && !sched_queue_empty(&ci->thread_queue)))
         goto retry;
 
+    if (ci->busy_poll_until > here) {
+        apply(runloop_busy_poll_handler);
+        kern_pause();
+        goto retry;
+    }
+
     kernel_sleep();
 }
 
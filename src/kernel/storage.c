@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <errno.h>
 #include <pagecache.h>
 #include <storage.h>
 #include <fs.h>
@@ -202,6 +203,10 @@ define_closure_function(2, 1, void, storage_simple_req_handler,
     case STORAGE_OP_WRITE:
         apply(bound(write), req->data, req->blocks, req->completion);
         break;
+    case STORAGE_OP_DISCARD:
+    case STORAGE_OP_WRITE_ZEROES:
+        async_apply_status_handler(req->completion, storage_unsupported_status());
+        break;
     }
 }
 
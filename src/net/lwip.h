@@ -19,15 +19,18 @@
 status direct_connect(heap h, ip_addr_t *addr, u16 port, connection_handler ch);
 
 closure_type(netif_dev_setup, boolean, tuple config);
+closure_type(netif_dev_poll, boolean);
 
 typedef struct netif_dev {
     struct netif n;
     closure_struct(netif_dev_setup, setup);
+    closure_struct(netif_dev_poll, poll);   /* optional: process RX without waiting for an irq */
 } *netif_dev;
 
 static inline void netif_dev_init(netif_dev dev)
 {
     dev->setup.__apply = 0;
+    dev->poll.__apply = 0;
 }
 
 u16 ifflags_from_netif(struct netif *netif);
@@ -61,14 +61,21 @@
 
 #define LWIP_WND_SCALE 1
 #define TCP_MSS 1460            /* Assuming ethernet; may want to derive this */
-#define TCP_WND 0x34000         /* For maximum throughput should be the same as TCP_SND_BUF */
-#define TCP_SND_BUF 0x34000     /* Same as /proc/sys/net/core/wmem_default on Linux */
+/* Upper limits of per-socket buffer sizes, which are autotuned by netsyscall (see tcp_rmem and
+ * tcp_wmem); same as the Linux default maximum values */
+#define TCP_WND 0x600000
+#define TCP_SND_BUF 0x400000
 #define TCP_SNDLOWAT (0xFFFE - (4 * TCP_MSS))   /* Unused, but needed to pass lwIP sanity checks */
 #define TCP_SND_QUEUELEN TCP_SNDQUEUELEN_OVERFLOW
 #define TCP_OVERSIZE TCP_MSS
 #define TCP_QUEUE_OOSEQ 1
+/* Advertise out-of-order data to the sender. This is receiver-side only: lwIP ignores SACK blocks
+ * received from the peer, so loss recovery when sending is limited to fast retransmit of the first
+ * unacknowledged segment and retransmission timeouts. */
+#define LWIP_TCP_SACK_OUT 1
+#define LWIP_TCP_MAX_SACK_NUM 4
 
-#define TCP_RCV_SCALE 2         /* (0xFFFFU << TCP_RCV_SCALE) must be greater than TCP_WND */
+#define TCP_RCV_SCALE 7         /* (0xFFFFU << TCP_RCV_SCALE) must be greater than TCP_WND */
 #define TCP_LISTEN_BACKLOG 1
 #define LWIP_DHCP 1
 // would prefer to set this dynamically...also,
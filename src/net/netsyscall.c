@@ -11,6 +11,7 @@
 #include <lwip/udp.h>
 #include <net_system_structs.h>
 #include <socket.h>
+#include <tcp_cc.h>
 
 //#define NETSYSCALL_DEBUG
 #ifdef NETSYSCALL_DEBUG
@@ -81,21 +82,44 @@ enum udp_socket_state {
     UDP_SOCK_SHUTDOWN = 2,
 };
 
+typedef struct reuseport_group *reuseport_group;
+
 typedef struct netsock {
     struct sock sock;             /* must be first */
     process p;
     queue incoming;
     err_t lwip_error;             /* lwIP error code; ERR_OK if normal */
     u8 ipv6only:1;
+    u8 reuseport:1;
+    u32 busy_poll;                /* busy poll budget in microseconds (0: disabled) */
+    int incoming_cpu;             /* CPU the socket is being consumed from, -1 if unknown */
+    reuseport_group rp_group;
     union {
 	struct {
 	    struct tcp_pcb *lw;
 	    tcpflags_t flags;
 	    enum tcp_socket_state state; // half open?
+	    struct tcp_cc cc;
+	    /* buffer sizing; protected by the PCB lock */
+	    u32 rcvbuf, sndbuf;
+	    u8 rcvbuf_lock:1;       /* set via SO_RCVBUF: no autotuning */
+	    u8 sndbuf_lock:1;       /* set via SO_SNDBUF: no autotuning */
+	    u32 rcv_wnd_cap;        /* receive window plus unread data (0 if not connected) */
+	    u32 rcv_rtt_seq;        /* receive RTT sample completes when this sequence number arrives */
+	    timestamp rcv_rtt_stamp;
+	    timestamp rcv_rtt;
+	    u32 rcvq_space;         /* bytes read by the application in the last measured RTT */
+	    u32 rcvq_copied;
+	    timestamp rcvq_stamp;
 	} tcp;
 	struct {
 	    struct udp_pcb *lw;
 	    enum udp_socket_state state;
+	    u16 gso_size;           /* UDP_SEGMENT: segment size of outgoing datagrams (0: none) */
+	    u8 gro:1;               /* UDP_GRO: coalesce incoming datagrams of the same flow */
+	    struct udp_entry *gro_tail;     /* queued datagram that can be extended via GRO */
+	    u32 rcvbuf;             /* limit of queued incoming data */
+	    u32 sndbuf;             /* reported only: outgoing datagrams are not queued */
 	} udp;
     } info;
     closure_struct(file_io, read);
@@ -113,11 +137,48 @@ typedef struct netsock {
 #define netsock_lock(s)     spin_lock(&(s)->sock.f.lock)
 #define netsock_unlock(s)   spin_unlock(&(s)->sock.f.lock)
 
+/* Free space in the send buffer of a TCP socket: lwIP accounts for TCP_SND_BUF bytes per
+ * connection, of which only the socket send buffer size can be used. */
+static inline u32 netsock_tcp_sndbuf(netsock s, struct tcp_pcb *pcb)
+{
+    u32 avail = tcp_sndbuf(pcb);
+    u32 queued = TCP_SND_BUF - avail;
+    return (queued < s->info.tcp.sndbuf) ? MIN(s->info.tcp.sndbuf - queued, avail) : 0;
+}
+
+/* Sockets with SO_REUSEPORT bound to the same local address and port, among which incoming
+ * connections (TCP) and datagrams (UDP) are distributed. A group holds a reference for each of its
+ * members, and lwIP callbacks hold a reference while distributing incoming data; the group pointer
+ * of a socket is protected by the socket lock.
+ * Lock order: reuseport_lock -> group lock -> netsock lock. */
+struct reuseport_group {
+    struct list l;
+    int type;
+    ip_addr_t addr;
+    u16 port;
+    struct spinlock lock;
+    struct refcount refcount;
+    vector members;
+    struct tcp_pcb *listener;   /* lwIP listen PCB shared by listening TCP members */
+};
+
 #define DEFAULT_SO_RCVBUF   0x34000 /* same as Linux */
+#define DEFAULT_SO_SNDBUF   0x34000 /* same as Linux */
 
-#define TCP_CONG_CTRL_ALGO  "reno"  /* TCP congestion control algorithm name */
+#define TCP_MEM_MIN     0
+#define TCP_MEM_DEFAULT 1
+#define TCP_MEM_MAX     2
 
 int so_rcvbuf;
+/* TCP receive and send buffer sizes (min, default, max), same as Linux tcp_rmem and tcp_wmem */
+static u32 tcp_rmem[3] = {4 * KB, 128 * KB, TCP_WND};
+static u32 tcp_wmem[3] = {4 * KB, 16 * KB, TCP_SND_BUF};
+u32 net_busy_read;  /* default SO_BUSY_POLL value (microseconds) */
+u32 net_busy_poll;  /* busy poll budget for poll/select/epoll (microseconds) */
+
+static heap reuseport_heap;
+static struct list reuseport_groups;
+static struct spinlock reuseport_lock;
 
 static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
@@ -158,6 +219,30 @@ static void netsock_check_loop(void)
     }
 }
 
+static boolean netsock_busy_poll_netif(struct netif *n, void *priv)
+{
+    if (!netif_is_loopback(n) && netif_is_up(n)) {
+        netif_dev dev = n->state;
+        netif_dev_poll poll = (netif_dev_poll)&dev->poll;
+        if (*poll)
+            apply(poll);
+    }
+    return false;
+}
+
+/* Invoked by an idle CPU in busy poll mode. */
+closure_function(0, 0, void, netsock_busy_poll)
+{
+    netif_iterate(netsock_busy_poll_netif, 0);
+}
+
+/* Called when a thread is about to block on the socket. */
+static void netsock_busy_poll_arm(netsock s)
+{
+    if (s->busy_poll)
+        runloop_busy_poll(microseconds(s->busy_poll));
+}
+
 static netsock get_netsock(struct sock *sock)
 {
     if ((sock->domain != AF_INET) && (sock->domain != AF_INET6))
@@ -180,7 +265,7 @@ static u32 netsock_events_locked(netsock s)
                as is the TCP sendbuf size read. */
             rv = (in ? EPOLLIN | EPOLLRDNORM : 0) |
                 (s->info.tcp.lw->state == ESTABLISHED ?
-                 (tcp_sndbuf(s->info.tcp.lw) ? EPOLLOUT | EPOLLWRNORM : 0) :
+                 (netsock_tcp_sndbuf(s, s->info.tcp.lw) ? EPOLLOUT | EPOLLWRNORM : 0) :
                  EPOLLIN | EPOLLOUT);
             break;
         case TCP_SOCK_UNDEFINED:
@@ -378,6 +463,124 @@ static void netsock_tcp_put(struct tcp_pcb * tcp_lw)
     tcp_unref(tcp_lw);
 }
 
+/* Brings the receive window of a connection in line with the socket receive buffer size, and
+ * returns to lwIP the window freed by the application reading `recved` bytes.
+ * lwIP sizes receive windows up to TCP_WND: the excess is withheld from tcp_recved(). */
+static void netsock_tcp_rcv_wnd_update(netsock s, struct tcp_pcb *pcb, u32 recved)
+{
+    u32 cap = s->info.tcp.rcv_wnd_cap;
+    u32 target = s->info.tcp.rcvbuf;
+    if (!cap) {
+        if (recved)
+            tcp_recved(pcb, recved);
+        return;
+    }
+    if (cap > target) {
+        u32 excess = cap - target;
+        u32 withheld = MIN(excess, recved);
+        recved -= withheld;
+        excess -= withheld;
+        if (excess) {
+            /* shrink the part of the window that has not been announced yet: a window announced
+             * to the peer is never taken back */
+            u32 right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
+            u32 unannounced = TCP_SEQ_GT(right_edge, pcb->rcv_ann_right_edge) ?
+                              right_edge - pcb->rcv_ann_right_edge : 0;
+            u32 shrink = MIN(excess, unannounced);
+            pcb->rcv_wnd -= shrink;
+            excess -= shrink;
+        }
+        cap = target + excess;
+    } else if (cap < target) {
+        u32 grow = MIN(target, TCP_WND_MAX(pcb)) - MIN(cap, TCP_WND_MAX(pcb));
+        recved += grow;
+        cap += grow;
+    }
+    s->info.tcp.rcv_wnd_cap = cap;
+    if (recved)
+        tcp_recved(pcb, recved);
+}
+
+/* To be called when a connection is established. */
+static void netsock_tcp_rcv_wnd_init(netsock s, struct tcp_pcb *pcb)
+{
+    s->info.tcp.rcv_wnd_cap = pcb->rcv_wnd + s->sock.rx_len;
+    netsock_tcp_rcv_wnd_update(s, pcb, 0);
+}
+
+/* Estimates the RTT from the receiver side, as the time it takes for the sender to fill the
+ * advertised window. */
+static void netsock_tcp_rcv_rtt_measure(netsock s, struct tcp_pcb *pcb)
+{
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    if (s->info.tcp.rcv_rtt_seq) {
+        if (!TCP_SEQ_GEQ(pcb->rcv_nxt, s->info.tcp.rcv_rtt_seq))
+            return;
+        timestamp sample = t - s->info.tcp.rcv_rtt_stamp;
+        timestamp rtt = s->info.tcp.rcv_rtt;
+        s->info.tcp.rcv_rtt = (!rtt || (sample < rtt)) ? sample : (7 * rtt + sample) / 8;
+    }
+    s->info.tcp.rcv_rtt_seq = pcb->rcv_nxt + pcb->rcv_wnd;
+    s->info.tcp.rcv_rtt_stamp = t;
+}
+
+/* Grows the receive buffer so that the window can hold twice the amount of data the application
+ * consumes in one RTT. */
+static void netsock_tcp_rcvbuf_autotune(netsock s, struct tcp_pcb *pcb, u32 copied)
+{
+    timestamp rtt = s->info.tcp.rcv_rtt;
+    if (s->info.tcp.rcvbuf_lock || !rtt)
+        return;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    s->info.tcp.rcvq_copied += copied;
+    if (!s->info.tcp.rcvq_stamp) {
+        s->info.tcp.rcvq_stamp = t;
+        return;
+    }
+    if (t - s->info.tcp.rcvq_stamp < rtt)
+        return;
+    copied = s->info.tcp.rcvq_copied;
+    if (copied > s->info.tcp.rcvq_space) {
+        u64 rcvwin = 2 * (u64)copied + 16 * pcb->mss;
+        if (rcvwin > s->info.tcp.rcvbuf) {
+            s->info.tcp.rcvbuf = MIN(rcvwin, tcp_rmem[TCP_MEM_MAX]);
+            net_debug("sock %d, rcvbuf %d\n", s->sock.fd, s->info.tcp.rcvbuf);
+        }
+        s->info.tcp.rcvq_space = copied;
+    }
+    s->info.tcp.rcvq_copied = 0;
+    s->info.tcp.rcvq_stamp = t;
+}
+
+/* Grows the send buffer so that it can hold two congestion windows worth of data. */
+static void netsock_tcp_sndbuf_autotune(netsock s, struct tcp_pcb *pcb)
+{
+    if (s->info.tcp.sndbuf_lock)
+        return;
+    u64 sndbuf = 2 * (u64)pcb->cwnd;
+    if (sndbuf > s->info.tcp.sndbuf)
+        s->info.tcp.sndbuf = MIN(sndbuf, tcp_wmem[TCP_MEM_MAX]);
+}
+
+static void netsock_tcp_buf_init(netsock s, netsock parent)
+{
+    if (parent) {
+        s->info.tcp.rcvbuf = parent->info.tcp.rcvbuf;
+        s->info.tcp.sndbuf = parent->info.tcp.sndbuf;
+        s->info.tcp.rcvbuf_lock = parent->info.tcp.rcvbuf_lock;
+        s->info.tcp.sndbuf_lock = parent->info.tcp.sndbuf_lock;
+    } else {
+        s->info.tcp.rcvbuf = tcp_rmem[TCP_MEM_DEFAULT];
+        s->info.tcp.sndbuf = tcp_wmem[TCP_MEM_DEFAULT];
+        s->info.tcp.rcvbuf_lock = s->info.tcp.sndbuf_lock = 0;
+    }
+    s->info.tcp.rcv_wnd_cap = 0;
+    s->info.tcp.rcv_rtt_seq = 0;
+    s->info.tcp.rcv_rtt = 0;
+    s->info.tcp.rcvq_space = s->info.tcp.rcvq_copied = 0;
+    s->info.tcp.rcvq_stamp = 0;
+}
+
 static void netsock_tcp_close(netsock s, struct tcp_pcb *tcp_lw)
 {
     netsock_lock(s);
@@ -389,6 +592,196 @@ static void netsock_tcp_close(netsock s, struct tcp_pcb *tcp_lw)
     netsock_unlock(s);
 }
 
+static u32 reuseport_hash(const ip_addr_t *raddr, u16 rport, u16 lport)
+{
+    u32 words[4];
+    int n;
+    if (IP_IS_V6_VAL(*raddr)) {
+        runtime_memcpy(words, ip_2_ip6(raddr)->addr, sizeof(words));
+        n = 4;
+    } else {
+        words[0] = ip_2_ip4(raddr)->addr;
+        n = 1;
+    }
+    u64 hash = 0xcbf29ce484222325;
+    for (int i = 0; i < n; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211;
+    }
+    hash ^= ((u32)rport << 16) | lport;
+    hash *= 1099511628211;
+    return hash ^ (hash >> 32);
+}
+
+static boolean reuseport_eligible(netsock s)
+{
+    if (s->sock.type == SOCK_STREAM)
+        return (s->info.tcp.state == TCP_SOCK_LISTENING);
+    return !(s->info.udp.lw->flags & UDP_FLAGS_CONNECTED);
+}
+
+/* Called with group lock held. Members being consumed from the current (i.e. RX) CPU are
+ * preferred; among the candidates, the flow hash selects one. */
+static netsock reuseport_select(reuseport_group g, u32 hash)
+{
+    int cpu = current_cpu()->id;
+    int local = 0, eligible = 0;
+    netsock m;
+    vector_foreach(g->members, m) {
+        if (!reuseport_eligible(m))
+            continue;
+        eligible++;
+        if (m->incoming_cpu == cpu)
+            local++;
+    }
+    if (eligible == 0)
+        return 0;
+    int index = hash % (local ? local : eligible);
+    vector_foreach(g->members, m) {
+        if (!reuseport_eligible(m) || (local && (m->incoming_cpu != cpu)))
+            continue;
+        if (index-- == 0)
+            return m;
+    }
+    return 0;
+}
+
+/* Returns the group of a socket with a reference held, or 0. */
+static reuseport_group reuseport_get(netsock s)
+{
+    netsock_lock(s);
+    reuseport_group g = s->rp_group;
+    if (g)
+        refcount_reserve(&g->refcount);
+    netsock_unlock(s);
+    return g;
+}
+
+static void reuseport_put(reuseport_group g)
+{
+    if (refcount_release(&g->refcount)) {
+        deallocate_vector(g->members);
+        deallocate(reuseport_heap, g, sizeof(*g));
+    }
+}
+
+/* Releases the lock and the reference of a group obtained with reuseport_get(). */
+static void reuseport_unlock(reuseport_group g)
+{
+    spin_unlock(&g->lock);
+    reuseport_put(g);
+}
+
+/* Called with the reuseport lock held. Returns the group that a socket binding to an address and
+ * port joins, 0 if there is none, or INVALID_ADDRESS if the address and port are in use by a group
+ * that the socket cannot join (i.e. a socket without SO_REUSEPORT, or an overlapping address). */
+static reuseport_group reuseport_lookup_locked(netsock s, const ip_addr_t *addr, u16 port)
+{
+    if (port == 0)
+        return 0;
+    list_foreach(&reuseport_groups, l) {
+        reuseport_group g = struct_from_list(l, reuseport_group, l);
+        if ((g->type != s->sock.type) || (g->port != port))
+            continue;
+        if (ip_addr_cmp(&g->addr, addr))
+            return s->reuseport ? g : INVALID_ADDRESS;
+        if (ip_addr_isany(&g->addr) || ip_addr_isany(addr))
+            return INVALID_ADDRESS;
+    }
+    return 0;
+}
+
+/* Called with the reuseport lock held; creates a new group if g is 0. */
+static void reuseport_join_locked(netsock s, reuseport_group g, const ip_addr_t *addr, u16 port)
+{
+    if (!g) {
+        g = allocate(reuseport_heap, sizeof(*g));
+        if (g == INVALID_ADDRESS)
+            return;
+        g->members = allocate_vector(reuseport_heap, 4);
+        if (g->members == INVALID_ADDRESS) {
+            deallocate(reuseport_heap, g, sizeof(*g));
+            return;
+        }
+        g->type = s->sock.type;
+        ip_addr_copy(g->addr, *addr);
+        g->port = port;
+        spin_lock_init(&g->lock);
+        init_refcount(&g->refcount, 0, 0);
+        g->listener = 0;
+        list_push_back(&reuseport_groups, &g->l);
+    }
+    spin_lock(&g->lock);
+    vector_push(g->members, s);
+    refcount_reserve(&g->refcount);
+    netsock_lock(s);
+    s->rp_group = g;
+    netsock_unlock(s);
+    spin_unlock(&g->lock);
+}
+
+/* Returns true if the socket was sharing the group listen PCB with other members, in which case
+ * the PCB must be left open. */
+static boolean reuseport_leave(netsock s)
+{
+    reuseport_group g = s->rp_group;
+    boolean shared = false;
+    netsock m;
+    spin_lock(&reuseport_lock);
+    spin_lock(&g->lock);
+    vector_foreach(g->members, m) {
+        if (m == s) {
+            vector_delete(g->members, _i);
+            break;
+        }
+    }
+    netsock_lock(s);
+    s->rp_group = 0;
+    netsock_unlock(s);
+    if ((s->sock.type == SOCK_STREAM) && g->listener && (s->info.tcp.lw == g->listener)) {
+        vector_foreach(g->members, m) {
+            if (m->info.tcp.lw == g->listener) {
+                /* hand over the lwIP callbacks to a remaining listener */
+                tcp_arg(g->listener, m);
+                shared = true;
+                break;
+            }
+        }
+        if (!shared)
+            g->listener = 0;
+    }
+    /* lwIP callbacks that hold a reference see an empty group */
+    if (vector_length(g->members) == 0)
+        list_delete(&g->l);
+    spin_unlock(&g->lock);
+    spin_unlock(&reuseport_lock);
+    reuseport_put(g);
+    return shared;
+}
+
+/* lwIP allows multiple PCBs to be bound to the same address and port if all of them have the
+ * SOF_REUSEADDR option set. For a socket with SO_REUSEPORT, the option is set only while joining
+ * an existing group, and cleared while creating a group, so that the group cannot share its port
+ * with sockets outside the group; after a successful bind, the option is set so that later members
+ * can join. */
+#define reuseport_bind_begin(s, pcb, g) do {                \
+        if ((s)->reuseport) {                               \
+            if (g)                                          \
+                ip_set_option(pcb, SOF_REUSEADDR);          \
+            else                                            \
+                ip_reset_option(pcb, SOF_REUSEADDR);        \
+        }                                                   \
+    } while (0)
+
+#define reuseport_bind_end(s, pcb, err, reuseaddr) do {     \
+        if ((s)->reuseport) {                               \
+            if (((err) == ERR_OK) || (reuseaddr))           \
+                ip_set_option(pcb, SOF_REUSEADDR);          \
+            else                                            \
+                ip_reset_option(pcb, SOF_REUSEADDR);        \
+        }                                                   \
+    } while (0)
+
 static inline s64 lwip_to_errno(s8 err)
 {
     switch (err) {
@@ -423,8 +816,33 @@ struct udp_entry {
     struct pbuf * pbuf;
     ip_addr_t raddr;
     u16 rport;
+    u16 gso_size;   /* size of coalesced segments (all except the last one) */
+    u16 segs;       /* number of coalesced datagrams */
 };
 
+/* Maximum number of datagrams that can be sent or received with a single UDP GSO/GRO buffer */
+#define UDP_MAX_SEGMENTS    64
+
+/* Maximum payload size of a UDP GSO/GRO buffer */
+#define UDP_GSO_MAX_SIZE    (0xffff - UDP_HLEN)
+
+/* Appends a control message to the ancillary data of a received message; must be called with an
+ * error context set. */
+static void put_cmsg(struct msghdr *msg, u64 controllen, int level, int type, void *data, u64 len)
+{
+    u64 offset = msg->msg_controllen;
+    if (offset + CMSG_LEN(len) > controllen) {
+        msg->msg_flags |= MSG_CTRUNC;
+        return;
+    }
+    struct cmsghdr *cmsg = msg->msg_control + offset;
+    cmsg->cmsg_len = CMSG_LEN(len);
+    cmsg->cmsg_level = level;
+    cmsg->cmsg_type = type;
+    runtime_memcpy(CMSG_DATA(cmsg), data, len);
+    msg->msg_controllen = MIN(offset + CMSG_SPACE(len), controllen);
+}
+
 static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
                                        io_completion completion, u64 bqflags)
 {
@@ -475,6 +893,7 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
             goto out_unlock;
         }
         netsock_unlock(s);
+        netsock_busy_poll_arm(s);
         return blockq_block_required((unix_context)ctx, bqflags);
     }
 
@@ -483,6 +902,7 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
         rv = -EFAULT;
         goto rx_done;
     }
+    u64 controllen = msg->msg_controllen;
     msg->msg_controllen = 0;
     msg->msg_flags = 0;
     sockaddr src_addr = msg->msg_name;
@@ -510,6 +930,18 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
             ((struct udp_entry *)p)->pbuf;
         struct pbuf *cur_buf = pbuf;
 
+        if (s->sock.type == SOCK_DGRAM) {
+            struct udp_entry *e = p;
+
+            /* once seen by the application, a datagram cannot be extended by GRO */
+            if (e == s->info.udp.gro_tail)
+                s->info.udp.gro_tail = 0;
+            if (e->segs > 1) {
+                int gso_size = e->gso_size;
+                put_cmsg(msg, controllen, SOL_UDP, UDP_GRO, &gso_size, sizeof(gso_size));
+            }
+        }
+
         while ((length > 0) && cur_buf) {
             if (cur_buf->len > 0) {
                 u64 xfer = MIN(iov->iov_len - iov_offset, cur_buf->len);
@@ -568,7 +1000,8 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
     if (tcp_lw) {
         if (rv > 0) {
             tcp_lock(tcp_lw);
-            tcp_recved(tcp_lw, rv);
+            netsock_tcp_rcvbuf_autotune(s, tcp_lw, rv);
+            netsock_tcp_rcv_wnd_update(s, tcp_lw, rv);
             tcp_unlock(tcp_lw);
         }
         tcp_unref(tcp_lw);
@@ -685,13 +1118,13 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
        bits here (and tcp_write() doesn't accept more than 2^16
        anyway), so even if we have a large transmit window due to
        LWIP_WND_SCALE, we still can't write more than 2^16. Sigh... */
-    u64 avail = tcp_sndbuf(tcp_lw);
+    u64 avail = netsock_tcp_sndbuf(s, tcp_lw);
     if (avail == 0) {
         /* directly poll for loopback traffic in case the enqueued netsock_poll is backed up */
         tcp_unlock(tcp_lw);
         netif_poll_loopback();
         tcp_lock(tcp_lw);
-        avail = tcp_sndbuf(tcp_lw);
+        avail = netsock_tcp_sndbuf(s, tcp_lw);
         if (avail == 0) {
           full:
             tcp_unlock(tcp_lw);
@@ -744,7 +1177,7 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         if (err == ERR_OK) {
             buf_offset += n;
             rv += n;
-            if ((avail = tcp_sndbuf(tcp_lw)) == 0)
+            if ((avail = netsock_tcp_sndbuf(s, tcp_lw)) == 0)
                 break;
             if (!iov)
                 remain -= n;
@@ -768,6 +1201,7 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         err = tcp_output(tcp_lw);
         if (err == ERR_OK) {
             net_debug(" tcp_write and tcp_output successful for %ld bytes\n", rv);
+            tcp_cc_sent(&s->info.tcp.cc, tcp_lw);
             netsock_check_loop();
             if (avail == 0)
                 fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLOUT condition */
@@ -789,8 +1223,29 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
     return rv;
 }
 
+/* Copies data from an I/O vector, starting at (and advancing) the position given by an iovec
+ * pointer and an offset within the iovec. */
+static void iov_copy_advance(void *dest, struct iovec **iov, u64 *iov_offset, u64 len)
+{
+    while (len > 0) {
+        struct iovec *v = *iov;
+        u64 xfer = MIN(v->iov_len - *iov_offset, len);
+        runtime_memcpy(dest, v->iov_base + *iov_offset, xfer);
+        dest += xfer;
+        len -= xfer;
+        *iov_offset += xfer;
+        if (*iov_offset == v->iov_len) {
+            (*iov)++;
+            *iov_offset = 0;
+        }
+    }
+}
+
+/* If gso_size is non-zero and smaller than the data length, the data is sent as a train of
+ * datagrams of gso_size bytes (the last one may be shorter), i.e. segmentation is done in the
+ * stack with a single pass through the socket. */
 static sysreturn socket_write_udp(netsock s, void *source, struct iovec *iov, u64 length,
-                                  struct sockaddr *dest_addr, socklen_t addrlen)
+                                  struct sockaddr *dest_addr, socklen_t addrlen, u16 gso_size)
 {
     ip_addr_t ipaddr;
     u16 port = 0;
@@ -804,7 +1259,13 @@ static sysreturn socket_write_udp(netsock s, void *source, struct iovec *iov, u6
         if (ret)
             return ret;
     }
-    err_t err = ERR_OK;
+    u64 xfer_len = source ? length : iov_total_len(iov, length);
+    u64 seg_len = xfer_len;
+    if (gso_size && (xfer_len > gso_size)) {
+        if ((xfer_len > UDP_GSO_MAX_SIZE) || (xfer_len > gso_size * UDP_MAX_SEGMENTS))
+            return -EINVAL;
+        seg_len = gso_size;
+    }
 
     /* XXX check how much we can queue, maybe make udp bh */
     netsock_lock(s);
@@ -813,35 +1274,43 @@ static sysreturn socket_write_udp(netsock s, void *source, struct iovec *iov, u6
         return -EDESTADDRREQ;
     }
 
-    u64 xfer_len = source ? length : iov_total_len(iov, length);
-    struct pbuf *pbuf = pbuf_alloc(PBUF_TRANSPORT, xfer_len, PBUF_RAM);
-    if (!pbuf) {
-        netsock_unlock(s);
-        msg_err("failed to allocate pbuf for udp_send()\n");
-        return -ENOBUFS;
-    }
-    if (context_set_err(ctx)) {
-        netsock_unlock(s);
+    sysreturn rv = xfer_len;
+    u64 offset = 0;
+    u64 iov_offset = 0;
+    do {
+        u64 len = MIN(seg_len, xfer_len - offset);
+        struct pbuf *pbuf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+        if (!pbuf) {
+            msg_err("failed to allocate pbuf for udp_send()\n");
+            rv = -ENOBUFS;
+            break;
+        }
+        if (context_set_err(ctx)) {
+            netsock_unlock(s);
+            pbuf_free(pbuf);
+            return -EFAULT;
+        }
+        if (source)
+            runtime_memcpy(pbuf->payload, source + offset, len);
+        else
+            iov_copy_advance(pbuf->payload, &iov, &iov_offset, len);
+        context_clear_err(ctx);
+        err_t err;
+        if (dest_addr)
+            err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
+        else
+            err = udp_send(s->info.udp.lw, pbuf);
         pbuf_free(pbuf);
-        return -EFAULT;
-    }
-    if (source)
-        runtime_memcpy(pbuf->payload, source, length);
-    else
-        iov_to_buf(pbuf->payload, iov, length);
-    context_clear_err(ctx);
-    if (dest_addr)
-        err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
-    else
-        err = udp_send(s->info.udp.lw, pbuf);
+        if (err != ERR_OK) {
+            net_debug("lwip error %d\n", err);
+            rv = lwip_to_errno(err);
+            break;
+        }
+        offset += len;
+    } while (offset < xfer_len);
     netsock_unlock(s);
-    pbuf_free(pbuf);
-    if (err != ERR_OK) {
-        net_debug("lwip error %d\n", err);
-        return lwip_to_errno(err);
-    }
     netsock_check_loop();
-    return xfer_len;
+    return rv;
 }
 
 static sysreturn socket_write_internal(struct sock *sock, void *source, struct iovec *iov,
@@ -866,7 +1335,7 @@ static sysreturn socket_write_internal(struct sock *sock, void *source, struct i
                                                 flags, completion);
         return blockq_check(sock->txbq, ba, bh);
     } else if (sock->type == SOCK_DGRAM) {
-        rv = socket_write_udp(s, source, iov, length, dest_addr, addrlen);
+        rv = socket_write_udp(s, source, iov, length, dest_addr, addrlen, s->info.udp.gso_size);
     } else {
 	msg_err("socket type %d unsupported\n", sock->type);
 	rv = -EINVAL;
@@ -1160,13 +1629,24 @@ closure_func_basic(fdesc_close, sysreturn, socket_close,
          * argument to NULL. */
         tcp_lw = netsock_tcp_get(s);
         if (tcp_lw) {
-            netsock_tcp_close(s, tcp_lw);
+            if (s->rp_group && reuseport_leave(s)) {
+                /* the listen PCB is still in use by other members of the group */
+                netsock_lock(s);
+                s->info.tcp.state = TCP_SOCK_UNDEFINED;
+                netsock_unlock(s);
+            } else {
+                netsock_tcp_close(s, tcp_lw);
+            }
             netsock_tcp_put(tcp_lw);
             tcp_unref(tcp_lw);
             netsock_check_loop();
+        } else if (s->rp_group) {
+            reuseport_leave(s);
         }
         break;
     case SOCK_DGRAM:
+        if (s->rp_group)
+            reuseport_leave(s);
         udp_remove(s->info.udp.lw);
         break;
     }
@@ -1271,6 +1751,22 @@ sysreturn shutdown(int sockfd, int how)
     return s->shutdown(s, how);
 }
 
+/* Coalesces a received datagram into the last queued datagram of a UDP_GRO socket, if they belong
+ * to the same flow and the queued datagram is a train of same-sized segments that the new one can
+ * extend (a shorter segment terminates the train). Called with the socket lock held. */
+static boolean udp_gro_receive(netsock s, struct udp_entry *e, struct pbuf *p,
+                               const ip_addr_t *raddr, u16 rport)
+{
+    struct pbuf *head = e->pbuf;
+    if ((e->rport != rport) || !ip_addr_cmp(&e->raddr, raddr) || (p->tot_len == 0) ||
+        (p->tot_len > e->gso_size) || (head->tot_len + p->tot_len > UDP_GSO_MAX_SIZE))
+        return false;
+    pbuf_cat(head, p);
+    if ((++e->segs == UDP_MAX_SEGMENTS) || (p->tot_len < e->gso_size))
+        s->info.udp.gro_tail = 0;
+    return true;
+}
+
 static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
                             struct ip_globals *ip_data, u16 port)
 {
@@ -1282,21 +1778,51 @@ static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
 	      s->sock.fd, pcb, p, n[0], n[1], n[2], n[3], port);
     assert(pcb == s->info.udp.lw);
     if (p) {
+        reuseport_group g = reuseport_get(s);
+        if (g) {
+            spin_lock(&g->lock);
+            if (!(pcb->flags & UDP_FLAGS_CONNECTED)) {
+                netsock m = reuseport_select(g, reuseport_hash(&ip_data->current_iphdr_src, port,
+                                                               pcb->local_port));
+                if (m)
+                    s = m;
+            }
+        }
 	netsock_lock(s);
-	if ((s->sock.rx_len + p->tot_len > so_rcvbuf) || queue_full(s->incoming)) {
+	if (s->sock.rx_len + p->tot_len > s->info.udp.rcvbuf)
+	    goto drop;
+	struct udp_entry * e = s->info.udp.gro_tail;
+	if (e && udp_gro_receive(s, e, p, &ip_data->current_iphdr_src, port)) {
+	    /* the socket has already been notified of the queued datagram */
+	    s->sock.rx_len += p->tot_len;
 	    netsock_unlock(s);
-	    pbuf_free(p);
+	    if (g)
+	        reuseport_unlock(g);
 	    return;
 	}
+	if (queue_full(s->incoming))
+	    goto drop;
 	/* could make a cache if we care to */
-	struct udp_entry * e = allocate(s->sock.h, sizeof(*e));
+	e = allocate(s->sock.h, sizeof(*e));
 	assert(e != INVALID_ADDRESS);
 	e->pbuf = p;
 	runtime_memcpy(&e->raddr, &ip_data->current_iphdr_src, sizeof(ip_addr_t));
 	e->rport = port;
+	e->gso_size = p->tot_len;
+	e->segs = 1;
 	assert(enqueue(s->incoming, e));
 	s->sock.rx_len += p->tot_len;
+	if (s->info.udp.gro)
+	    s->info.udp.gro_tail = (p->tot_len > 0) ? e : 0;
 	wakeup_sock(s, WAKEUP_SOCK_RX);
+	if (g)
+	    reuseport_unlock(g);
+	return;
+      drop:
+	netsock_unlock(s);
+	if (g)
+	    reuseport_unlock(g);
+	pbuf_free(p);
     } else {
 	msg_err("null pbuf\n");
     }
@@ -1343,6 +1869,10 @@ static int allocate_sock(process p, int af, int type, u32 flags, boolean alloc_f
     s->sock.recvmsg = netsock_recvmsg;
     s->sock.shutdown = netsock_shutdown;
     s->ipv6only = 0;
+    s->reuseport = 0;
+    s->busy_poll = net_busy_read;
+    s->incoming_cpu = -1;
+    s->rp_group = 0;
     set_lwip_error(s, ERR_OK);
     if (alloc_fd) {
         fd = s->sock.fd = allocate_fd(p, s);
@@ -1372,6 +1902,8 @@ static int allocate_tcp_sock(process p, int af, struct tcp_pcb *pcb, u32 flags)
 	s->info.tcp.lw = pcb;
 	s->info.tcp.flags = pcb->flags & SOCK_TCP_CFG_FLAGS;
 	s->info.tcp.state = TCP_SOCK_CREATED;
+	tcp_cc_init(&s->info.tcp.cc, tcp_cc_default);
+	netsock_tcp_buf_init(s, 0);
 	tcp_ref(pcb);
     }
     return fd;
@@ -1384,6 +1916,11 @@ static int allocate_udp_sock(process p, int af, struct udp_pcb *pcb, u32 flags)
     if (fd >= 0) {
         s->info.udp.lw = pcb;
         s->info.udp.state = UDP_SOCK_CREATED;
+        s->info.udp.gso_size = 0;
+        s->info.udp.gro = 0;
+        s->info.udp.gro_tail = 0;
+        s->info.udp.rcvbuf = so_rcvbuf;
+        s->info.udp.sndbuf = DEFAULT_SO_SNDBUF;
         udp_recv(pcb, udp_input_lower, s);
     }
     return fd;
@@ -1465,10 +2002,13 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
         msg_err("Unexpected error from lwIP: %d\n", err);
     }
 
+    if (p)
+        netsock_tcp_rcv_rtt_measure(s, pcb);
+
     /* A null pbuf indicates connection closed. */
     netsock_lock(s);
     if (p) {
-        if ((s->sock.rx_len + p->tot_len > so_rcvbuf) || !enqueue(s->incoming, p)) {
+        if ((s->sock.rx_len + p->tot_len > TCP_WND) || !enqueue(s->incoming, p)) {
 	    netsock_unlock(s);
 	    msg_err("incoming queue full\n");
             return ERR_BUF;     /* XXX verify */
@@ -1501,6 +2041,15 @@ static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         /* Allow receiving both IPv4 and IPv6 packets (dual-stack support). */
         IP_SET_TYPE(&ipaddr, IPADDR_TYPE_ANY);
     err_t err;
+    boolean reuseaddr;
+    /* binding to the address and port of a group is serialized with the updates of the group */
+    spin_lock(&reuseport_lock);
+    reuseport_group g = reuseport_lookup_locked(s, &ipaddr, port);
+    if (g == INVALID_ADDRESS) {
+        spin_unlock(&reuseport_lock);
+        ret = -EADDRINUSE;
+        goto out;
+    }
     netsock_lock(s);
     if (sock->type == SOCK_STREAM) {
 	if (!s->info.tcp.lw || (s->info.tcp.lw->local_port != 0)) {
@@ -1508,14 +2057,28 @@ static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
 	    goto unlock_out;
 	}
 	net_debug("calling tcp_bind, pcb %p, port %d\n", s->info.tcp.lw, port);
+	reuseaddr = !!ip_get_option(s->info.tcp.lw, SOF_REUSEADDR);
+	reuseport_bind_begin(s, s->info.tcp.lw, g);
 	err = tcp_bind(s->info.tcp.lw, &ipaddr, port);
+	reuseport_bind_end(s, s->info.tcp.lw, err, reuseaddr);
+	if (err == ERR_OK) {
+	    ip_addr_copy(ipaddr, s->info.tcp.lw->local_ip);
+	    port = s->info.tcp.lw->local_port;
+	}
     } else if (sock->type == SOCK_DGRAM) {
         if (s->info.udp.lw->local_port != 0) {
             ret = -EINVAL; /* already bound */
             goto unlock_out;
         }
         net_debug("calling udp_bind, pcb %p, port %d\n", s->info.udp.lw, port);
+        reuseaddr = !!ip_get_option(s->info.udp.lw, SOF_REUSEADDR);
+        reuseport_bind_begin(s, s->info.udp.lw, g);
         err = udp_bind(s->info.udp.lw, &ipaddr, port);
+        reuseport_bind_end(s, s->info.udp.lw, err, reuseaddr);
+        if (err == ERR_OK) {
+            ip_addr_copy(ipaddr, s->info.udp.lw->local_ip);
+            port = s->info.udp.lw->local_port;
+        }
     } else {
         msg_warn("unsupported socket type %d\n", s->sock.type);
         ret = -EINVAL;
@@ -1524,6 +2087,9 @@ static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
     ret = lwip_to_errno(err);
   unlock_out:
     netsock_unlock(s);
+    if ((ret == 0) && s->reuseport)
+        reuseport_join_locked(s, g, &ipaddr, port);
+    spin_unlock(&reuseport_lock);
   out:
     socket_release(sock);
     return ret;
@@ -1561,6 +2127,8 @@ static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
     }
     netsock s = (netsock)arg;
     net_debug("fd %d, pcb %p, len %d\n", s->sock.fd, pcb, len);
+    tcp_cc_acked(&s->info.tcp.cc, pcb, len);
+    netsock_tcp_sndbuf_autotune(s, pcb);
     netsock_lock(s);
     wakeup_sock(s, WAKEUP_SOCK_TX);
     return ERR_OK;
@@ -1639,6 +2207,7 @@ static err_t connect_tcp_complete(void* arg, struct tcp_pcb* tpcb, err_t err)
    }
    assert(s->info.tcp.state == TCP_SOCK_IN_CONNECTION);
    s->info.tcp.state = TCP_SOCK_OPEN;
+   netsock_tcp_rcv_wnd_init(s, tpcb);
    set_lwip_error(s, err);
    wakeup_sock(s, WAKEUP_SOCK_TX);
    return ERR_OK;
@@ -1793,12 +2362,45 @@ sysreturn sendto(int sockfd, void *buf, u64 len, int flags,
     return sock->sendto(sock, buf, len, flags, dest_addr, addrlen);
 }
 
+/* Retrieves the segment size of a UDP_SEGMENT control message, if any. */
+static sysreturn udp_sendmsg_gso_size(const struct msghdr *msg, u16 *gso_size)
+{
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    sysreturn rv = 0;
+    for (struct cmsghdr *cmsg = cmsg_first(msg); cmsg; cmsg = cmsg_next(msg, cmsg)) {
+        if (cmsg->cmsg_len < sizeof(struct cmsghdr)) {
+            rv = -EINVAL;
+            break;
+        }
+        if ((cmsg->cmsg_level != SOL_UDP) || (cmsg->cmsg_type != UDP_SEGMENT))
+            continue;
+        if (cmsg->cmsg_len != CMSG_LEN(sizeof(u16))) {
+            rv = -EINVAL;
+            break;
+        }
+        *gso_size = *(u16 *)CMSG_DATA(cmsg);
+    }
+    context_clear_err(ctx);
+    return rv;
+}
+
 static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg, int flags,
                                  boolean in_bh, io_completion completion)
 {
     sysreturn rv = sendto_prepare(s, flags);
     if (rv < 0)
         goto out;
+    if (s->type == SOCK_DGRAM) {
+        netsock ns = (netsock)s;
+        u16 gso_size = ns->info.udp.gso_size;
+        rv = udp_sendmsg_gso_size(msg, &gso_size);
+        if (rv == 0)
+            rv = socket_write_udp(ns, 0, msg->msg_iov, msg->msg_iovlen, msg->msg_name,
+                                  msg->msg_namelen, gso_size);
+        goto out;
+    }
     return socket_write_internal(s, 0, msg->msg_iov, msg->msg_iovlen, flags,
                                  msg->msg_name, msg->msg_namelen,
                                  get_current_context(current_cpu()), in_bh, completion);
@@ -1898,6 +2500,7 @@ static sysreturn netsock_recvfrom(struct sock *sock, void *buf, u64 len,
         goto out;
     }
 
+    s->incoming_cpu = current_cpu()->id;
     blockq_action ba = contextual_closure(sock_read_bh, s, buf, len, flags,
                                           src_addr, addrlen, (io_completion)&sock->f.io_complete);
     return blockq_check(sock->rxbq, ba, false);
@@ -1936,6 +2539,8 @@ static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
         rv = (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : -ENOTCONN;
         goto out;
     }
+    if (!in_bh)
+        s->incoming_cpu = current_cpu()->id;
     blockq_action ba = contextual_closure(recvmsg_bh, s, msg, flags, completion);
     return blockq_check(sock->rxbq, ba, in_bh);
   out:
@@ -2029,12 +2634,22 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
         return ERR_CLSD;
     }
     netsock s = z;
+    reuseport_group g = reuseport_get(s);
+    if (g) {
+        spin_lock(&g->lock);
+        if (lw) {
+            netsock m = reuseport_select(g, reuseport_hash(&lw->remote_ip, lw->remote_port,
+                                                           lw->local_port));
+            if (m)
+                s = m;
+        }
+    }
     netsock_lock(s);
 
     if (err == ERR_MEM) {
         set_lwip_error(s, err);
         wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
-        return err;               /* lwIP doesn't care */
+        goto out;               /* lwIP doesn't care */
     }
 
     netsock sn;
@@ -2048,6 +2663,9 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     sn->info.tcp.lw = lw;
     tcp_ref(lw);
     sn->info.tcp.state = TCP_SOCK_OPEN;
+    tcp_cc_init(&sn->info.tcp.cc, s->info.tcp.cc.ops);
+    netsock_tcp_buf_init(sn, s);
+    netsock_tcp_rcv_wnd_init(sn, lw);
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, sn);
     tcp_recv(lw, tcp_input_lower);
@@ -2063,16 +2681,23 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     tcp_backlog_delayed(lw);
 
     wakeup_sock(s, WAKEUP_SOCK_RX);
-    return ERR_OK;
+    err = ERR_OK;
+    goto out;
   unlock_out:
     netsock_unlock(s);
+  out:
+    if (g)
+        reuseport_unlock(g);
     return err;
 }
 
 static sysreturn netsock_listen(struct sock *sock, int backlog)
 {
     netsock s = (netsock) sock;
+    reuseport_group g = s->rp_group;
     sysreturn rv;
+    if (g)
+        spin_lock(&g->lock);
     netsock_lock(s);
     backlog = MIN(backlog, SOCK_QUEUE_LEN);
     if (s->sock.type != SOCK_STREAM) {
@@ -2088,17 +2713,30 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
         }
         goto unlock_out;
     }
-    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
+    struct tcp_pcb * lw;
+    if (g && g->listener) {
+        /* lwIP allows a single listen PCB for a given address and port: share the PCB of the
+         * group, whose accept callback distributes new connections among the members. */
+        lw = g->listener;
+        tcp_close(s->info.tcp.lw);
+        tcp_backlog_set(lw, backlog);
+    } else {
+        lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
+        if (g)
+            g->listener = lw;
+        tcp_arg(lw, s);
+        tcp_accept(lw, accept_tcp_from_lwip);
+    }
     tcp_unref(s->info.tcp.lw);
     tcp_ref(lw);
     s->info.tcp.lw = lw;
     s->info.tcp.state = TCP_SOCK_LISTENING;
     set_lwip_error(s, ERR_OK);
-    tcp_arg(lw, s);
-    tcp_accept(lw, accept_tcp_from_lwip);
     rv = 0;
   unlock_out:
     netsock_unlock(s);
+    if (g)
+        spin_unlock(&g->lock);
     socket_release(sock);
     return rv;
 }
@@ -2144,6 +2782,7 @@ closure_function(5, 1, sysreturn, accept_bh,
             rv = -EAGAIN;
             goto out;
         }
+        netsock_busy_poll_arm(s);
         return blockq_block_required((unix_context)ctx, bqflags);   /* block */
     }
 
@@ -2224,6 +2863,7 @@ static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
         goto out;
     }
 
+    s->incoming_cpu = current_cpu()->id;
     blockq_action ba = contextual_closure(accept_bh, s, current, addr, addrlen, flags);
     return blockq_check(sock->rxbq, ba, false);
   out:
@@ -2383,7 +3023,69 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
             }
             break;
         case SO_REUSEPORT:
-            goto unimplemented;
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->reuseport = !!int_optval;
+            netsock_unlock(s);
+            break;
+        case SO_INCOMING_CPU:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if ((int_optval < 0) || ((u64)int_optval >= total_processors)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->incoming_cpu = int_optval;
+            break;
+        case SO_BUSY_POLL:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if (int_optval < 0) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->busy_poll = int_optval;
+            break;
+        case SO_SNDBUF:
+        case SO_RCVBUF: {
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+
+            /* As in Linux, the requested size is doubled to account for bookkeeping overhead, and
+             * the doubled value is reported by getsockopt(). */
+            u32 *mem = (optname == SO_RCVBUF) ? tcp_rmem : tcp_wmem;
+            u64 size = (int_optval > 0) ? 2 * (u64)int_optval : 0;
+            size = MIN(MAX(size, mem[TCP_MEM_MIN]), mem[TCP_MEM_MAX]);
+            if (s->sock.type == SOCK_DGRAM) {
+                netsock_lock(s);
+                if (optname == SO_RCVBUF)
+                    s->info.udp.rcvbuf = size;
+                else
+                    s->info.udp.sndbuf = size;
+                netsock_unlock(s);
+                break;
+            }
+            struct tcp_pcb *tcp_lw = netsock_tcp_get(s);
+            if (!tcp_lw) {
+                rv = -EINVAL;
+                goto out;
+            }
+            if (optname == SO_RCVBUF) {
+                s->info.tcp.rcvbuf = size;
+                s->info.tcp.rcvbuf_lock = 1;
+                netsock_tcp_rcv_wnd_update(s, tcp_lw, 0);
+            } else {
+                s->info.tcp.sndbuf = size;
+                s->info.tcp.sndbuf_lock = 1;
+            }
+            netsock_tcp_put(tcp_lw);
+            break;
+        }
         default:
             goto unimplemented;
         }
@@ -2418,6 +3120,61 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
                 netsock_unlock(s);
             }
             break;
+        case TCP_CONGESTION: {
+            if ((s->sock.type != SOCK_STREAM)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            char name[TCP_CA_NAME_MAX];
+            if (optlen > sizeof(name))
+                optlen = sizeof(name);
+            if (!copy_from_user(optval, name, optlen)) {
+                rv = -EFAULT;
+                goto out;
+            }
+            tcp_cc_ops ops = tcp_cc_find(sstring_from_cstring(name, optlen));
+            if (!ops) {
+                rv = -ENOENT;
+                goto out;
+            }
+            struct tcp_pcb *tcp_lw = netsock_tcp_get(s);
+            if (!tcp_lw) {
+                rv = -EINVAL;
+                goto out;
+            }
+            tcp_cc_init(&s->info.tcp.cc, ops);
+            netsock_tcp_put(tcp_lw);
+            break;
+        }
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM) {
+            rv = -ENOPROTOOPT;
+            goto out;
+        }
+        switch (optname) {
+        case UDP_SEGMENT:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if ((int_optval < 0) || (int_optval > UDP_GSO_MAX_SIZE)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->info.udp.gso_size = int_optval;
+            break;
+        case UDP_GRO:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->info.udp.gro = !!int_optval;
+            s->info.udp.gro_tail = 0;
+            netsock_unlock(s);
+            break;
         default:
             goto unimplemented;
         }
@@ -2510,11 +3267,19 @@ static void netsock_get_tcpinfo(netsock s, struct tcp_info *info)
 #endif
     info->tcpi_retrans = lw->nrtx;
     info->tcpi_rcv_ssthresh = info->tcpi_snd_ssthresh = lw->ssthresh;
-    info->tcpi_rtt = info->tcpi_rcv_rtt = info->tcpi_min_rtt =
-            lw->rttest * TCP_SLOW_INTERVAL * 1000;  /* microseconds */
+    struct tcp_cc *cc = &s->info.tcp.cc;
+    if (cc->srtt) {
+        info->tcpi_rtt = info->tcpi_rcv_rtt = cc->srtt;
+        info->tcpi_min_rtt = cc->min_rtt;
+    } else {
+        info->tcpi_rtt = info->tcpi_rcv_rtt = info->tcpi_min_rtt =
+                lw->rttest * TCP_SLOW_INTERVAL * 1000;  /* microseconds */
+    }
+    if (s->info.tcp.rcv_rtt)
+        info->tcpi_rcv_rtt = usec_from_timestamp(s->info.tcp.rcv_rtt);
     info->tcpi_snd_cwnd = lw->cwnd;
     info->tcpi_advmss = lw->mss;
-    info->tcpi_rcv_space = so_rcvbuf - s->sock.rx_len;
+    info->tcpi_rcv_space = s->info.tcp.rcvbuf - MIN(s->sock.rx_len, s->info.tcp.rcvbuf);
     info->tcpi_notsent_bytes = lw->snd_lbb - lw->snd_nxt;
     struct tcp_seg *ooo = lw->ooseq;
     while (ooo) {
@@ -2552,10 +3317,12 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             ret_optval.val = -lwip_to_errno(get_and_clear_lwip_error(s));
             break;
         case SO_SNDBUF:
-            ret_optval.val = (s->sock.type == SOCK_STREAM) ? TCP_SND_BUF : 0;
+            ret_optval.val = (s->sock.type == SOCK_STREAM) ? s->info.tcp.sndbuf :
+                                                             s->info.udp.sndbuf;
             break;
         case SO_RCVBUF:
-            ret_optval.val = so_rcvbuf;
+            ret_optval.val = (s->sock.type == SOCK_STREAM) ? s->info.tcp.rcvbuf :
+                                                             s->info.udp.rcvbuf;
             break;
         case SO_PRIORITY:
             ret_optval.val = 0; /* default value in Linux */
@@ -2587,7 +3354,13 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             break;
         }
         case SO_REUSEPORT:
-            ret_optval.val = 0;
+            ret_optval.val = s->reuseport;
+            break;
+        case SO_INCOMING_CPU:
+            ret_optval.val = s->incoming_cpu;
+            break;
+        case SO_BUSY_POLL:
+            ret_optval.val = s->busy_poll;
             break;
         case SO_PROTOCOL:
             ret_optval.val = s->sock.type == SOCK_STREAM ? IP_PROTO_TCP : IP_PROTO_UDP;
@@ -2636,7 +3409,8 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             break;
         case TCP_CONGESTION:
             zero(ret_optval.str, sizeof(ret_optval.str));
-            runtime_memcpy(ret_optval.str, TCP_CONG_CTRL_ALGO, sizeof(TCP_CONG_CTRL_ALGO));
+            sstring algo = s->info.tcp.cc.ops->name;
+            runtime_memcpy(ret_optval.str, algo.ptr, algo.len);
             ret_optlen = sizeof(ret_optval.str);
             break;
         case TCP_CORK:
@@ -2649,6 +3423,22 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             goto unimplemented;
         }
         break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM) {
+            rv = -EOPNOTSUPP;
+            goto out;
+        }
+        switch (optname) {
+        case UDP_SEGMENT:
+            ret_optval.val = s->info.udp.gso_size;
+            break;
+        case UDP_GRO:
+            ret_optval.val = s->info.udp.gro;
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
     case IPPROTO_IPV6:
         switch (optname) {
         case IPV6_V6ONLY:
@@ -2714,6 +3504,27 @@ void register_net_syscalls(struct syscall *map)
     register_syscall(map, shutdown, shutdown);
 }
 
+/* Parses a (min default max) array of buffer sizes; the maximum cannot be raised beyond the
+ * compile-time lwIP limits. */
+static void tcp_mem_cfg(tuple cfg, symbol name, u32 *mem)
+{
+    value v = get(cfg, name);
+    if (!v)
+        return;
+    u64 val[3];
+    for (int i = 0; i < 3; i++) {
+        if (!is_composite(v) || !get_u64(v, integer_key(i), &val[i]))
+            goto invalid;
+    }
+    if ((val[TCP_MEM_MIN] > val[TCP_MEM_DEFAULT]) || (val[TCP_MEM_DEFAULT] > val[TCP_MEM_MAX]))
+        goto invalid;
+    for (int i = 0; i < 3; i++)
+        mem[i] = MIN(val[i], mem[TCP_MEM_MAX]);
+    return;
+  invalid:
+    msg_err("invalid %b value, expected (min default max) array\n", symbol_string(name));
+}
+
 boolean netsyscall_init(unix_heaps uh, tuple cfg)
 {
     u64 rcvbuf;
@@ -2721,6 +3532,21 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
         so_rcvbuf = MIN(MAX(rcvbuf, 256), MASK(sizeof(so_rcvbuf) * 8 - 1));
     else
         so_rcvbuf = DEFAULT_SO_RCVBUF;
+    u64 busy_poll;
+    if (get_u64(cfg, sym(busy_read), &busy_poll))
+        net_busy_read = MIN(busy_poll, U32_MAX);
+    if (get_u64(cfg, sym(busy_poll), &busy_poll))
+        net_busy_poll = MIN(busy_poll, U32_MAX);
+    if (get(cfg, sym(tcp_rmem))) {
+        tcp_mem_cfg(cfg, sym(tcp_rmem), tcp_rmem);
+    } else if (get(cfg, sym(so_rcvbuf))) {
+        /* the configured receive buffer size is the initial size of TCP receive buffers, which
+         * are autotuned from there */
+        tcp_rmem[TCP_MEM_DEFAULT] = MIN(so_rcvbuf, tcp_rmem[TCP_MEM_MAX]);
+        tcp_rmem[TCP_MEM_MIN] = MIN(tcp_rmem[TCP_MEM_MIN], tcp_rmem[TCP_MEM_DEFAULT]);
+    }
+    tcp_mem_cfg(cfg, sym(tcp_wmem), tcp_wmem);
+    init_tcp_cc(cfg);
     kernel_heaps kh = (kernel_heaps)uh;
     heap h = heap_locked(kh);
     caching_heap socket_cache = allocate_objcache(h, (heap)heap_page_backed(kh),
@@ -2728,7 +3554,11 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
     if (socket_cache == INVALID_ADDRESS)
 	return false;
     uh->socket_cache = socket_cache;
+    reuseport_heap = h;
+    list_init(&reuseport_groups);
+    spin_lock_init(&reuseport_lock);
     net_loop_poll = closure(h, netsock_poll);
+    runloop_busy_poll_handler = closure(h, netsock_busy_poll);
     netlink_init();
     vsock_init();
     return true;
@@ -0,0 +1,348 @@
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/priv/tcp_priv.h>
+#include <tcp_cc.h>
+
+//#define TCP_CC_DEBUG
+#ifdef TCP_CC_DEBUG
+#define tcp_cc_debug(x, ...) do {log_printf(ss("TCPCC"), ss("%s: " x), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define tcp_cc_debug(x, ...)
+#endif
+
+BSS_RO_AFTER_INIT tcp_cc_ops tcp_cc_default;
+
+static u64 icbrt(u64 x)
+{
+    u64 r = 0;
+    for (int s = 63; s >= 0; s -= 3) {
+        r <<= 1;
+        u64 b = 3 * r * (r + 1) + 1;
+        if ((x >> s) >= b) {
+            x -= b << s;
+            r++;
+        }
+    }
+    return r;
+}
+
+static u32 tcp_cc_inflight(struct tcp_pcb *pcb)
+{
+    return pcb->snd_nxt - pcb->lastack;
+}
+
+/* Reno: lwIP built-in behavior */
+static const struct tcp_cc_ops reno_ops = {
+    .name = ss_static_init("reno"),
+};
+
+/* CUBIC (RFC 8312), with C = 0.4 and beta = 0.7 */
+
+#define CUBIC_BETA          7   /* tenths */
+#define CUBIC_MAX_T         30000   /* milliseconds */
+#define CUBIC_MAX_K_DIFF    (64 * MB)
+
+static void cubic_init(tcp_cc cc, struct tcp_pcb *pcb)
+{
+    cc->cubic.w_max = 0;
+    cc->cubic.epoch_start = 0;
+}
+
+static void cubic_loss(tcp_cc cc, struct tcp_pcb *pcb, boolean timeout, timestamp t)
+{
+    u32 cwnd = cc->cwnd;
+    u32 mss = pcb->mss;
+
+    /* fast convergence: release bandwidth if the window keeps shrinking */
+    if (cwnd < cc->cubic.w_max)
+        cc->cubic.w_max = cwnd * (10 + CUBIC_BETA) / 20;
+    else
+        cc->cubic.w_max = cwnd;
+    pcb->ssthresh = MAX(cwnd * CUBIC_BETA / 10, 2 * mss);
+    if (!timeout)
+        pcb->cwnd = pcb->ssthresh;
+    cc->cubic.epoch_start = 0;
+    tcp_cc_debug("pcb %p, w_max %d, ssthresh %d, timeout %d\n", pcb, cc->cubic.w_max,
+                 pcb->ssthresh, timeout);
+}
+
+static void cubic_acked(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, timestamp t)
+{
+    u32 mss = pcb->mss;
+    u32 cwnd;
+
+    if (pcb->cwnd < pcb->ssthresh)
+        return; /* slow start is handled by lwIP */
+    cwnd = MAX(cc->cwnd, pcb->ssthresh);
+    if (!cc->cubic.epoch_start) {
+        cc->cubic.epoch_start = t;
+        if (cwnd < cc->cubic.w_max) {
+            /* K = cubic_root((w_max - cwnd) / C), in milliseconds */
+            u64 diff = MIN(cc->cubic.w_max - cwnd, CUBIC_MAX_K_DIFF);
+            cc->cubic.k = icbrt(diff * 2500000000ull / mss);
+        } else {
+            cc->cubic.k = 0;
+            cc->cubic.w_max = cwnd;
+        }
+        cc->cubic.w_est = cwnd;
+    }
+    s64 dt = msec_from_timestamp(t - cc->cubic.epoch_start) + cc->min_rtt / THOUSAND -
+             cc->cubic.k;
+    dt = MIN(MAX(dt, -CUBIC_MAX_T), CUBIC_MAX_T);
+    s64 target = (s64)cc->cubic.w_max + 4 * dt * dt * dt * mss / 10000000000ll;
+    if (target < cwnd)
+        target = cwnd;
+    else
+        target = MIN(target, (s64)cwnd * 3 / 2);
+
+    /* TCP-friendly region: alpha = 3 * (1 - beta) / (1 + beta) segments per RTT */
+    cc->cubic.w_est += (u64)acked * mss * 3 * (10 - CUBIC_BETA) / ((10 + CUBIC_BETA) * cwnd);
+    if (cc->cubic.w_est > target)
+        target = cc->cubic.w_est;
+
+    u32 inc;
+    if (target > cwnd)
+        inc = (u64)(target - cwnd) * acked / cwnd;
+    else
+        inc = (u64)mss * acked / (100 * (u64)cwnd);
+    pcb->cwnd = MIN(cwnd + MAX(inc, 1), TCPWND_MAX);
+}
+
+static const struct tcp_cc_ops cubic_ops = {
+    .name = ss_static_init("cubic"),
+    .init = cubic_init,
+    .acked = cubic_acked,
+    .loss = cubic_loss,
+};
+
+/* BBR: congestion window driven by a model of the bottleneck bandwidth and of the round-trip
+ * propagation time. lwIP does not pace transmissions, so gains are applied to the congestion
+ * window only. */
+
+#define BBR_UNIT                1000
+#define BBR_HIGH_GAIN           2885    /* 2 / ln(2) */
+#define BBR_CWND_GAIN           2000
+#define BBR_BW_WIN_ROUNDS       10
+#define BBR_FULL_BW_THRESH      1250
+#define BBR_FULL_BW_CNT         3
+#define BBR_PROBE_RTT_INTERVAL  seconds(10)
+#define BBR_PROBE_RTT_DURATION  milliseconds(200)
+#define BBR_MIN_CWND_SEGS       4
+#define BBR_CYCLE_LEN           8
+
+static const u32 bbr_cycle_gain[BBR_CYCLE_LEN] = {
+    1250, 750, 1000, 1000, 1000, 1000, 1000, 1000
+};
+
+static void bbr_init(tcp_cc cc, struct tcp_pcb *pcb)
+{
+    zero(&cc->bbr, sizeof(cc->bbr));
+    cc->bbr.mode = BBR_STARTUP;
+}
+
+static u32 bbr_bdp(tcp_cc cc, u32 gain)
+{
+    return cc->bbr.btl_bw * cc->min_rtt / MILLION * gain / BBR_UNIT;
+}
+
+static void bbr_update_round(tcp_cc cc, struct tcp_pcb *pcb, timestamp t)
+{
+    if (cc->bbr.round_start && !TCP_SEQ_GEQ(pcb->lastack, cc->bbr.round_end_seq))
+        return;
+    if (cc->bbr.round_start) {
+        /* delivery rate over the last round trip */
+        timestamp elapsed = t - cc->bbr.round_start;
+        u64 usecs = usec_from_timestamp(elapsed);
+        if (usecs) {
+            u64 bw = (cc->bbr.delivered - cc->bbr.round_delivered) * MILLION / usecs;
+            if ((bw >= cc->bbr.btl_bw) ||
+                (cc->bbr.round_count - cc->bbr.btl_bw_round > BBR_BW_WIN_ROUNDS)) {
+                cc->bbr.btl_bw = bw;
+                cc->bbr.btl_bw_round = cc->bbr.round_count;
+            }
+        }
+        cc->bbr.round_count++;
+        if (cc->bbr.mode == BBR_STARTUP) {
+            if (cc->bbr.btl_bw >= cc->bbr.full_bw * BBR_FULL_BW_THRESH / BBR_UNIT) {
+                cc->bbr.full_bw = cc->bbr.btl_bw;
+                cc->bbr.full_bw_cnt = 0;
+            } else if (++cc->bbr.full_bw_cnt >= BBR_FULL_BW_CNT) {
+                tcp_cc_debug("pcb %p: startup done, bw %ld\n", pcb, cc->bbr.btl_bw);
+                cc->bbr.mode = BBR_DRAIN;
+            }
+        }
+    }
+    cc->bbr.round_start = t;
+    cc->bbr.round_end_seq = pcb->snd_nxt;
+    cc->bbr.round_delivered = cc->bbr.delivered;
+}
+
+static void bbr_update_mode(tcp_cc cc, struct tcp_pcb *pcb, timestamp t)
+{
+    u32 bdp = bbr_bdp(cc, BBR_UNIT);
+    switch (cc->bbr.mode) {
+    case BBR_DRAIN:
+        if (tcp_cc_inflight(pcb) <= bdp) {
+            cc->bbr.mode = BBR_PROBE_BW;
+            cc->bbr.cycle_idx = 0;
+            cc->bbr.cycle_stamp = t;
+        }
+        break;
+    case BBR_PROBE_BW:
+        if (t - cc->bbr.cycle_stamp > microseconds(cc->min_rtt)) {
+            cc->bbr.cycle_idx = (cc->bbr.cycle_idx + 1) % BBR_CYCLE_LEN;
+            cc->bbr.cycle_stamp = t;
+        }
+        break;
+    case BBR_PROBE_RTT:
+        if (t >= cc->bbr.probe_rtt_done) {
+            if (!cc->min_rtt)
+                cc->min_rtt = cc->bbr.prior_min_rtt;
+            cc->min_rtt_stamp = t;
+            cc->cwnd = MAX(cc->cwnd, cc->bbr.prior_cwnd);
+            cc->bbr.mode = (cc->bbr.full_bw_cnt >= BBR_FULL_BW_CNT) ? BBR_PROBE_BW : BBR_STARTUP;
+            cc->bbr.cycle_stamp = t;
+        }
+        return;
+    default:
+        break;
+    }
+    if (cc->min_rtt_stamp && (t - cc->min_rtt_stamp > BBR_PROBE_RTT_INTERVAL)) {
+        tcp_cc_debug("pcb %p: probing RTT\n", pcb);
+        cc->bbr.mode = BBR_PROBE_RTT;
+        cc->bbr.prior_cwnd = cc->cwnd;
+        cc->bbr.probe_rtt_done = t + BBR_PROBE_RTT_DURATION;
+        cc->bbr.prior_min_rtt = cc->min_rtt;
+        cc->min_rtt = 0;    /* take the minimum RTT from samples collected while probing */
+    }
+}
+
+static void bbr_acked(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, timestamp t)
+{
+    u32 min_cwnd = BBR_MIN_CWND_SEGS * pcb->mss;
+    u32 gain;
+
+    cc->bbr.delivered += acked;
+    bbr_update_round(cc, pcb, t);
+    bbr_update_mode(cc, pcb, t);
+    switch (cc->bbr.mode) {
+    case BBR_STARTUP:
+        gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        gain = BBR_UNIT;
+        break;
+    case BBR_PROBE_BW:
+        gain = BBR_CWND_GAIN * bbr_cycle_gain[cc->bbr.cycle_idx] / BBR_UNIT;
+        break;
+    case BBR_PROBE_RTT:
+        pcb->cwnd = min_cwnd;
+        return;
+    }
+    u32 cwnd = cc->cwnd;
+    u32 target = bbr_bdp(cc, gain);
+    if (!target || (cwnd < target))
+        cwnd += acked;
+    else if (cc->bbr.mode != BBR_STARTUP)
+        cwnd = target;
+    pcb->cwnd = MIN(MAX(cwnd, min_cwnd), TCPWND_MAX - 1);
+
+    /* keep lwIP out of slow start, so that any change to the threshold signals a loss */
+    pcb->ssthresh = MIN(pcb->cwnd, TCPWND_MAX - 1);
+}
+
+static void bbr_loss(tcp_cc cc, struct tcp_pcb *pcb, boolean timeout, timestamp t)
+{
+    /* BBR does not react to isolated losses: restore the window that was in use, unless all
+     * in-flight data has been lost */
+    if (!timeout)
+        pcb->cwnd = cc->cwnd;
+}
+
+static const struct tcp_cc_ops bbr_ops = {
+    .name = ss_static_init("bbr"),
+    .init = bbr_init,
+    .acked = bbr_acked,
+    .loss = bbr_loss,
+};
+
+static tcp_cc_ops tcp_cc_algos[] = {
+    &reno_ops,
+    &cubic_ops,
+    &bbr_ops,
+};
+
+tcp_cc_ops tcp_cc_find(sstring name)
+{
+    for (int i = 0; i < _countof(tcp_cc_algos); i++)
+        if (!runtime_strcmp(tcp_cc_algos[i]->name, name))
+            return tcp_cc_algos[i];
+    return 0;
+}
+
+void tcp_cc_init(tcp_cc cc, tcp_cc_ops ops)
+{
+    zero(cc, sizeof(*cc));
+    cc->ops = ops;
+}
+
+static void tcp_cc_rtt_sample(tcp_cc cc, u64 rtt, timestamp t)
+{
+    cc->srtt = cc->srtt ? (7 * cc->srtt + rtt) / 8 : rtt;
+    if (!cc->min_rtt || (rtt <= cc->min_rtt)) {
+        cc->min_rtt = MAX(rtt, 1);
+        cc->min_rtt_stamp = t;
+    }
+}
+
+/* To be called after segments may have been transmitted: starts an RTT sample if none is in
+ * progress. */
+void tcp_cc_sent(tcp_cc cc, struct tcp_pcb *pcb)
+{
+    if (!cc->ops->acked || cc->rtt_seq || (pcb->snd_nxt == cc->snd_nxt))
+        return;
+    cc->snd_nxt = pcb->snd_nxt;
+    if (tcp_cc_inflight(pcb)) {
+        cc->rtt_seq = pcb->snd_nxt;
+        cc->rtt_start = now(CLOCK_ID_MONOTONIC_RAW);
+    }
+}
+
+/* To be called from the lwIP sent callback, i.e. after lwIP processed an ACK for new data. */
+void tcp_cc_acked(tcp_cc cc, struct tcp_pcb *pcb, u32 acked)
+{
+    tcp_cc_ops ops = cc->ops;
+    if (!ops->acked)
+        return;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    if (!cc->cwnd) {
+        /* first ACK on this connection */
+        if (ops->init)
+            ops->init(cc, pcb);
+    } else if (pcb->ssthresh != cc->ssthresh) {
+        cc->rtt_seq = 0;    /* Karn's algorithm: do not sample retransmitted segments */
+        ops->loss(cc, pcb, pcb->cwnd < pcb->ssthresh, t);
+        cc->cwnd = pcb->cwnd;
+    }
+    if (cc->rtt_seq && TCP_SEQ_GEQ(pcb->lastack, cc->rtt_seq)) {
+        tcp_cc_rtt_sample(cc, usec_from_timestamp(t - cc->rtt_start), t);
+        cc->rtt_seq = 0;
+    }
+    ops->acked(cc, pcb, acked, t);
+    cc->cwnd = pcb->cwnd;
+    cc->ssthresh = pcb->ssthresh;
+}
+
+void init_tcp_cc(tuple cfg)
+{
+    tcp_cc_default = &reno_ops;
+    buffer algo = get_string(cfg, sym(tcp_congestion_control));
+    if (algo) {
+        tcp_cc_ops ops = tcp_cc_find(buffer_to_sstring(algo));
+        if (ops)
+            tcp_cc_default = ops;
+        else
+            msg_err("unknown TCP congestion control algorithm '%b', using %s\n", algo,
+                    tcp_cc_default->name);
+    }
+}
@@ -0,0 +1,73 @@
+/* TCP congestion control
+ *
+ * lwIP implements Reno (RFC 5681) internally; other algorithms are layered on top of it by
+ * adjusting the congestion window and slow start threshold of a PCB each time new data is
+ * acknowledged. Loss events are detected from lwIP lowering the slow start threshold (fast
+ * retransmit and retransmission timeout both do so). Retransmissions are left to lwIP, which does
+ * not process incoming SACK blocks: multiple losses in a window are recovered one segment per round
+ * trip, or by a retransmission timeout.
+ * All functions must be called with the PCB lock held.
+ */
+
+#define TCP_CA_NAME_MAX 16
+
+typedef struct tcp_cc *tcp_cc;
+
+typedef const struct tcp_cc_ops {
+    sstring name;
+    void (*init)(tcp_cc cc, struct tcp_pcb *pcb);
+    void (*acked)(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, timestamp t);
+    void (*loss)(tcp_cc cc, struct tcp_pcb *pcb, boolean timeout, timestamp t);
+} *tcp_cc_ops;
+
+enum bbr_mode {
+    BBR_STARTUP,
+    BBR_DRAIN,
+    BBR_PROBE_BW,
+    BBR_PROBE_RTT,
+};
+
+struct tcp_cc {
+    tcp_cc_ops ops;
+    u32 cwnd;           /* congestion window as last seen (or set) by the algorithm */
+    u32 ssthresh;       /* slow start threshold as last seen (or set) by the algorithm */
+    u32 snd_nxt;
+    u32 rtt_seq;        /* RTT sample in progress: completed when this sequence number is acked */
+    timestamp rtt_start;
+    u64 srtt;           /* smoothed RTT (microseconds) */
+    u64 min_rtt;        /* minimum RTT (microseconds) */
+    timestamp min_rtt_stamp;
+    union {
+        struct {
+            u32 w_max;          /* window before the last reduction */
+            u32 w_est;          /* Reno-friendly window estimate */
+            u64 k;              /* milliseconds to reach w_max again */
+            timestamp epoch_start;
+        } cubic;
+        struct {
+            enum bbr_mode mode;
+            u64 btl_bw;         /* bottleneck bandwidth estimate (bytes per second) */
+            u64 btl_bw_round;
+            u64 full_bw;
+            u32 full_bw_cnt;
+            u64 round_count;
+            u32 round_end_seq;
+            u64 round_delivered;
+            timestamp round_start;
+            u64 delivered;
+            u32 cycle_idx;
+            timestamp cycle_stamp;
+            timestamp probe_rtt_done;
+            u32 prior_cwnd;
+            u64 prior_min_rtt;
+        } bbr;
+    };
+};
+
+extern tcp_cc_ops tcp_cc_default;
+
+tcp_cc_ops tcp_cc_find(sstring name);
+void tcp_cc_init(tcp_cc cc, tcp_cc_ops ops);
+void tcp_cc_sent(tcp_cc cc, struct tcp_pcb *pcb);
+void tcp_cc_acked(tcp_cc cc, struct tcp_pcb *pcb, u32 acked);
+void init_tcp_cc(tuple cfg);
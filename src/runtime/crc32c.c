@@ -1,7 +1,7 @@
 #include <runtime.h>
+#include <crc32c.h>
 
-#include "crc.h"
-
+/* byte-wise lookup table for the reflected CRC-32C polynomial (0x82f63b78) */
 static const u32 crc32c_table[256] = {
     0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
     0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b, 0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
@@ -38,10 +38,36 @@ static const u32 crc32c_table[256] = {
 };
 
 
-u32 crc32c(const u8 *data, bytes len)
+static u32 crc32c_sw(u32 crc, const u8 *p, bytes len)
 {
-    u32 crc = ~0;
     for (bytes i = 0; i < len; i++)
-        crc = crc32c_table[(crc & 0xff) ^ data[i]] ^ (crc >> 8);
-    return ~crc;
+        crc = crc32c_table[(crc & 0xff) ^ p[i]] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC32C_HW
+static int crc32c_hw = -1;  /* instruction availability, not yet known if -1 */
+
+static u32 crc32c_hw_update(u32 crc, const u8 *p, bytes len)
+{
+    for (; (len > 0) && (u64_from_pointer(p) & (sizeof(u64) - 1)); len--)
+        crc = crc32c_hw_8(crc, *p++);
+    for (; len >= sizeof(u64); len -= sizeof(u64), p += sizeof(u64))
+        crc = crc32c_hw_64(crc, *(u64 *)p);
+    for (; len > 0; len--)
+        crc = crc32c_hw_8(crc, *p++);
+    return crc;
+}
+#endif
+
+u32 crc32c(u32 crc, const void *data, bytes len)
+{
+    crc = ~crc;
+#ifdef CRC32C_HW
+    if (crc32c_hw < 0)
+        crc32c_hw = crc32c_hw_available();
+    if (crc32c_hw)
+        return ~crc32c_hw_update(crc, data, len);
+#endif
+    return ~crc32c_sw(crc, data, len);
 }
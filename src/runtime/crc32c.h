@@ -0,0 +1,5 @@
+/* CRC-32C (Castagnoli), as used by iSCSI, SCTP and ext4 */
+
+/* Returns the CRC of data appended to a sequence with CRC crc (0 for an empty sequence), so that
+ * the CRC of a sequence can be computed in pieces. */
+u32 crc32c(u32 crc, const void *data, bytes len);
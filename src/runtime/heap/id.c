@@ -366,6 +366,86 @@ static inline void set_next(id_heap i, bytes count, u64 next)
     }
 }
 
+static void id_count_free_blocks(u64 *counts, int orders, u64 start, u64 end)
+{
+    while (start < end) {
+        u64 order = msb(end - start);
+        if (start)
+            order = MIN(order, lsb(start));
+        order = MIN(order, orders - 1);
+        counts[order]++;
+        start += U64_FROM_BIT(order);
+    }
+}
+
+static void id_range_free_blocks(id_range r, u64 *counts, int orders)
+{
+    u64 *map = bitmap_base(r->b);
+    u64 mapwords = r->b->mapbits >> BITMAP_WORDLEN_LOG;
+    u64 end = r->n.r.end - r->bitmap_start;
+    u64 bit = r->n.r.start - r->bitmap_start;
+    u64 run_start = 0;
+    boolean in_run = false;
+    while (bit < end) {
+        u64 w = ((bit >> BITMAP_WORDLEN_LOG) < mapwords) ? map[bit >> BITMAP_WORDLEN_LOG] : 0;
+        boolean allocated;
+        u64 next;
+        if (!(bit & BITMAP_WORDMASK) && (bit + BITMAP_WORDLEN <= end) && ((w == 0) || (w == -1ull))) {
+            allocated = (w != 0);
+            next = bit + BITMAP_WORDLEN;
+        } else {
+            allocated = (w & U64_FROM_BIT(bit & BITMAP_WORDMASK)) != 0;
+            next = bit + 1;
+        }
+        if (allocated) {
+            if (in_run) {
+                id_count_free_blocks(counts, orders, r->bitmap_start + run_start,
+                                     r->bitmap_start + bit);
+                in_run = false;
+            }
+        } else if (!in_run) {
+            run_start = bit;
+            in_run = true;
+        }
+        bit = next;
+    }
+    if (in_run)
+        id_count_free_blocks(counts, orders, r->bitmap_start + run_start, r->bitmap_start + end);
+}
+
+/* Counts the free ids as naturally aligned power-of-2 blocks (i.e. with the same alignment that
+ * the heap guarantees for allocations), so that counts[n] is the number of free blocks of
+ * (pagesize << n) bytes; free blocks larger than the highest order are counted as multiple blocks
+ * of the highest order. */
+static void free_blocks(id_heap i, u64 *counts, int orders)
+{
+    zero(counts, orders * sizeof(u64));
+    rangemap_foreach(i->ranges, n)
+        id_range_free_blocks((id_range)n, counts, orders);
+}
+
+closure_function(2, 1, boolean, free_in_range_handler,
+                 range, q, u64 *, free,
+                 rmnode n)
+{
+    id_range r = (id_range)n;
+    range ri = range_intersection(bound(q), n->r);
+    for (u64 page = ri.start; page < ri.end; page++)
+        if (!bitmap_get(r->b, page - r->bitmap_start))
+            (*bound(free))++;
+    return true;
+}
+
+/* Returns the number of free bytes within the given area. */
+static u64 free_in_range(id_heap i, u64 base, u64 length)
+{
+    range q = range_rshift(irangel(base & ~page_mask(i), pad(length, page_size(i))),
+                           page_order(i));
+    u64 free = 0;
+    rangemap_range_lookup(i->ranges, q, stack_closure(free_in_range_handler, q, &free));
+    return free << page_order(i);
+}
+
 #ifdef KERNEL
 /* locking variants */
 
@@ -425,6 +505,21 @@ static void set_next_locking(id_heap i, bytes count, u64 next)
     spin_unlock_irq(id_lock(i), flags);
 }
 
+static void free_blocks_locking(id_heap i, u64 *counts, int orders)
+{
+    u64 flags = spin_lock_irq(id_lock(i));
+    free_blocks(i, counts, orders);
+    spin_unlock_irq(id_lock(i), flags);
+}
+
+static u64 free_in_range_locking(id_heap i, u64 base, u64 length)
+{
+    u64 flags = spin_lock_irq(id_lock(i));
+    u64 free = free_in_range(i, base, length);
+    spin_unlock_irq(id_lock(i), flags);
+    return free;
+}
+
 closure_function(2, 0, value, id_get_allocated,
                  id_heap, i, value, v)
 {
@@ -443,6 +538,20 @@ closure_function(2, 0, value, id_get_free,
     return value_rewrite_u64(bound(v), bound(i)->total - bound(i)->allocated);
 }
 
+closure_function(2, 0, value, id_get_free_blocks,
+                 id_heap, i, tuple, t)
+{
+    id_heap i = bound(i);
+    tuple t = bound(t);
+    u64 counts[ID_HEAP_FREE_BLOCK_ORDERS];
+    id_heap_free_blocks(i, counts, ID_HEAP_FREE_BLOCK_ORDERS);
+    for (int order = 0; order < ID_HEAP_FREE_BLOCK_ORDERS; order++) {
+        symbol s = intern_u64(i->h.pagesize << order);
+        set(t, s, value_rewrite_u64(get(t, s), counts[order]));
+    }
+    return t;
+}
+
 #define register_stat(i, n, t, name)                                    \
     v = value_from_u64(0);                                              \
     s = sym(name);                                                      \
@@ -463,6 +572,15 @@ static value id_management(heap h)
     register_stat(i, n, t, allocated);
     register_stat(i, n, t, total);
     register_stat(i, n, t, free);
+
+    /* histogram of free blocks, keyed by block size */
+    tuple fb = allocate_tuple();
+    assert(fb != INVALID_ADDRESS);
+    for (int order = 0; order < ID_HEAP_FREE_BLOCK_ORDERS; order++)
+        set(fb, intern_u64(i->h.pagesize << order), value_from_u64(0));
+    s = sym(free_blocks);
+    set(t, s, fb);
+    tuple_notifier_register_get_notify(n, s, closure(i->meta, id_get_free_blocks, i, fb));
     i->mgmt = (tuple)n;
     return n;
 }
@@ -563,6 +681,8 @@ id_heap allocate_id_heap(heap meta, heap map, bytes pagesize, boolean locking)
         i->set_randomize = set_randomize_locking;
         i->alloc_subrange = alloc_subrange_locking;
         i->set_next = set_next_locking;
+        i->free_blocks = free_blocks_locking;
+        i->free_in_range = free_in_range_locking;
     } else
 #else
     i->h.management = 0;
@@ -575,6 +695,8 @@ id_heap allocate_id_heap(heap meta, heap map, bytes pagesize, boolean locking)
         i->set_randomize = set_randomize;
         i->alloc_subrange = alloc_subrange;
         i->set_next = set_next;
+        i->free_blocks = free_blocks;
+        i->free_in_range = free_in_range;
     }
     i->page_order = msb(pagesize);
     i->allocated = 0;
@@ -5,6 +5,8 @@ typedef struct id_heap {
     void (*set_randomize)(struct id_heap *i, boolean randomize);
     u64 (*alloc_subrange)(struct id_heap *i, bytes count, u64 start, u64 end);
     void (*set_next)(struct id_heap *i, bytes count, u64 next);
+    void (*free_blocks)(struct id_heap *i, u64 *counts, int orders);
+    u64 (*free_in_range)(struct id_heap *i, u64 base, u64 length);
     /* private */
     u64 page_order;
     u64 allocated;
@@ -29,6 +31,11 @@ boolean id_heap_range_foreach(id_heap i, range_handler rh);
 #define id_heap_set_randomize(__h, __r) ((__h)->set_randomize(__h, __r))
 #define id_heap_alloc_subrange(__h, __c, __s, __e) ((__h)->alloc_subrange(__h, __c, __s, __e))
 #define id_heap_set_next(__h, __c, __n) ((__h)->set_next(__h, __c, __n))
+#define id_heap_free_blocks(__h, __c, __o) ((__h)->free_blocks(__h, __c, __o))
+#define id_heap_free_in_range(__h, __b, __l) ((__h)->free_in_range(__h, __b, __l))
+
+/* number of block sizes (starting from the heap page size) in the free blocks histogram */
+#define ID_HEAP_FREE_BLOCK_ORDERS   11
 
 /* If count == 1, the return value is guaranteed to be the lowest-numbered
  * non-allocated id starting from min. */
@@ -0,0 +1,171 @@
+#include <runtime.h>
+#include <lz4.h>
+
+/* A compressed block is a sequence of (literals, match) pairs; each sequence starts with a token
+ * whose high and low nibbles hold the literal length and the match length (minus LZ4_MIN_MATCH),
+ * with the value 15 meaning that the length continues in the following bytes. The last sequence
+ * contains only literals, and the last LZ4_LAST_LITERALS bytes of input are always literals. */
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5
+#define LZ4_MF_LIMIT        12  /* a match cannot start in the last LZ4_MF_LIMIT bytes */
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_RUN_MASK        15
+#define LZ4_SKIP_TRIGGER    6   /* search step is increased every 2^LZ4_SKIP_TRIGGER misses */
+
+static inline u32 lz4_read32(const u8 *p)
+{
+    u32 v;
+    runtime_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_ORDER);
+}
+
+static boolean lz4_put_length(u8 **op, u8 *oend, bytes len)
+{
+    u8 *p = *op;
+    for (; len >= 255; len -= 255) {
+        if (p >= oend)
+            return false;
+        *p++ = 255;
+    }
+    if (p >= oend)
+        return false;
+    *p++ = len;
+    *op = p;
+    return true;
+}
+
+/* A zero offset denotes the last sequence, which has no match. */
+static boolean lz4_put_sequence(u8 **op, u8 *oend, const u8 *literals, bytes lit_len,
+                                u64 offset, bytes match_len)
+{
+    u8 *p = *op;
+    if (p >= oend)
+        return false;
+    u8 *token = p++;
+    *token = MIN(lit_len, LZ4_RUN_MASK) << 4;
+    if ((lit_len >= LZ4_RUN_MASK) && !lz4_put_length(&p, oend, lit_len - LZ4_RUN_MASK))
+        return false;
+    if (oend - p < lit_len)
+        return false;
+    runtime_memcpy(p, literals, lit_len);
+    p += lit_len;
+    if (offset) {
+        if (oend - p < 2)
+            return false;
+        *p++ = offset;
+        *p++ = offset >> 8;
+        *token |= MIN(match_len, LZ4_RUN_MASK);
+        if ((match_len >= LZ4_RUN_MASK) && !lz4_put_length(&p, oend, match_len - LZ4_RUN_MASK))
+            return false;
+    }
+    *op = p;
+    return true;
+}
+
+bytes lz4_compress(const void *src, bytes len, void *dest, bytes dest_len, void *table)
+{
+    const u8 *base = src;
+    const u8 *end = base + len;
+    const u8 *anchor = base;
+    u8 *op = dest;
+    u8 *oend = op + dest_len;
+    u32 *positions = table;
+    if (len > LZ4_MF_LIMIT) {
+        const u8 *mf_limit = end - LZ4_MF_LIMIT;
+        const u8 *match_limit = end - LZ4_LAST_LITERALS;
+        const u8 *ip = base;
+        u64 misses = 0;
+        zero(table, LZ4_HASH_TABLE_SIZE);
+        while (ip < mf_limit) {
+            u32 seq = lz4_read32(ip);
+            u32 h = lz4_hash(seq);
+            const u8 *ref = base + positions[h];
+            positions[h] = ip - base;
+            if ((ref >= ip) || (ip - ref > LZ4_MAX_OFFSET) || (lz4_read32(ref) != seq)) {
+                ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+            while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])) {
+                ip--;
+                ref--;
+            }
+            const u8 *match_end = ip + LZ4_MIN_MATCH;
+            const u8 *ref_end = ref + LZ4_MIN_MATCH;
+            while ((match_end < match_limit) && (*match_end == *ref_end)) {
+                match_end++;
+                ref_end++;
+            }
+            if (!lz4_put_sequence(&op, oend, anchor, ip - anchor, ip - ref,
+                                  match_end - ip - LZ4_MIN_MATCH))
+                return 0;
+            ip = anchor = match_end;
+        }
+    }
+    if (!lz4_put_sequence(&op, oend, anchor, end - anchor, 0, 0))
+        return 0;
+    return op - (u8 *)dest;
+}
+
+static boolean lz4_get_length(const u8 **ip, const u8 *iend, bytes *len)
+{
+    const u8 *p = *ip;
+    u8 b;
+    do {
+        if (p >= iend)
+            return false;
+        b = *p++;
+        *len += b;
+    } while (b == 255);
+    *ip = p;
+    return true;
+}
+
+s64 lz4_decompress(const void *src, bytes len, void *dest, bytes dest_len)
+{
+    const u8 *ip = src;
+    const u8 *iend = ip + len;
+    u8 *op = dest;
+    u8 *oend = op + dest_len;
+    while (ip < iend) {
+        u8 token = *ip++;
+        bytes lit_len = token >> 4;
+        if ((lit_len == LZ4_RUN_MASK) && !lz4_get_length(&ip, iend, &lit_len))
+            return -1;
+        if ((iend - ip < lit_len) || (oend - op < lit_len))
+            return -1;
+        runtime_memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend)
+            break;
+        if (iend - ip < 2)
+            return -1;
+        u64 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > op - (u8 *)dest))
+            return -1;
+        bytes match_len = token & LZ4_RUN_MASK;
+        if ((match_len == LZ4_RUN_MASK) && !lz4_get_length(&ip, iend, &match_len))
+            return -1;
+        match_len += LZ4_MIN_MATCH;
+        if (oend - op < match_len)
+            return -1;
+        const u8 *ref = op - offset;
+        if (offset >= match_len) {
+            runtime_memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            /* overlapping match: replicates the last offset bytes */
+            for (bytes i = 0; i < match_len; i++)
+                *op++ = *ref++;
+        }
+    }
+    return op - (u8 *)dest;
+}
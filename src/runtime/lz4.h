@@ -0,0 +1,15 @@
+/* LZ4 block format (without the frame format wrapper) */
+
+#define LZ4_HASH_ORDER      12
+#define LZ4_HASH_TABLE_SIZE (U64_FROM_BIT(LZ4_HASH_ORDER) * sizeof(u32))
+
+/* worst-case size of the compressed representation of len bytes */
+#define lz4_compress_bound(len) ((len) + (len) / 255 + 16)
+
+/* Returns the length of the compressed data, or 0 if it does not fit in dest_len bytes;
+ * table must point to LZ4_HASH_TABLE_SIZE bytes of scratch memory. */
+bytes lz4_compress(const void *src, bytes len, void *dest, bytes dest_len, void *table);
+
+/* Returns the length of the decompressed data, or -1 if the input is malformed or the
+ * decompressed data does not fit in dest_len bytes. */
+s64 lz4_decompress(const void *src, bytes len, void *dest, bytes dest_len);
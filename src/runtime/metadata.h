@@ -1,3 +1,12 @@
+/* Directory contents may be stored in deferred form, in which case they are loaded here. */
+static inline tuple children(tuple x)
+{
+    tuple c = get_tuple(x, sym(children));
+    if (c)
+        deferred_tuple_load(c);
+    return c;
+}
+
 static inline tuple resolve_path(tuple n, vector v)
 {
     buffer i;
@@ -5,7 +14,7 @@ static inline tuple resolve_path(tuple n, vector v)
         /* null entries ("//") are skipped in path */
         if (buffer_length(i) == 0)
             continue;
-        tuple c = get_tuple(n, sym(children));
+        tuple c = children(n);
         if (!c)
             return c;
         n = get_tuple(c, intern(i));
@@ -15,11 +24,6 @@ static inline tuple resolve_path(tuple n, vector v)
     return n;
 }
 
-static inline tuple children(tuple x)
-{
-    return get_tuple(x, sym(children));
-}
-
 static inline string contents(tuple x)
 {
     return get_string(x, sym(contents));
@@ -0,0 +1,162 @@
+#include <runtime.h>
+
+#define RADIX_MAX_DEPTH ((64 + RADIX_NODE_ORDER - 1) / RADIX_NODE_ORDER)
+
+static radix_node allocate_radix_node(radix_tree t, int shift)
+{
+    radix_node n = allocate_zero(t->h, sizeof(*n));
+    if (n != INVALID_ADDRESS)
+        n->shift = shift;
+    return n;
+}
+
+static inline boolean radix_key_fits(radix_node n, u64 key)
+{
+    return (n->shift + RADIX_NODE_ORDER >= 64) || !(key >> (n->shift + RADIX_NODE_ORDER));
+}
+
+void init_radix_tree(radix_tree t, heap h, radix_retire_handler retire)
+{
+    t->h = h;
+    t->root = 0;
+    t->count = 0;
+    t->retire = retire;
+}
+
+/* Nodes are fully initialized before being made reachable, so that concurrent lock-free lookups
+ * never see a partially constructed node. */
+boolean radix_tree_insert(radix_tree t, u64 key, void *p)
+{
+    assert(p && (p != INVALID_ADDRESS));
+    radix_node n = t->root;
+    if (!n) {
+        n = allocate_radix_node(t, 0);
+        if (n == INVALID_ADDRESS)
+            return false;
+        write_barrier();
+        t->root = n;
+    }
+    while (!radix_key_fits(n, key)) {
+        radix_node r = allocate_radix_node(t, n->shift + RADIX_NODE_ORDER);
+        if (r == INVALID_ADDRESS)
+            return false;
+        r->slots[0] = n;
+        r->used = 1;
+        write_barrier();
+        t->root = n = r;
+    }
+    while (1) {
+        void **slot = &n->slots[(key >> n->shift) & MASK(RADIX_NODE_ORDER)];
+        if (n->shift == 0) {
+            if (*slot)
+                return false;
+            write_barrier();
+            *slot = p;
+            n->used++;
+            t->count++;
+            return true;
+        }
+        radix_node c = *slot;
+        if (!c) {
+            c = allocate_radix_node(t, n->shift - RADIX_NODE_ORDER);
+            if (c == INVALID_ADDRESS)
+                return false;
+            write_barrier();
+            *slot = c;
+            n->used++;
+        }
+        n = c;
+    }
+}
+
+/* Emptied nodes are unlinked before being retired, so that lookups starting after the retire
+ * handler has been called cannot reach them; a lookup already traversing an unlinked node only sees
+ * empty slots. */
+void *radix_tree_remove(radix_tree t, u64 key)
+{
+    radix_node path[RADIX_MAX_DEPTH];
+    int depth = 0;
+    radix_node n = t->root;
+    if (!n || !radix_key_fits(n, key))
+        return INVALID_ADDRESS;
+    void *p;
+    while (1) {
+        void **slot = &n->slots[(key >> n->shift) & MASK(RADIX_NODE_ORDER)];
+        p = *slot;
+        if (!p)
+            return INVALID_ADDRESS;
+        path[depth++] = n;
+        if (n->shift == 0) {
+            *slot = 0;
+            n->used--;
+            t->count--;
+            break;
+        }
+        n = p;
+    }
+    while ((depth > 0) && !path[depth - 1]->used) {
+        n = path[--depth];
+        void **slot = depth ? &path[depth - 1]->slots[(key >> path[depth - 1]->shift) &
+                                                     MASK(RADIX_NODE_ORDER)] :
+                              (void **)&t->root;
+        *slot = 0;
+        if (!t->retire) {
+            deallocate(t->h, n, sizeof(*n));
+        } else if (!apply(t->retire, n)) {
+            /* an empty node can be linked back without a barrier: readers only see empty slots */
+            *slot = n;
+            break;
+        }
+        if (depth)
+            path[depth - 1]->used--;
+    }
+    return p;
+}
+
+static boolean radix_node_traverse(radix_node n, u64 base, radix_handler h)
+{
+    for (u64 i = 0; i < RADIX_NODE_SLOTS; i++) {
+        void *p = n->slots[i];
+        if (!p)
+            continue;
+        u64 key = base | (i << n->shift);
+        if (n->shift == 0) {
+            if (!apply(h, key, p))
+                return false;
+        } else if (!radix_node_traverse(p, key, h)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Values are visited in ascending key order. */
+boolean radix_tree_traverse(radix_tree t, radix_handler h)
+{
+    return t->root ? radix_node_traverse(t->root, 0, h) : true;
+}
+
+static void radix_node_destruct(radix_tree t, radix_node n, u64 base, radix_handler destructor)
+{
+    for (u64 i = 0; i < RADIX_NODE_SLOTS; i++) {
+        void *p = n->slots[i];
+        if (!p)
+            continue;
+        u64 key = base | (i << n->shift);
+        if (n->shift == 0) {
+            if (destructor)
+                apply(destructor, key, p);
+        } else {
+            radix_node_destruct(t, p, key, destructor);
+        }
+    }
+    deallocate(t->h, n, sizeof(*n));
+}
+
+void destruct_radix_tree(radix_tree t, radix_handler destructor)
+{
+    if (t->root)
+        radix_node_destruct(t, t->root, 0, destructor);
+    t->root = 0;
+    t->count = 0;
+}
@@ -0,0 +1,60 @@
+/* Radix tree mapping 64-bit integer keys to pointers.
+ *
+ * Lookups do not take any lock: writers (which must be serialized by the caller) publish new
+ * nodes and values with a write barrier. A node emptied by a removal is unlinked from the tree and
+ * passed to the retire handler given at initialization, which takes ownership of it and must defer
+ * freeing it until no lock-free reader can reach it anymore; without a retire handler, emptied nodes
+ * are freed immediately. Likewise, it is up to the caller to ensure that a value obtained from a
+ * lookup is not freed while in use by a lock-free reader.
+ */
+
+#define RADIX_NODE_ORDER    6
+#define RADIX_NODE_SLOTS    U64_FROM_BIT(RADIX_NODE_ORDER)
+
+typedef struct radix_node {
+    u8 shift;                       /* bit position of the key index for this level */
+    u8 used;                        /* number of non-empty slots */
+    void *slots[RADIX_NODE_SLOTS];
+} *radix_node;
+
+/* Returns false if the node cannot be retired, in which case it is left in the tree. */
+closure_type(radix_retire_handler, boolean, radix_node n);
+
+typedef struct radix_tree {
+    heap h;
+    radix_node root;
+    u64 count;
+    radix_retire_handler retire;
+} *radix_tree;
+
+closure_type(radix_handler, boolean, u64 key, void *p);
+
+void init_radix_tree(radix_tree t, heap h, radix_retire_handler retire);
+boolean radix_tree_insert(radix_tree t, u64 key, void *p);
+void *radix_tree_remove(radix_tree t, u64 key);
+boolean radix_tree_traverse(radix_tree t, radix_handler h);
+void destruct_radix_tree(radix_tree t, radix_handler destructor);
+
+/* Returns INVALID_ADDRESS if the key is not in the tree. */
+static inline void *radix_tree_lookup(radix_tree t, u64 key)
+{
+    radix_node n = *(radix_node volatile *)&t->root;
+    if (!n)
+        return INVALID_ADDRESS;
+    if ((n->shift + RADIX_NODE_ORDER < 64) && (key >> (n->shift + RADIX_NODE_ORDER)))
+        return INVALID_ADDRESS;
+    /* no read barrier needed: dependent loads are ordered on all supported architectures */
+    while (1) {
+        void *p = *(void *volatile *)&n->slots[(key >> n->shift) & MASK(RADIX_NODE_ORDER)];
+        if (!p)
+            return INVALID_ADDRESS;
+        if (n->shift == 0)
+            return p;
+        n = p;
+    }
+}
+
+static inline u64 radix_tree_get_count(radix_tree t)
+{
+    return t->count;
+}
@@ -77,8 +77,16 @@ enum storage_op {
     STORAGE_OP_READSG,
     STORAGE_OP_WRITESG,
     STORAGE_OP_FLUSH,
+    STORAGE_OP_DISCARD,         /* the device may deallocate the blocks (data is not used) */
+    STORAGE_OP_WRITE_ZEROES,    /* the blocks read back as zeroes (data is not used) */
 };
 
+/* Completion status of requests for operations not supported by a storage device */
+#define storage_unsupported_status() ({                                 \
+    status __s = timm("result", "unsupported storage operation");       \
+    timm_append(__s, "fsstatus", "%d", -EOPNOTSUPP);                    \
+})
+
 typedef struct storage_req {
     u8 op;
     range blocks;
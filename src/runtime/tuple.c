@@ -1,4 +1,8 @@
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
 
 //#define TUPLE_DEBUG
 #if defined(TUPLE_DEBUG)
@@ -17,6 +21,8 @@ BSS_RO_AFTER_INIT static heap iheap;
 #define type_vector  2
 #define type_integer 3
 #define type_string  4
+#define type_deferred       5   /* tuple with contents encoded separately */
+#define type_deferred_ref   6   /* reference to a tuple within a deferred tuple */
 
 #define immediate 1
 #define reference 0
@@ -331,10 +337,15 @@ static void push_header(buffer b, boolean imm, u8 type, u64 length)
     }
 }
 
-static void set_new_value(value e, value a, heap h, table dictionary, buffer source, u64 *total, u64 *obsolete, boolean old_encoding)
+static value decode_value_internal(heap h, table dictionary, buffer source, u64 *total,
+                                   u64 *obsolete, boolean old_encoding, tuple_deferral td,
+                                   tuple holder);
+
+static void set_new_value(value e, value a, heap h, table dictionary, buffer source, u64 *total,
+                          u64 *obsolete, boolean old_encoding, tuple_deferral td)
 {
     tuple_debug("%s: e %p, a %v\n", func_ss, e, a);
-    value nv = decode_value(h, dictionary, source, total, obsolete, old_encoding);
+    value nv = decode_value_internal(h, dictionary, source, total, obsolete, old_encoding, td, e);
     if (obsolete) {
         value old_v = get(e, a);
         if (old_v) {
@@ -361,21 +372,153 @@ static value pop_indirect_value(table dictionary, buffer source)
     return v;
 }
 
+/* Deferred tuples
+ * A tuple encoded in deferred form has its contents encoded with a separate dictionary, preceded
+ * by the number of entries in the encoding and by an attachment, i.e. opaque data supplied by the
+ * user of the encoding. Decoding such a tuple yields an empty tuple, whose contents are decoded
+ * when the tuple is loaded, i.e. when first accessed (see deferred_tuple_load()); until then, the
+ * original encoding is retained so that it can be copied as is if the tuple is encoded again.
+ * Tuples within a deferred tuple are referenced by the deferred tuple and by their index in its
+ * dictionary. */
+
+typedef struct deferred_tuple {
+    heap h;
+    buffer encoding;
+    tuple holder;
+    deferred_tuple_handler loaded;
+} *deferred_tuple;
+
+#ifdef KERNEL
+static struct spinlock deferred_slock;
+#define deferred_lock_init()    spin_lock_init(&deferred_slock)
+#define deferred_lock()         spin_lock(&deferred_slock)
+#define deferred_unlock()       spin_unlock(&deferred_slock)
+#else
+#define deferred_lock_init()
+#define deferred_lock()
+#define deferred_unlock()
+#endif
+
+/* deferred tuples that have not been loaded yet */
+static table deferred_tuples;
+
+static deferred_tuple find_deferred_tuple(tuple t, boolean remove)
+{
+    /* a deferred tuple is empty until loaded */
+    if ((tagof(t) != tag_table_tuple) || (t->t.count != 0))
+        return 0;
+    deferred_lock();
+    deferred_tuple dt = deferred_tuples ? (remove ? table_remove(deferred_tuples, t) :
+                                           table_find(deferred_tuples, t)) : 0;
+    deferred_unlock();
+    return dt;
+}
+
+static void free_deferred_tuple(deferred_tuple dt)
+{
+    deallocate_buffer(dt->encoding);
+    deallocate(dt->h, dt, sizeof(*dt));
+}
+
+static void decode_deferred(heap h, tuple t, tuple holder, buffer source, u64 len, u64 *total,
+                            tuple_deferral td)
+{
+    if (total) {
+        buffer b = alloca_wrap_buffer(buffer_ref(source, 0), len);
+        *total += pop_varint(b);
+    }
+    deferred_tuple dt = allocate(h, sizeof(*dt));
+    assert(dt != INVALID_ADDRESS);
+    dt->h = h;
+    dt->encoding = allocate_buffer(h, len);
+    assert(dt->encoding != INVALID_ADDRESS);
+    assert(buffer_write(dt->encoding, buffer_ref(source, 0), len));
+    source->start += len;
+    dt->holder = holder;
+    dt->loaded = td ? td->loaded : 0;
+    deferred_lock();
+    if (!deferred_tuples) {
+        deferred_tuples = allocate_table(h, identity_key, pointer_equal);
+        assert(deferred_tuples != INVALID_ADDRESS);
+    }
+    table_set(deferred_tuples, t, dt);
+    deferred_unlock();
+}
+
+boolean is_deferred_tuple(tuple t)
+{
+    return find_deferred_tuple(t, false) != 0;
+}
+
+/* Returns the attachment of a deferred tuple that has not been loaded yet. */
+void *deferred_tuple_attachment(tuple t, bytes *length)
+{
+    deferred_tuple dt = find_deferred_tuple(t, false);
+    if (!dt)
+        return 0;
+    buffer b = alloca_wrap_buffer(buffer_ref(dt->encoding, 0), buffer_length(dt->encoding));
+    pop_varint(b);
+    *length = pop_varint(b);
+    return buffer_ref(b, 0);
+}
+
+void load_deferred_tuple(tuple t)
+{
+    deferred_tuple dt = find_deferred_tuple(t, true);
+    if (!dt)
+        return;
+    tuple_debug("%s: t %p, holder %p\n", func_ss, t, dt->holder);
+    buffer b = dt->encoding;
+    pop_varint(b);  /* number of entries */
+    buffer_consume(b, pop_varint(b));   /* attachment */
+    table dictionary = allocate_table(dt->h, identity_key, pointer_equal);
+    assert(dictionary != INVALID_ADDRESS);
+    drecord(dictionary, t);
+    struct tuple_deferral td = {
+        .h = dt->h,
+        .loaded = dt->loaded,
+    };
+    decode_value_internal(dt->h, dictionary, b, 0, 0, false, &td, dt->holder);
+    if (!dt->loaded || !apply(dt->loaded, dt->holder, t, dictionary))
+        deallocate_table(dictionary);
+    free_deferred_tuple(dt);
+}
+
+static tuple decode_deferred_ref(heap h, table dictionary, buffer source, u64 *total,
+                                 u64 *obsolete, boolean old_encoding, tuple_deferral td)
+{
+    tuple c = decode_value_internal(h, dictionary, source, total, obsolete, old_encoding, td, 0);
+    u64 index = pop_varint(source);
+    if (!c || !is_tuple(c))
+        halt("invalid deferred tuple reference, offset %d\n", source->start);
+    deferred_tuple_load(c);
+    table d = (td && td->dictionaries) ? table_find(td->dictionaries, c) : 0;
+    tuple t = d ? table_find(d, pointer_from_u64(index)) : 0;
+    if (!t)
+        halt("deferred tuple reference not found: 0x%lx, offset %d\n", index, source->start);
+    tuple_debug("decode_value: deferred reference %p:0x%lx -> %p\n", c, index, t);
+    drecord(dictionary, t);
+    return t;
+}
+
 // h is for buffer values, copy them out
 // would be nice to merge into a tuple dest, but it changes the loop and makes
 // it weird in the reference case
-value decode_value(heap h, table dictionary, buffer source, u64 *total,
-                   u64 *obsolete, boolean old_encoding)
+static value decode_value_internal(heap h, table dictionary, buffer source, u64 *total,
+                                   u64 *obsolete, boolean old_encoding, tuple_deferral td,
+                                   tuple holder)
 {
     u8 type;
     boolean imm;
     u64 len = pop_header(source, &imm, &type, old_encoding);
     tuple_debug("%s: type %d, imm %d, len %d\n", func_ss, type, imm, len);
 
-    if (type == type_tuple) {
+    if ((type == type_tuple) || (type == type_deferred_ref)) {
         tuple t;
     
-        if (imm == immediate) {
+        if (type == type_deferred_ref) {
+            t = decode_deferred_ref(h, dictionary, source, total, obsolete, old_encoding, td);
+        } else if (imm == immediate) {
             t = allocate_tuple();
             tuple_debug("decode_value: immediate, alloced tuple %v\n", t);
             drecord(dictionary, t);
@@ -383,6 +526,9 @@ value decode_value(heap h, table dictionary, buffer source, u64 *total,
             t = pop_indirect_value(dictionary, source);
         }
 
+        /* the contents of a deferred tuple must be loaded before they are modified */
+        if (len > 0)
+            deferred_tuple_load(t);
         for (int i = 0; i < len ; i++) {
             u8 nametype;
             // nametype is always buffer. can we use that bit?
@@ -398,10 +544,17 @@ value decode_value(heap h, table dictionary, buffer source, u64 *total,
                 if (!s)
                     halt("indirect symbol not found: 0x%lx, offset %d\n", nlen, source->start);
             }
-            set_new_value(t, s, h, dictionary, source, total, obsolete, old_encoding);
+            set_new_value(t, s, h, dictionary, source, total, obsolete, old_encoding, td);
         }
         tuple_debug("decode_value: decoded tuple %v\n", t);
         return t;
+    } else if (type == type_deferred) {
+        assert(imm == immediate);
+        tuple t = allocate_tuple();
+        tuple_debug("decode_value: deferred tuple %p, length %ld\n", t, len);
+        drecord(dictionary, t);
+        decode_deferred(h, t, holder, source, len, total, td);
+        return t;
     } else if (type == type_vector) {
         vector v;
         if (imm == immediate) {
@@ -414,7 +567,7 @@ value decode_value(heap h, table dictionary, buffer source, u64 *total,
         }
         for (int i = 0; i < len; i++)
             set_new_value(v, integer_key(i), h, dictionary, source, total, obsolete,
-                          old_encoding);
+                          old_encoding, td);
         tuple_debug("decode_value: decoded vector %v\n", v);
         return v;
     } else if (type == type_integer) {
@@ -474,6 +627,12 @@ value decode_value(heap h, table dictionary, buffer source, u64 *total,
     }
 }
 
+value decode_value(heap h, table dictionary, buffer source, u64 *total,
+                   u64 *obsolete, boolean old_encoding, tuple_deferral td)
+{
+    return decode_value_internal(h, dictionary, source, total, obsolete, old_encoding, td, 0);
+}
+
 void encode_symbol(buffer dest, table dictionary, symbol s)
 {
     u64 ind;
@@ -493,17 +652,76 @@ static void encode_string(buffer dest, string s)
     assert(push_buffer(dest, s));
 }
 
-static void encode_tuple_internal(buffer dest, table dictionary, tuple t, u64 *total, table visited);
-static void encode_vector_internal(buffer dest, table dictionary, vector v, u64 *total, table visited);
+typedef struct encoder {
+    table dictionary;
+    u64 *total;
+    table visited;
+    tuple_deferral td;
+    tuple container;    /* deferred tuple whose contents are being encoded */
+} *encoder;
+
+static void deferral_set_location(tuple_deferral td, value v, tuple container, u64 index)
+{
+    deferred_location l = table_find(td->locations, v);
+    if (!l) {
+        l = allocate(td->h, sizeof(*l));
+        assert(l != INVALID_ADDRESS);
+        table_set(td->locations, v, l);
+    }
+    l->container = container;
+    l->index = index;
+}
+
+/* Records the locations of the values within a loaded deferred tuple, given the dictionary of its
+ * contents. */
+void deferral_record_locations(tuple_deferral td, tuple t, table dictionary)
+{
+    table_foreach(dictionary, k, v) {
+        if ((v != t) && is_composite(v))
+            deferral_set_location(td, v, t, u64_from_pointer(k));
+    }
+}
+
+static void encoder_record(encoder enc, value v)
+{
+    srecord(enc->dictionary, v);
+    if (enc->container && is_composite(v))
+        deferral_set_location(enc->td, v, enc->container, enc->dictionary->count);
+}
+
+/* Encodes a reference to a tuple that has already been encoded, either directly or within a
+ * deferred tuple; returns false if the tuple has not been encoded. */
+static boolean encode_tuple_reference(buffer dest, encoder enc, tuple t, u64 count)
+{
+    u64 d = u64_from_pointer(table_find(enc->dictionary, t));
+    if (d) {
+        push_header(dest, reference, type_tuple, count);
+        push_varint(dest, d);
+        return true;
+    }
+    deferred_location l;
+    if (!enc->td || !enc->td->locations || !(l = table_find(enc->td->locations, t)))
+        return false;
+    tuple_debug("%s: t %p in deferred tuple %p at index 0x%lx\n", func_ss, t, l->container,
+                l->index);
+    push_header(dest, reference, type_deferred_ref, count);
+    assert(encode_tuple_reference(dest, enc, l->container, 0));
+    push_varint(dest, l->index);
+    srecord(enc->dictionary, t);
+    return true;
+}
+
+static void encode_tuple_internal(buffer dest, encoder enc, tuple t, tuple holder, symbol a);
+static void encode_vector_internal(buffer dest, encoder enc, vector v);
 static void encode_integer(buffer dest, value v);
-static void encode_value_internal(buffer dest, table dictionary, value v, u64 *total, table visited)
+static void encode_value_internal(buffer dest, encoder enc, value v, tuple holder, symbol a)
 {
     if (!v) {
         push_header(dest, immediate, type_buffer, 0);
     } else if (is_tuple(v)) {
-        encode_tuple_internal(dest, dictionary, (tuple)v, total, visited);
+        encode_tuple_internal(dest, enc, (tuple)v, holder, a);
     } else if (is_vector(v)) {
-        encode_vector_internal(dest, dictionary, (vector)v, total, visited);
+        encode_vector_internal(dest, enc, (vector)v);
     } else if (is_integer(v)) {
         encode_integer(dest, v);
     } else if (tagof(v) == tag_string /* not untyped */) {
@@ -521,28 +739,29 @@ static void encode_value_internal(buffer dest, table dictionary, value v, u64 *t
 
 // could close over encoder!
 // these are special cases of a slightly more general scheme
-void encode_eav(buffer dest, table dictionary, tuple e, symbol a, value v, u64 *obsolete)
+void encode_eav(buffer dest, table dictionary, tuple e, symbol a, value v, u64 *obsolete,
+                tuple_deferral td)
 {
     // this can be push value really..dont need to assume that its already
     // been rooted - merge these two cases - maybe methodize the tuple interface
     // (set/get/iterate)
-    u64 d = u64_from_pointer(table_find(dictionary, e));
-    if (d) {
-        tuple_debug("encode_eav: e (%v) indirect at index 0x%lx\n", e, d);
-        push_header(dest, reference, type_tuple, 1);
-        push_varint(dest, d);
-    } else {
+    table visited = allocate_table(transient, identity_key, pointer_equal);
+    assert(visited != INVALID_ADDRESS);
+    struct encoder enc = {
+        .dictionary = dictionary,
+        .visited = visited,
+        .td = td,
+    };
+    if (!encode_tuple_reference(dest, &enc, e, 1)) {
         tuple_debug("encode_eav: e (%v) immediate at index 0x%lx\n",
                     e, dictionary->count + 1);
         push_header(dest, immediate, type_tuple, 1);
         srecord(dictionary, e);
     }
-    table visited = allocate_table(transient, identity_key, pointer_equal);
-    assert(visited != INVALID_ADDRESS);
     table_set(visited, e, (void *)1);
     tuple_debug("   encoding symbol \"%b\" with value %v\n", symbol_string(a), v);
     encode_symbol(dest, dictionary, a);
-    encode_value_internal(dest, dictionary, v, 0, visited);
+    encode_value_internal(dest, &enc, v, e, a);
     deallocate_table(visited);
     if (obsolete) {
         value old_v = get(e, a);
@@ -568,49 +787,114 @@ closure_function(1, 2, boolean, encode_value_count_each,
     return true;
 }
 
-closure_function(4, 2, boolean, encode_tuple_each,
-                 buffer, dest, table, dictionary, u64 *, total, table, visited,
+closure_function(3, 2, boolean, encode_tuple_each,
+                 buffer, dest, encoder, enc, tuple, t,
                  value s, value v)
 {
     assert(is_symbol(s));
     tuple_debug("   s %b, v %p, tag %d\n", symbol_string(s), v, tagof(v));
     if (no_encode(v))
         return true;
-    encode_symbol(bound(dest), bound(dictionary), s);
-    encode_value_internal(bound(dest), bound(dictionary), v, bound(total), bound(visited));
-    if (bound(total))
-        (*bound(total))++;
+    encoder enc = bound(enc);
+    encode_symbol(bound(dest), enc->dictionary, s);
+    encode_value_internal(bound(dest), enc, v, bound(t), s);
+    if (enc->total)
+        (*enc->total)++;
+    return true;
+}
+
+/* Encodes in deferred form a tuple that has not been loaded yet, or that is selected by the
+ * deferral handler. */
+static boolean encode_deferred(buffer dest, encoder enc, tuple t, tuple holder, symbol a)
+{
+    deferred_tuple dt = find_deferred_tuple(t, false);
+    if (dt) {
+        /* copy the original encoding */
+        buffer encoding = dt->encoding;
+        push_header(dest, immediate, type_deferred, buffer_length(encoding));
+        assert(push_buffer(dest, encoding));
+        if (enc->total) {
+            buffer b = alloca_wrap_buffer(buffer_ref(encoding, 0), buffer_length(encoding));
+            *enc->total += pop_varint(b);
+        }
+        encoder_record(enc, t);
+        return true;
+    }
+    tuple_deferral td = enc->td;
+    if (!td || !td->defer || !holder)
+        return false;
+    buffer attachment = allocate_buffer(transient, 16);
+    assert(attachment != INVALID_ADDRESS);
+    if (!apply(td->defer, holder, a, t, attachment)) {
+        deallocate_buffer(attachment);
+        return false;
+    }
+    tuple_debug("%s: t %p, holder %p, attachment length %ld\n", func_ss, t, holder,
+                buffer_length(attachment));
+    encoder_record(enc, t);
+    u64 entries = 0;
+    struct encoder contents_enc = {
+        .dictionary = allocate_table(transient, identity_key, pointer_equal),
+        .total = &entries,
+        .visited = enc->visited,
+        .td = td,
+        .container = t,
+    };
+    assert(contents_enc.dictionary != INVALID_ADDRESS);
+    srecord(contents_enc.dictionary, t);
+    buffer contents = allocate_buffer(transient, 256);
+    assert(contents != INVALID_ADDRESS);
+    encode_tuple_internal(contents, &contents_enc, t, 0, 0);
+    deallocate_table(contents_enc.dictionary);
+    buffer b = allocate_buffer(transient, buffer_length(attachment) + buffer_length(contents) +
+                                          2 * sizeof(u64));
+    assert(b != INVALID_ADDRESS);
+    push_varint(b, entries);
+    push_varint(b, buffer_length(attachment));
+    assert(push_buffer(b, attachment));
+    assert(push_buffer(b, contents));
+    push_header(dest, immediate, type_deferred, buffer_length(b));
+    assert(push_buffer(dest, b));
+    deallocate_buffer(b);
+    deallocate_buffer(contents);
+    deallocate_buffer(attachment);
+    if (enc->total)
+        *enc->total += entries;
     return true;
 }
 
-static void encode_tuple_internal(buffer dest, table dictionary, tuple t, u64 *total, table visited)
+static void encode_tuple_internal(buffer dest, encoder enc, tuple t, tuple holder, symbol a)
 {
-    tuple_debug("%s: dest %p, dictionary %p, tuple %p\n", func_ss, dest, dictionary, t);
-    u64 d = u64_from_pointer(table_find(dictionary, t));
+    tuple_debug("%s: dest %p, dictionary %p, tuple %p\n", func_ss, dest, enc->dictionary, t);
     u64 count = 0;
 
-    if (!(visited && table_find(visited, t)))
+    if (!(enc->visited && table_find(enc->visited, t)))
         iterate(t, stack_closure(encode_value_count_each, &count));
 
-    if (d) {
-        push_header(dest, reference, type_tuple, count);
-        push_varint(dest, d);
-    } else {
+    if (!encode_tuple_reference(dest, enc, t, count)) {
+        if (encode_deferred(dest, enc, t, holder, a))
+            return;
         push_header(dest, immediate, type_tuple, count);
-        srecord(dictionary, t);
+        encoder_record(enc, t);
     }
 
     if (count > 0) {
-        table_set(visited, t, (void *)1);
-        iterate(t, stack_closure(encode_tuple_each, dest, dictionary, total, visited));
+        table_set(enc->visited, t, (void *)1);
+        iterate(t, stack_closure(encode_tuple_each, dest, enc, t));
     }
 }
 
-void encode_tuple(buffer dest, table dictionary, tuple t, u64 *total)
+void encode_tuple(buffer dest, table dictionary, tuple t, u64 *total, tuple_deferral td)
 {
     table visited = allocate_table(transient, identity_key, pointer_equal);
     assert(visited != INVALID_ADDRESS);
-    encode_tuple_internal(dest, dictionary, t, total, visited);
+    struct encoder enc = {
+        .dictionary = dictionary,
+        .total = total,
+        .visited = visited,
+        .td = td,
+    };
+    encode_tuple_internal(dest, &enc, t, 0, 0);
     deallocate_table(visited);
 }
 
@@ -618,29 +902,35 @@ void encode_value(buffer dest, table dictionary, value v, u64 *total)
 {
     table visited = allocate_table(transient, identity_key, pointer_equal);
     assert(visited != INVALID_ADDRESS);
-    encode_value_internal(dest, dictionary, v, total, visited);
+    struct encoder enc = {
+        .dictionary = dictionary,
+        .total = total,
+        .visited = visited,
+    };
+    encode_value_internal(dest, &enc, v, 0, 0);
     deallocate_table(visited);
 }
 
-closure_function(4, 2, boolean, encode_vector_each,
-                 buffer, dest, table, dictionary, u64 *, total, table, visited,
+closure_function(2, 2, boolean, encode_vector_each,
+                 buffer, dest, encoder, enc,
                  value a, value v)
 {
     tuple_debug("   a %v, v %p, tag %d\n", a, v, tagof(v));
     if (no_encode(v))
         v = 0;                  /* must retain order - encode null instead? */
-    encode_value_internal(bound(dest), bound(dictionary), v, bound(total), bound(visited));
-    if (bound(total))
-        (*bound(total))++;
+    encoder enc = bound(enc);
+    encode_value_internal(bound(dest), enc, v, 0, 0);
+    if (enc->total)
+        (*enc->total)++;
     return true;
 }
 
-static void encode_vector_internal(buffer dest, table dictionary, vector v, u64 *total, table visited)
+static void encode_vector_internal(buffer dest, encoder enc, vector v)
 {
-    tuple_debug("%s: dest %p, dictionary %p, vector %v\n", func_ss, dest, dictionary, v);
-    u64 d = u64_from_pointer(table_find(dictionary, v));
+    tuple_debug("%s: dest %p, dictionary %p, vector %v\n", func_ss, dest, enc->dictionary, v);
+    u64 d = u64_from_pointer(table_find(enc->dictionary, v));
     u64 count;
-    if (!(visited && table_find(visited, v)))
+    if (!(enc->visited && table_find(enc->visited, v)))
         count = vector_length(v);
     else
         count = 0;
@@ -649,11 +939,11 @@ static void encode_vector_internal(buffer dest, table dictionary, vector v, u64
         push_varint(dest, d);
     } else {
         push_header(dest, immediate, type_vector, count);
-        srecord(dictionary, v);
+        encoder_record(enc, v);
     }
     if (count > 0) {
-        table_set(visited, v, (void *)1);
-        iterate(v, stack_closure(encode_vector_each, dest, dictionary, total, visited));
+        table_set(enc->visited, v, (void *)1);
+        iterate(v, stack_closure(encode_vector_each, dest, enc));
     }
 }
 
@@ -689,9 +979,13 @@ void deallocate_value(value v)
     case tag_symbol:
         /* no safe way to dealloc symbols yet */
         break;
-    case tag_table_tuple:
+    case tag_table_tuple: {
+        deferred_tuple dt = find_deferred_tuple((tuple)v, true);
+        if (dt)
+            free_deferred_tuple(dt);
         deallocate_table((table)v);
         break;
+    }
     case tag_function_tuple:
         /* XXX No standard interface to remove function tuple...release a refcount? */
         break;
@@ -715,4 +1009,5 @@ void init_integers(heap h)
 void init_tuples(heap h)
 {
     theap = h;
+    deferred_lock_init();
 }
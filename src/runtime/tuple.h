@@ -31,13 +31,40 @@ tuple clone_tuple(tuple t);
 void destruct_value(value v, boolean recursive);
 void deallocate_value(value t);
 
-void encode_tuple(buffer dest, table dictionary, tuple t, u64 *total);
+/* Location of a tuple or vector within a deferred tuple */
+typedef struct deferred_location {
+    tuple container;
+    u64 index;
+} *deferred_location;
+
+/* Selects the tuples (values of attribute a in holder) to be encoded in deferred form, and writes
+ * their attachment. */
+closure_type(tuple_defer, boolean, tuple holder, symbol a, tuple t, buffer attachment);
+
+/* Invoked when a deferred tuple is loaded, with the dictionary of its contents; returns true if
+ * the handler takes ownership of the dictionary. */
+closure_type(deferred_tuple_handler, boolean, tuple holder, tuple t, table dictionary);
+
+typedef struct tuple_deferral {
+    heap h;
+    table locations;        /* encoding: value -> deferred_location */
+    tuple_defer defer;      /* encoding: selects tuples to be encoded in deferred form */
+    table dictionaries;     /* decoding: loaded deferred tuple -> dictionary */
+    deferred_tuple_handler loaded;  /* decoding */
+} *tuple_deferral;
+
+void encode_tuple(buffer dest, table dictionary, tuple t, u64 *total, tuple_deferral td);
 
 // h is for the bodies, the space for symbols and tuples are both implicit
 void *decode_value(heap h, table dictionary, buffer source, u64 *total,
-                   u64 *obsolete, boolean old_encoding);
+                   u64 *obsolete, boolean old_encoding, tuple_deferral td);
 void encode_eav(buffer dest, table dictionary, tuple e, symbol a, value v,
-                u64 *obsolete);
+                u64 *obsolete, tuple_deferral td);
+
+void deferral_record_locations(tuple_deferral td, tuple t, table dictionary);
+boolean is_deferred_tuple(tuple t);
+void *deferred_tuple_attachment(tuple t, bytes *length);
+void load_deferred_tuple(tuple t);
 
 value indirect_integer_from_u64(u64 n);
 value indirect_integer_from_s64(s64 n);
@@ -48,6 +75,14 @@ static inline boolean is_tuple(value v)
     return tag == tag_table_tuple || tag == tag_function_tuple;
 }
 
+/* Loads the contents of a deferred tuple, if not loaded yet; a deferred tuple is empty until
+ * loaded, so non-empty tuples are skipped without a lookup. */
+static inline void deferred_tuple_load(tuple t)
+{
+    if ((tagof(t) == tag_table_tuple) && (t->t.count == 0))
+        load_deferred_tuple(t);
+}
+
 static inline boolean is_symbol(value v)
 {
     return tagof(v) == tag_symbol;
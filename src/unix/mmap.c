@@ -43,8 +43,22 @@ static struct {
     closure_struct(rbnode_handler, pf_print);
 
     struct list pf_freelist;
+
+    /* background collapse of small pages into huge pages */
+    process thp_process;
+    u64 thp_scan_addr;
+    u64 *thp_collapse_pages;
+    struct timer thp_collapse_timer;
+    closure_struct(timer_handler, thp_collapse_scan);
+
+    /* physical memory compaction */
+    u32 compact_pending;
+    timestamp compact_deferred;
+    closure_struct(thunk, compact);
 } mmap_info;
 
+static void mmap_compact_request(void);
+
 static status demand_page_internal(process p, context ctx, u64 vaddr, vmap vm, pending_fault *pf);
 
 closure_func_basic(thunk, void, pending_fault_complete)
@@ -53,6 +67,7 @@ closure_func_basic(thunk, void, pending_fault_complete)
     process p = pf->p;
     context ctx = pf->ctx;
     u64 vaddr = pf->addr;
+    psi_resource stall = (pf->type == PENDING_FAULT_ANONYMOUS) ? PSI_MEM : PSI_IO;
     vmap_lock(p);
     vmap vm = vmap_from_vaddr(p, vaddr);
     status s;
@@ -67,7 +82,8 @@ closure_func_basic(thunk, void, pending_fault_complete)
         if (is_ok(s))
             /* File read-ahead must be done without holding the vmap lock, because it can suspend
              * the current context. */
-            ra = irange(pf->filebacked.node_offset + PAGESIZE,
+            ra = irange(pf->filebacked.node_offset +
+                        (pf->filebacked.large ? PAGESIZE_2M : PAGESIZE),
                         vm->node_offset + range_span(vm->node.r));
         else
             ra = irange(1, 0);  /* dummy invalid range */
@@ -81,6 +97,7 @@ closure_func_basic(thunk, void, pending_fault_complete)
         msg_err("page fill failed with %v\n", s);
     }
     demand_page_done(ctx, vaddr, s);
+    psi_stall_end(stall);
     context_schedule_return(ctx);
     if (pn) {
         if (range_valid(ra)) {
@@ -187,6 +204,8 @@ boolean new_zeroed_pages(u64 v, vmap vm, pageflags flags)
         return true;
     void *m;
     while ((m = allocate(mmap_info.virtual_backed, page_size)) == INVALID_ADDRESS) {
+        if (page_size == PAGESIZE_2M)
+            mmap_compact_request();
         if (page_size == PAGESIZE) {
             vmap_debug("%s: cannot get physical page\n", func_ss);
             return false;
@@ -287,6 +306,64 @@ closure_func_basic(thunk, void, pending_fault_filebacked)
     pagecache_get_page(pf->filebacked.pn, pf->filebacked.node_offset, h);
 }
 
+closure_func_basic(status_handler, void, pending_fault_large_page_fetched,
+                   status s)
+{
+    pending_fault pf = struct_from_closure(pending_fault, filebacked.large_page_fetched);
+    thunk t;
+    if (is_ok(s)) {
+        t = (thunk)&pf->complete;
+    } else {
+        /* fall back to fetching a small page */
+        timm_dealloc(s);
+        pf->filebacked.large = false;
+        pf->filebacked.node_offset += pf->addr & MASK(PAGELOG_2M) & ~PAGEMASK;
+        t = init_closure_func(&pf->async_handler, thunk, pending_fault_filebacked);
+    }
+    apply(t);
+}
+
+closure_func_basic(thunk, void, pending_fault_filebacked_large)
+{
+    pending_fault pf = struct_from_closure(pending_fault, async_handler);
+    status_handler sh = init_closure_func(&pf->filebacked.large_page_fetched, status_handler,
+                                          pending_fault_large_page_fetched);
+    pagecache_node_fetch_pages(pf->filebacked.pn, irangel(pf->filebacked.node_offset, PAGESIZE_2M),
+                               0, sh);
+}
+
+closure_func_basic(entry_handler, boolean, vmap_pte_absent,
+                   int level, u64 vaddr, pteptr entry)
+{
+    pte e = pte_from_pteptr(entry);
+    return !pte_is_present(e) || !pte_is_mapping(level, e);
+}
+
+/* Read-only file mappings can be backed by large pagecache pages where the mapping and the file
+ * contents are 2MB-aligned with each other, and the file extends over the whole large page. */
+static boolean filebacked_large_page_allowed(vmap vm, u64 page_addr, u64 node_offset)
+{
+    if ((mmap_info.thp_max_size < PAGESIZE_2M) ||
+        (vm->flags & (VMAP_FLAG_WRITABLE | VMAP_FLAG_TAIL_BSS)))
+        return false;
+    if ((page_addr < vm->node.r.start) || (page_addr + PAGESIZE_2M > vm->node.r.end) ||
+        (node_offset & MASK(PAGELOG_2M)) ||
+        (node_offset + PAGESIZE_2M > pagecache_get_node_length(vm->cache_node)))
+        return false;
+    return traverse_ptes(page_addr, PAGESIZE_2M, stack_closure_func(entry_handler, vmap_pte_absent));
+}
+
+static boolean mmap_filebacked_large_page(vmap vm, u64 page_addr, u64 node_offset,
+                                          pageflags flags)
+{
+    void *kvirt = pagecache_get_large_page_if_filled(vm->cache_node, node_offset);
+    if (kvirt == INVALID_ADDRESS)
+        return false;
+    pf_debug("   mapping large page at 0x%lx, node_offset 0x%lx\n", page_addr, node_offset);
+    map(page_addr, physical_from_virtual(kvirt), PAGESIZE_2M, flags);
+    return true;
+}
+
 static status demand_filebacked_page(process p, context ctx, u64 vaddr, vmap vm, pending_fault *pf)
 {
     pageflags flags = pageflags_from_vmflags(vm->flags);
@@ -308,9 +385,14 @@ static status demand_filebacked_page(process p, context ctx, u64 vaddr, vmap vm,
         return timm("result", "out of range page");
     }
 
+    u64 large_addr = vaddr & ~MASK(PAGELOG_2M);
+    u64 large_offset = node_offset - (page_addr - large_addr);
+    boolean large = filebacked_large_page_allowed(vm, large_addr, large_offset);
     void *kvirt;
     status s;
     if (!*pf) {
+        if (large && mmap_filebacked_large_page(vm, large_addr, large_offset, flags))
+            return STATUS_OK;
         kvirt = pagecache_get_page_if_filled(pn, node_offset);
         if (kvirt != INVALID_ADDRESS)
             return mmap_filebacked_page(vm, page_addr, flags, kvirt);
@@ -319,13 +401,32 @@ static status demand_filebacked_page(process p, context ctx, u64 vaddr, vmap vm,
             pagecache_node_ref(pn);
             new_pf->type = PENDING_FAULT_FILEBACKED;
             new_pf->filebacked.pn = pn;
-            new_pf->filebacked.node_offset = node_offset;
-            init_closure_func(&new_pf->async_handler, thunk, pending_fault_filebacked);
+            new_pf->filebacked.large = large;
+            if (large) {
+                new_pf->filebacked.node_offset = large_offset;
+                init_closure_func(&new_pf->async_handler, thunk, pending_fault_filebacked_large);
+            } else {
+                new_pf->filebacked.node_offset = node_offset;
+                init_closure_func(&new_pf->async_handler, thunk, pending_fault_filebacked);
+            }
         }
         *pf = new_pf;
         return STATUS_OK;
     }
-    if (((*pf)->filebacked.pn != pn) || ((*pf)->filebacked.node_offset != node_offset))
+    if ((*pf)->filebacked.pn != pn)
+        return STATUS_OK;
+    if ((*pf)->filebacked.large) {
+        if (!large || ((*pf)->filebacked.node_offset != large_offset) ||
+            mmap_filebacked_large_page(vm, large_addr, large_offset, flags))
+            return STATUS_OK;
+
+        /* The large page cannot be mapped (e.g. because some of its pages were already in the
+         * cache as small pages): map a small page if available, otherwise retry the fault. */
+        kvirt = pagecache_get_page_if_filled(pn, node_offset);
+        return (kvirt != INVALID_ADDRESS) ? mmap_filebacked_page(vm, page_addr, flags, kvirt) :
+                                            STATUS_OK;
+    }
+    if ((*pf)->filebacked.node_offset != node_offset)
         return STATUS_OK;
     kvirt = (*pf)->filebacked.page_kvirt;
     if (kvirt == INVALID_ADDRESS)
@@ -394,6 +495,7 @@ status do_demand_page(process p, context ctx, u64 vaddr, vmap vm, boolean *done)
     if (pf) {
         if (pf != INVALID_ADDRESS) {
             demand_page_major_fault(ctx);
+            psi_stall_begin((pf->type == PENDING_FAULT_ANONYMOUS) ? PSI_MEM : PSI_IO);
             async_apply_bh((thunk)&pf->async_handler);
             *done = false;
         } else {
@@ -1112,9 +1214,13 @@ closure_function(1, 1, boolean, vmap_unmap,
     return true;
 }
 
+static void lazyfree_remove_range_locked(process p, range q);
+static void lazyfree_update_cleaner(process p);
+
 static void process_remove_range_locked(process p, range q, boolean unmap)
 {
     vmap_debug("%s: q %R\n", func_ss, q);
+    lazyfree_remove_range_locked(p, q);
     vmap_handler vh = unmap ? stack_closure(vmap_unmap, p) : 0;
     rangemap_range_lookup(p->vmaps, q,
                           (rmnode_handler)stack_closure(vmap_remove_intersection, p->vmaps, q, vh));
@@ -1380,13 +1486,160 @@ static sysreturn munmap(void *addr, u64 length)
     vmap_lock(p);
     process_remove_range_locked(p, irangel(where, pad(length, PAGESIZE)), true);
     vmap_unlock(p);
+    lazyfree_update_cleaner(p);
     return 0;
 }
 
+closure_function(2, 1, boolean, lazyfree_remove_intersection,
+                 rangemap, lazyfree, range, q,
+                 rmnode n)
+{
+    rangemap_insert_hole(bound(lazyfree), range_intersection(bound(q), n->r));
+    return true;
+}
+
+static void lazyfree_remove_range_locked(process p, range q)
+{
+    rangemap_range_lookup(p->lazyfree, q,
+                          stack_closure(lazyfree_remove_intersection, p->lazyfree, q));
+}
+
+closure_function(2, 1, boolean, lazyfree_reclaim_vmap,
+                 range, q, u64 *, cleaned,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    if (((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS) &&
+        !(vm->flags & VMAP_FLAG_SHARED)) {
+        range ri = range_intersection(bound(q), n->r);
+        *bound(cleaned) += unmap_and_free_clean_phys(ri.start, range_span(ri));
+    }
+    return true;
+}
+
+/* Frees lazily freed pages that have not been written to since the MADV_FREE call. The address
+ * space scanned in a call is bounded, since the vmap lock is held with interrupts disabled. */
+closure_func_basic(mem_cleaner, u64, mmap_lazyfree_cleaner,
+                   u64 clean_bytes)
+{
+    process p = struct_from_field(closure_self(), process, lazyfree_cleaner);
+    u64 cleaned = 0;
+    u64 scanned = 0;
+
+    /* memory cleaners may be invoked with the vmap lock held (e.g. when handling a page fault) */
+    u64 flags = irq_disable_save();
+    if (!spin_try(&p->vmap_lock)) {
+        irq_restore(flags);
+        return 0;
+    }
+    rmnode n;
+    while ((cleaned < clean_bytes) && (scanned < MMAP_LAZYFREE_SCAN_MAX) &&
+           ((n = rangemap_first_node(p->lazyfree)) != INVALID_ADDRESS)) {
+        range q = irangel(n->r.start, MIN(range_span(n->r), MMAP_LAZYFREE_SCAN_MAX - scanned));
+        lazyfree_remove_range_locked(p, q);
+        rangemap_range_lookup(p->vmaps, q, stack_closure(lazyfree_reclaim_vmap, q, &cleaned));
+        scanned += range_span(q);
+    }
+    spin_unlock_irq(&p->vmap_lock, flags);
+    vmap_debug("%s: cleaned %ld bytes\n", func_ss, cleaned);
+    return cleaned;
+}
+
+/* The lazyfree cleaner is registered only while the process has lazily freed ranges; called
+ * without the vmap lock held after the ranges may have changed. The cleaner cannot unregister
+ * itself, so after it has reclaimed all ranges it is unregistered by the next call. */
+static void lazyfree_update_cleaner(process p)
+{
+    spin_lock(&p->lazyfree_lock);
+    vmap_lock(p);
+    boolean needed = (rangemap_first_node(p->lazyfree) != INVALID_ADDRESS);
+    vmap_unlock(p);
+    if (needed != p->lazyfree_registered) {
+        mem_cleaner cleaner = (mem_cleaner)&p->lazyfree_cleaner;
+        if (needed ? mm_register_mem_cleaner(cleaner) : mm_unregister_mem_cleaner(cleaner))
+            p->lazyfree_registered = needed;
+    }
+    spin_unlock(&p->lazyfree_lock);
+}
+
 closure_function(2, 1, boolean, madvise_vmap_validate,
                  int, advice, sysreturn *, rv,
                  rmnode n)
 {
+    vmap vm = (vmap)n;
+    int type = vm->flags & VMAP_MMAP_TYPE_MASK;
+    switch (bound(advice)) {
+    case MADV_DONTNEED:
+        if (type == VMAP_MMAP_TYPE_CUSTOM)
+            goto invalid;
+        break;
+    case MADV_FREE:
+        if ((type != VMAP_MMAP_TYPE_ANONYMOUS) || (vm->flags & VMAP_FLAG_SHARED))
+            goto invalid;
+        break;
+    case MADV_POPULATE_READ:
+    case MADV_POPULATE_WRITE:
+        if (type == VMAP_MMAP_TYPE_CUSTOM)
+            goto invalid;
+        break;
+    }
+    return true;
+  invalid:
+    *bound(rv) = -EINVAL;
+    return false;
+}
+
+closure_function(3, 1, boolean, madvise_vmap_apply,
+                 process, p, range, q, int, advice,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    range ri = range_intersection(bound(q), n->r);
+    int type = vm->flags & VMAP_MMAP_TYPE_MASK;
+    u64 node_offset = vm->node_offset + (ri.start - n->r.start);
+    switch (bound(advice)) {
+    case MADV_DONTNEED:
+        lazyfree_remove_range_locked(bound(p), ri);
+        if (type == VMAP_MMAP_TYPE_ANONYMOUS)
+            unmap_and_free_phys(ri.start, range_span(ri));
+        else if (type == VMAP_MMAP_TYPE_FILEBACKED)
+            /* private copies are discarded, the next access reads the file contents; shared
+             * mappings stay registered with the page cache */
+            pagecache_node_release_mapped_pages(vm->cache_node, ri, node_offset);
+        break;
+    case MADV_FREE:
+#ifdef PAGE_DIRTY
+        /* writes after this point set the dirty bit again, and prevent the page from being freed */
+        clean_mapped_pages(ri.start, range_span(ri));
+        if ((rangemap_count(bound(p)->lazyfree) < MMAP_LAZYFREE_MAX_RANGES) &&
+            rangemap_insert_range(bound(p)->lazyfree, ri))
+            break;
+#endif
+        /* cannot detect subsequent writes, or too many ranges: free right away */
+        unmap_and_free_phys(ri.start, range_span(ri));
+        break;
+    case MADV_WILLNEED:
+        if (type == VMAP_MMAP_TYPE_FILEBACKED)
+            pagecache_node_fetch_pages(vm->cache_node, irangel(node_offset, range_span(ri)), 0, 0);
+        break;
+    case MADV_COLD:
+        if (type == VMAP_MMAP_TYPE_FILEBACKED)
+            pagecache_node_deactivate(vm->cache_node, irangel(node_offset, range_span(ri)));
+        break;
+    }
+    return true;
+}
+
+/* Faults in pages as if they were written to (e.g. to break copy-on-write sharing), without
+ * altering their contents. */
+static boolean populate_writable(void *buf, bytes length)
+{
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return false;
+    for (u64 a = u64_from_pointer(buf); a < u64_from_pointer(buf) + length; a += PAGESIZE)
+        fetch_and_add(pointer_from_u64(a), 0);
+    context_clear_err(ctx);
     return true;
 }
 
@@ -1402,6 +1655,13 @@ sysreturn madvise(void *addr, s64 length, int advice)
     case MADV_NOHUGEPAGE:
         clear_mask = VMAP_FLAG_THP;
         break;
+    case MADV_DONTNEED:
+    case MADV_FREE:
+    case MADV_WILLNEED:
+    case MADV_COLD:
+    case MADV_POPULATE_READ:
+    case MADV_POPULATE_WRITE:
+        break;
     default:
         return 0;   /* ignore non-supported advice values */
     }
@@ -1414,10 +1674,15 @@ sysreturn madvise(void *addr, s64 length, int advice)
     vmap_lock(p);
     int res = rangemap_range_lookup_with_gaps(vmaps, q, vmap_handler, gap_handler);
     if (res == RM_MATCH) {
-        while (range_span(q)) {
-            vmap vm = (vmap)rangemap_lookup(vmaps, q.start);
-            vmap_update_flags_intersection(vmaps, q, clear_mask, set_mask, vm);
-            q.start = MIN(q.end, vm->node.r.end);
+        if (clear_mask || set_mask) {
+            range r = q;
+            while (range_span(r)) {
+                vmap vm = (vmap)rangemap_lookup(vmaps, r.start);
+                vmap_update_flags_intersection(vmaps, r, clear_mask, set_mask, vm);
+                r.start = MIN(r.end, vm->node.r.end);
+            }
+        } else {
+            rangemap_range_lookup(vmaps, q, stack_closure(madvise_vmap_apply, p, q, advice));
         }
         rv = 0;
     } else {
@@ -1425,9 +1690,334 @@ sysreturn madvise(void *addr, s64 length, int advice)
             rv = -ENOMEM;
     }
     vmap_unlock(p);
+    if (rv == 0) {
+        if (advice == MADV_POPULATE_READ) {
+            if (!fault_in_user_memory(addr, range_span(q), false))
+                rv = -EFAULT;
+        } else if (advice == MADV_POPULATE_WRITE) {
+            if (!validate_user_memory_permissions(p, addr, range_span(q), VMAP_FLAG_WRITABLE, 0) ||
+                !populate_writable(addr, range_span(q)))
+                rv = -EFAULT;
+        } else if ((advice == MADV_FREE) || (advice == MADV_DONTNEED)) {
+            lazyfree_update_cleaner(p);
+        }
+    }
     return rv;
 }
 
+static boolean vmap_is_thp_collapsible(vmap vm)
+{
+    if (!(vm->flags & VMAP_FLAG_THP) || (vm->flags & VMAP_FLAG_SHARED))
+        return false;
+    if (vm->flags & VMAP_FLAG_MMAP)
+        return ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS);
+    return !!(vm->flags & VMAP_FLAG_HEAP);
+}
+
+closure_function(1, 3, boolean, thp_count_ptes,
+                 u64 *, count,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if (!pte_is_present(e) || !pte_is_mapping(level, e))
+        return true;
+    if (pte_map_size(level, e) != PAGESIZE) {
+        /* already mapped with a large page */
+        *bound(count) = 0;
+        return false;
+    }
+    (*bound(count))++;
+    return true;
+}
+
+static boolean thp_collapse_range(process p, vmap vm, u64 vaddr)
+{
+    u64 populated = 0;
+    traverse_ptes(vaddr, PAGESIZE_2M, stack_closure(thp_count_ptes, &populated));
+    if (populated < THP_COLLAPSE_MIN_PAGES)
+        return false;
+
+    /* lazily freed pages must retain their dirty state */
+    if (rangemap_range_intersects(p->lazyfree, irangel(vaddr, PAGESIZE_2M)))
+        return false;
+    void *m = allocate(mmap_info.virtual_backed, PAGESIZE_2M);
+    if (m == INVALID_ADDRESS) {
+        mmap_compact_request();
+        return false;
+    }
+    boolean collapsed = false;
+    if (!(physical_from_virtual(m) & MASK(PAGELOG_2M)) && pagecache_block_direct_io()) {
+        collapsed = collapse_pages(vaddr, m, pageflags_from_vmflags(vm->flags),
+                                   mmap_info.thp_collapse_pages);
+        pagecache_unblock_direct_io();
+    }
+    if (!collapsed)
+        deallocate(mmap_info.virtual_backed, m, PAGESIZE_2M);
+    pf_debug("%s: vaddr 0x%lx, %ld pages populated, %s\n", func_ss, vaddr, populated,
+             collapsed ? ss("collapsed") : ss("not collapsed"));
+    return collapsed;
+}
+
+/* Scans THP-eligible mappings, resuming from where the previous scan stopped, and collapses
+ * sufficiently populated 2MB ranges into huge pages. */
+closure_func_basic(timer_handler, void, thp_collapse_scan,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    process p = mmap_info.thp_process;
+    int budget = THP_COLLAPSE_SCAN_RANGES;
+    vmap_lock(p);
+    u64 addr = mmap_info.thp_scan_addr;
+    rmnode n = rangemap_lookup_at_or_next(p->vmaps, addr);
+    while (n != INVALID_ADDRESS) {
+        vmap vm = (vmap)n;
+        if (vmap_is_thp_collapsible(vm)) {
+            addr = pad(MAX(addr, n->r.start), PAGESIZE_2M);
+            while ((budget > 0) && (addr + PAGESIZE_2M <= n->r.end)) {
+                thp_collapse_range(p, vm, addr);
+                addr += PAGESIZE_2M;
+                budget--;
+            }
+            if (budget == 0)
+                break;
+        }
+        n = rangemap_next_node(p->vmaps, n);
+    }
+    mmap_info.thp_scan_addr = (n == INVALID_ADDRESS) ? 0 : addr;
+    vmap_unlock(p);
+}
+
+/* Physical memory compaction: small pages of private anonymous mappings are movable, and are
+ * migrated out of the 2MB physical blocks where all other pages are free, so that these blocks
+ * become available for huge page allocations. */
+
+#define COMPACT_BLOCK_PAGES (PAGESIZE_2M >> PAGELOG)
+
+typedef struct compact_block {
+    u64 phys;
+    u64 movable;
+    u64 reserved_pages;
+    u64 reserved[COMPACT_BLOCK_PAGES / 64];
+    u64 recorded;
+    boolean valid;
+    struct page_migration pm[COMPACT_BLOCK_PAGES];
+} *compact_block;
+
+static boolean vmap_is_movable(vmap vm)
+{
+    if (vm->flags & VMAP_FLAG_SHARED)
+        return false;
+    if (vm->flags & VMAP_FLAG_MMAP)
+        return ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS);
+    return !!(vm->flags & (VMAP_FLAG_HEAP | VMAP_FLAG_STACK));
+}
+
+closure_function(1, 1, boolean, compact_phys_limit,
+                 u64 *, limit,
+                 range r)
+{
+    *bound(limit) = MAX(*bound(limit), r.end);
+    return true;
+}
+
+closure_function(2, 3, boolean, compact_mark_movable,
+                 u64 *, movable, u64, pages,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if ((level == PT_PTE_LEVEL) && pte_is_present(e)) {
+        u64 page = page_from_pte(e) >> PAGELOG;
+        if (page < bound(pages))
+            bound(movable)[page >> 6] |= U64_FROM_BIT(page & 63);
+    }
+    return true;
+}
+
+/* Selects the blocks that need the least migrations. */
+closure_function(4, 1, boolean, compact_select_blocks,
+                 id_heap, physical, u64 *, movable, compact_block, blocks, int *, nblocks,
+                 range r)
+{
+    compact_block blocks = bound(blocks);
+    int nblocks = *bound(nblocks);
+    for (u64 b = pad(r.start, PAGESIZE_2M); b + PAGESIZE_2M <= r.end; b += PAGESIZE_2M) {
+        u64 *w = bound(movable) + (b >> (PAGELOG + 6));
+        u64 movable = 0;
+        for (int i = 0; i < COMPACT_BLOCK_PAGES / 64; i++)
+            for (u64 x = w[i]; x; x &= x - 1)
+                movable++;
+        if (!movable || ((nblocks == THP_COMPACT_BLOCKS) &&
+                         (movable >= blocks[nblocks - 1].movable)))
+            continue;
+        u64 free = id_heap_free_in_range(bound(physical), b, PAGESIZE_2M) >> PAGELOG;
+        if (movable + free != COMPACT_BLOCK_PAGES)
+            continue;   /* some pages are not movable */
+        int i = MIN(nblocks, THP_COMPACT_BLOCKS - 1);
+        for (; (i > 0) && (blocks[i - 1].movable > movable); i--) {
+            blocks[i].phys = blocks[i - 1].phys;
+            blocks[i].movable = blocks[i - 1].movable;
+        }
+        blocks[i].phys = b;
+        blocks[i].movable = movable;
+        if (nblocks < THP_COMPACT_BLOCKS)
+            nblocks++;
+    }
+    *bound(nblocks) = nblocks;
+    return true;
+}
+
+closure_function(2, 3, boolean, compact_record_pages,
+                 compact_block, blocks, int, nblocks,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if ((level != PT_PTE_LEVEL) || !pte_is_present(e))
+        return true;
+    u64 phys = page_from_pte(e);
+    for (int i = 0; i < bound(nblocks); i++) {
+        compact_block cb = &bound(blocks)[i];
+        if (!point_in_range(irangel(cb->phys, PAGESIZE_2M), phys))
+            continue;
+        page_migration pm = &cb->pm[(phys - cb->phys) >> PAGELOG];
+        if (pm->vaddr)
+            cb->valid = false;  /* mapped more than once */
+        else
+            pm->vaddr = vaddr;
+        cb->recorded++;
+        break;
+    }
+    return true;
+}
+
+static void compact_block_reserve(id_heap physical, compact_block cb)
+{
+    cb->reserved_pages = 0;
+    zero(cb->reserved, sizeof(cb->reserved));
+    for (int i = 0; i < COMPACT_BLOCK_PAGES; i++) {
+        if (id_heap_set_area(physical, cb->phys + (i << PAGELOG), PAGESIZE, true, true)) {
+            cb->reserved[i / 64] |= U64_FROM_BIT(i % 64);
+            cb->reserved_pages++;
+        }
+    }
+}
+
+static void compact_block_release(id_heap physical, compact_block cb)
+{
+    for (int i = 0; i < COMPACT_BLOCK_PAGES; i++)
+        if (cb->reserved[i / 64] & U64_FROM_BIT(i % 64))
+            deallocate_u64((heap)physical, cb->phys + (i << PAGELOG), PAGESIZE);
+}
+
+/* Returns true if the block has been freed entirely. */
+static boolean compact_block_migrate(id_heap physical, compact_block cb)
+{
+    page_migration pm = cb->pm;
+    int count = 0;
+    for (int i = 0; i < COMPACT_BLOCK_PAGES; i++) {
+        if (!pm[i].vaddr)
+            continue;
+        u64 phys = allocate_u64((heap)physical, PAGESIZE);
+        if (phys == INVALID_PHYSICAL) {
+            for (int j = 0; j < count; j++)
+                deallocate_u64((heap)physical, pm[j].phys, PAGESIZE);
+            compact_block_release(physical, cb);
+            return false;
+        }
+        pm[count].vaddr = pm[i].vaddr;
+        pm[count++].phys = phys;
+    }
+    migrate_pages(pm, count);
+    boolean migrated = true;
+    for (int i = 0; i < count; i++) {
+        if (!pm[i].entry) {
+            deallocate_u64((heap)physical, pm[i].phys, PAGESIZE);
+            migrated = false;
+        }
+    }
+    if (migrated) {
+        /* all pages in the block are now owned by this function */
+        deallocate_u64((heap)physical, cb->phys, PAGESIZE_2M);
+    } else {
+        for (int i = 0; i < count; i++)
+            if (pm[i].entry)
+                deallocate_u64((heap)physical, pm[i].phys, PAGESIZE);
+        compact_block_release(physical, cb);
+    }
+    return migrated;
+}
+
+closure_func_basic(thunk, void, mmap_compact)
+{
+    process p = mmap_info.thp_process;
+    id_heap physical = heap_physical(get_kernel_heaps());
+    u64 limit = 0;
+    id_heap_range_foreach(physical, stack_closure(compact_phys_limit, &limit));
+    u64 pages = limit >> PAGELOG;
+    bytes movable_size = pad(pages, 64) >> 3;
+    u64 *movable = allocate_zero(mmap_info.h, movable_size);
+    bytes blocks_size = THP_COMPACT_BLOCKS * sizeof(struct compact_block);
+    compact_block blocks = allocate(mmap_info.h, blocks_size);
+    int nblocks = 0;
+    int compacted = 0;
+    if ((movable == INVALID_ADDRESS) || (blocks == INVALID_ADDRESS))
+        goto out;
+    vmap_lock(p);
+    rangemap_foreach(p->vmaps, n) {
+        if (vmap_is_movable((vmap)n))
+            traverse_ptes(n->r.start, range_span(n->r),
+                          stack_closure(compact_mark_movable, movable, pages));
+    }
+    id_heap_range_foreach(physical, stack_closure(compact_select_blocks, physical, movable,
+                                                  blocks, &nblocks));
+    for (int i = 0; i < nblocks; i++) {
+        compact_block cb = &blocks[i];
+        zero(cb->pm, sizeof(cb->pm));
+        cb->recorded = 0;
+        cb->valid = true;
+        compact_block_reserve(physical, cb);
+    }
+    rangemap_foreach(p->vmaps, n) {
+        if (vmap_is_movable((vmap)n))
+            traverse_ptes(n->r.start, range_span(n->r),
+                          stack_closure(compact_record_pages, blocks, nblocks));
+    }
+
+    /* in-flight direct I/O may be transferring data to or from the pages being moved */
+    boolean migrate = pagecache_block_direct_io();
+    for (int i = 0; i < nblocks; i++) {
+        compact_block cb = &blocks[i];
+        if (!migrate || !cb->valid || (cb->reserved_pages + cb->recorded != COMPACT_BLOCK_PAGES))
+            compact_block_release(physical, cb);
+        else if (compact_block_migrate(physical, cb))
+            compacted++;
+    }
+    if (migrate)
+        pagecache_unblock_direct_io();
+    vmap_unlock(p);
+  out:
+    pf_debug("%s: %d of %d candidate blocks compacted\n", func_ss, compacted, nblocks);
+    if (movable != INVALID_ADDRESS)
+        deallocate(mmap_info.h, movable, movable_size);
+    if (blocks != INVALID_ADDRESS)
+        deallocate(mmap_info.h, blocks, blocks_size);
+    if (!compacted)
+        mmap_info.compact_deferred = now(CLOCK_ID_MONOTONIC) + seconds(THP_COMPACT_DEFER_SECONDS);
+    write_barrier();
+    mmap_info.compact_pending = false;
+}
+
+/* Called when a huge page cannot be allocated: tries to make huge pages available by compacting
+ * physical memory. */
+static void mmap_compact_request(void)
+{
+    if ((mmap_info.thp_max_size != PAGESIZE_2M) ||
+        (now(CLOCK_ID_MONOTONIC) < mmap_info.compact_deferred))
+        return;
+    if (compare_and_swap_32(&mmap_info.compact_pending, false, true))
+        async_apply_bh(init_closure_func(&mmap_info.compact, thunk, mmap_compact));
+}
+
 /* kernel start */
 extern void * START;
 
@@ -1543,6 +2133,11 @@ void mmap_process_init(process p, tuple root)
         p->mmap_min_addr = PAGESIZE;
     p->vmaps = allocate_rangemap(h);
     assert(p->vmaps != INVALID_ADDRESS);
+    p->lazyfree = allocate_rangemap(h);
+    assert(p->lazyfree != INVALID_ADDRESS);
+    spin_lock_init(&p->lazyfree_lock);
+    p->lazyfree_registered = false;
+    init_closure_func(&p->lazyfree_cleaner, mem_cleaner, mmap_lazyfree_cleaner);
     vmap_heap vmh = allocate(h, sizeof(struct vmap_heap));
     assert(vmh != INVALID_ADDRESS);
     vmh->h.alloc = vmh_alloc;
@@ -1578,6 +2173,20 @@ void mmap_process_init(process p, tuple root)
 #endif
 
     list_init(&mmap_info.pf_freelist);
+
+    init_timer(&mmap_info.thp_collapse_timer);
+    if (mmap_info.thp_max_size == PAGESIZE_2M) {
+        mmap_info.thp_collapse_pages = allocate(h, (PAGESIZE_2M >> PAGELOG) * sizeof(u64));
+        assert(mmap_info.thp_collapse_pages != INVALID_ADDRESS);
+        mmap_info.thp_process = p;
+        mmap_info.thp_scan_addr = 0;
+        mmap_info.compact_pending = false;
+        mmap_info.compact_deferred = 0;
+        timestamp t = seconds(THP_COLLAPSE_PERIOD_SECONDS);
+        register_timer(kernel_timers, &mmap_info.thp_collapse_timer, CLOCK_ID_MONOTONIC, t, false,
+                       t, init_closure_func(&mmap_info.thp_collapse_scan, timer_handler,
+                                            thp_collapse_scan));
+    }
 }
 
 void register_mmap_syscalls(struct syscall *map)
@@ -462,6 +462,12 @@ static void epoll_check_epollfds(epoll e, epoll_blocked w)
     }
 }
 
+static inline void epoll_busy_poll_arm(void)
+{
+    if (net_busy_poll)
+        runloop_busy_poll(microseconds(net_busy_poll));
+}
+
 /* It would be nice to devise a way to allow a poll waiter to continue
    to collect events between wakeup (first event) and running. */
 
@@ -496,6 +502,7 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     spin_unlock(&w->lock);
 
     epoll_debug("  continue blocking\n");
+    epoll_busy_poll_arm();
     return blockq_block_required(&bound(t)->syscall->uc, flags);
   out_wakeup:
     unwrap_buffer(w->e->h, w->user_events);
@@ -722,6 +729,7 @@ closure_function(3, 1, sysreturn, select_bh,
     }
     spin_unlock(&w->lock);
 
+    epoll_busy_poll_arm();
     return blockq_block_required(&t->syscall->uc, flags);
   out_wakeup:
     if (w->rset)
@@ -942,6 +950,7 @@ closure_function(3, 1, sysreturn, poll_bh,
     }
     spin_unlock(&w->lock);
 
+    epoll_busy_poll_arm();
     return blockq_block_required(&t->syscall->uc, flags);
   out_wakeup:
     unwrap_buffer(w->e->h, w->poll_fds);
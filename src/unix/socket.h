@@ -39,6 +39,35 @@ struct msghdr {
     int msg_flags;
 };
 
+struct cmsghdr {
+    u64 cmsg_len;
+    int cmsg_level;
+    int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) pad(len, sizeof(u64))
+#define CMSG_DATA(cmsg) ((void *)((cmsg) + 1))
+#define CMSG_LEN(len)   (sizeof(struct cmsghdr) + (len))
+#define CMSG_SPACE(len) (sizeof(struct cmsghdr) + CMSG_ALIGN(len))
+
+/* Ancillary data iterators: the control buffer of the message header must be accessible (for
+ * user memory, an error context must be set). */
+static inline struct cmsghdr *cmsg_first(const struct msghdr *mh)
+{
+    return (mh->msg_controllen >= sizeof(struct cmsghdr)) ? mh->msg_control : 0;
+}
+
+static inline struct cmsghdr *cmsg_next(const struct msghdr *mh, struct cmsghdr *cmsg)
+{
+    if (cmsg->cmsg_len < sizeof(struct cmsghdr))
+        return 0;
+    cmsg = (void *)cmsg + CMSG_ALIGN(cmsg->cmsg_len);
+    void *end = mh->msg_control + mh->msg_controllen;
+    if (((void *)(cmsg + 1) > end) || ((void *)cmsg + CMSG_ALIGN(cmsg->cmsg_len) > end))
+        return 0;
+    return cmsg;
+}
+
 struct mmsghdr {
     struct msghdr msg_hdr;
     unsigned int msg_len;
@@ -207,6 +207,33 @@ static u32 cpu_online_events(file f)
     return (EPOLLIN | EPOLLOUT);
 }
 
+static sysreturn pressure_read(psi_resource r, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(256);
+    psi_print(b, r);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn pressure_cpu_read(file f, void *dest, u64 length, u64 offset)
+{
+    return pressure_read(PSI_CPU, dest, length, offset);
+}
+
+static sysreturn pressure_memory_read(file f, void *dest, u64 length, u64 offset)
+{
+    return pressure_read(PSI_MEM, dest, length, offset);
+}
+
+static sysreturn pressure_io_read(file f, void *dest, u64 length, u64 offset)
+{
+    return pressure_read(PSI_IO, dest, length, offset);
+}
+
+static u32 pressure_events(file f)
+{
+    return EPOLLIN;
+}
+
 static const special_file special_files[] = {
     { ss_static_init("/dev/urandom"), .read = urandom_read, .write = 0, .events = urandom_events },
     { ss_static_init("/dev/null"), .read = null_read, .write = null_write, .events = null_events },
@@ -215,6 +242,10 @@ static const special_file special_files[] = {
       .read = mounts_read, .events = mounts_events,
       .alloc_size = sizeof(struct mounts_notify_data)},
     { ss_static_init("/proc/self/maps"), .read = maps_read, .events = maps_events, },
+    { ss_static_init("/proc/pressure/cpu"), .read = pressure_cpu_read, .events = pressure_events },
+    { ss_static_init("/proc/pressure/memory"), .read = pressure_memory_read,
+      .events = pressure_events },
+    { ss_static_init("/proc/pressure/io"), .read = pressure_io_read, .events = pressure_events },
     { ss_static_init("/sys/devices/system/cpu/online"), .read = cpu_online_read,
       .write = null_write, .events = cpu_online_events },
     FTRACE_SPECIAL_FILES
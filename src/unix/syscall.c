@@ -757,11 +757,11 @@ int unix_file_new(filesystem fs, tuple md, int type, int flags, fsfile fsf)
     f->fsf = fsf;
     u64 length;
     if (fsf) {
+        pagecache_node pn = fsfile_get_cachenode(fsf);
         if (flags & O_DIRECT) {
-            f->fs_read = fsfile_get_reader(fsf);
-            f->fs_write = fsfile_get_writer(fsf);
+            f->fs_read = pagecache_node_get_direct_reader(pn);
+            f->fs_write = pagecache_node_get_direct_writer(pn);
         } else {
-            pagecache_node pn = fsfile_get_cachenode(fsf);
             f->fs_read = pagecache_node_get_reader(pn);
             f->fs_write = pagecache_node_get_writer(pn);
         }
@@ -2081,6 +2081,57 @@ sysreturn ioctl_generic(fdesc f, unsigned long request, vlist ap)
     }
 }
 
+closure_function(2, 2, void, file_trim_complete,
+                 filesystem, fs, struct fstrim_range *, range,
+                 status s, bytes len)
+{
+    sysreturn rv;
+    if (is_ok(s)) {
+        rv = set_user_value(&bound(range)->len, len) ? 0 : -EFAULT;
+    } else {
+        rv = sysreturn_from_fs_status_value(s);
+        timm_dealloc(s);
+    }
+    filesystem_release(bound(fs));
+    syscall_return(current, rv);
+    closure_finish();
+}
+
+/* Discards the unused storage of the filesystem where the file resides; the file descriptor
+ * reference is consumed, since the calling thread may not return to the ioctl() caller. */
+static sysreturn file_trim(file f, struct fstrim_range *range)
+{
+    struct fstrim_range r;
+    filesystem fs = f->fs;
+    sysreturn rv;
+    if (!copy_from_user(range, &r, sizeof(r))) {
+        rv = -EFAULT;
+        goto out;
+    }
+    if (!fs || !fs->trim) {
+        rv = -EOPNOTSUPP;
+        goto out;
+    }
+    if (filesystem_is_readonly(fs)) {
+        rv = -EROFS;
+        goto out;
+    }
+    filesystem_reserve(fs);
+    io_status_handler completion = contextual_closure(file_trim_complete, fs, range);
+    if (completion == INVALID_ADDRESS) {
+        filesystem_release(fs);
+        rv = -ENOMEM;
+        goto out;
+    }
+    fdesc_put(&f->f);
+    u64 end = (r.len > U64_MAX - r.start) ? U64_MAX : r.start + r.len;
+    fs->trim(fs, irange(r.start, end), r.minlen, completion);
+    return thread_maybe_sleep_uninterruptible(current);
+  out:
+    fdesc_put(&f->f);
+    return rv;
+}
+
 sysreturn ioctl(int fd, unsigned long request, ...)
 {
     // checks if fd is valid
@@ -2089,6 +2140,12 @@ sysreturn ioctl(int fd, unsigned long request, ...)
     vlist args;
     sysreturn rv;
     vstart(args, request);
+    if ((request == FITRIM) &&
+        ((f->type == FDESC_TYPE_REGULAR) || (f->type == FDESC_TYPE_DIRECTORY))) {
+        rv = file_trim((file)f, varg(args, struct fstrim_range *));
+        vend(args);
+        return rv;
+    }
     if (f->ioctl)
         rv = apply(f->ioctl, request, args);
     else
@@ -2415,6 +2472,7 @@ static void syscall_context_pause(context ctx)
 {
     syscall_context sc = (syscall_context)ctx;
     syscall_accumulate_stime(sc);
+    psi_thread_running(false);
     context_release_refcount(ctx);
 }
 
@@ -2424,6 +2482,7 @@ static void syscall_context_resume(context ctx)
     assert(sc->start_time == 0); // XXX tmp debug
     timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
     sc->start_time = here == 0 ? 1 : here;
+    psi_thread_running(true);
     context_reserve_refcount(ctx);
 }
 
@@ -123,6 +123,14 @@ struct flock {
 #define FIONCLEX        0x5450
 #define FIOCLEX         0x5451
 
+#define FITRIM          0xc0185879  /* _IOWR('X', 121, struct fstrim_range) */
+
+struct fstrim_range {
+    u64 start;
+    u64 len;
+    u64 minlen;
+};
+
 #define AT_NULL         0               /* End of vector */
 #define AT_IGNORE       1               /* Entry should be ignored */
 #define AT_EXECFD       2               /* File descriptor of program */
@@ -188,8 +196,14 @@ struct flock {
 #define MS_SYNC       4
 
 /* madvise */
+#define MADV_WILLNEED       3
+#define MADV_DONTNEED       4
+#define MADV_FREE           8
 #define MADV_HUGEPAGE       14
 #define MADV_NOHUGEPAGE     15
+#define MADV_COLD           20
+#define MADV_POPULATE_READ  22
+#define MADV_POPULATE_WRITE 23
 
 typedef int clockid_t;
 
@@ -789,6 +803,7 @@ struct io_uring_params {
 #define IPPROTO_IP      0
 #define SOL_SOCKET      1
 #define SOL_TCP         6
+#define SOL_UDP         17
 #define IPPROTO_IPV6    41
 
 /* set/getsockopt optnames */
@@ -807,6 +822,8 @@ struct io_uring_params {
 #define SO_ACCEPTCONN   30
 #define SO_PROTOCOL     38
 #define SO_DOMAIN       39
+#define SO_BUSY_POLL    46
+#define SO_INCOMING_CPU 49
 
 #define IP_TOS              1
 #define IP_TTL              2
@@ -829,6 +846,9 @@ struct io_uring_params {
 #define IPV6_TCLASS         67
 #define IPV6_MINHOPCOUNT    73
 
+#define UDP_SEGMENT     103
+#define UDP_GRO         104
+
 /* eventfd flags */
 #define EFD_CLOEXEC     O_CLOEXEC
 #define EFD_NONBLOCK    O_NONBLOCK
@@ -215,6 +215,7 @@ static void thread_cputime_update(thread t)
 
 static void thread_pause(context ctx)
 {
+    psi_thread_running(false);
     if (shutting_down & SHUTDOWN_ONGOING)
         return;
     thread t = (thread)ctx;
@@ -230,6 +231,7 @@ static void thread_resume(context ctx)
     assert(t->start_time == 0); // XXX tmp debug
     timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
     t->start_time = here == 0 ? 1 : here;
+    psi_thread_running(true);
     context_frame f = thread_frame(t);
     thread_frame_restore_tls(f);
     thread_frame_restore_fpsimd(f);
@@ -240,6 +242,7 @@ static void thread_schedule_return(context ctx)
 {
     thread t = (thread)ctx;
     thread_cputime_update(t);   /* so that it is scheduled based on how much CPU time it used */
+    psi_stall_begin(PSI_CPU);  /* waiting in the run queue */
     sched_enqueue(t->scheduling_queue, &t->task);
 }
 
@@ -247,6 +250,7 @@ closure_func_basic(thunk, void, thread_return)
 {
     cpuinfo ci = current_cpu();
     thread t = struct_from_closure(thread, thread_return);
+    psi_stall_end(PSI_CPU);
     if (t->p->trap)
         runloop(); // XXX pause?
 
@@ -296,6 +300,7 @@ void thread_sleep_uninterruptible(thread t)
 {
     t->syscall->uc.blocked_on = INVALID_ADDRESS;
     thread_log(current, "sleep uninterruptible");
+    psi_stall_begin(PSI_IO);
     ftrace_thread_switch(t, 0);
     thread_unlock(t);
     syscall_yield();
@@ -319,6 +324,8 @@ void thread_wakeup(thread t)
     thread_log(current, "%s: %ld->%ld blocked_on %s, RIP=0x%lx", func_ss, current->tid, t->tid,
                bq != INVALID_ADDRESS ? blockq_name(bq) : ss("uninterruptible"),
                thread_frame(t)[SYSCALL_FRAME_PC]);
+    if (bq == INVALID_ADDRESS)
+        psi_stall_end(PSI_IO);
     sc->uc.blocked_on = 0;
     t->syscall = 0;
     context_release_refcount(&sc->uc.kc.context);
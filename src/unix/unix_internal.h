@@ -66,6 +66,7 @@ typedef s64 sysreturn;
 // fix config/build, remove this include to take off network
 #include <net.h>
 boolean netsyscall_init(unix_heaps uh, tuple cfg);
+extern u32 net_busy_poll;
 
 typedef struct process *process;
 typedef struct thread *thread;
@@ -274,7 +275,9 @@ typedef struct pending_fault {
             pagecache_node pn;
             u64 node_offset;
             closure_struct(pagecache_page_handler, demand_file_page);
+            closure_struct(status_handler, large_page_fetched);
             void *page_kvirt;
+            boolean large;      /* fetching a large page at node_offset */
         } filebacked;
     };
     struct list l_free;
@@ -500,6 +503,10 @@ typedef struct process {
     u64               mmap_min_addr;
     struct spinlock   vmap_lock;
     rangemap          vmaps;    /* process mappings */
+    rangemap          lazyfree; /* MADV_FREE ranges, reclaimable under memory pressure */
+    struct spinlock   lazyfree_lock;    /* serializes registration of the lazyfree cleaner */
+    boolean           lazyfree_registered;
+    closure_struct(mem_cleaner, lazyfree_cleaner);
     vmap              stack_map;
     vmap              heap_map;
     struct aux        saved_aux[NAUX];
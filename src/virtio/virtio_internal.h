@@ -127,6 +127,7 @@ physical virtqueue_used_paddr(struct virtqueue *vq);
 u16 virtqueue_entries(virtqueue vq);
 u16 virtqueue_free_entries(virtqueue vq);
 void virtqueue_set_polling(virtqueue vq, boolean enable);
+boolean virtqueue_poll(virtqueue vq);
 
 typedef struct vqmsg *vqmsg;
 
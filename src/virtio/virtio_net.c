@@ -78,6 +78,7 @@ typedef struct vnet {
     int rxbuflen;
     virtqueue *txq_map;
     vnet_rx rx;
+    u64 rx_count;
     struct virtqueue *ctl;
     u64 empty_phys;
     void *empty; // just a mac..fix, from pre-heap days
@@ -410,6 +411,16 @@ static inline u64 find_page_size(bytes each, int n)
     return MIN(1ul << find_order(each * (n + 1)), PAGESIZE_2M);
 }
 
+closure_func_basic(netif_dev_poll, boolean, virtio_net_poll)
+{
+    vnet vn = struct_from_closure(vnet, ndev.poll);
+    boolean processed = false;
+    for (u64 i = 0; i < vn->rx_count; i++)
+        if (virtqueue_poll(vn->rx[i].q))
+            processed = true;
+    return processed;
+}
+
 closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
                    tuple config)
 {
@@ -517,6 +528,8 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
     } else {
         netif_set_link_up(&vn->ndev.n);
     }
+    vn->rx_count = vq_pairs;
+    init_closure_func(&vn->ndev.poll, netif_dev_poll, virtio_net_poll);
     vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
     mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vnet_mem_cleaner));
     return true;
@@ -543,6 +556,7 @@ static void virtio_net_attach(vtdev dev)
     backed_heap contiguous = dev->contiguous;
     vnet vn = allocate(h, sizeof(struct vnet));
     assert(vn != INVALID_ADDRESS);
+    netif_dev_init(&vn->ndev);
     init_closure_func(&vn->ndev.setup, netif_dev_setup, virtio_net_setup);
     vn->net_header_len = (dev->features & VIRTIO_F_VERSION_1) ||
         (dev->features & VIRTIO_NET_F_MRG_RXBUF) != 0 ?
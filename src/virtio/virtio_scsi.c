@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <errno.h>
 #include <virtio/scsi.h>
 #include <storage.h>
 
@@ -428,6 +429,10 @@ closure_func_basic(storage_req_handler, void, virtio_scsi_req_handler,
     case STORAGE_OP_WRITE:
         virtio_scsi_io(d, SCSI_CMD_WRITE_16, req->data, req->blocks, req->completion);
         break;
+    case STORAGE_OP_DISCARD:
+    case STORAGE_OP_WRITE_ZEROES:
+        async_apply_status_handler(req->completion, storage_unsupported_status());
+        break;
     }
 }
 
@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <errno.h>
 #include <storage.h>
 
 #include "virtio_internal.h"
@@ -12,12 +13,20 @@
 #define virtio_blk_debug(x, ...)
 #endif
 
+// payload of discard and write zeroes requests
+struct virtio_blk_discard_write_zeroes {
+    u64 sector;
+    u32 num_sectors;
+    u32 flags;
+} __attribute__((packed));
+
 // this is not really a struct...fix the general encoding problem
 typedef struct virtio_blk_req {
     u32 type;
     u32 reserved;
     u64 sector;
     u8 status;
+    struct virtio_blk_discard_write_zeroes seg;
 } __attribute__((packed)) *virtio_blk_req;
 
 // device configuration offsets
@@ -60,6 +69,8 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_F_FLUSH      U64_FROM_BIT(9)
 #define VIRTIO_BLK_F_TOPOLOGY   U64_FROM_BIT(10)
 #define VIRTIO_BLK_F_CONFIG_WCE U64_FROM_BIT(11)
+#define VIRTIO_BLK_F_DISCARD    U64_FROM_BIT(13)
+#define VIRTIO_BLK_F_WRITE_ZEROES   U64_FROM_BIT(14)
 
 #define VIRTIO_BLK_R_CAPACITY_LOW                (offsetof(struct virtio_blk_config *, capacity))
 #define VIRTIO_BLK_R_CAPACITY_HIGH               (offsetof(struct virtio_blk_config *, capacity) + 4)
@@ -87,13 +98,18 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
 #define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_T_DISCARD    11
+#define VIRTIO_BLK_T_WRITE_ZEROES   13
+
+#define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP  1
 
 #define VIRTIO_BLK_S_OK         0
 #define VIRTIO_BLK_S_IOERR      1
 #define VIRTIO_BLK_S_UNSUPP     2
 
 #define VIRTIO_BLK_DRIVER_FEATURES  \
-    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH)
+    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH | \
+     VIRTIO_BLK_F_DISCARD | VIRTIO_BLK_F_WRITE_ZEROES)
 
 typedef struct storage {
     vtdev v;
@@ -102,6 +118,10 @@ typedef struct storage {
     u64 capacity;
     u64 block_size;
     u32 seg_max;
+    u32 max_discard_sectors;
+    u32 discard_alignment;  /* in sectors */
+    u32 max_write_zeroes_sectors;
+    boolean write_zeroes_unmap;
 } *storage;
 
 static virtio_blk_req allocate_virtio_blk_req(storage st, u32 type, u64 sector, u64 *phys)
@@ -127,8 +147,11 @@ closure_function(4, 1, void, complete,
                  u64 len)
 {
     status st = 0;
-    // 1 is io error, 2 is unsupported operation
-    if (bound(req)->status) st = timm("result", "%d", bound(req)->status);
+    u8 req_status = bound(req)->status;
+    if (req_status == VIRTIO_BLK_S_UNSUPP)
+        st = storage_unsupported_status();
+    else if (req_status)
+        st = timm("result", "%d", req_status);
     async_apply_status_handler(bound(f), st);
     deallocate_virtio_blk_req(bound(s), bound(req), bound(phys));
     closure_finish();
@@ -245,6 +268,55 @@ static void storage_flush(storage st, status_handler s)
     vqmsg_commit(vq, m, c);
 }
 
+/* Discard and write zeroes requests carry a single segment, so a range of sectors larger than the
+ * device limit is split into multiple requests. Since discarding is only a hint to the device,
+ * sectors outside the discard alignment are left alone instead of failing the request. */
+static void virtio_storage_discard(storage st, u32 type, range sectors, status_handler sh)
+{
+    virtio_blk_debug("%s: type %d, sectors %R\n", func_ss, type, sectors);
+    u64 max_sectors;
+    u32 flags = 0;
+    if (type == VIRTIO_BLK_T_DISCARD) {
+        if (!(st->v->features & VIRTIO_BLK_F_DISCARD))
+            goto unsupported;
+        u64 align = st->discard_alignment;
+        sectors.start = ((sectors.start + align - 1) / align) * align;
+        sectors.end = MAX(sectors.start, (sectors.end / align) * align);
+        max_sectors = st->max_discard_sectors;
+    } else {
+        if (!(st->v->features & VIRTIO_BLK_F_WRITE_ZEROES))
+            goto unsupported;
+        max_sectors = st->max_write_zeroes_sectors;
+        if (st->write_zeroes_unmap)
+            flags = VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP;
+    }
+    merge m = allocate_merge(st->v->general, sh);
+    sh = apply_merge(m);
+    virtqueue vq = st->command;
+    while (range_span(sectors)) {
+        u64 req_phys;
+        virtio_blk_req req = allocate_virtio_blk_req(st, type, 0, &req_phys);
+        if (req == INVALID_ADDRESS) {
+            apply(apply_merge(m), timm_oom);
+            break;
+        }
+        u64 nsectors = MIN(range_span(sectors), max_sectors);
+        req->seg.sector = sectors.start;
+        req->seg.num_sectors = nsectors;
+        req->seg.flags = flags;
+        vqmsg msg = allocate_vqmsg(vq);
+        assert(msg != INVALID_ADDRESS);
+        vqmsg_push(vq, msg, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
+        vqmsg_push(vq, msg, req_phys + offsetof(virtio_blk_req, seg), sizeof(req->seg), false);
+        virtio_storage_io_commit(st, vq, msg, req, req_phys, apply_merge(m));
+        sectors.start += nsectors;
+    }
+    apply(sh, STATUS_OK);
+    return;
+  unsupported:
+    async_apply_status_handler(sh, storage_unsupported_status());
+}
+
 closure_func_basic(storage_req_handler, void, virtio_storage_req_handler,
                    storage_req req)
 {
@@ -268,6 +340,12 @@ closure_func_basic(storage_req_handler, void, virtio_storage_req_handler,
     case STORAGE_OP_WRITE:
         storage_rw_internal(st, true, req->data, req->blocks, req->completion);
         break;
+    case STORAGE_OP_DISCARD:
+        virtio_storage_discard(st, VIRTIO_BLK_T_DISCARD, req->blocks, req->completion);
+        break;
+    case STORAGE_OP_WRITE_ZEROES:
+        virtio_storage_discard(st, VIRTIO_BLK_T_WRITE_ZEROES, req->blocks, req->completion);
+        break;
     }
 }
 
@@ -290,6 +368,22 @@ static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
         if (v->features & VIRTIO_BLK_F_CONFIG_WCE)
             vtdev_cfg_write_1(v, VIRTIO_BLK_R_WRITEBACK, 1 /* writeback */);
     }
+    if (v->features & VIRTIO_BLK_F_DISCARD) {
+        s->max_discard_sectors = vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_DISCARD_SECTORS);
+        s->discard_alignment = vtdev_cfg_read_4(v, VIRTIO_BLK_R_DISCARD_SECTOR_ALIGNMENT);
+        if (s->max_discard_sectors == 0)
+            s->max_discard_sectors = U32_MAX;
+        if (s->discard_alignment == 0)
+            s->discard_alignment = 1;
+        virtio_blk_debug("%s: max discard sectors %d, alignment %d\n", func_ss,
+                         s->max_discard_sectors, s->discard_alignment);
+    }
+    if (v->features & VIRTIO_BLK_F_WRITE_ZEROES) {
+        s->max_write_zeroes_sectors = vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_WRITE_ZEROS_SECTORS);
+        if (s->max_write_zeroes_sectors == 0)
+            s->max_write_zeroes_sectors = U32_MAX;
+        s->write_zeroes_unmap = vtdev_cfg_read_1(v, VIRTIO_BLK_R_WRITE_ZEROS_MAY_UNMAP);
+    }
     vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
 
     apply(a, init_closure_func(&s->req_handler, storage_req_handler, virtio_storage_req_handler),
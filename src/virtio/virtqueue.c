@@ -217,6 +217,20 @@ static void vq_poll(virtqueue vq)
     }
 }
 
+/* Process used buffers without waiting for an interrupt; returns whether any buffer has been
+ * processed. */
+boolean virtqueue_poll(virtqueue vq)
+{
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    u16 last_used_idx = vq->last_used_idx;
+    vq_poll(vq);
+    boolean processed = (vq->last_used_idx != last_used_idx);
+    if (processed)
+        virtqueue_fill(vq);
+    spin_unlock_irq(&vq->lock, irqflags);
+    return processed;
+}
+
 closure_function(1, 0, void, vq_interrupt,
                  virtqueue, vq)
 {
@@ -248,6 +248,31 @@ static inline __attribute__((always_inline)) void kern_pause(void)
     asm volatile("pause");
 }
 
+#ifdef __x86_64__
+/* CRC-32C instructions, available with SSE4.2 */
+#define CRC32C_HW
+
+static inline u8 crc32c_hw_available(void)
+{
+    u32 a = 1, b, c = 0, d;
+    asm volatile("cpuid" : "+a" (a), "=b" (b), "+c" (c), "=d" (d));
+    return (c & (1 << 20)) != 0;
+}
+
+static inline __attribute__((always_inline)) u32 crc32c_hw_8(u32 crc, u8 data)
+{
+    asm("crc32b %1, %0" : "+r" (crc) : "rm" (data));
+    return crc;
+}
+
+static inline __attribute__((always_inline)) u32 crc32c_hw_64(u32 crc, u64 data)
+{
+    u64 c = crc;
+    asm("crc32q %1, %0" : "+r" (c) : "rm" (data));
+    return c;
+}
+#endif
+
 struct arch_vdso_dat {
     u8 platform_has_rdtscp;
 };
@@ -11,6 +11,8 @@
 
 #define BIGDATA "bigfile"
 #define NEWFILE "newfile"
+#define DELALLOC_FILE "delalloc"
+#define DELALLOC_BLOCKS 1024
 #define SECTOR_SIZE 512
 #define NUM_WRITE_RETRIES 2
 /* this could be up to log ext size */
@@ -84,11 +86,42 @@ out:
     return b;
 }
 
+/* Storage for buffered writes is accounted as used before the data is written back. */
+void delalloc_test(const char *path)
+{
+    struct statfs statbuf;
+
+    assert(statfs(path, &statbuf) == 0);
+    uint64_t bfree = statbuf.f_bfree;
+    int bs = statbuf.f_bsize;
+    uint8_t *buf = malloc(bs);
+    assert(buf);
+    memset(buf, 0xa5, bs);
+    int fd = open(DELALLOC_FILE, O_CREAT|O_RDWR, 0644);
+    assert(fd >= 0);
+    for (int b = 0; b < DELALLOC_BLOCKS; b++)
+        assert(write(fd, buf, bs) == bs);
+    assert(statfs(path, &statbuf) == 0);
+    printf("after buffered write of %d blocks: free blocks %lu -> %lu\n", DELALLOC_BLOCKS, bfree,
+           statbuf.f_bfree);
+    assert(bfree - statbuf.f_bfree >= DELALLOC_BLOCKS);
+    assert(fsync(fd) == 0);
+    close(fd);
+    assert(remove(DELALLOC_FILE) == 0);
+    sync();
+    usleep(1000*1000);
+    assert(statfs(path, &statbuf) == 0);
+    printf("after delete: free blocks %lu\n", statbuf.f_bfree);
+    assert(statbuf.f_bfree + MAX_FREE_BYTES/bs >= bfree);
+    free(buf);
+}
+
 int main(int argc, char **argv)
 {
     struct statfs statbuf;
     int fd;
 
+    delalloc_test(argv[0]);
     assert(statfs(argv[0], &statbuf) == 0);
     uint64_t bfree = statbuf.f_bfree;
     uint64_t btotal = statbuf.f_blocks;
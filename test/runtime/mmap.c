@@ -1471,6 +1471,68 @@ static void filebacked_sigbus_test(void)
     }
 }
 
+#define LARGEMAP_FILE_LEN   (2 * PAGESIZE_2M)
+
+/* Read-only file mappings are backed by 2MB pages when the whole 2MB range is fetched at once;
+ * the file is written with direct I/O so that none of its pages are in the cache as small pages. */
+static void filebacked_large_page_test(void)
+{
+    printf("** starting large page file mapping test\n");
+    int fd = open("largemap", O_CREAT | O_RDWR | O_DIRECT, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("open largemap");
+    test_assert(ftruncate(fd, LARGEMAP_FILE_LEN) == 0);
+    unsigned long *buf = aligned_alloc(PAGESIZE, PAGESIZE_2M);
+    test_assert(buf != NULL);
+    for (off_t offset = 0; offset < LARGEMAP_FILE_LEN; offset += PAGESIZE_2M) {
+        for (int i = 0; i < PAGESIZE_2M / sizeof(*buf); i++)
+            buf[i] = offset / sizeof(*buf) + i;
+        test_assert(pwrite(fd, buf, PAGESIZE_2M, offset) == PAGESIZE_2M);
+    }
+    close(fd);
+    free(buf);
+
+    fd = open("largemap", O_RDONLY);
+    if (fd < 0)
+        test_perror("open largemap read-only");
+    u8 *reserved = mmap(NULL, LARGEMAP_FILE_LEN + PAGESIZE_2M, PROT_NONE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    test_assert(reserved != MAP_FAILED);
+    u8 *addr = (u8 *)pad(u64_from_pointer(reserved), PAGESIZE_2M);
+    test_assert(mmap(addr, LARGEMAP_FILE_LEN, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == addr);
+
+    /* a fault anywhere in the first 2MB maps all of it */
+    unsigned long *p = (unsigned long *)addr;
+    test_assert(p[PAGESIZE / sizeof(*p) + 1] == PAGESIZE / sizeof(*p) + 1);
+    uint8_t vec[PAGESIZE_2M / PAGESIZE];
+    test_assert(mincore(addr, PAGESIZE_2M, vec) == 0);
+    for (int i = 0; i < PAGESIZE_2M / PAGESIZE; i++)
+        if (!(vec[i] & 1))
+            test_error("page %d of large page not mapped", i);
+
+    /* a range with pages already cached is mapped with small pages */
+    unsigned long val;
+    test_assert(pread(fd, &val, sizeof(val), PAGESIZE_2M) == sizeof(val));
+    test_assert(val == PAGESIZE_2M / sizeof(val));
+    for (int i = 0; i < LARGEMAP_FILE_LEN / sizeof(*p); i++)
+        if (p[i] != i)
+            test_error("largemap: unexpected value 0x%lx at index %d", p[i], i);
+
+    /* partial unmap splits the large page */
+    test_assert(munmap(addr, PAGESIZE) == 0);
+    test_assert(mincore(addr + PAGESIZE, PAGESIZE_2M - PAGESIZE, vec) == 0);
+    for (int i = 0; i < PAGESIZE_2M / PAGESIZE - 1; i++)
+        if (!(vec[i] & 1))
+            test_error("page %d of split large page not mapped", i + 1);
+    for (int i = PAGESIZE / sizeof(*p); i < PAGESIZE_2M / sizeof(*p); i++)
+        if (p[i] != i)
+            test_error("largemap after unmap: unexpected value 0x%lx at index %d", p[i], i);
+    test_assert(munmap(reserved, LARGEMAP_FILE_LEN + PAGESIZE_2M) == 0);
+    close(fd);
+    test_assert(unlink("largemap") == 0);
+    printf("** large page file mapping test passed\n");
+}
+
 static void thp_test(void)
 {
     size_t map_len = 16 * MB;
@@ -1542,6 +1604,179 @@ static void thp_test(void)
            elapsed.tv_sec, elapsed.tv_nsec, (1000000000ull / MB) * map_len / ns);
 }
 
+/* the kernel scans THP-eligible mappings every 10 seconds, collapsing populated 2MB ranges */
+#define THP_COLLAPSE_WAIT_SECONDS   25
+#define THP_COLLAPSE_MAP_LEN        (8 * MB)
+
+static struct {
+    volatile unsigned long *pages;
+    volatile int stop;
+    unsigned long iterations;
+} thp_writer;
+
+static void *thp_writer_worker(void *arg)
+{
+    unsigned long k;
+    for (k = 1; !thp_writer.stop; k++)
+        for (int i = 0; i < THP_COLLAPSE_MAP_LEN / PAGESIZE; i++)
+            thp_writer.pages[i * (PAGESIZE / sizeof(unsigned long))] = k;
+    thp_writer.iterations = k - 1;
+    return NULL;
+}
+
+/* Populates an anonymous mapping with small pages, then makes it eligible for huge pages so that
+ * it is collapsed in the background while a thread keeps writing to it: no write may be lost, and
+ * the mapping must keep working when split again by munmap and mprotect. */
+static void thp_collapse_test(void)
+{
+    size_t map_len = THP_COLLAPSE_MAP_LEN;
+    u8 *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED)
+        test_perror("mmap");
+    test_assert(madvise(addr, map_len, MADV_NOHUGEPAGE) == 0);
+    for (int i = 0; i < map_len; i += PAGESIZE)
+        memset(addr + i, i / PAGESIZE, PAGESIZE);
+    test_assert(madvise(addr, map_len, MADV_HUGEPAGE) == 0);
+
+    /* the writer only touches the first word of each page */
+    thp_writer.pages = (unsigned long *)addr;
+    thp_writer.stop = 0;
+    pthread_t pt;
+    test_assert(pthread_create(&pt, NULL, thp_writer_worker, NULL) == 0);
+    sleep(THP_COLLAPSE_WAIT_SECONDS);
+    thp_writer.stop = 1;
+    test_assert(pthread_join(pt, NULL) == 0);
+    test_assert(thp_writer.iterations > 0);
+    for (int i = 0; i < map_len / PAGESIZE; i++) {
+        u8 *page = addr + i * PAGESIZE;
+        test_assert(*(unsigned long *)page == thp_writer.iterations);
+        for (int j = sizeof(unsigned long); j < PAGESIZE; j++)
+            test_assert(page[j] == (u8)i);
+    }
+
+    /* split the (possibly) collapsed ranges */
+    u8 *hole = addr + 2 * MB + 3 * PAGESIZE;
+    test_assert(munmap(hole, PAGESIZE) == 0);
+    test_assert(mprotect(addr + 4 * MB + PAGESIZE, PAGESIZE, PROT_READ) == 0);
+    test_assert(addr[4 * MB + PAGESIZE + sizeof(unsigned long)] == (u8)(4 * MB / PAGESIZE + 1));
+    for (int i = 0; i < map_len / PAGESIZE; i++) {
+        u8 *page = addr + i * PAGESIZE;
+        if ((page == hole) || (page == addr + 4 * MB + PAGESIZE))
+            continue;
+        page[0] = 0xff;
+        test_assert(page[PAGESIZE - 1] == (u8)i);
+    }
+    test_assert(munmap(addr, map_len) == 0);
+}
+
+/* Fragments physical memory with small pages kept in use in every 2MB block, then allocates huge
+ * pages, which makes the kernel migrate the small pages elsewhere: the contents of both mappings
+ * must be preserved. */
+static void thp_compact_test(void)
+{
+    size_t frag_len = 64 * MB;
+    size_t map_len = 64 * MB;
+    u8 *frag = mmap(NULL, frag_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (frag == MAP_FAILED)
+        test_perror("mmap");
+    test_assert(madvise(frag, frag_len, MADV_NOHUGEPAGE) == 0);
+    for (int i = 0; i < frag_len; i += PAGESIZE)
+        memset(frag + i, i / PAGESIZE, PAGESIZE);
+
+    /* keep one small page out of 64 */
+    for (int i = 0; i < frag_len; i += 64 * PAGESIZE)
+        test_assert(madvise(frag + i + PAGESIZE, 63 * PAGESIZE, MADV_DONTNEED) == 0);
+
+    u8 *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED)
+        test_perror("mmap");
+    test_assert(madvise(addr, map_len, MADV_HUGEPAGE) == 0);
+    for (int i = 0; i < map_len; i += PAGESIZE)
+        memset(addr + i, ~(i / PAGESIZE), PAGESIZE);
+
+    /* compaction runs asynchronously */
+    sleep(1);
+    for (int i = 0; i < map_len; i += PAGESIZE)
+        test_assert((addr[i] == (u8)~(i / PAGESIZE)) &&
+                    (addr[i + PAGESIZE - 1] == (u8)~(i / PAGESIZE)));
+    for (int i = 0; i < frag_len; i += PAGESIZE) {
+        u8 expected = ((i / PAGESIZE) % 64) ? 0 : (u8)(i / PAGESIZE);
+        test_assert((frag[i] == expected) && (frag[i + PAGESIZE - 1] == expected));
+    }
+    test_assert(munmap(addr, map_len) == 0);
+    test_assert(munmap(frag, frag_len) == 0);
+}
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static void madvise_advice_test(void)
+{
+    size_t map_len = 4 * PAGESIZE;
+    uint8_t *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED)
+        test_perror("mmap");
+
+    /* anonymous pages read back as zero after MADV_DONTNEED */
+    memset(addr, 0xaa, map_len);
+    test_assert(madvise(addr, 2 * PAGESIZE, MADV_DONTNEED) == 0);
+    for (int i = 0; i < map_len; i++)
+        test_assert(addr[i] == ((i < 2 * PAGESIZE) ? 0 : 0xaa));
+
+    /* lazily freed pages are either zero-filled or retain their contents; pages written after
+     * MADV_FREE retain the new data */
+    memset(addr, 0x55, map_len);
+    test_assert(madvise(addr, map_len, MADV_FREE) == 0);
+    for (int i = 0; i < map_len; i++)
+        test_assert((addr[i] == 0) || (addr[i] == 0x55));
+    memset(addr, 0x66, PAGESIZE);
+    for (int i = 0; i < PAGESIZE; i++)
+        test_assert(addr[i] == 0x66);
+
+    test_assert(madvise(addr, map_len, MADV_POPULATE_READ) == 0);
+    test_assert(madvise(addr, map_len, MADV_POPULATE_WRITE) == 0);
+    test_assert(addr[0] == 0x66);
+    munmap(addr, map_len);
+
+    int fd = open("madvise_file", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("open");
+    uint8_t buf[PAGESIZE];
+    memset(buf, 0x77, sizeof(buf));
+    for (int i = 0; i < map_len / PAGESIZE; i++)
+        test_assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+    addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+        test_perror("mmap");
+    test_assert(madvise(addr, map_len, MADV_WILLNEED) == 0);
+    test_assert(madvise(addr, map_len, MADV_COLD) == 0);
+    test_assert((madvise(addr, map_len, MADV_FREE) == -1) && (errno == EINVAL));
+
+    /* private copies of file pages are dropped by MADV_DONTNEED */
+    addr[0] = 0x11;
+    test_assert(madvise(addr, PAGESIZE, MADV_DONTNEED) == 0);
+    test_assert(addr[0] == 0x77);
+    munmap(addr, map_len);
+
+    /* MADV_DONTNEED on a shared file mapping keeps the data written to the mapping, and pages
+     * written after the call are still written back to the file */
+    addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        test_perror("mmap");
+    addr[0] = 0x22;
+    test_assert(madvise(addr, map_len, MADV_DONTNEED) == 0);
+    test_assert(addr[0] == 0x22);
+    addr[PAGESIZE] = 0x33;
+    test_assert(msync(addr, map_len, MS_SYNC) == 0);
+    test_assert((pread(fd, buf, 1, 0) == 1) && (buf[0] == 0x22));
+    test_assert((pread(fd, buf, 1, PAGESIZE) == 1) && (buf[0] == 0x33));
+    munmap(addr, map_len);
+    close(fd);
+    test_assert(unlink("madvise_file") == 0);
+}
+
 static void madvise_test(void)
 {
     size_t map_len = 2 * PAGESIZE;
@@ -1554,7 +1789,10 @@ static void madvise_test(void)
     test_assert((madvise(addr, map_len, MADV_HUGEPAGE) == -1) && (errno == ENOMEM));
     munmap(addr + map_len / 2, map_len / 2);
 
+    madvise_advice_test();
     thp_test();
+    thp_collapse_test();
+    thp_compact_test();
 }
 
 int main(int argc, char * argv[])
@@ -1583,6 +1821,7 @@ int main(int argc, char * argv[])
     filebacked_test(h);
     multithread_filebacked_test(h, MT_N_THREADS);
     filebacked_sigbus_test();
+    filebacked_large_page_test();
     madvise_test();
     check_fault_in_user_memory();
 
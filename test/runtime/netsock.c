@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <net/if.h>
 #include <poll.h>
 #include <pthread.h>
@@ -24,6 +25,18 @@
 
 #define NETSOCK_TEST_PEEK_COUNT 8
 
+#define NETSOCK_TEST_REUSEPORT_PORT     1238
+#define NETSOCK_TEST_REUSEPORT_COUNT    16
+
+#define NETSOCK_TEST_GSO_PORT       1239
+#define NETSOCK_TEST_GSO_SEGSIZE    1000
+#define NETSOCK_TEST_GSO_SIZE       (10 * NETSOCK_TEST_GSO_SEGSIZE + 500)
+
+#define NETSOCK_TEST_BUSY_POLL_PORT     1240
+#define NETSOCK_TEST_BUSY_POLL_COUNT    1000
+#define NETSOCK_TEST_BUSY_POLL_USECS    50
+#define NETSOCK_TEST_BUSY_POLL_MSGLEN   64
+
 static inline void timespec_sub(struct timespec *a, struct timespec *b, struct timespec *r)
 {
     r->tv_sec = a->tv_sec - b->tv_sec;
@@ -105,6 +118,11 @@ static void netsock_test_basic(int sock_type)
         test_assert(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val == 0);
         netsock_toggle_and_check_sockopt(fd, SOL_SOCKET, SO_REUSEADDR, 1);
         netsock_toggle_and_check_sockopt(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+        netsock_toggle_and_check_sockopt(fd, SOL_SOCKET, SO_BUSY_POLL, 1);
+        /* the buffer size is doubled to account for bookkeeping overhead (same as Linux) */
+        val = 64 * KB;
+        test_assert(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, len) == 0);
+        test_assert(getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, &len) == 0 && val == 128 * KB);
         test_assert(listen(fd, 1) == 0);
         test_assert(listen(fd, 1) == 0);    /* test listen() call on already listening socket */
         test_assert(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val == 1);
@@ -122,6 +140,7 @@ static void netsock_test_basic(int sock_type)
          * behavior, and it is explicitly supported by lwIP (see SOF_INHERITED). */
         test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_REUSEADDR, &val, &len) == 0 && val == 1);
         test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_KEEPALIVE, &val, &len) == 0 && val == 1);
+        test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_RCVBUF, &val, &len) == 0 && val == 128 * KB);
         val = 0;
         test_assert(setsockopt(tx_fd, IPPROTO_TCP, TCP_NODELAY, &val, len) == 0);
 
@@ -517,7 +536,351 @@ static void netsock_test_rcvbuf(void)
         test_assert(ioctl(rx_fd, FIONREAD, &rx_avail) == 0);
     } while (rx_avail > 0);
     test_assert(rx_count == MIN(xfer_size, rcvbuf));
+
+    /* buffer sizes set via socket options are doubled (same as Linux); incoming datagrams that
+     * do not fit in the receive buffer are dropped */
+    rcvbuf = 16 * KB;
+    test_assert(setsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, optval) == 0);
+    test_assert(getsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optval) == 0);
+    test_assert(rcvbuf == 32 * KB);
+    rcvbuf = 16 * KB;
+    test_assert(setsockopt(tx_fd, SOL_SOCKET, SO_SNDBUF, &rcvbuf, optval) == 0);
+    test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_SNDBUF, &rcvbuf, &optval) == 0);
+    test_assert(rcvbuf == 32 * KB);
+    for (int i = 0; i < pkt_count; i++)
+        test_assert(send(tx_fd, pkt, sizeof(pkt), 0) == sizeof(pkt));
+    rx_count = 0;
+    do {
+        test_assert(recv(rx_fd, pkt, sizeof(pkt), 0) == sizeof(pkt));
+        rx_count += sizeof(pkt);
+        test_assert(ioctl(rx_fd, FIONREAD, &rx_avail) == 0);
+    } while (rx_avail > 0);
+    test_assert(rx_count <= 32 * KB);
+    test_assert((close(tx_fd) == 0) && (close(rx_fd) == 0));
+}
+
+static void netsock_test_udp_gso_send(int fd, uint8_t *buf, int gso_size)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr *cmsg;
+
+    for (int i = 0; i < NETSOCK_TEST_GSO_SIZE; i++)
+        buf[i] = i;
+    iov[0].iov_base = buf;
+    iov[0].iov_len = NETSOCK_TEST_GSO_SIZE / 3;
+    iov[1].iov_base = buf + iov[0].iov_len;
+    iov[1].iov_len = NETSOCK_TEST_GSO_SIZE - iov[0].iov_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (gso_size) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cmsg) = gso_size;
+    }
+    test_assert(sendmsg(fd, &msg, 0) == NETSOCK_TEST_GSO_SIZE);
+}
+
+/* Receives a train of datagrams sent with netsock_test_udp_gso_send(), and returns the number of
+ * received datagrams. */
+static int netsock_test_udp_gro_recv(int fd, uint8_t *buf, int gro)
+{
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    int received = 0, count = 0;
+
+    do {
+        iov.iov_base = buf + received;
+        iov.iov_len = NETSOCK_TEST_GSO_SIZE - received;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t rv = recvmsg(fd, &msg, 0);
+        test_assert(rv > 0);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (rv > NETSOCK_TEST_GSO_SEGSIZE) {
+            test_assert(gro && cmsg && (cmsg->cmsg_level == SOL_UDP) &&
+                        (cmsg->cmsg_type == UDP_GRO));
+            test_assert(*(int *)CMSG_DATA(cmsg) == NETSOCK_TEST_GSO_SEGSIZE);
+        } else {
+            test_assert(!cmsg);
+        }
+        received += rv;
+        count++;
+    } while (received < NETSOCK_TEST_GSO_SIZE);
+    test_assert(received == NETSOCK_TEST_GSO_SIZE);
+    for (int i = 0; i < NETSOCK_TEST_GSO_SIZE; i++)
+        test_assert(buf[i] == (uint8_t)i);
+    return count;
+}
+
+static void netsock_test_udp_gso_gro(void)
+{
+    int tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    int val;
+    socklen_t len;
+    uint8_t *buf;
+    const int seg_count = (NETSOCK_TEST_GSO_SIZE + NETSOCK_TEST_GSO_SEGSIZE - 1) /
+                          NETSOCK_TEST_GSO_SEGSIZE;
+
+    buf = malloc(NETSOCK_TEST_GSO_SIZE);
+    test_assert(buf != NULL);
+    tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(tx_fd > 0);
+    rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(rx_fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_GSO_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(rx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    /* segmentation without GRO: the receiver gets each segment as a separate datagram */
+    netsock_test_udp_gso_send(tx_fd, buf, NETSOCK_TEST_GSO_SEGSIZE);
+    test_assert(netsock_test_udp_gro_recv(rx_fd, buf, 0) == seg_count);
+
+    /* segment size set via socket option */
+    val = NETSOCK_TEST_GSO_SEGSIZE;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+    len = sizeof(val);
+    test_assert(getsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, &len) == 0);
+    test_assert(val == NETSOCK_TEST_GSO_SEGSIZE);
+    test_assert(send(tx_fd, buf, NETSOCK_TEST_GSO_SIZE, 0) == NETSOCK_TEST_GSO_SIZE);
+    test_assert(netsock_test_udp_gro_recv(rx_fd, buf, 0) == seg_count);
+
+    /* too many segments */
+    val = NETSOCK_TEST_GSO_SIZE / 100;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+    test_assert((send(tx_fd, buf, NETSOCK_TEST_GSO_SIZE, 0) == -1) && (errno == EINVAL));
+    val = 0;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+
+    /* GRO: segments that are queued in the receiving socket are coalesced */
+    val = 1;
+    test_assert(setsockopt(rx_fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0);
+    len = sizeof(val);
+    test_assert(getsockopt(rx_fd, SOL_UDP, UDP_GRO, &val, &len) == 0);
+    test_assert(val == 1);
+    netsock_test_udp_gso_send(tx_fd, buf, NETSOCK_TEST_GSO_SEGSIZE);
+    usleep(100 * 1000);
+    test_assert(netsock_test_udp_gro_recv(rx_fd, buf, 1) == 1);
+
     test_assert((close(tx_fd) == 0) && (close(rx_fd) == 0));
+    free(buf);
+}
+
+static int netsock_test_reuseport_rx(int *fds, int nfds, int sock_type)
+{
+    struct pollfd pfd[2];
+    int count = 0;
+    uint8_t buf[8];
+
+    for (int i = 0; i < nfds; i++) {
+        pfd[i].fd = fds[i];
+        pfd[i].events = POLLIN;
+    }
+    while (poll(pfd, nfds, 100) > 0) {
+        for (int i = 0; i < nfds; i++) {
+            if (!(pfd[i].revents & POLLIN))
+                continue;
+            if (sock_type == SOCK_STREAM) {
+                int conn_fd = accept(fds[i], NULL, NULL);
+                test_assert(conn_fd > 0);
+                test_assert(close(conn_fd) == 0);
+            } else {
+                test_assert(recv(fds[i], buf, sizeof(buf), 0) == sizeof(buf));
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+static void netsock_test_reuseport(int sock_type)
+{
+    int fds[2], fd;
+    struct sockaddr_in addr;
+    int val = 1;
+    socklen_t len = sizeof(val);
+    uint8_t buf[8];
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_REUSEPORT_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 2; i++) {
+        fds[i] = socket(AF_INET, sock_type, 0);
+        test_assert(fds[i] > 0);
+        netsock_toggle_and_check_sockopt(fds[i], SOL_SOCKET, SO_REUSEPORT, 1);
+        test_assert(bind(fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        if (sock_type == SOCK_STREAM)
+            test_assert(listen(fds[i], NETSOCK_TEST_REUSEPORT_COUNT) == 0);
+    }
+
+    /* a socket without SO_REUSEPORT cannot join the group, even with SO_REUSEADDR */
+    fd = socket(AF_INET, sock_type, 0);
+    test_assert(fd > 0);
+    test_assert((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) && (errno == EADDRINUSE));
+    test_assert(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) == 0);
+    test_assert((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) && (errno == EADDRINUSE));
+    test_assert(close(fd) == 0);
+
+    for (int i = 0; i < NETSOCK_TEST_REUSEPORT_COUNT; i++) {
+        fd = socket(AF_INET, sock_type, 0);
+        test_assert(fd > 0);
+        test_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        if (sock_type == SOCK_DGRAM)
+            test_assert(send(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        test_assert(close(fd) == 0);
+    }
+    test_assert(netsock_test_reuseport_rx(fds, 2, sock_type) == NETSOCK_TEST_REUSEPORT_COUNT);
+
+    /* the remaining member takes over the traffic of a closed member */
+    test_assert(close(fds[0]) == 0);
+    test_assert(getsockopt(fds[1], SOL_SOCKET, SO_REUSEPORT, &val, &len) == 0 && val == 1);
+    fd = socket(AF_INET, sock_type, 0);
+    test_assert(fd > 0);
+    test_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    if (sock_type == SOCK_DGRAM)
+        test_assert(send(fd, buf, sizeof(buf), 0) == sizeof(buf));
+    test_assert(netsock_test_reuseport_rx(&fds[1], 1, sock_type) == 1);
+    test_assert(close(fd) == 0);
+    test_assert(close(fds[1]) == 0);
+
+    /* a socket with SO_REUSEPORT cannot share the port of a socket outside a group */
+    addr.sin_port = htons(NETSOCK_TEST_REUSEPORT_PORT + 1);
+    fd = socket(AF_INET, sock_type, 0);
+    test_assert(fd > 0);
+    test_assert(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) == 0);
+    test_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    fds[0] = socket(AF_INET, sock_type, 0);
+    test_assert(fds[0] > 0);
+    test_assert(setsockopt(fds[0], SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) == 0);
+    test_assert((bind(fds[0], (struct sockaddr *)&addr, sizeof(addr)) == -1) &&
+                (errno == EADDRINUSE));
+    test_assert(close(fds[0]) == 0);
+    test_assert(close(fd) == 0);
+}
+
+static void netsock_test_busy_poll_set(int fd)
+{
+    int val = NETSOCK_TEST_BUSY_POLL_USECS;
+    socklen_t len = sizeof(val);
+    test_assert(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, len) == 0);
+    test_assert(getsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, &len) == 0);
+    test_assert(val == NETSOCK_TEST_BUSY_POLL_USECS);
+}
+
+static int netsock_test_busy_poll_epoll(int fd)
+{
+    struct epoll_event ev;
+    int efd = epoll_create1(0);
+    test_assert(efd >= 0);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    test_assert(epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) == 0);
+    return efd;
+}
+
+/* Waits for incoming data via epoll, then receives a whole message. */
+static void netsock_test_busy_poll_recv(int efd, int fd, uint8_t *buf, struct sockaddr_in *from)
+{
+    struct epoll_event ev;
+    socklen_t addr_len = sizeof(*from);
+    int rx = 0;
+
+    while (rx < NETSOCK_TEST_BUSY_POLL_MSGLEN) {
+        test_assert(epoll_wait(efd, &ev, 1, -1) == 1);
+        test_assert((ev.data.fd == fd) && (ev.events & EPOLLIN));
+        int ret = recvfrom(fd, buf + rx, NETSOCK_TEST_BUSY_POLL_MSGLEN - rx, MSG_DONTWAIT,
+                           (struct sockaddr *)from, &addr_len);
+        if ((ret < 0) && (errno == EAGAIN))
+            continue;
+        test_assert(ret > 0);
+        rx += ret;
+    }
+}
+
+static void *netsock_test_busy_poll_thread(void *arg)
+{
+    int *fds = arg;
+    int fd = fds[0];
+    uint8_t buf[NETSOCK_TEST_BUSY_POLL_MSGLEN];
+    struct sockaddr_in addr;
+
+    if (fds[1] == SOCK_STREAM) {
+        fd = accept(fds[0], NULL, NULL);
+        test_assert(fd > 0);
+        netsock_test_busy_poll_set(fd);
+    }
+    int efd = netsock_test_busy_poll_epoll(fd);
+    for (int i = 0; i < NETSOCK_TEST_BUSY_POLL_COUNT; i++) {
+        netsock_test_busy_poll_recv(efd, fd, buf, &addr);
+        if (fds[1] == SOCK_STREAM)
+            test_assert(send(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        else
+            test_assert(sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr,
+                               sizeof(addr)) == sizeof(buf));
+    }
+    test_assert(close(efd) == 0);
+    if (fd != fds[0])
+        test_assert(close(fd) == 0);
+    return NULL;
+}
+
+/* Request-response exchanges between sockets with SO_BUSY_POLL set, waiting for incoming data via
+ * epoll: the network interfaces are polled while waiting. */
+static void netsock_test_busy_poll(int sock_type)
+{
+    int fds[2], fd, efd;
+    struct sockaddr_in addr;
+    uint8_t buf[NETSOCK_TEST_BUSY_POLL_MSGLEN];
+    pthread_t pt;
+    struct timespec start, end, elapsed;
+
+    fds[0] = socket(AF_INET, sock_type, 0);
+    test_assert(fds[0] > 0);
+    fds[1] = sock_type;
+    netsock_test_busy_poll_set(fds[0]);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_BUSY_POLL_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(fds[0], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    if (sock_type == SOCK_STREAM)
+        test_assert(listen(fds[0], 1) == 0);
+    test_assert(pthread_create(&pt, NULL, netsock_test_busy_poll_thread, fds) == 0);
+
+    fd = socket(AF_INET, sock_type, 0);
+    test_assert(fd > 0);
+    netsock_test_busy_poll_set(fd);
+    test_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    efd = netsock_test_busy_poll_epoll(fd);
+    test_assert(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+    for (int i = 0; i < NETSOCK_TEST_BUSY_POLL_COUNT; i++) {
+        memset(buf, i, sizeof(buf));
+        test_assert(send(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        netsock_test_busy_poll_recv(efd, fd, buf, &addr);
+        for (int j = 0; j < sizeof(buf); j++)
+            test_assert(buf[j] == (uint8_t)i);
+    }
+    test_assert(clock_gettime(CLOCK_MONOTONIC, &end) == 0);
+    timespec_sub(&end, &start, &elapsed);
+    printf("%s(%d): %d round trips in %ld.%.9ld seconds\n", __func__, sock_type,
+           NETSOCK_TEST_BUSY_POLL_COUNT, elapsed.tv_sec, elapsed.tv_nsec);
+    test_assert(pthread_join(pt, NULL) == 0);
+    test_assert(close(efd) == 0);
+    test_assert(close(fd) == 0);
+    test_assert(close(fds[0]) == 0);
 }
 
 static void netsock_test_netconf(void)
@@ -852,6 +1215,11 @@ int main(int argc, char **argv)
     netsock_test_nonblocking_connect();
     netsock_test_peek();
     netsock_test_rcvbuf();
+    netsock_test_udp_gso_gro();
+    netsock_test_reuseport(SOCK_STREAM);
+    netsock_test_reuseport(SOCK_DGRAM);
+    netsock_test_busy_poll(SOCK_STREAM);
+    netsock_test_busy_poll(SOCK_DGRAM);
     netsock_test_netconf();
     netsock_test_msg(SOCK_STREAM);
     netsock_test_msg(SOCK_DGRAM);
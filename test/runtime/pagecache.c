@@ -0,0 +1,196 @@
+/* tests for file data caching */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+#define PAGECACHE_PAGE_SIZE 4096
+
+#define CACHED_READ_FILE_SIZE   (4 * 1024 * 1024)
+#define CACHED_READ_ITERATIONS  20000
+
+#define WORKING_SET_HOT_SIZE    (1 * 1024 * 1024)
+#define WORKING_SET_SCAN_SIZE   (32 * 1024 * 1024)
+
+#define DIRTY_WRITERS       4
+#define DIRTY_FILE_SIZE     (8 * 1024 * 1024)
+#define DIRTY_WRITE_SIZE    (64 * 1024)
+
+static void pattern_fill(unsigned long *buf, size_t len, off_t offset)
+{
+    for (size_t i = 0; i < len / sizeof(*buf); i++)
+        buf[i] = offset / sizeof(*buf) + i;
+}
+
+static void pattern_check(const unsigned long *buf, size_t len, off_t offset)
+{
+    for (size_t i = 0; i < len / sizeof(*buf); i++)
+        if (buf[i] != offset / sizeof(*buf) + i)
+            test_error("unexpected value 0x%lx at file offset 0x%lx", buf[i],
+                       offset + i * sizeof(*buf));
+}
+
+static int pattern_file_create(const char *path, size_t size)
+{
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0)
+        test_perror("open %s", path);
+    unsigned long *buf = malloc(PAGECACHE_PAGE_SIZE);
+    test_assert(buf != NULL);
+    for (off_t offset = 0; offset < size; offset += PAGECACHE_PAGE_SIZE) {
+        pattern_fill(buf, PAGECACHE_PAGE_SIZE, offset);
+        test_assert(pwrite(fd, buf, PAGECACHE_PAGE_SIZE, offset) == PAGECACHE_PAGE_SIZE);
+    }
+    free(buf);
+    return fd;
+}
+
+static void pattern_file_check(int fd, off_t start, size_t len, size_t bufsize)
+{
+    unsigned long *buf = malloc(bufsize);
+    test_assert(buf != NULL);
+    for (off_t offset = start; offset < start + len; offset += bufsize) {
+        size_t n = (start + len - offset < bufsize) ? start + len - offset : bufsize;
+        test_assert(pread(fd, buf, n, offset) == n);
+        pattern_check(buf, n, offset);
+    }
+    free(buf);
+}
+
+static void *cached_reader(void *arg)
+{
+    int fd = (long)arg;
+    unsigned int seed = gettid();
+    unsigned long buf[3 * PAGECACHE_PAGE_SIZE / sizeof(unsigned long)];
+    for (int i = 0; i < CACHED_READ_ITERATIONS; i++) {
+        /* reads of 1 to 3 pages at a word-aligned offset, so that reads may straddle pages */
+        size_t len = (1 + rand_r(&seed) % 3) * PAGECACHE_PAGE_SIZE;
+        off_t offset = (rand_r(&seed) % ((CACHED_READ_FILE_SIZE - len) / sizeof(*buf))) *
+                       sizeof(*buf);
+        test_assert(pread(fd, buf, len, offset) == len);
+        pattern_check(buf, len, offset);
+    }
+    return NULL;
+}
+
+static void cached_readers_run(int fd)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    test_assert(cpus > 0);
+    int nthreads = 2 * cpus;
+    pthread_t threads[nthreads];
+    for (int i = 0; i < nthreads; i++)
+        test_assert(pthread_create(&threads[i], NULL, cached_reader, (void *)(long)fd) == 0);
+    for (int i = 0; i < nthreads; i++)
+        test_assert(pthread_join(threads[i], NULL) == 0);
+}
+
+/* Cache hits from multiple CPUs update the page lists in per-CPU batches, which hold references to
+ * the cached pages until they are applied; the file is then removed while its pages may still be
+ * referenced by pending batches. */
+static void cached_read_test(void)
+{
+    int fd = pattern_file_create("cached", CACHED_READ_FILE_SIZE);
+    pattern_file_check(fd, 0, CACHED_READ_FILE_SIZE, PAGECACHE_PAGE_SIZE);
+    cached_readers_run(fd);
+    test_assert(unlink("cached") == 0);
+    cached_readers_run(fd);
+    close(fd);
+
+    /* a new file reusing the freed cache pages */
+    fd = pattern_file_create("cached", CACHED_READ_FILE_SIZE);
+    cached_readers_run(fd);
+    close(fd);
+    test_assert(unlink("cached") == 0);
+}
+
+/* Pages are promoted to the active list on their second access, where small reads within a page
+ * count as a single access; a file read once in sequence (the scan) is accessed while a hot file is
+ * read repeatedly, both with reads that start in the middle of pages. */
+static void working_set_test(void)
+{
+    int hot = pattern_file_create("hot", WORKING_SET_HOT_SIZE);
+    int scan = pattern_file_create("scan", WORKING_SET_SCAN_SIZE);
+    test_assert(fsync(hot) == 0);
+    test_assert(fsync(scan) == 0);
+    for (int i = 0; i < 3; i++)
+        pattern_file_check(hot, 0, WORKING_SET_HOT_SIZE, PAGECACHE_PAGE_SIZE);
+
+    /* sequential small reads: each page is read in several parts */
+    off_t part = PAGECACHE_PAGE_SIZE / 4;
+    pattern_file_check(scan, 0, WORKING_SET_SCAN_SIZE, part);
+    pattern_file_check(hot, part, WORKING_SET_HOT_SIZE - part, PAGECACHE_PAGE_SIZE);
+
+    /* the scanned file can be read again */
+    pattern_file_check(scan, 0, WORKING_SET_SCAN_SIZE, 16 * PAGECACHE_PAGE_SIZE);
+    pattern_file_check(hot, 0, WORKING_SET_HOT_SIZE, PAGECACHE_PAGE_SIZE);
+    close(scan);
+    close(hot);
+    test_assert(unlink("scan") == 0);
+    test_assert(unlink("hot") == 0);
+}
+
+static void *dirty_writer(void *arg)
+{
+    long id = (long)arg;
+    char path[16];
+    snprintf(path, sizeof(path), "dirty%ld", id);
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0)
+        test_perror("open %s", path);
+    unsigned long *buf = malloc(DIRTY_WRITE_SIZE);
+    test_assert(buf != NULL);
+
+    /* each file is written twice, so that pages are dirtied again while being written back */
+    for (int pass = 0; pass < 2; pass++) {
+        for (off_t offset = 0; offset < DIRTY_FILE_SIZE; offset += DIRTY_WRITE_SIZE) {
+            pattern_fill(buf, DIRTY_WRITE_SIZE, offset);
+            if (pass == 0)
+                buf[0] = ~buf[0];
+            test_assert(pwrite(fd, buf, DIRTY_WRITE_SIZE, offset) == DIRTY_WRITE_SIZE);
+        }
+    }
+    free(buf);
+    return (void *)(long)fd;
+}
+
+/* Concurrent buffered writers dirty pages faster than they can be written back, and may be paused
+ * until writeback catches up; the data written last must be read back and synced. */
+static void dirty_write_test(void)
+{
+    pthread_t threads[DIRTY_WRITERS];
+    int fds[DIRTY_WRITERS];
+    for (long i = 0; i < DIRTY_WRITERS; i++)
+        test_assert(pthread_create(&threads[i], NULL, dirty_writer, (void *)i) == 0);
+    for (int i = 0; i < DIRTY_WRITERS; i++) {
+        void *retval;
+        test_assert(pthread_join(threads[i], &retval) == 0);
+        fds[i] = (long)retval;
+    }
+    for (int i = 0; i < DIRTY_WRITERS; i++)
+        pattern_file_check(fds[i], 0, DIRTY_FILE_SIZE, DIRTY_WRITE_SIZE);
+    sync();
+    for (int i = 0; i < DIRTY_WRITERS; i++) {
+        char path[16];
+        pattern_file_check(fds[i], 0, DIRTY_FILE_SIZE, DIRTY_WRITE_SIZE);
+        test_assert(fsync(fds[i]) == 0);
+        close(fds[i]);
+        snprintf(path, sizeof(path), "dirty%d", i);
+        test_assert(unlink(path) == 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    cached_read_test();
+    working_set_test();
+    dirty_write_test();
+    printf("pagecache test passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/* tests for pressure stall information files in /proc/pressure */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+#define PRESSURE_BUF_SIZE   256
+#define PRESSURE_SPIN_NS    500000000ull
+
+typedef struct pressure_line {
+    double avg[3];
+    unsigned long long total;
+} pressure_line;
+
+typedef struct pressure {
+    pressure_line some;
+    pressure_line full;
+} pressure;
+
+static int pressure_read_file(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        test_perror("open %s", path);
+    int len = 0;
+    while (len < size - 1) {
+        int rv = read(fd, buf + len, size - 1 - len);
+        if (rv < 0)
+            test_perror("read %s", path);
+        if (rv == 0)
+            break;
+        len += rv;
+    }
+    buf[len] = '\0';
+    close(fd);
+    return len;
+}
+
+static void pressure_parse_line(const char *line, const char *name, pressure_line *pl)
+{
+    char kind[8];
+    char end;
+    int rv = sscanf(line, "%7s avg10=%lf avg60=%lf avg300=%lf total=%llu%c", kind, &pl->avg[0],
+                    &pl->avg[1], &pl->avg[2], &pl->total, &end);
+    if ((rv != 6) || (end != '\n'))
+        test_error("invalid line '%s'", line);
+    test_assert(!strcmp(kind, name));
+    for (int i = 0; i < 3; i++)
+        test_assert((pl->avg[i] >= 0) && (pl->avg[i] <= 100));
+}
+
+static void pressure_get(const char *resource, pressure *p)
+{
+    char path[64];
+    char buf[PRESSURE_BUF_SIZE];
+    snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+    int len = pressure_read_file(path, buf, sizeof(buf));
+    test_assert((len > 0) && (buf[len - 1] == '\n'));
+    char *full = strchr(buf, '\n') + 1;
+    test_assert(strchr(full, '\n') == buf + len - 1);
+    pressure_parse_line(buf, "some", &p->some);
+    pressure_parse_line(full, "full", &p->full);
+
+    /* the "full" state is a subset of the "some" state */
+    test_assert(p->full.total <= p->some.total);
+}
+
+static void pressure_format_test(void)
+{
+    const char *resources[] = { "cpu", "memory", "io" };
+    for (int i = 0; i < sizeof(resources) / sizeof(resources[0]); i++) {
+        pressure p, q;
+        pressure_get(resources[i], &p);
+        pressure_get(resources[i], &q);
+        test_assert(q.some.total >= p.some.total);
+        test_assert(q.full.total >= p.full.total);
+    }
+
+    /* reads at an offset return the rest of the contents */
+    char buf[PRESSURE_BUF_SIZE];
+    int fd = open("/proc/pressure/io", O_RDONLY);
+    if (fd < 0)
+        test_perror("open");
+    test_assert(read(fd, buf, 4) == 4);
+    test_assert(!memcmp(buf, "some", 4));
+    test_assert(read(fd, buf, 5) == 5);
+    test_assert(!memcmp(buf, " avg1", 5));
+    close(fd);
+}
+
+static unsigned long long ns_now(void)
+{
+    struct timespec ts;
+    test_assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *pressure_spin(void *arg)
+{
+    unsigned long long end = ns_now() + PRESSURE_SPIN_NS;
+    while (ns_now() < end);
+    return NULL;
+}
+
+/* More runnable threads than CPUs make threads wait in the run queue. */
+static void pressure_cpu_test(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    test_assert(cpus > 0);
+    int nthreads = 2 * cpus + 1;
+    pthread_t threads[nthreads];
+    pressure before, after;
+    pressure_get("cpu", &before);
+    for (int i = 0; i < nthreads; i++)
+        test_assert(pthread_create(&threads[i], NULL, pressure_spin, NULL) == 0);
+    for (int i = 0; i < nthreads; i++)
+        test_assert(pthread_join(threads[i], NULL) == 0);
+    pressure_get("cpu", &after);
+    test_assert(after.some.total > before.some.total);
+}
+
+int main(int argc, char **argv)
+{
+    pressure_format_test();
+    pressure_cpu_test();
+    printf("pressure test passed\n");
+    return EXIT_SUCCESS;
+}
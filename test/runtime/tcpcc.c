@@ -0,0 +1,149 @@
+/* TCP congestion control test: transfers data over the loopback interface with each available
+ * congestion control algorithm; packet loss and latency are emulated by the netem klib (see
+ * tcpcc.manifest). */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+#define TCPCC_TEST_PORT     1240
+#define TCPCC_TEST_SIZE     (4 * MB)
+
+static const char *tcpcc_algos[] = {"reno", "cubic", "bbr"};
+
+static void tcpcc_set(int fd, const char *algo)
+{
+    char name[16];
+    socklen_t len = sizeof(name);
+
+    test_assert(setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, algo, strlen(algo)) == 0);
+    test_assert(getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, &len) == 0);
+    test_assert(!strcmp(name, algo));
+}
+
+static void *tcpcc_sender(void *arg)
+{
+    const char *algo = arg;
+    struct sockaddr_in addr;
+    uint8_t buf[8 * KB];
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    tcpcc_set(fd, algo);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(TCPCC_TEST_PORT);
+    test_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    for (size_t sent = 0; sent < TCPCC_TEST_SIZE; ) {
+        size_t len = MIN(sizeof(buf), TCPCC_TEST_SIZE - sent);
+        for (size_t i = 0; i < len; i++)
+            buf[i] = (sent + i) & 0xff;
+        ssize_t rv = write(fd, buf, len);
+        test_assert(rv > 0);
+        sent += rv;
+    }
+
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    test_assert(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0);
+    int sndbuf;
+    len = sizeof(sndbuf);
+    test_assert(getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0);
+    printf("  %s: cwnd %u, ssthresh %u, rtt %u us, retransmits %u, send buffer %d\n", algo,
+           info.tcpi_snd_cwnd, info.tcpi_snd_ssthresh, info.tcpi_rtt, info.tcpi_retrans, sndbuf);
+    test_assert(close(fd) == 0);
+    return NULL;
+}
+
+static void tcpcc_test_transfer(const char *algo)
+{
+    int listen_fd, fd;
+    struct sockaddr_in addr;
+    uint8_t buf[8 * KB];
+    size_t received = 0;
+    pthread_t pt;
+    struct timespec start, end;
+    char name[16];
+    socklen_t len = sizeof(name);
+    int val = 1;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(listen_fd > 0);
+    test_assert(setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) == 0);
+    tcpcc_set(listen_fd, algo);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(TCPCC_TEST_PORT);
+    test_assert(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(listen(listen_fd, 1) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    test_assert(pthread_create(&pt, NULL, tcpcc_sender, (void *)algo) == 0);
+    fd = accept(listen_fd, NULL, NULL);
+    test_assert(fd > 0);
+
+    /* accepted sockets inherit the algorithm of the listening socket */
+    test_assert(getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, &len) == 0);
+    test_assert(!strcmp(name, algo));
+
+    while (1) {
+        ssize_t rv = read(fd, buf, sizeof(buf));
+        test_assert(rv >= 0);
+        if (rv == 0)
+            break;
+        for (ssize_t i = 0; i < rv; i++)
+            test_assert(buf[i] == ((received + i) & 0xff));
+        received += rv;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    test_assert(received == TCPCC_TEST_SIZE);
+    test_assert(pthread_join(pt, NULL) == 0);
+    test_assert(close(fd) == 0);
+    test_assert(close(listen_fd) == 0);
+    long long usecs = (end.tv_sec - start.tv_sec) * 1000000ll +
+                      (end.tv_nsec - start.tv_nsec) / 1000;
+    printf("  %s: %d bytes in %lld us (%lld KB/s)\n", algo, TCPCC_TEST_SIZE, usecs,
+           usecs ? (TCPCC_TEST_SIZE * 1000000ll / KB) / usecs : 0);
+}
+
+static void tcpcc_test_sockopt(void)
+{
+    int fd;
+    char name[16];
+    socklen_t len = sizeof(name);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    test_assert(getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, &len) == 0);
+    printf("default congestion control algorithm: %s\n", name);
+    test_assert((setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, "nonexistent", 11) == -1) &&
+                (errno == ENOENT));
+    for (int i = 0; i < sizeof(tcpcc_algos) / sizeof(tcpcc_algos[0]); i++)
+        tcpcc_set(fd, tcpcc_algos[i]);
+    test_assert(close(fd) == 0);
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(fd > 0);
+    test_assert((setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, "cubic", 5) == -1) &&
+                (errno == EINVAL));
+    test_assert(close(fd) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    tcpcc_test_sockopt();
+    for (int i = 0; i < sizeof(tcpcc_algos) / sizeof(tcpcc_algos[0]); i++)
+        tcpcc_test_transfer(tcpcc_algos[i]);
+    printf("TCP congestion control test OK\n");
+    return 0;
+}
@@ -545,6 +545,19 @@ static void write_test_direct(void)
     test_assert(pread(fd, rmap, map_size, 0) == map_size);
     test_assert(!memcmp(rmap, wmap, map_size));
 
+    /* coherency with cached I/O on the same file */
+    int cached_fd = open(file_name, O_RDWR);
+    test_assert(cached_fd >= 0);
+    memset(wmap, 0xa5, page_size);
+    test_assert(pwrite(cached_fd, wmap, page_size, 0) == page_size);
+    test_assert(pread(fd, rmap, page_size, 0) == page_size);
+    test_assert(!memcmp(rmap, wmap, page_size));
+    memset(wmap, 0x5a, page_size);
+    test_assert(pwrite(fd, wmap, page_size, 0) == page_size);
+    test_assert(pread(cached_fd, rmap, page_size, 0) == page_size);
+    test_assert(!memcmp(rmap, wmap, page_size));
+    close(cached_fd);
+
     munmap(wmap, map_size);
     munmap(rmap, map_size);
     close(fd);
@@ -0,0 +1,99 @@
+#include <runtime.h>
+#include <crc32c.h>
+
+#include "../test_utils.h"
+
+#define TEST_BUF_SIZE   4096
+
+/* bit-wise reference implementation */
+static u32 crc32c_ref(const u8 *data, bytes len)
+{
+    u32 crc = ~0;
+    for (bytes i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static boolean vector_test(void)
+{
+    /* check values from RFC 3720 (iSCSI) */
+    u8 data[32];
+    if (crc32c(0, "123456789", 9) != 0xe3069283) {
+        msg_err("check value mismatch\n");
+        return false;
+    }
+    zero(data, sizeof(data));
+    if (crc32c(0, data, sizeof(data)) != 0x8a9136aa) {
+        msg_err("zeroes: 0x%x\n", crc32c(0, data, sizeof(data)));
+        return false;
+    }
+    runtime_memset(data, 0xff, sizeof(data));
+    if (crc32c(0, data, sizeof(data)) != 0x62a8ab43) {
+        msg_err("ones: 0x%x\n", crc32c(0, data, sizeof(data)));
+        return false;
+    }
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = i;
+    if (crc32c(0, data, sizeof(data)) != 0x46dd794e) {
+        msg_err("incrementing: 0x%x\n", crc32c(0, data, sizeof(data)));
+        return false;
+    }
+    if (crc32c(0, data, 0) != 0) {
+        msg_err("empty sequence\n");
+        return false;
+    }
+    return true;
+}
+
+static boolean random_test(heap h)
+{
+    u8 *buf = allocate(h, TEST_BUF_SIZE + sizeof(u64));
+    boolean result = false;
+    for (int i = 0; i < TEST_BUF_SIZE + sizeof(u64); i++)
+        buf[i] = random_u64();
+
+    /* all alignments and small lengths, and lengths split at arbitrary points */
+    for (int offset = 0; offset < sizeof(u64); offset++) {
+        for (bytes len = 0; len < 256; len++) {
+            u8 *data = buf + offset;
+            u32 expected = crc32c_ref(data, len);
+            if (crc32c(0, data, len) != expected) {
+                msg_err("mismatch at offset %d, length %ld\n", offset, len);
+                goto out;
+            }
+            bytes split = random_u64() % (len + 1);
+            if (crc32c(crc32c(0, data, split), data + split, len - split) != expected) {
+                msg_err("mismatch at offset %d, length %ld, split %ld\n", offset, len, split);
+                goto out;
+            }
+        }
+    }
+    if (crc32c(0, buf, TEST_BUF_SIZE) != crc32c_ref(buf, TEST_BUF_SIZE)) {
+        msg_err("mismatch for %d bytes\n", TEST_BUF_SIZE);
+        goto out;
+    }
+    result = true;
+  out:
+    deallocate(h, buf, TEST_BUF_SIZE + sizeof(u64));
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!vector_test())
+        goto fail;
+
+    if (!random_test(h))
+        goto fail;
+
+    msg_debug("crc32c test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("crc32c test failed\n");
+    exit(EXIT_FAILURE);
+}
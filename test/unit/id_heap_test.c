@@ -381,6 +381,57 @@ static boolean alloc_align_test(heap h)
     return true;
 }
 
+static boolean free_blocks_check(id_heap id, u64 *expected)
+{
+    u64 counts[4];
+    id_heap_free_blocks(id, counts, 4);
+    for (int order = 0; order < 4; order++) {
+        if (counts[order] != expected[order]) {
+            msg_err("order %d: %ld free blocks, expected %ld\n", order, counts[order],
+                    expected[order]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static boolean free_blocks_test(heap h)
+{
+    id_heap id = create_id_heap(h, h, 0, 256, 1, false);
+    if (id == INVALID_ADDRESS) {
+        msg_err("cannot create heap\n");
+        return false;
+    }
+    u64 all_free[4] = {0, 0, 0, 32};
+    if (!free_blocks_check(id, all_free))
+        return false;
+    if (allocate_u64((heap)id, 1) != 0) {
+        msg_err("unexpected allocation\n");
+        return false;
+    }
+    u64 first_allocated[4] = {1, 1, 1, 31};
+    if (!free_blocks_check(id, first_allocated))
+        return false;
+    if (!id_heap_set_area(id, 16, 1, true, true)) {
+        msg_err("cannot set area\n");
+        return false;
+    }
+    u64 two_allocated[4] = {2, 2, 2, 30};
+    if (!free_blocks_check(id, two_allocated))
+        return false;
+    u64 free = id_heap_free_in_range(id, 0, 32);
+    if (free != 30) {
+        msg_err("unexpected free count %ld\n", free);
+        return false;
+    }
+    deallocate_u64((heap)id, 0, 1);
+    deallocate_u64((heap)id, 16, 1);
+    if (!free_blocks_check(id, all_free))
+        return false;
+    destroy_heap((heap)id);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -406,6 +457,9 @@ int main(int argc, char **argv)
     if (!alloc_align_test(h))
         goto fail;
 
+    if (!free_blocks_test(h))
+        goto fail;
+
     msg_debug("test passed\n");
     exit(EXIT_SUCCESS);
   fail:
@@ -0,0 +1,140 @@
+#include <runtime.h>
+#include <lz4.h>
+
+#include "../test_utils.h"
+
+#define TEST_BUF_SIZE   (256 * KB)
+
+static boolean roundtrip(heap h, u8 *data, bytes len, bytes max_compressed)
+{
+    bytes dest_len = lz4_compress_bound(len);
+    u8 *compressed = allocate(h, dest_len);
+    u8 *decompressed = allocate(h, len + 1);
+    void *table = allocate(h, LZ4_HASH_TABLE_SIZE);
+    boolean result = false;
+    bytes clen = lz4_compress(data, len, compressed, dest_len, table);
+    if (clen == 0) {
+        msg_err("failed to compress %ld bytes\n", len);
+        goto out;
+    }
+    if (clen > max_compressed) {
+        msg_err("compressed %ld bytes to %ld bytes, expected at most %ld\n", len, clen,
+                max_compressed);
+        goto out;
+    }
+    s64 dlen = lz4_decompress(compressed, clen, decompressed, len + 1);
+    if (dlen != len) {
+        msg_err("decompressed length %ld, expected %ld\n", dlen, len);
+        goto out;
+    }
+    if (runtime_memcmp(data, decompressed, len)) {
+        msg_err("decompressed data mismatch (length %ld)\n", len);
+        goto out;
+    }
+
+    /* a destination buffer that is too small must be detected */
+    if (len > 0) {
+        if (lz4_decompress(compressed, clen, decompressed, len - 1) != -1) {
+            msg_err("decompression into short buffer not detected\n");
+            goto out;
+        }
+        if ((clen < len) && lz4_compress(data, len, compressed, clen - 1, table) != 0) {
+            msg_err("compression into short buffer not detected\n");
+            goto out;
+        }
+    }
+    result = true;
+  out:
+    deallocate(h, compressed, dest_len);
+    deallocate(h, decompressed, len + 1);
+    deallocate(h, table, LZ4_HASH_TABLE_SIZE);
+    return result;
+}
+
+static boolean basic_test(heap h)
+{
+    u8 *data = allocate(h, TEST_BUF_SIZE);
+    boolean result = false;
+
+    /* empty and tiny inputs are stored as literals */
+    if (!roundtrip(h, data, 0, 1) || !roundtrip(h, (u8 *)"abc", 3, 4))
+        goto out;
+
+    /* zeroes and short repeating patterns */
+    zero(data, TEST_BUF_SIZE);
+    if (!roundtrip(h, data, TEST_BUF_SIZE, TEST_BUF_SIZE / 128))
+        goto out;
+    for (int i = 0; i < TEST_BUF_SIZE; i++)
+        data[i] = "nanos"[i % 5];
+    if (!roundtrip(h, data, TEST_BUF_SIZE, TEST_BUF_SIZE / 128))
+        goto out;
+
+    /* text-like data with long-distance repetitions */
+    for (int i = 0; i < TEST_BUF_SIZE; i++)
+        data[i] = 'a' + ((i / 7) * 31 + (i % 7)) % 26;
+    if (!roundtrip(h, data, TEST_BUF_SIZE, TEST_BUF_SIZE / 2))
+        goto out;
+
+    /* incompressible data must fit in the compression bound */
+    for (int i = 0; i < TEST_BUF_SIZE; i++)
+        data[i] = random_u64();
+    if (!roundtrip(h, data, TEST_BUF_SIZE, lz4_compress_bound(TEST_BUF_SIZE)))
+        goto out;
+
+    /* mixed random and repeated chunks, at all small lengths */
+    for (int i = 0; i < TEST_BUF_SIZE; i += 64)
+        if ((i / 64) & 1)
+            runtime_memcpy(data + i, data + i - 64, 64);
+    for (bytes len = 1; len < 512; len++)
+        if (!roundtrip(h, data, len, lz4_compress_bound(len)))
+            goto out;
+    result = true;
+  out:
+    deallocate(h, data, TEST_BUF_SIZE);
+    return result;
+}
+
+static boolean malformed_test(heap h)
+{
+    u8 dest[64];
+
+    /* match offset pointing before the start of the output */
+    u8 bad_offset[] = { 0x14, 'a', 0x02, 0x00, 0x00 };
+    if (lz4_decompress(bad_offset, sizeof(bad_offset), dest, sizeof(dest)) != -1)
+        return false;
+
+    /* zero match offset */
+    u8 zero_offset[] = { 0x14, 'a', 0x00, 0x00, 0x00 };
+    if (lz4_decompress(zero_offset, sizeof(zero_offset), dest, sizeof(dest)) != -1)
+        return false;
+
+    /* truncated literals */
+    u8 truncated[] = { 0x50, 'a', 'b' };
+    if (lz4_decompress(truncated, sizeof(truncated), dest, sizeof(dest)) != -1)
+        return false;
+
+    /* overlapping match replicating a single byte */
+    u8 run[] = { 0x1f, 'x', 0x01, 0x00, 0x01, 0x50, 'a', 'b', 'c', 'd', 'e' };
+    s64 len = lz4_decompress(run, sizeof(run), dest, sizeof(dest));
+    if ((len != 1 + 15 + 1 + 4 + 5) || (dest[0] != 'x') || (dest[20] != 'x') ||
+        (dest[21] != 'a'))
+        return false;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!basic_test(h))
+        goto fail;
+
+    if (!malformed_test(h))
+        goto fail;
+
+    msg_debug("lz4 test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("lz4 test failed\n");
+    exit(EXIT_FAILURE);
+}
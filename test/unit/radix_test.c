@@ -0,0 +1,199 @@
+#include <runtime.h>
+#include <stdlib.h>
+
+#define RANDOM_KEYS 4096
+
+#define test_fail(x, ...) do {msg_err(x, ##__VA_ARGS__); return false;} while(0)
+
+closure_function(2, 2, boolean, check_order,
+                 u64 *, last, u64 *, count,
+                 u64 key, void *p)
+{
+    if ((*bound(count) > 0) && (key <= *bound(last))) {
+        msg_err("key 0x%lx after 0x%lx\n", key, *bound(last));
+        return false;
+    }
+    if (p != pointer_from_u64(key + 1)) {
+        msg_err("key 0x%lx has value %p\n", key, p);
+        return false;
+    }
+    *bound(last) = key;
+    (*bound(count))++;
+    return true;
+}
+
+closure_function(1, 2, boolean, count_destructed,
+                 u64 *, count,
+                 u64 key, void *p)
+{
+    (*bound(count))++;
+    return true;
+}
+
+static boolean basic_test(heap h)
+{
+    struct radix_tree t;
+    u64 keys[] = {0, 1, 63, 64, 4095, 4096, 1ull << 40, (1ull << 63) | 5, 12345678};
+    int n = sizeof(keys) / sizeof(keys[0]);
+
+    init_radix_tree(&t, h, 0);
+    if (radix_tree_lookup(&t, 0) != INVALID_ADDRESS)
+        test_fail("lookup in empty tree succeeded\n");
+    for (int i = 0; i < n; i++) {
+        if (!radix_tree_insert(&t, keys[i], pointer_from_u64(keys[i] + 1)))
+            test_fail("failed to insert key 0x%lx\n", keys[i]);
+        if (radix_tree_insert(&t, keys[i], pointer_from_u64(keys[i] + 1)))
+            test_fail("duplicate insertion of key 0x%lx succeeded\n", keys[i]);
+    }
+    if (radix_tree_get_count(&t) != n)
+        test_fail("unexpected count %ld\n", radix_tree_get_count(&t));
+    for (int i = 0; i < n; i++) {
+        if (radix_tree_lookup(&t, keys[i]) != pointer_from_u64(keys[i] + 1))
+            test_fail("lookup of key 0x%lx failed\n", keys[i]);
+    }
+    if ((radix_tree_lookup(&t, 2) != INVALID_ADDRESS) ||
+        (radix_tree_lookup(&t, 1ull << 41) != INVALID_ADDRESS))
+        test_fail("lookup of missing key succeeded\n");
+
+    u64 last, count = 0;
+    if (!radix_tree_traverse(&t, stack_closure(check_order, &last, &count)) || (count != n))
+        test_fail("traversal failed (%ld keys visited)\n", count);
+
+    if (radix_tree_remove(&t, 64) != pointer_from_u64(65))
+        test_fail("failed to remove key 64\n");
+    if (radix_tree_remove(&t, 64) != INVALID_ADDRESS)
+        test_fail("removal of missing key succeeded\n");
+    if ((radix_tree_lookup(&t, 64) != INVALID_ADDRESS) ||
+        (radix_tree_lookup(&t, 63) != pointer_from_u64(64)))
+        test_fail("lookup after removal failed\n");
+    if (!radix_tree_insert(&t, 64, pointer_from_u64(65)))
+        test_fail("re-insertion of removed key failed\n");
+
+    count = 0;
+    destruct_radix_tree(&t, stack_closure(count_destructed, &count));
+    if ((count != n) || (radix_tree_get_count(&t) != 0) ||
+        (radix_tree_lookup(&t, 0) != INVALID_ADDRESS))
+        test_fail("destruct failed (%ld values)\n", count);
+    return true;
+}
+
+closure_function(3, 1, boolean, retire_node,
+                 heap, h, u64 *, retired, boolean *, accept,
+                 radix_node n)
+{
+    for (u64 i = 0; i < RADIX_NODE_SLOTS; i++) {
+        if (n->slots[i]) {
+            msg_err("retired node %p has non-empty slot %ld\n", n, i);
+            return false;
+        }
+    }
+    if (!*bound(accept))
+        return false;
+    (*bound(retired))++;
+    deallocate(bound(h), n, sizeof(*n));
+    return true;
+}
+
+static boolean retire_test(heap h)
+{
+    struct radix_tree t;
+    u64 keys[] = {0, 1, 64, 4096, 1ull << 40};
+    int n = sizeof(keys) / sizeof(keys[0]);
+    u64 retired = 0;
+    boolean accept = false;
+
+    /* a refused retirement leaves the emptied nodes in the tree */
+    init_radix_tree(&t, h, stack_closure(retire_node, h, &retired, &accept));
+    for (int i = 0; i < n; i++)
+        if (!radix_tree_insert(&t, keys[i], pointer_from_u64(keys[i] + 1)))
+            test_fail("failed to insert key 0x%lx\n", keys[i]);
+    if (radix_tree_remove(&t, 4096) != pointer_from_u64(4097))
+        test_fail("failed to remove key 4096\n");
+    if ((retired != 0) || (radix_tree_lookup(&t, 4096) != INVALID_ADDRESS) ||
+        (radix_tree_lookup(&t, 64) != pointer_from_u64(65)))
+        test_fail("lookup after refused retirement failed\n");
+
+    /* removing the last key below a node retires the node, and its emptied ancestors */
+    accept = true;
+    if (!radix_tree_insert(&t, 4096, pointer_from_u64(4097)) ||
+        (radix_tree_remove(&t, 4096) != pointer_from_u64(4097)))
+        test_fail("failed to re-insert and remove key 4096\n");
+    if (retired == 0)
+        test_fail("no node retired after removing key 4096\n");
+    u64 partial = retired;
+    if ((radix_tree_remove(&t, 0) != pointer_from_u64(1)) || (retired != partial))
+        test_fail("node retired while not empty\n");
+    for (int i = 0; i < n; i++) {
+        if ((keys[i] != 0) && (keys[i] != 4096) &&
+            (radix_tree_remove(&t, keys[i]) != pointer_from_u64(keys[i] + 1)))
+            test_fail("failed to remove key 0x%lx\n", keys[i]);
+    }
+    if (t.root || (radix_tree_get_count(&t) != 0))
+        test_fail("tree not empty after removing all keys\n");
+    if (!radix_tree_insert(&t, 1ull << 40, pointer_from_u64(1)) ||
+        (radix_tree_lookup(&t, 1ull << 40) != pointer_from_u64(1)))
+        test_fail("insertion in emptied tree failed\n");
+    destruct_radix_tree(&t, 0);
+    return true;
+}
+
+static boolean random_test(heap h)
+{
+    struct radix_tree t;
+    u64 *keys = malloc(RANDOM_KEYS * sizeof(u64));
+    boolean result = false;
+
+    init_radix_tree(&t, h, 0);
+    for (int i = 0; i < RANDOM_KEYS; i++) {
+        /* mix of dense and sparse keys */
+        keys[i] = (i & 1) ? (random_u64() & MASK(48)) : i;
+        if (!radix_tree_insert(&t, keys[i], pointer_from_u64(keys[i] + 1))) {
+            msg_err("failed to insert key 0x%lx\n", keys[i]);
+            goto out;
+        }
+    }
+    for (int i = 0; i < RANDOM_KEYS; i += 2) {
+        if (radix_tree_remove(&t, keys[i]) != pointer_from_u64(keys[i] + 1)) {
+            msg_err("failed to remove key 0x%lx\n", keys[i]);
+            goto out;
+        }
+    }
+    for (int i = 0; i < RANDOM_KEYS; i++) {
+        void *p = radix_tree_lookup(&t, keys[i]);
+        if (p != ((i & 1) ? pointer_from_u64(keys[i] + 1) : INVALID_ADDRESS)) {
+            msg_err("unexpected lookup result %p for key 0x%lx\n", p, keys[i]);
+            goto out;
+        }
+    }
+    u64 last, count = 0;
+    if (!radix_tree_traverse(&t, stack_closure(check_order, &last, &count)) ||
+        (count != RANDOM_KEYS / 2)) {
+        msg_err("traversal failed (%ld keys visited)\n", count);
+        goto out;
+    }
+    result = true;
+  out:
+    destruct_radix_tree(&t, 0);
+    free(keys);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!basic_test(h))
+        goto fail;
+
+    if (!retire_test(h))
+        goto fail;
+
+    if (!random_test(h))
+        goto fail;
+
+    msg_debug("test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("test failed\n");
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,637 @@
+#include <tfs_internal.h>
+#include <crc32c.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#define TEST_DISK_SIZE  (32 * MB)
+#define TEST_FILE_SIZE  (1 * MB)
+#define TEST_CHUNK_SIZE (64 * KB)
+#define TEST_MAX_OPS    4096
+
+#define test_fail(x, ...) do {msg_err(x, ##__VA_ARGS__); goto out;} while(0)
+
+/* The storage of the test filesystems is an in-memory disk; storage requests are recorded, and
+ * their completion can be deferred in order to test operations that run concurrently with storage
+ * I/O. */
+static u8 *disk;
+
+static struct test_op {
+    u8 op;
+    range blocks;
+    u64 used_blocks;    /* storage in use in the filesystem when the request was issued */
+} ops[TEST_MAX_OPS];
+static int op_count;
+
+static tfs test_fs;
+static boolean defer_completions;
+static vector pending_completions;
+
+static void ops_reset(void)
+{
+    op_count = 0;
+}
+
+static int ops_find(u8 op, int start)
+{
+    for (int i = start; i < op_count; i++)
+        if (ops[i].op == op)
+            return i;
+    return -1;
+}
+
+static int ops_count(u8 op, int start, int end)
+{
+    int count = 0;
+    for (int i = start; i < end; i++)
+        if (ops[i].op == op)
+            count++;
+    return count;
+}
+
+closure_func_basic(storage_req_handler, void, test_storage_req,
+                   storage_req req)
+{
+    u64 offset = req->blocks.start << SECTOR_OFFSET;
+    u64 length = range_span(req->blocks) << SECTOR_OFFSET;
+    assert(offset + length <= TEST_DISK_SIZE);
+    if (op_count < TEST_MAX_OPS) {
+        struct test_op *op = &ops[op_count++];
+        op->op = req->op;
+        op->blocks = req->blocks;
+        op->used_blocks = test_fs ? test_fs->used_blocks : 0;
+    }
+    switch (req->op) {
+    case STORAGE_OP_READSG:
+        sg_copy_from_buf(disk + offset, req->data, length);
+        break;
+    case STORAGE_OP_WRITESG:
+        sg_copy_to_buf(disk + offset, req->data, length);
+        break;
+    case STORAGE_OP_DISCARD:
+    case STORAGE_OP_WRITE_ZEROES:
+        zero(disk + offset, length);
+        break;
+    }
+    if (defer_completions)
+        vector_push(pending_completions, req->completion);
+    else
+        apply(req->completion, STATUS_OK);
+}
+
+static void run_pending(void)
+{
+    status_handler sh;
+    while ((sh = vector_delete(pending_completions, 0)))
+        apply(sh, STATUS_OK);
+}
+
+/* Completion status of the last operation: 0 on success, a negative errno value on error. */
+static s64 test_status;
+
+static void test_status_set(status s)
+{
+    test_status = 0;
+    if (!is_ok(s)) {
+        if (!get_s64(s, sym(fsstatus), &test_status))
+            test_status = -EIO;
+        timm_dealloc(s);
+    }
+}
+
+closure_func_basic(io_status_handler, void, test_io_complete,
+                   status s, bytes length)
+{
+    test_status_set(s);
+}
+
+closure_func_basic(status_handler, void, test_complete,
+                   status s)
+{
+    test_status_set(s);
+}
+
+closure_func_basic(filesystem_complete, void, test_fs_complete,
+                   filesystem fs, status s)
+{
+    if (is_ok(s))
+        test_fs = (tfs)fs;
+    else
+        msg_err("failed to create filesystem: %v\n", s);
+}
+
+static closure_struct(storage_req_handler, req_handler);
+static closure_struct(io_status_handler, io_complete);
+static closure_struct(status_handler, complete);
+
+static tfs fs_create(heap h)
+{
+    zero(disk, TEST_DISK_SIZE);
+    test_fs = 0;
+    defer_completions = false;
+    create_filesystem(h, SECTOR_SIZE, TEST_DISK_SIZE, (storage_req_handler)&req_handler, false,
+                      sstring_empty(), stack_closure_func(filesystem_complete, test_fs_complete));
+    return test_fs;
+}
+
+static void fs_destroy(tfs fs)
+{
+    destroy_filesystem(&fs->fs);
+    test_fs = 0;
+}
+
+static tfsfile file_create(tfs fs)
+{
+    tuple md = allocate_tuple();
+    set(md, sym(extents), allocate_tuple());
+    if (filesystem_write_tuple(fs, md) != 0)
+        return INVALID_ADDRESS;
+    return allocate_fsfile(fs, md);
+}
+
+static s64 file_write(tfsfile f, void *src, range q)
+{
+    test_status = 1;
+    filesystem_write_linear(&f->f, src, q, (io_status_handler)&io_complete);
+    return test_status;
+}
+
+static s64 file_read(tfsfile f, void *dest, range q)
+{
+    test_status = 1;
+    filesystem_read_linear(&f->f, dest, q, (io_status_handler)&io_complete);
+    return test_status;
+}
+
+/* Returns whether a file range reads back as expected. */
+static boolean file_check(heap h, tfsfile f, u8 *expected, range q)
+{
+    u8 *buf = allocate(h, range_span(q));
+    assert(buf != INVALID_ADDRESS);
+    s64 fss = file_read(f, buf, q);
+    boolean match = (fss == 0) && !runtime_memcmp(buf, expected + q.start, range_span(q));
+    if (!match)
+        msg_err("range %R: status %ld, %s\n", q, fss, fss ? ss("no data") : ss("data mismatch"));
+    deallocate(h, buf, range_span(q));
+    return match;
+}
+
+static int extent_count(tfsfile f)
+{
+    int count = 0;
+    rangemap_foreach(f->extentmap, n)
+        count++;
+    return count;
+}
+
+static void random_fill(u8 *buf, bytes length)
+{
+    for (bytes i = 0; i < length; i++)
+        buf[i] = random_u64();
+}
+
+/* Returns the checksum stored for a file block, 0 if not known. */
+static u32 block_checksum(tfsfile f, u64 block)
+{
+    extent ex = (extent)rangemap_lookup(f->extentmap, block);
+    if ((ex == INVALID_ADDRESS) || !ex->md)
+        return 0;
+    tuple checksums = get_tuple(ex->md, sym(checksums));
+    if (!checksums)
+        return 0;
+    u64 index = block - ex->node.r.start;
+    string s = get_string(checksums, intern_u64(index / TFS_CHECKSUM_GROUP_BLOCKS));
+    if (!s)
+        return 0;
+    return le32toh(*(u32 *)buffer_ref(s, (index % TFS_CHECKSUM_GROUP_BLOCKS) * sizeof(u32)));
+}
+
+/* Returns whether the checksums stored for the file blocks in r match the expected data. */
+static boolean checksums_match(tfsfile f, u8 *expected, range r)
+{
+    tfs fs = (tfs)f->f.fs;
+    u64 block_size = fs_blocksize(&fs->fs);
+    for (u64 block = r.start; block < r.end; block++) {
+        u32 sum = block_checksum(f, block);
+        if (sum != crc32c(0, expected + (block << fs->fs.blocksize_order), block_size)) {
+            msg_err("block 0x%lx: checksum 0x%x\n", block, sum);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Corrupts the storage of a file block. */
+static void block_corrupt(tfsfile f, u64 block)
+{
+    tfs fs = (tfs)f->f.fs;
+    extent ex = (extent)rangemap_lookup(f->extentmap, block);
+    assert(ex != INVALID_ADDRESS);
+    disk[((ex->start_block + block - ex->node.r.start) << fs->fs.blocksize_order) + 1] ^= 0xff;
+}
+
+/* Reads a file block, returning the read status. */
+static s64 block_read(tfsfile f, u64 block)
+{
+    u8 buf[SECTOR_SIZE];
+    int order = ((tfs)f->f.fs)->fs.blocksize_order;
+    assert(U64_FROM_BIT(order) <= sizeof(buf));
+    return file_read(f, buf, irangel(block << order, U64_FROM_BIT(order)));
+}
+
+static boolean defrag_test(heap h)
+{
+    boolean result = false;
+    u8 *data = allocate(h, TEST_FILE_SIZE);
+    assert(data != INVALID_ADDRESS);
+    random_fill(data, TEST_FILE_SIZE);
+    tfs fs = fs_create(h);
+    if (!fs)
+        test_fail("failed to create filesystem\n");
+    tfsfile f = file_create(fs);
+    if (f == INVALID_ADDRESS)
+        test_fail("failed to create file\n");
+
+    /* chunks written in reverse order end up in extents that are not contiguous on storage */
+    for (s64 offset = TEST_FILE_SIZE - TEST_CHUNK_SIZE; offset >= 0; offset -= TEST_CHUNK_SIZE) {
+        if (file_write(f, data + offset, irangel(offset, TEST_CHUNK_SIZE)) != 0)
+            test_fail("write at 0x%lx failed: %ld\n", offset, test_status);
+    }
+    int extents = extent_count(f);
+    if (extents != TEST_FILE_SIZE / TEST_CHUNK_SIZE)
+        test_fail("%d extents before defragmentation\n", extents);
+    u64 used = fs->used_blocks;
+    u64 file_blocks = TEST_FILE_SIZE >> fs->fs.blocksize_order;
+    ops_reset();
+    test_status = 1;
+    filesystem_defrag(&f->f, (status_handler)&complete);
+    if (test_status != 0)
+        test_fail("defragmentation failed: %ld\n", test_status);
+    if (extent_count(f) != 1)
+        test_fail("%d extents after defragmentation\n", extent_count(f));
+    if ((fs->defrag_extents != extents - 1) || (fs->defrag_bytes != TEST_FILE_SIZE))
+        test_fail("defragmentation stats: %ld extents, %ld bytes\n", fs->defrag_extents,
+                  fs->defrag_bytes);
+
+    /* the relocated data is flushed before it is referenced by the log, and the old storage is
+     * released only after the new extents have been flushed */
+    int data_flush = ops_find(STORAGE_OP_FLUSH, 0);
+    int log_flush = (data_flush >= 0) ? ops_find(STORAGE_OP_FLUSH, data_flush + 1) : -1;
+    if (log_flush < 0)
+        test_fail("missing storage flushes\n");
+    if (ops_count(STORAGE_OP_WRITESG, 0, data_flush) == 0)
+        test_fail("no relocated data written before the first flush\n");
+    if (ops_count(STORAGE_OP_WRITESG, data_flush, log_flush) == 0)
+        test_fail("no log write between flushes\n");
+    if (ops[log_flush].used_blocks < used + file_blocks)
+        test_fail("old storage released before the log was flushed\n");
+    if (fs->used_blocks + file_blocks > ops[log_flush].used_blocks)
+        test_fail("old storage not released (%ld blocks in use)\n", fs->used_blocks);
+    if (!file_check(h, f, data, irange(0, TEST_FILE_SIZE)))
+        test_fail("data mismatch after defragmentation\n");
+
+    /* a file whose extents are already merged is left alone */
+    ops_reset();
+    test_status = 1;
+    filesystem_defrag(&f->f, (status_handler)&complete);
+    if ((test_status != 0) || (extent_count(f) != 1) || (ops_count(STORAGE_OP_WRITESG, 0, op_count)))
+        test_fail("defragmentation of a single extent: status %ld\n", test_status);
+
+    /* a run that is written to while its data is being copied is not merged */
+    for (s64 offset = TEST_FILE_SIZE - TEST_CHUNK_SIZE; offset >= 0; offset -= TEST_CHUNK_SIZE) {
+        if (file_write(f, data + offset, irangel(offset + TEST_FILE_SIZE, TEST_CHUNK_SIZE)) != 0)
+            test_fail("write at 0x%lx failed: %ld\n", offset + TEST_FILE_SIZE, test_status);
+    }
+    extents = extent_count(f);
+    defer_completions = true;
+    test_status = 1;
+    filesystem_defrag(&f->f, (status_handler)&complete);
+    defer_completions = false;
+    random_fill(data, TEST_CHUNK_SIZE);
+    if (file_write(f, data, irangel(TEST_FILE_SIZE, TEST_CHUNK_SIZE)) != 0)
+        test_fail("concurrent write failed: %ld\n", test_status);
+    run_pending();
+    if ((test_status != 0) || (extent_count(f) != extents))
+        test_fail("concurrent write: status %ld, %d extents (expected %d)\n", test_status,
+                  extent_count(f), extents);
+    if (!file_check(h, f, data - TEST_FILE_SIZE, irangel(TEST_FILE_SIZE, TEST_CHUNK_SIZE)))
+        test_fail("data mismatch after concurrent write\n");
+    result = true;
+  out:
+    if (fs)
+        fs_destroy(fs);
+    deallocate(h, data, TEST_FILE_SIZE);
+    return result;
+}
+
+static boolean checksum_test(heap h)
+{
+    boolean result = false;
+    u8 *data = allocate(h, TEST_FILE_SIZE);
+    assert(data != INVALID_ADDRESS);
+    random_fill(data, TEST_FILE_SIZE);
+    tfs fs = fs_create(h);
+    if (!fs)
+        test_fail("failed to create filesystem\n");
+    fs->checksums = true;
+    tfsfile f = file_create(fs);
+    if (f == INVALID_ADDRESS)
+        test_fail("failed to create file\n");
+    int order = fs->fs.blocksize_order;
+    u64 file_blocks = TEST_FILE_SIZE >> order;
+    u64 chunk_blocks = TEST_CHUNK_SIZE >> order;
+    for (s64 offset = TEST_FILE_SIZE - TEST_CHUNK_SIZE; offset >= 0; offset -= TEST_CHUNK_SIZE) {
+        if (file_write(f, data + offset, irangel(offset, TEST_CHUNK_SIZE)) != 0)
+            test_fail("write at 0x%lx failed: %ld\n", offset, test_status);
+    }
+    if (!checksums_match(f, data, irange(0, file_blocks)))
+        test_fail("checksums not stored\n");
+
+    /* a corrupted block fails verification, while the rest of the file can be read */
+    u64 block = chunk_blocks + 3;
+    block_corrupt(f, block);
+    if (block_read(f, block) != -EIO)
+        test_fail("read of corrupted block: status %ld\n", test_status);
+    if (fs->checksum_errors != 1)
+        test_fail("%ld checksum errors\n", fs->checksum_errors);
+    if (!file_check(h, f, data, irange(0, block << order)) ||
+        !file_check(h, f, data, irange((block + 1) << order, TEST_FILE_SIZE)))
+        test_fail("read of valid blocks failed\n");
+
+    /* rewriting the block fixes it */
+    if (file_write(f, data + (block << order), irangel(block << order, 1 << order)) != 0)
+        test_fail("rewrite failed: %ld\n", test_status);
+    if (!file_check(h, f, data, irange(0, TEST_FILE_SIZE)))
+        test_fail("read after rewrite failed\n");
+
+    /* the checksums of blocks being written are unknown until the data is written and flushed */
+    random_fill(data, TEST_CHUNK_SIZE);
+    defer_completions = true;
+    ops_reset();
+    test_status = 1;
+    filesystem_write_linear(&f->f, data, irangel(0, TEST_CHUNK_SIZE),
+                            (io_status_handler)&io_complete);
+    for (block = 0; block < chunk_blocks; block++)
+        if (block_checksum(f, block))
+            test_fail("checksum of block 0x%lx known before write\n", block);
+    for (int i = vector_length(pending_completions); i > 0; i--) {
+        status_handler sh = vector_delete(pending_completions, 0);
+        apply(sh, STATUS_OK);
+    }
+    int flush = ops_find(STORAGE_OP_FLUSH, 0);
+    if ((test_status != 0) || (flush < 0))
+        test_fail("write completion: status %ld, flush %d\n", test_status, flush);
+    if (block_checksum(f, 0))
+        test_fail("checksum known before flush\n");
+    defer_completions = false;
+    run_pending();
+    if (!checksums_match(f, data, irange(0, chunk_blocks)) ||
+        !file_check(h, f, data, irange(0, TEST_FILE_SIZE)))
+        test_fail("checksums after flush\n");
+
+    /* checksums are carried over to the extents merged by defragmentation */
+    test_status = 1;
+    filesystem_defrag(&f->f, (status_handler)&complete);
+    if ((test_status != 0) || (extent_count(f) != 1))
+        test_fail("defragmentation: status %ld, %d extents\n", test_status, extent_count(f));
+    if (!checksums_match(f, data, irange(0, file_blocks)))
+        test_fail("checksums after defragmentation\n");
+    block = file_blocks - 1;
+    block_corrupt(f, block);
+    if (block_read(f, block) != -EIO)
+        test_fail("read of corrupted block after defragmentation: status %ld\n", test_status);
+
+    /* the scrub finds corrupted blocks, reporting each once */
+    block_corrupt(f, 0);
+    fs->scrub = fs->scrub_running = true;
+    thunk scrub_step = (thunk)&fs->scrub_step;
+    apply(scrub_step);
+    if (fs->scrub_running || (fs->scrub_passes != 1) || (fs->scrub_errors != 2) ||
+        (fs->scrub_bytes < TEST_FILE_SIZE))
+        test_fail("scrub: %ld passes, %ld errors, %ld bytes\n", fs->scrub_passes,
+                  fs->scrub_errors, fs->scrub_bytes);
+    result = true;
+  out:
+    if (fs)
+        fs_destroy(fs);
+    deallocate(h, data, TEST_FILE_SIZE);
+    return result;
+}
+
+static boolean checksum_compressed_test(heap h)
+{
+    boolean result = false;
+    u8 *data = allocate(h, TEST_CHUNK_SIZE);
+    assert(data != INVALID_ADDRESS);
+    /* compressible data */
+    for (int i = 0; i < TEST_CHUNK_SIZE; i++)
+        data[i] = (i / 64) & 0xff;
+    tfs fs = fs_create(h);
+    if (!fs)
+        test_fail("failed to create filesystem\n");
+    fs->checksums = fs->compress = true;
+    tfsfile f = file_create(fs);
+    if (f == INVALID_ADDRESS)
+        test_fail("failed to create file\n");
+    if (file_write(f, data, irange(0, TEST_CHUNK_SIZE)) != 0)
+        test_fail("write failed: %ld\n", test_status);
+    extent ex = (extent)rangemap_first_node(f->extentmap);
+    if ((ex == INVALID_ADDRESS) || !ex->compressed)
+        test_fail("data not compressed\n");
+
+    /* the checksums cover the compressed data, one per storage block */
+    int order = fs->fs.blocksize_order;
+    u64 nblocks = pad(ex->compressed, U64_FROM_BIT(order)) >> order;
+    for (u64 i = 0; i < nblocks; i++) {
+        u32 sum = crc32c(0, disk + ((ex->start_block + i) << order), U64_FROM_BIT(order));
+        if (block_checksum(f, ex->node.r.start + i) != sum)
+            test_fail("checksum of compressed block %ld\n", i);
+    }
+    if (block_checksum(f, ex->node.r.start + nblocks))
+        test_fail("checksum past the compressed data\n");
+    disk[(ex->start_block << order) + 1] ^= 0xff;
+    if (block_read(f, ex->node.r.end - 1) != -EIO)
+        test_fail("read of corrupted compressed extent: status %ld\n", test_status);
+    result = true;
+  out:
+    if (fs)
+        fs_destroy(fs);
+    deallocate(h, data, TEST_CHUNK_SIZE);
+    return result;
+}
+
+#define TEST_SYNC_REQUESTS   5
+
+closure_function(1, 1, void, sync_test_complete,
+                 int *, count,
+                 status s)
+{
+    if (is_ok(s))
+        (*bound(count))++;
+    else
+        timm_dealloc(s);
+}
+
+/* Sync requests issued while a flush is in flight are served together by a single log and storage
+ * flush. */
+static boolean sync_batch_test(heap h)
+{
+    boolean result = false;
+    u8 *data = allocate(h, TEST_CHUNK_SIZE);
+    assert(data != INVALID_ADDRESS);
+    random_fill(data, TEST_CHUNK_SIZE);
+    tfs fs = fs_create(h);
+    if (!fs)
+        test_fail("failed to create filesystem\n");
+    tfsfile f = file_create(fs);
+    if (f == INVALID_ADDRESS)
+        test_fail("failed to create file\n");
+    if (file_write(f, data, irange(0, TEST_CHUNK_SIZE)) != 0)
+        test_fail("write failed: %ld\n", test_status);
+
+    /* an uncontended sync is served right away */
+    int completed = 0;
+    status_handler completion = stack_closure(sync_test_complete, &completed);
+    ops_reset();
+    apply(fs->fs.get_sync_handler(&fs->fs, 0, false, completion), STATUS_OK);
+    if ((completed != 1) || (ops_count(STORAGE_OP_FLUSH, 0, op_count) != 1) ||
+        (fs->sync_batches[0] != 1) || fs->syncing)
+        test_fail("single sync: %d completed, %d flushes\n", completed,
+                  ops_count(STORAGE_OP_FLUSH, 0, op_count));
+
+    /* while the flush of the first request is in flight, the other requests are queued */
+    completed = 0;
+    ops_reset();
+    defer_completions = true;
+    for (int i = 0; i < TEST_SYNC_REQUESTS; i++) {
+        if (file_write(f, data, irange(0, TEST_CHUNK_SIZE)) != 1)
+            test_fail("write %d: status %ld\n", i, test_status);
+        apply(fs->fs.get_sync_handler(&fs->fs, &f->f, false, completion), STATUS_OK);
+    }
+    defer_completions = false;
+    if (completed || !fs->syncing || (vector_length(fs->sync_batch) != 1) ||
+        (vector_length(fs->sync_pending) != TEST_SYNC_REQUESTS - 1))
+        test_fail("queued syncs: %d completed, batch %d, pending %d\n", completed,
+                  vector_length(fs->sync_batch), vector_length(fs->sync_pending));
+    run_pending();
+    if ((completed != TEST_SYNC_REQUESTS) || fs->syncing)
+        test_fail("%d syncs completed\n", completed);
+    if (ops_count(STORAGE_OP_FLUSH, 0, op_count) != 2)
+        test_fail("%d storage flushes for %d syncs\n", ops_count(STORAGE_OP_FLUSH, 0, op_count),
+                  TEST_SYNC_REQUESTS);
+    if ((fs->sync_batches[0] != 2) || (fs->sync_batches[msb(TEST_SYNC_REQUESTS - 1)] != 1))
+        test_fail("sync batch histogram: %ld, %ld\n", fs->sync_batches[0],
+                  fs->sync_batches[msb(TEST_SYNC_REQUESTS - 1)]);
+    result = true;
+  out:
+    if (fs)
+        fs_destroy(fs);
+    deallocate(h, data, TEST_CHUNK_SIZE);
+    return result;
+}
+
+/* Returns the storage block where a file block is stored, INVALID_PHYSICAL if not allocated. */
+static u64 file_storage_block(tfsfile f, u64 block)
+{
+    extent ex = (extent)rangemap_lookup(f->extentmap, block);
+    return (ex != INVALID_ADDRESS) ? ex->start_block + block - ex->node.r.start : INVALID_PHYSICAL;
+}
+
+/* Appending files get storage preallocated past their end, which is not accounted as used and is
+ * reclaimed when the filesystem runs out of free storage. */
+static boolean prealloc_test(heap h)
+{
+    boolean result = false;
+    u8 *data = allocate(h, TEST_FILE_SIZE);
+    assert(data != INVALID_ADDRESS);
+    random_fill(data, TEST_FILE_SIZE);
+    tfs fs = fs_create(h);
+    if (!fs)
+        test_fail("failed to create filesystem\n");
+    tfsfile f = file_create(fs);
+    tfsfile g = file_create(fs);
+    if ((f == INVALID_ADDRESS) || (g == INVALID_ADDRESS))
+        test_fail("failed to create files\n");
+    int order = fs->fs.blocksize_order;
+    u64 chunk_blocks = TEST_CHUNK_SIZE >> order;
+
+    /* interleaved appends to 2 files: the storage preallocated for each file grows with the file
+     * size, so that the number of storage fragments of a file grows logarithmically */
+    for (s64 offset = 0; offset < TEST_FILE_SIZE; offset += TEST_CHUNK_SIZE) {
+        u64 free = fs->fs.get_freeblocks(&fs->fs);
+        if (file_write(f, data + offset, irangel(offset, TEST_CHUNK_SIZE)) != 0)
+            test_fail("append at 0x%lx failed: %ld\n", offset, test_status);
+        if (fs->fs.get_freeblocks(&fs->fs) != free - chunk_blocks)
+            test_fail("append at 0x%lx: %ld free blocks, expected %ld\n", offset,
+                      fs->fs.get_freeblocks(&fs->fs), free - chunk_blocks);
+        if (file_write(g, data + offset, irangel(offset, TEST_CHUNK_SIZE)) != 0)
+            test_fail("append to second file at 0x%lx failed: %ld\n", offset, test_status);
+    }
+    if (!range_span(f->prealloc) || !range_span(g->prealloc) ||
+        (fs->prealloc_blocks != range_span(f->prealloc) + range_span(g->prealloc)))
+        test_fail("preallocation: %R, %R, %ld blocks\n", f->prealloc, g->prealloc,
+                  fs->prealloc_blocks);
+    u64 file_blocks = TEST_FILE_SIZE >> order;
+    int fragments = 1;
+    for (u64 block = 1; block < file_blocks; block++) {
+        if (file_storage_block(f, block) != file_storage_block(f, block - 1) + 1)
+            fragments++;
+    }
+    if (fragments > msb(TEST_FILE_SIZE / TEST_CHUNK_SIZE) + 1)
+        test_fail("%d storage fragments\n", fragments);
+    if (f->prealloc.start != file_storage_block(f, file_blocks - 1) + 1)
+        test_fail("preallocated storage at %R\n", f->prealloc);
+
+    /* filling the filesystem uses the preallocated storage once free storage runs out */
+    u64 f_prealloc = range_span(f->prealloc);
+    u64 available = fs->fs.get_freeblocks(&fs->fs);
+    tfsfile filler = file_create(fs);
+    if (filler == INVALID_ADDRESS)
+        test_fail("failed to create filler file\n");
+    u64 written = 0;
+    for (u64 offset = 0; file_write(filler, data, irangel(offset, TEST_CHUNK_SIZE)) == 0;
+         offset += TEST_CHUNK_SIZE)
+        written += chunk_blocks;
+    if (test_status != -ENOSPC)
+        test_fail("filling filesystem: status %ld\n", test_status);
+    if (range_span(f->prealloc) || range_span(g->prealloc) || fs->prealloc_blocks)
+        test_fail("preallocated storage not reclaimed: %ld blocks\n", fs->prealloc_blocks);
+    if (written + chunk_blocks + f_prealloc <= available)
+        test_fail("%ld blocks written with %ld blocks available\n", written, available);
+    if (!file_check(h, f, data, irange(0, TEST_FILE_SIZE)) ||
+        !file_check(h, g, data, irange(0, TEST_FILE_SIZE)))
+        test_fail("data mismatch after reclaiming preallocated storage\n");
+    result = true;
+  out:
+    if (fs)
+        fs_destroy(fs);
+    deallocate(h, data, TEST_FILE_SIZE);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+    disk = allocate(h, TEST_DISK_SIZE);
+    assert(disk != INVALID_ADDRESS);
+    pending_completions = allocate_vector(h, 64);
+    init_closure_func(&req_handler, storage_req_handler, test_storage_req);
+    init_closure_func(&io_complete, io_status_handler, test_io_complete);
+    init_closure_func(&complete, status_handler, test_complete);
+
+    if (!defrag_test(h))
+        goto fail;
+    if (!checksum_test(h))
+        goto fail;
+    if (!checksum_compressed_test(h))
+        goto fail;
+    if (!sync_batch_test(h))
+        goto fail;
+    if (!prealloc_test(h))
+        goto fail;
+
+    msg_debug("tfs test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("tfs test failed\n");
+    exit(EXIT_FAILURE);
+}
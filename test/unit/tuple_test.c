@@ -158,7 +158,7 @@ boolean encode_decode_test(heap h)
     table tdict1 = allocate_table(h, identity_key, pointer_equal);
     u64 total_entries = 0;
 
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
 
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 1);
@@ -167,7 +167,7 @@ boolean encode_decode_test(heap h)
     table tdict2 = allocate_table(h, identity_key, pointer_equal);
     total_entries = 0;
     u64 obsolete_entries = 0;
-    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false);
+    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false, 0);
 
     test_assert((total_entries == 1) && (obsolete_entries == 0));
     buffer buf = allocate_buffer(h, 128);
@@ -176,11 +176,11 @@ boolean encode_decode_test(heap h)
 
     // update tuple by removing an entry
     obsolete_entries = 0;
-    encode_eav(b3, tdict1, t3, intern_u64(1), 0, &obsolete_entries);
+    encode_eav(b3, tdict1, t3, intern_u64(1), 0, &obsolete_entries, 0);
     test_assert(obsolete_entries == 2);
     obsolete_entries = 0;
     test_assert(decode_value(h, tdict2, b3,
-                             &total_entries, &obsolete_entries, false) == t4);
+                             &total_entries, &obsolete_entries, false, 0) == t4);
     test_assert(!get(t4, intern_u64(1)));
     test_assert((total_entries == 2) && (obsolete_entries == 2));
 
@@ -188,7 +188,7 @@ boolean encode_decode_test(heap h)
     set(t3, integer_key(1), value_from_s64(-3));
     total_entries = 0;
     table_clear(tdict1);
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 1);
 
@@ -196,7 +196,7 @@ boolean encode_decode_test(heap h)
     total_entries = 0;
     obsolete_entries = 0;
     table_clear(tdict1);
-    t4 = decode_value(h, tdict1, b3, &total_entries, &obsolete_entries, false);
+    t4 = decode_value(h, tdict1, b3, &total_entries, &obsolete_entries, false, 0);
 
     test_assert((total_entries == 1) && (obsolete_entries == 0));
     buffer_clear(buf);
@@ -209,7 +209,7 @@ boolean encode_decode_test(heap h)
     set(t3, integer_key(1), value_from_s64(S64_MIN));
     total_entries = 0;
     table_clear(tdict1);
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 1);
 
@@ -217,7 +217,7 @@ boolean encode_decode_test(heap h)
     total_entries = 0;
     obsolete_entries = 0;
     table_clear(tdict1);
-    t4 = decode_value(h, tdict1, b3, &total_entries, &obsolete_entries, false);
+    t4 = decode_value(h, tdict1, b3, &total_entries, &obsolete_entries, false, 0);
 
     test_assert((total_entries == 1) && (obsolete_entries == 0));
     buffer_clear(buf);
@@ -228,7 +228,7 @@ boolean encode_decode_test(heap h)
     set(t3, integer_key(1), value_from_u64(U64_MAX));
     total_entries = 0;
     table_clear(tdict1);
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 1);
 
@@ -236,7 +236,7 @@ boolean encode_decode_test(heap h)
     total_entries = 0;
     obsolete_entries = 0;
     table_clear(tdict1);
-    t4 = decode_value(h, tdict1, b3, &total_entries, &obsolete_entries, false);
+    t4 = decode_value(h, tdict1, b3, &total_entries, &obsolete_entries, false, 0);
 
     test_assert((total_entries == 1) && (obsolete_entries == 0));
     buffer_clear(buf);
@@ -265,7 +265,7 @@ boolean encode_decode_reference_test(heap h)
     table tdict1 = allocate_table(h, identity_key, pointer_equal);
     u64 total_entries = 0;
 
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
 
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 3);    /* 2 entries for t3, plus 1 for t33 (despite two refs) */
@@ -274,7 +274,7 @@ boolean encode_decode_reference_test(heap h)
     total_entries = 0;
     u64 obsolete_entries = 0;
     table tdict2 = allocate_table(h, identity_key, pointer_equal);
-    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false);
+    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false, 0);
 
     /* t33 has been encoded once (despite being associated to 2 different symbols in t3) */
     test_assert((total_entries == 3) && (obsolete_entries == 0));
@@ -301,7 +301,7 @@ boolean encode_decode_self_reference_test(heap h)
     table tdict1 = allocate_table(h, identity_key, pointer_equal);
     u64 total_entries = 0;
 
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
 
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 1);
@@ -310,7 +310,7 @@ boolean encode_decode_self_reference_test(heap h)
     total_entries = 0;
     u64 obsolete_entries = 0;
     table tdict2 = allocate_table(h, identity_key, pointer_equal);
-    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false);
+    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false, 0);
 
     test_assert((total_entries == 1) && (obsolete_entries == 0));
 
@@ -337,7 +337,7 @@ boolean encode_decode_lengthy_test(heap h)
     table tdict1 = allocate_table(h, identity_key, pointer_equal);
     u64 total_entries = 0;
 
-    encode_tuple(b3, tdict1, t3, &total_entries);
+    encode_tuple(b3, tdict1, t3, &total_entries, 0);
 
     test_assert(buffer_length(b3) > 0);
     test_assert(total_entries == 1000);
@@ -346,7 +346,7 @@ boolean encode_decode_lengthy_test(heap h)
     total_entries = 0;
     u64 obsolete_entries = 0;
     table tdict2 = allocate_table(h, identity_key, pointer_equal);
-    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false);
+    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries, false, 0);
 
     test_assert((total_entries == 1000) && (obsolete_entries == 0));
     test_assert(tuple_count(t4) == 1000);
@@ -358,6 +358,107 @@ fail:
     return failure;
 }
 
+closure_func_basic(tuple_defer, boolean, test_defer,
+                   tuple holder, symbol a, tuple t, buffer attachment)
+{
+    if (a != sym(children))
+        return false;
+    assert(buffer_write_cstring(attachment, "att"));
+    return true;
+}
+
+closure_function(2, 3, boolean, test_deferred_loaded,
+                 table, dictionaries, int *, loads,
+                 tuple holder, tuple t, table dictionary)
+{
+    (*bound(loads))++;
+    if (!bound(dictionaries))
+        return false;
+    table_set(bound(dictionaries), t, dictionary);
+    return true;
+}
+
+boolean encode_decode_deferred_test(heap h)
+{
+    boolean failure = true;
+    tuple t3 = allocate_tuple();
+    tuple dir = allocate_tuple();
+    tuple c3 = allocate_tuple();
+    tuple a3 = allocate_tuple();
+    tuple b3 = allocate_tuple();
+    set(a3, sym(x), wrap_string_cstring("1"));
+    set(b3, sym(y), wrap_string_cstring("2"));
+    set(c3, sym(a), a3);
+    set(c3, sym(b), b3);
+    set(dir, sym(children), c3);
+    set(t3, sym(dir), dir);
+
+    // encode with the children tuple in deferred form
+    buffer b = allocate_buffer(h, 128);
+    table tdict1 = allocate_table(h, identity_key, pointer_equal);
+    struct tuple_deferral td1 = {
+        .h = h,
+        .locations = allocate_table(h, identity_key, pointer_equal),
+        .defer = closure_func(h, tuple_defer, test_defer),
+    };
+    u64 total_entries = 0;
+    encode_tuple(b, tdict1, t3, &total_entries, &td1);
+    test_assert(total_entries == 6);
+    deferred_location l = table_find(td1.locations, a3);
+    test_assert(l && (l->container == c3));
+    test_assert(!table_find(tdict1, a3));
+
+    // decode: the deferred tuple is empty until loaded
+    int loads = 0;
+    table dictionaries = allocate_table(h, identity_key, pointer_equal);
+    struct tuple_deferral td2 = {
+        .h = h,
+        .dictionaries = dictionaries,
+        .loaded = closure(h, test_deferred_loaded, dictionaries, &loads),
+    };
+    table tdict2 = allocate_table(h, identity_key, pointer_equal);
+    total_entries = 0;
+    u64 obsolete_entries = 0;
+    tuple t4 = decode_value(h, tdict2, b, &total_entries, &obsolete_entries, false, &td2);
+    test_assert((total_entries == 6) && (obsolete_entries == 0));
+    tuple c4 = get_tuple(get_tuple(t4, sym(dir)), sym(children));
+    test_assert(c4 && is_deferred_tuple(c4) && (tuple_count(c4) == 0));
+    bytes len;
+    void *attachment = deferred_tuple_attachment(c4, &len);
+    test_assert(attachment && (len == 3) && !runtime_memcmp(attachment, "att", 3));
+
+    // a tuple that has not been loaded is encoded again as is
+    buffer b2 = allocate_buffer(h, 128);
+    total_entries = 0;
+    encode_tuple(b2, allocate_table(h, identity_key, pointer_equal), t4, &total_entries, 0);
+    test_assert(total_entries == 6);
+    test_assert(is_deferred_tuple(c4));
+    int loads5 = 0;
+    struct tuple_deferral td3 = {
+        .h = h,
+        .loaded = closure(h, test_deferred_loaded, 0, &loads5),
+    };
+    tuple t5 = decode_value(h, allocate_table(h, identity_key, pointer_equal), b2, 0, 0, false,
+                            &td3);
+    tuple c5 = children(get_tuple(t5, sym(dir)));
+    test_assert((loads5 == 1) && c5 && !is_deferred_tuple(c5) && (tuple_count(c5) == 2));
+    test_assert(!buffer_compare_with_sstring(get_string(get_tuple(c5, sym(a)), sym(x)), ss("1")));
+    test_assert(!buffer_compare_with_sstring(get_string(get_tuple(c5, sym(b)), sym(y)), ss("2")));
+
+    // a reference to a tuple within a deferred tuple loads the deferred tuple when decoded
+    buffer_clear(b);
+    encode_eav(b, tdict1, a3, sym(z), wrap_string_cstring("3"), 0, &td1);
+    test_assert(loads == 0);
+    decode_value(h, tdict2, b, &total_entries, &obsolete_entries, false, &td2);
+    test_assert((loads == 1) && !is_deferred_tuple(c4) && (tuple_count(c4) == 2));
+    tuple a4 = get_tuple(c4, sym(a));
+    test_assert(a4 && !buffer_compare_with_sstring(get_string(a4, sym(z)), ss("3")));
+    test_assert(!buffer_compare_with_sstring(get_string(a4, sym(x)), ss("1")));
+    failure = false;
+fail:
+    return failure;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -369,6 +470,7 @@ int main(int argc, char **argv)
     failure |= encode_decode_reference_test(h);
     failure |= encode_decode_self_reference_test(h);
     failure |= encode_decode_lengthy_test(h);
+    failure |= encode_decode_deferred_test(h);
 
     if (failure) {
         msg_err("Test failed\n");
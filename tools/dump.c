@@ -101,7 +101,7 @@ closure_function(3, 2, boolean, readdir_each_child,
 void readdir(filesystem fs, heap h, tuple w, buffer path)
 {
     buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    tuple t = get_tuple(w, sym(children));
+    tuple t = children(w);
     if (t) {
         mkdir(cstring(path, tmpbuf), 0777);
         iterate(t, stack_closure(readdir_each_child, fs, h, path));
@@ -112,6 +112,24 @@ void readdir(filesystem fs, heap h, tuple w, buffer path)
     }
 }
 
+static void load_tree(tuple t);
+
+closure_func_basic(binding_handler, boolean, load_tree_each,
+                   value k, value v)
+{
+    if (is_tuple(v))
+        load_tree(v);
+    return true;
+}
+
+/* Loads the contents of all directories, so that the entire metadata can be printed. */
+static void load_tree(tuple t)
+{
+    tuple c = children(t);
+    if (c)
+        iterate(c, stack_closure_func(binding_handler, load_tree_each));
+}
+
 static void print_colored(int indent, int color, symbol s, boolean newline)
 {
     while (indent--)
@@ -170,6 +188,7 @@ closure_function(3, 2, void, fsc,
     bprintf(rb, "UUID: ");
     print_uuid(rb, uuid);
     if (!(options & DUMP_OPT_TREE)) {
+        load_tree(root);
         bprintf(rb, "\nmetadata\n");
         print_value(rb, root, timm("indent", "0"));
     }
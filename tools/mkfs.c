@@ -260,6 +260,10 @@ closure_function(2, 1, void, bwrite,
     case STORAGE_OP_FLUSH:
         apply(req->completion, STATUS_OK);
         return;
+    case STORAGE_OP_DISCARD:
+    case STORAGE_OP_WRITE_ZEROES:
+        apply(req->completion, storage_unsupported_status());
+        return;
     default:
         halt("%s: invalid storage op %d\n", func_ss, req->op);
     }
@@ -352,8 +356,9 @@ closure_func_basic(io_status_handler, void, mkfs_write_handler,
     }
 }
 
-closure_function(4, 2, void, fsc,
-                 heap, h, descriptor, out, tuple, root, const char *, target_root,
+closure_function(6, 2, void, fsc,
+                 heap, h, descriptor, out, tuple, root, const char *, target_root, boolean, compress,
+                 boolean, checksums,
                  filesystem fs, status s)
 {
     tuple root = bound(root);
@@ -376,6 +381,11 @@ closure_function(4, 2, void, fsc,
     deallocate_buffer(b);
     rprintf("\n");
 
+    /* the metadata tuple, which is the first tuple written to the log, is the filesystem root */
+    deallocate_value(fs->root);
+    fs->root = md;
+    filesystem_set_compression(fs, bound(compress));
+    filesystem_set_checksums(fs, bound(checksums));
     tfs tfs = (struct tfs *)fs;
     filesystem_write_tuple(tfs, md);
     vector i;
@@ -398,6 +408,8 @@ closure_function(4, 2, void, fsc,
             }
         }
     }
+    /* write the directory tree as a checkpoint, so that large directories are loaded lazily */
+    filesystem_checkpoint(tfs);
     filesystem_flush(fs, ignore_status);
     closure_finish();
 }
@@ -545,6 +557,8 @@ static void usage(const char *program_name)
            "%s [options] -e image-file\n"
            "Options:\n"
            "-b boot-image	- specify boot image to prepend\n"
+           "-c		- compress file contents in the root filesystem\n"
+           "-C		- store checksums of file contents in the root filesystem\n"
            "-u uefi-loader	- specify UEFI loader (creates EFI System Partition)\n"
            "-k kern-image	- specify kernel image\n"
            "-l label	- specify filesystem label\n"
@@ -622,13 +636,21 @@ int main(int argc, char **argv)
     long long img_size = 0;
     long long coredumplimit = 0;
     boolean empty_fs = false;
+    boolean compress = false;
+    boolean checksums = false;
     const char *uefi_loader = NULL;
     heap h = init_process_runtime();
     cmdline_tuples = allocate_vector(h, 4);
     assert(cmdline_tuples != INVALID_ADDRESS);
 
-    while ((c = getopt(argc, argv, "eb:k:l:r:s:u:t:")) != EOF) {
+    while ((c = getopt(argc, argv, "cCeb:k:l:r:s:u:t:")) != EOF) {
         switch (c) {
+        case 'c':
+            compress = true;
+            break;
+        case 'C':
+            checksums = true;
+            break;
         case 'e':
             empty_fs = true;
             break;
@@ -790,7 +812,8 @@ int main(int argc, char **argv)
         }
         if (boot) {
             create_filesystem(h, SECTOR_SIZE, BOOTFS_SIZE, closure(h, bwrite, out, offset), false,
-                              sstring_empty(), closure(h, fsc, h, out, boot, target_root));
+                              sstring_empty(), closure(h, fsc, h, out, boot, target_root, false,
+                                                  false));
             offset += BOOTFS_SIZE;
 
             /* Remove tuple from root, so it doesn't end up in the root FS. */
@@ -806,7 +829,7 @@ int main(int argc, char **argv)
                       closure(h, bwrite, out, offset),
                       false,
                       label,
-                      closure(h, fsc, h, out, root, target_root));
+                      closure(h, fsc, h, out, root, target_root, compress, checksums));
 
     off_t current_size = lseek(out, 0, SEEK_END);
     if (current_size < 0) {
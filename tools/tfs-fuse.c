@@ -39,6 +39,8 @@ static heap h;
 
 static filesystem rootfs;
 static tuple cwd;
+static boolean compress;
+static boolean checksums;
 static id_heap fdallocator;
 static vector files;
 static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
@@ -222,6 +224,10 @@ closure_function(2, 1, void, req_handle,
         break;
     case STORAGE_OP_FLUSH:
         break;
+    case STORAGE_OP_DISCARD:
+    case STORAGE_OP_WRITE_ZEROES:
+        apply(req->completion, storage_unsupported_status());
+        return;
     default:
         halt("%s: invalid storage op %d\n", func_ss, req->op);
     }
@@ -832,6 +838,8 @@ closure_func_basic(filesystem_complete, void, fsc,
     printf("Filesystem load complete, mounting...\n");
     rootfs = fs;
     cwd = filesystem_getroot(rootfs);
+    filesystem_set_compression(rootfs, compress);
+    filesystem_set_checksums(rootfs, checksums);
 
     closure_finish();
 }
@@ -859,6 +867,8 @@ void usage(const char *prog)
     fprintf(stderr, "  -f\t\t\tStay in foreground\n");
     fprintf(stderr, "  -d\t\t\tFuse debug messages\n");
     fprintf(stderr, "  -b\t\t\tMount boot partition\n");
+    fprintf(stderr, "  -c\t\t\tCompress contents of written files\n");
+    fprintf(stderr, "  -C\t\t\tStore checksums of contents of written files\n");
     exit(EXIT_FAILURE);
 }
 
@@ -867,13 +877,19 @@ int main(int argc, char **argv)
     int partition = PARTITION_ROOTFS;
     if (argc < 3)
         usage(argv[0]);
-    /* if -b is passed, remove it from the args for fuse */
+    /* if -b, -c or -C are passed, remove them from the args for fuse */
     for (int i = 1; i < argc - 2; i++) {
-        if (strcmp(argv[i], "-b") != 0)
+        if (strcmp(argv[i], "-b") == 0)
+            partition = PARTITION_BOOTFS;
+        else if (strcmp(argv[i], "-c") == 0)
+            compress = true;
+        else if (strcmp(argv[i], "-C") == 0)
+            checksums = true;
+        else
             continue;
-        partition = PARTITION_BOOTFS;
         memmove(&argv[i], &argv[i+1], (argc - i+1) * sizeof(char *));
         argc--;
+        i--;
     }
     int fd = open(argv[argc - 1], O_RDWR);
     if (fd < 0) {